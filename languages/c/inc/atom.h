@@ -16,6 +16,7 @@
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <hiredis/hiredis.h>
 #include <syslog.h>
 
@@ -42,6 +43,7 @@ enum atom_error_t {
 	ATOM_CALLBACK_FAILED,
 	ATOM_SERIALIZATION_ERROR,
 	ATOM_DESERIALIZATION_ERROR,
+	ATOM_COMMAND_CIRCUIT_OPEN,
 	ATOM_LANGUAGE_ERRORS_BEGIN = 100,
 	ATOM_USER_ERRORS_BEGIN = 1000,
 };
@@ -49,6 +51,17 @@ enum atom_error_t {
 #define ATOM_RESPONSE_STREAM_PREFIX "response:"
 #define ATOM_COMMAND_STREAM_PREFIX "command:"
 #define ATOM_DATA_STREAM_PREFIX "stream:"
+#define ATOM_CACHE_VERSION_PREFIX "cache_version:"
+#define ATOM_COMMAND_LIST_PREFIX "command_list:"
+#define ATOM_COMMAND_REPLY_PREFIX "command_reply:"
+#define ATOM_UPLOAD_STREAM_PREFIX "upload:"
+#define ATOM_COMMAND_REGISTRY_PREFIX "command_registry:"
+#define ATOM_PARTITIONS_PREFIX "partitions:"
+
+// Partitions of a partitioned stream are streams of their own named
+//	"<stream>:p<N>", i.e. with keys "stream:<element>:<stream>:p<N>"
+#define ATOM_PARTITION_SUFFIX ":p"
+#define ATOM_MAX_PARTITIONS 256
 
 #define ATOM_LOG_STREAM_NAME "log"
 
@@ -82,6 +95,31 @@ enum cmd_keys_t {
 	CMD_N_KEYS,
 };
 
+// Optional key naming the stream that a chunked request's data is
+//	uploaded on, in place of the data key
+#define COMMAND_KEY_UPLOAD_STR "upload"
+
+enum cmd_optional_keys_t {
+	CMD_KEY_UPLOAD = CMD_N_KEYS,
+	CMD_N_OPTIONAL_KEYS,
+};
+
+//
+// Keys for each chunk on an upload stream. The last chunk has the last key
+//	and, if the caller gave up on the upload, the abort key.
+//
+
+#define UPLOAD_KEY_DATA_STR "data"
+#define UPLOAD_KEY_LAST_STR "last"
+#define UPLOAD_KEY_ABORT_STR "abort"
+
+enum upload_keys_t {
+	UPLOAD_KEY_DATA,
+	UPLOAD_KEY_LAST,
+	UPLOAD_KEY_ABORT,
+	UPLOAD_N_KEYS,
+};
+
 //
 // Keys shared in each response from the element
 //
@@ -101,9 +139,15 @@ enum stream_keys_t {
 //
 
 #define ACK_KEY_TIMEOUT_STR "timeout"
+#define ACK_KEY_CACHE_TTL_STR "cache_ttl"
+#define ACK_KEY_RPC_STR "rpc"
+#define ACK_KEY_UPLOAD_STR "upload"
 
 enum ack_keys_t {
 	ACK_KEY_TIMEOUT = STREAM_N_KEYS,
+	ACK_KEY_CACHE_TTL,
+	ACK_KEY_RPC,
+	ACK_KEY_UPLOAD,
 	ACK_N_KEYS,
 };
 
@@ -189,6 +233,26 @@ enum atom_error_t atom_get_all_data_streams(
 // Frees a list of results from a query to the system
 void atom_list_free(struct atom_list_node *list);
 
+// A command from the command registry. Each element keeps a hash of its
+//	commands, keyed on the command name, with values of the form
+//	"<timeout> <description>"
+struct atom_command_info {
+	const char *element;
+	const char *command;
+	const char *description;
+	int timeout;
+};
+
+// Calls the callback for each command in the command registry, optionally
+//	only for those of the passed element. The registries of all of the
+//	elements are read in a single pipelined round trip. Elements that
+//	don't keep a registry have no commands here.
+enum atom_error_t atom_get_all_commands_cb(
+	redisContext *ctx,
+	const char *element,
+	bool (*data_cb)(const struct atom_command_info *info, void *user_data),
+	void *user_data);
+
 // Helper for getting the command response stream. If buffer
 //	is non-NULL will write the name into the buffer,
 //	else will allocate a string and return it.
@@ -211,6 +275,89 @@ char *atom_get_data_stream_str(
 	const char *name,
 	char buffer[ATOM_NAME_MAXLEN]);
 
+// Helper for getting the key holding an element's response cache
+//	version. If buffer is non-NULL will write the name into the
+//	buffer, else will allocate a string and return it.
+char *atom_get_cache_version_str(
+	const char *element,
+	char buffer[ATOM_NAME_MAXLEN]);
+
+// Helper for getting the list an element takes list RPC requests on.
+//	If buffer is non-NULL will write the name into the buffer, else
+//	will allocate a string and return it.
+char *atom_get_command_list_str(
+	const char *element,
+	char buffer[ATOM_NAME_MAXLEN]);
+
+// Helper for getting the hash an element keeps its command registry in.
+//	If buffer is non-NULL will write the name into the buffer, else
+//	will allocate a string and return it.
+char *atom_get_command_registry_str(
+	const char *element,
+	char buffer[ATOM_NAME_MAXLEN]);
+
+// Helper for getting the name of a partition of a partitioned stream,
+//	"<name>:p<partition>", to be used as the stream name with the rest of
+//	the API. If buffer is non-NULL will write the name into the buffer,
+//	else will allocate a string and return it.
+char *atom_get_partition_stream_name(
+	const char *name,
+	int partition,
+	char buffer[ATOM_NAME_MAXLEN]);
+
+// Helper for getting the key holding the number of partitions of a
+//	partitioned stream. As with atom_get_data_stream_str(), if element is
+//	NULL then name is the raw stream name. If buffer is non-NULL will
+//	write the name into the buffer, else will allocate a string and
+//	return it.
+char *atom_get_partitions_str(
+	const char *element,
+	const char *name,
+	char buffer[ATOM_NAME_MAXLEN]);
+
+// Returns the partition that entries with the given partition key value
+//	go to. The same value always goes to the same partition s.t. entries
+//	for it stay in order. The hash is 32-bit FNV-1a, which all of the
+//	language clients need to match.
+int atom_partition_for_key(
+	const uint8_t *key,
+	size_t key_len,
+	int n_partitions);
+
+// Publishes the number of partitions of a stream we write s.t. readers
+//	can find them
+enum atom_error_t atom_set_partition_count(
+	redisContext *ctx,
+	const char *element,
+	const char *name,
+	int n_partitions);
+
+// Gets the number of partitions of a stream. Streams that aren't
+//	partitioned have 0.
+enum atom_error_t atom_get_partition_count(
+	redisContext *ctx,
+	const char *element,
+	const char *name,
+	int *n_partitions);
+
+// Log limiting, off until turned on with atom_log_limit_set(). Each
+//	atom_logf() call site, i.e. format string, may log up to its rate per
+//	second after an initial burst, and consecutive repeats of the same
+//	message are summed up in a single "repeated N times" message at most
+//	once per repeat summary period. Repeats still held back when logging
+//	stops are summed up by atom_log_flush(). Pass ATOM_LOG_NO_LIMIT for
+//	the rate or the period to turn either off. The defaults are sensible
+//	settings to turn it on with.
+#define ATOM_LOG_NO_LIMIT 0
+#define ATOM_LOG_DEFAULT_SITE_RATE 10
+#define ATOM_LOG_DEFAULT_SITE_BURST 20
+#define ATOM_LOG_DEFAULT_REPEAT_SUMMARY_MS 5000
+
+void atom_log_limit_set(
+	unsigned int site_rate,
+	unsigned int site_burst,
+	int repeat_summary_ms);
+
 // Logs a message to the standard log stream
 enum atom_error_t atom_log(
 	redisContext *ctx,
@@ -219,6 +366,23 @@ enum atom_error_t atom_log(
 	const char *msg,
 	size_t msg_len);
 
+// Logs an already formatted message to the standard log stream, rate
+//	limited the same as atom_logf() but keyed on site, which should be
+//	an address unique to the call site such as a string literal naming
+//	it. A NULL site isn't rate limited.
+enum atom_error_t atom_log_limited(
+	redisContext *ctx,
+	struct element *element,
+	int level,
+	const void *site,
+	const char *msg,
+	size_t msg_len);
+
+// Sends the "repeated N times" summary for any repeats of the last
+//	message that are being held back. Called on element cleanup.
+enum atom_error_t atom_log_flush(
+	redisContext *ctx);
+
 // Logs a message to the standard log stream using variadic
 //	args
 enum atom_error_t atom_vlogf(
@@ -0,0 +1,59 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file atom_probes.h
+//
+//  @brief USDT probes on the hot paths of the SDK, for tracing running
+//			elements with bpftrace and the like without a rebuild
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_PROBES_H
+#define __ATOM_PROBES_H
+
+//
+// Probes are under the "atom" provider, e.g.
+//
+//	bpftrace -e 'usdt:/usr/local/lib/libatom.so:atom:xadd_start { ... }'
+//
+// Each is a single nop until a tracer attaches to it. Strings are passed as
+//	pointers, for str() in bpftrace.
+//
+//	xadd_start(stream, n_items, n_bytes)	Before an XADD goes out
+//	xadd_end(stream, ok)					Once we have the XADD reply
+//	xread_block(stream, n_streams, block_ms)	Before an XREAD goes out,
+//											stream is the first one read
+//	xread_wake(stream, got_data)			Once we have the XREAD reply
+//	xread_return(stream, ok)				Once the reply is dispatched
+//	command_received(command, n_bytes)		Command read off the stream
+//	command_acked(command, timeout_ms)		ACK sent back to the caller
+//	command_handled(command, err_code)		Command callback returned
+//	command_responded(command, n_bytes)		Response sent to the caller
+//	entry_delivered(stream, id, n_keys)		Entry about to go to the handler
+//	entry_handled(stream, id, ok)			Handler returned
+//	context_acquired(ctx, n_free)			C++ context taken from the pool
+//	context_released(ctx, n_free)			C++ context back in the pool
+//
+// Probes are built in whenever sys/sdt.h is around. Build with
+//	ATOM_NO_PROBES to leave them out.
+//
+
+#if !defined(ATOM_NO_PROBES) && defined(__has_include)
+	#if __has_include(<sys/sdt.h>)
+		#include <sys/sdt.h>
+		#define ATOM_PROBES_ENABLED
+	#endif
+#endif
+
+#ifdef ATOM_PROBES_ENABLED
+	#define ATOM_PROBE2(name, a, b) \
+		DTRACE_PROBE2(atom, name, a, b)
+	#define ATOM_PROBE3(name, a, b, c) \
+		DTRACE_PROBE3(atom, name, a, b, c)
+#else
+	#define ATOM_PROBE2(name, a, b) do {} while (0)
+	#define ATOM_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif // __ATOM_PROBES_H
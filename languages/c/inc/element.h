@@ -21,6 +21,11 @@
 #include "element_command_server.h"
 #include "element_entry_read.h"
 #include "element_entry_write.h"
+#include "element_entry_spool.h"
+#include "element_entry_trim.h"
+#include "element_command_batch.h"
+#include "element_entry_ephemeral.h"
+#include "element_slow_op.h"
 
 // Element itself. Element consists of a name, command stream
 //	and response stream.
@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_command_batch.h
+//
+//  @brief Header for batched commands. A batch is a single command entry
+//			carrying several (command, data) calls to the same element,
+//			answered with a single response entry carrying each result.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_ELEMENT_COMMAND_BATCH_H
+#define __ATOM_ELEMENT_COMMAND_BATCH_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "atom.h"
+
+// Reserved command name for a batch. Handled by the command loop itself,
+//	elements don't need to add it.
+#define ELEMENT_COMMAND_BATCH_STR "__batch__"
+
+// Max number of calls in a single batch
+#define ELEMENT_COMMAND_BATCH_MAX_ITEMS 64
+
+// A single call in a batch. For a request, name is the command and data
+//	is the request data. For a response, err_code is the result of the
+//	call and data is either the response data or, on an error, the
+//	error string. When parsed the pointers point into the batch buffer.
+//
+//	The encoding is big-endian, a uint32 count of the items followed by
+//	each item. A request item is a uint32 name length, the name, a uint32
+//	data length and the data. A response item is an int32 error code, a
+//	uint32 data length and the data.
+struct element_command_batch_item {
+	const char *name;
+	size_t name_len;
+	int err_code;
+	const uint8_t *data;
+	size_t data_len;
+};
+
+// Encodes a batch. Returns a buffer allocated with malloc() that the
+//	caller must free, with its length in len
+uint8_t *element_command_batch_encode(
+	const struct element_command_batch_item *items,
+	size_t n_items,
+	bool response,
+	size_t *len);
+
+// Parses a batch without copying. Returns the number of items or -1 if
+//	the batch is malformed or has more than max_items items.
+int element_command_batch_parse(
+	const uint8_t *data,
+	size_t len,
+	bool response,
+	struct element_command_batch_item *items,
+	size_t max_items);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_ELEMENT_COMMAND_BATCH_H
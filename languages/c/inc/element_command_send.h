@@ -21,6 +21,21 @@
 // Forward declaration of the element struct
 struct element;
 
+// What the element told us about a command in its ACK. timeout is how long
+//	it may take to respond, in ms. cache_ttl is how long the response can be
+//	cached for, ELEMENT_COMMAND_NO_CACHE if it isn't cacheable or the
+//	command failed. rpc notes whether the command can be called with
+//	element_command_send_rpc().
+struct element_command_ack_info {
+	int timeout;
+	int cache_ttl;
+	bool rpc;
+};
+
+// How long the key a list RPC response is pushed onto lives past the
+//	timeout for the call
+#define ELEMENT_COMMAND_RPC_REPLY_TTL_MARGIN_MS 1000
+
 // Sends a command with the given data to the given stream. If
 //	block is true, will wait until the response is completed. If response_cb
 //	is also non-null then will call response_cb with the data in the response
@@ -40,6 +55,88 @@ enum atom_error_t element_command_send(
 	void *user_data,
 	char **error_str);
 
+// Same as element_command_send() but also notes how long the response
+//	can be cached for, in ms. cache_ttl is ELEMENT_COMMAND_NO_CACHE if
+//	the response isn't cacheable or the command failed.
+enum atom_error_t element_command_send_cacheable(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str,
+	int *cache_ttl);
+
+// Same as element_command_send() but also fills in what the element told
+//	us about the command in its ACK if ack_info is non-NULL
+enum atom_error_t element_command_send_negotiate(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str,
+	struct element_command_ack_info *ack_info);
+
+// Sends a command to an element that takes chunked requests for it, see
+//	element_command_set_chunked(). Rather than all of the request data
+//	at once, chunk_cb is called for each chunk in turn until it sets last,
+//	and each chunk is sent as soon as we have it. If chunk_cb fails the
+//	upload is aborted and the command fails. Returns
+//	ATOM_COMMAND_UNSUPPORTED without uploading anything if the element's
+//	ACK doesn't say it takes chunked requests. Always blocks.
+enum atom_error_t element_command_send_chunked(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	bool (*chunk_cb)(
+		const uint8_t **chunk,
+		size_t *chunk_len,
+		bool *last,
+		void *user_data),
+	void *chunk_user_data,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str);
+
+// Sends a command using list RPC, for commands the element has said
+//	take it. Always blocks, for up to timeout ms. Returns
+//	ATOM_COMMAND_UNSUPPORTED if the element no longer takes list RPC
+//	for the command, in which case the caller should go back to
+//	element_command_send().
+enum atom_error_t element_command_send_rpc(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	int timeout,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str);
+
 #ifdef __cplusplus
  }
 #endif
@@ -30,6 +30,9 @@ struct element;
 
 #define ELEMENT_COMMAND_LOOP_NO_TIMEOUT 0
 
+// Cache TTL for commands whose responses callers shouldn't cache
+#define ELEMENT_COMMAND_NO_CACHE 0
+
 // Element command. Mapping between command name
 //	and a function pointer to call with the data when the
 //	command is passed to the element. Needs to be a linked list
@@ -46,7 +49,14 @@ struct element_command {
 		void *user_data,
 		void **cleanup_ptr);
 	void (*cleanup)(void *cleanup_ptr);
+	char *description;
 	int timeout;
+	int cache_ttl;
+	bool rpc;
+	int (*chunk_cb)(
+		const uint8_t *chunk,
+		size_t chunk_len,
+		void *user_data);
 	void *user_data;
 	struct element_command *next;
 };
@@ -58,6 +68,10 @@ struct element_command {
 // Cleanup is an optional argument that will be passed the pointer
 //	returned from cb if set. By default this is NULL and the default cleanup
 //	of just freeing the response and error string will be performed.
+// The command is also published in the element's command registry s.t.
+//	it can be discovered without sending the element a command. This
+//	uses the element's response context, so add commands before
+//	starting the command loop.
 bool element_command_add(
 	struct element *elem,
 	const char *command,
@@ -73,6 +87,73 @@ bool element_command_add(
 	void *user_data,
 	int timeout);
 
+// Sets the description of a command that's published in the element's
+//	command registry
+bool element_command_set_description(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	const char *description);
+
+// Marks a command as cacheable. Callers may serve the response to a
+//	request from their cache for up to ttl ms, until the element's
+//	cache version is bumped. Only for commands whose response depends
+//	on nothing but the request data and state the element invalidates
+//	the cache for when it changes.
+bool element_command_set_cacheable(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	int ttl);
+
+// Bumps the element's cache version, invalidating all of the responses
+//	that callers have cached
+enum atom_error_t element_command_cache_invalidate(
+	redisContext *ctx,
+	struct element *elem);
+
+// Lets callers use list RPC for a command. Rather than going through the
+//	command and response streams, a list RPC request is pushed onto the
+//	element's command list and the response is pushed onto a key of the
+//	caller's choosing that only lives as long as the call. Callers find
+//	out a command takes list RPC from the ACK to a regular call. The
+//	element needs to be running element_command_rpc_loop() for it.
+bool element_command_set_rpc(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	bool rpc);
+
+// Lets callers send a command's request data in chunks. Rather than
+//	waiting for all of the data to arrive, the chunk callback is called
+//	with each chunk in order as it comes in and then the command callback
+//	is called with no data once the last chunk is in. Returning nonzero
+//	from the chunk callback fails the command with that user error. If
+//	the upload fails after some chunks have been passed along then the
+//	chunk callback is called once more with a NULL chunk s.t. it can drop
+//	what it has. The command timeout is also how long we'll wait between
+//	chunks.
+bool element_command_set_chunked(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	int (*chunk_cb)(
+		const uint8_t *chunk,
+		size_t chunk_len,
+		void *user_data));
+
+// Runs the list RPC loop. Pops requests off the element's command list
+//	and pushes back the responses. If loop is false will only handle a
+//	single request, and if timeout is nonzero will return
+//	ATOM_COMMAND_NO_RESPONSE if we don't get one within timeout ms. If
+//	loop is true a timeout just means we wait again. Needs its own
+//	context, separate from the one used by element_command_loop().
+enum atom_error_t element_command_rpc_loop(
+	redisContext *ctx,
+	struct element *elem,
+	bool loop,
+	int timeout);
+
 // Runs the command monitoring loop. Will perform XREADs on the command
 //	stream and process all commands. If loop is false will only do the XREAD
 //	once. If timeout is nonzero will return if we don't get a command
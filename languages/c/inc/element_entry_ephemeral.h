@@ -0,0 +1,73 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_ephemeral.h
+//
+//  @brief Encoding for entries on ephemeral streams. Ephemeral streams are
+//			published over redis pub/sub instead of being XADDed s.t.
+//			redis keeps no history for them. Readers have to be listening
+//			when an entry is written to get it.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_ELEMENT_ENTRY_EPHEMERAL_H
+#define __ATOM_ELEMENT_ENTRY_EPHEMERAL_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <hiredis/hiredis.h>
+#include "redis.h"
+
+// Max number of keys in an ephemeral entry
+#define ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS 64
+
+// Generates IDs for ephemeral entries. IDs have the same <ms>-<seq> form
+//	as stream IDs s.t. freshness tracking and the like work the same on
+//	ephemeral streams.
+struct element_entry_ephemeral_ids {
+	uint64_t last_ms;
+	uint64_t seq;
+};
+
+// A decoded ephemeral entry. The reply is laid out the same as the
+//	key, value array for an entry in an XREAD reply s.t. it can be passed
+//	to anything that takes one. Strings point into the message the entry
+//	was decoded from and are NULL-terminated.
+struct element_entry_ephemeral_entry {
+	char id[STREAM_ID_BUFFLEN];
+	redisReply reply;
+	redisReply *elements[2 * ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS];
+	redisReply strs[2 * ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS];
+};
+
+// Makes the next ID for an ephemeral entry
+void element_entry_ephemeral_next_id(
+	struct element_entry_ephemeral_ids *ids,
+	char id[STREAM_ID_BUFFLEN]);
+
+// Encodes an entry. Returns a buffer allocated with malloc() that the
+//	caller must free, with its length in len, or NULL if there are more
+//	than ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS items
+uint8_t *element_entry_ephemeral_encode(
+	const char *id,
+	const struct redis_xadd_info *items,
+	size_t n_items,
+	size_t *len);
+
+// Decodes an entry without copying. The entry is only valid as long as
+//	the data is.
+bool element_entry_ephemeral_decode(
+	const uint8_t *data,
+	size_t len,
+	struct element_entry_ephemeral_entry *entry);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_ELEMENT_ENTRY_EPHEMERAL_H
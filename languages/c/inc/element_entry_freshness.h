@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_freshness.h
+//
+//  @brief Header for tracking how old entries are when they're delivered
+//			to a reader
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_ELEMENT_ENTRY_FRESHNESS_H
+#define __ATOM_ELEMENT_ENTRY_FRESHNESS_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include <hiredis/hiredis.h>
+#include "atom.h"
+
+// Number of buckets in a freshness histogram. Bucket 0 holds ages of 0us
+//	and bucket i holds ages in [2^(i-1), 2^i) us. The last bucket holds
+//	everything older than that, ~36 minutes.
+#define ELEMENT_ENTRY_FRESHNESS_N_BUCKETS 32
+
+// Pass as the budget to not check for budget violations
+#define ELEMENT_ENTRY_FRESHNESS_NO_BUDGET 0
+
+// Producer timestamps smaller than this are taken to be in seconds,
+//	larger ones in milliseconds. Both are since the unix epoch.
+#define ELEMENT_ENTRY_FRESHNESS_TIMESTAMP_MS_MIN 100000000000ULL
+
+// Histogram of entry ages, in microseconds
+struct element_entry_freshness_hist {
+	uint64_t buckets[ELEMENT_ENTRY_FRESHNESS_N_BUCKETS];
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+};
+
+// Freshness of the entries delivered on a stream. redis_age is the time
+//	from the entry landing in redis, per its ID, to it being delivered to
+//	the user callback. producer_age is the same but from the timestamp
+//	key the producer put on the entry, only for entries that have one.
+//	Recording is done under lock s.t. a snapshot taken from another
+//	thread is never torn.
+struct element_entry_freshness {
+	struct element_entry_freshness_hist redis_age;
+	struct element_entry_freshness_hist producer_age;
+	uint64_t budget_us;
+	uint64_t violations;
+	void (*violation_cb)(
+		const char *id,
+		uint64_t age_us,
+		void *user_data);
+	void *user_data;
+	pthread_mutex_t lock;
+};
+
+// Initializes a freshness tracker. If budget_us is not
+//	ELEMENT_ENTRY_FRESHNESS_NO_BUDGET then violation_cb, if not NULL, will
+//	be called for each entry older than the budget. The age checked is the
+//	producer age if the entry has a timestamp, else the redis age.
+void element_entry_freshness_init(
+	struct element_entry_freshness *freshness,
+	uint64_t budget_us,
+	void (*violation_cb)(
+		const char *id,
+		uint64_t age_us,
+		void *user_data),
+	void *user_data);
+
+// Clears the stats and sets a new budget on a tracker that's already
+//	been initialized and might be recording from another thread
+void element_entry_freshness_reset(
+	struct element_entry_freshness *freshness,
+	uint64_t budget_us,
+	void (*violation_cb)(
+		const char *id,
+		uint64_t age_us,
+		void *user_data),
+	void *user_data);
+
+// Copies the stats of a tracker into snapshot. The snapshot gets a lock
+//	of its own rather than a copy of the tracker's.
+void element_entry_freshness_snapshot(
+	struct element_entry_freshness *freshness,
+	struct element_entry_freshness *snapshot);
+
+// Cleans up a freshness tracker
+void element_entry_freshness_cleanup(
+	struct element_entry_freshness *freshness);
+
+// Records the freshness of an entry that's about to be delivered. reply is
+//	the list of keys and values in the entry.
+void element_entry_freshness_record(
+	struct element_entry_freshness *freshness,
+	const char *id,
+	const redisReply *reply);
+
+// Returns the upper bound, in microseconds, of the bucket holding the
+//	pct percentile (0-100) of a histogram
+uint64_t element_entry_freshness_percentile(
+	const struct element_entry_freshness_hist *hist,
+	double pct);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_ELEMENT_ENTRY_FRESHNESS_H
@@ -15,8 +15,10 @@
  extern "C" {
 #endif
 
+#include <stdint.h>
 #include "atom.h"
 #include "redis.h"
+#include "element_entry_freshness.h"
 
 #define ELEMENT_ENTRY_READ_LOOP_FOREVER 0
 
@@ -25,7 +27,13 @@ struct element;
 
 // Struct that defines all information for processing a data stream:
 //	This struct is used both for the data loop and for getting the N
-//	most recent pieces of data.
+//	most recent pieces of data. If freshness is not NULL then the age of
+//	each entry delivered by the loop or by a read since is recorded in it.
+//	weight and max_count set how the read loop schedules the stream
+//	against the others it's reading, see redis_stream_info. Leave them 0
+//	for the defaults. Note that while any stream in the loop has a
+//	max_count the streams without one are read at most the largest
+//	max_count at a time as well, and take more XREADs to catch up.
 struct element_entry_read_info {
 	const char *element;
 	const char *stream;
@@ -40,8 +48,38 @@ struct element_entry_read_info {
 	size_t items_to_read;
 	size_t items_read;
 	size_t xreads;
+	struct element_entry_freshness *freshness;
+	unsigned int weight;
+	size_t max_count;
 };
 
+// Adaptive batching for the read loop. While the loop is behind, i.e. a
+//	stream returns a full COUNT, the COUNT is doubled up to max_count for
+//	throughput. Once it's caught up the COUNT drops back to min_count for
+//	latency and, if spin_us is set, the loop busy-polls with non-blocking
+//	XREADs for up to spin_us before falling back to a blocking XREAD.
+//	count and the stats are updated by the loop as it goes.
+#define ELEMENT_ENTRY_READ_BATCHING_DEFAULT_MIN_COUNT 1
+#define ELEMENT_ENTRY_READ_BATCHING_DEFAULT_MAX_COUNT 1024
+#define ELEMENT_ENTRY_READ_BATCHING_NO_SPIN 0
+struct element_entry_read_batching {
+	size_t min_count;
+	size_t max_count;
+	int spin_us;
+	size_t count;
+	uint64_t spin_reads;
+	uint64_t spin_hits;
+	uint64_t block_reads;
+	uint64_t entries;
+};
+
+// Initializes the batching settings and clears the stats
+void element_entry_read_batching_init(
+	struct element_entry_read_batching *batching,
+	size_t min_count,
+	size_t max_count,
+	int spin_us);
+
 // Allows an element to listen for all data on streams
 enum atom_error_t element_entry_read_loop(
 	redisContext *ctx,
@@ -51,6 +89,30 @@ enum atom_error_t element_entry_read_loop(
 	bool loop_forever,
 	int timeout);
 
+// Same as element_entry_read_loop but with adaptive batching. If batching
+//	is NULL then this is the same as element_entry_read_loop.
+enum atom_error_t element_entry_read_loop_adaptive(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_read_info *infos,
+	size_t n_infos,
+	bool loop_forever,
+	int timeout,
+	struct element_entry_read_batching *batching);
+
+// Same as element_entry_read_loop but for ephemeral streams, see
+//	element_entry_write_set_ephemeral(). Entries are pushed to us by
+//	redis as they're written rather than read, so there's no timeout and
+//	nothing written before we start listening is seen. The context is
+//	put into subscribe mode for the duration so can't be shared with
+//	anything else while the loop is running.
+enum atom_error_t element_entry_read_ephemeral_loop(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_read_info *infos,
+	size_t n_infos,
+	bool loop_forever);
+
 // Allows an element to get the N most recent items on a stream
 enum atom_error_t element_entry_read_n(
 	redisContext *ctx,
@@ -58,6 +120,16 @@ enum atom_error_t element_entry_read_n(
 	struct element_entry_read_info *info,
 	size_t n);
 
+// Gets the most recent item on each of the streams in the infos as a
+//	single consistent snapshot in one round trip. The response callback
+//	is called once for each stream that has an item, streams with no
+//	items are skipped.
+enum atom_error_t element_entry_read_latest_multi(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_read_info *infos,
+	size_t n_infos);
+
 // Reads at most N items that have happened since the passed
 //	last_seen_id
 #define ENTRY_READ_SINCE_BEGIN_BLOCKING_WITH_NEWEST_ID "$"
@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_spool.h
+//
+//  @brief Header for the local write-ahead spool used to hold entry
+//			writes while the nucleus is unreachable
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_ELEMENT_ENTRY_SPOOL_H
+#define __ATOM_ELEMENT_ENTRY_SPOOL_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include "atom.h"
+#include "redis.h"
+
+// Default size of the spool file, in bytes
+#define ELEMENT_ENTRY_SPOOL_DEFAULT_SIZE (64 * 1024 * 1024)
+
+// Pass as the drain rate to not rate limit the drain of a stream
+#define ELEMENT_ENTRY_SPOOL_NO_RATE_LIMIT 0
+
+// Max number of distinct streams we track rate limits and ordering for.
+//	MUST be a power of 2
+#define ELEMENT_ENTRY_SPOOL_MAX_STREAMS 64
+#if ((ELEMENT_ENTRY_SPOOL_MAX_STREAMS & (ELEMENT_ENTRY_SPOOL_MAX_STREAMS - 1)) != 0)
+	#error "ELEMENT_ENTRY_SPOOL_MAX_STREAMS is not a power of 2!"
+#endif
+
+// Max number of XADDs we'll pipeline before waiting on the replies
+#define ELEMENT_ENTRY_SPOOL_PIPELINE_DEPTH 64
+
+// How often we'll try to reconnect to redis while draining
+#define ELEMENT_ENTRY_SPOOL_RECONNECT_INTERVAL_MS 100
+
+// Number of drains redis can reject a record in, e.g. with WRONGTYPE or
+//	OOM, before it's dropped from the spool
+#define ELEMENT_ENTRY_SPOOL_MAX_REJECTS 8
+
+// Header at the beginning of the memory-mapped spool file. The records
+//	are kept in a ring directly after the header.
+struct element_entry_spool_header {
+	uint64_t magic;
+	uint64_t capacity;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t used;
+	uint64_t n_records;
+};
+
+// Per-stream drain state. Hashed on the stream name, collisions are
+//	treated as the same stream which keeps ordering conservative.
+struct element_entry_spool_stream {
+	uint32_t hash;
+	bool in_use;
+	size_t pending;
+	double tokens;
+	uint64_t last_refill_ms;
+	bool blocked;
+};
+
+// Spool itself. Thread-safe, can be shared between all of the write
+//	infos of an element.
+struct element_entry_spool {
+	int fd;
+	char *path;
+	struct element_entry_spool_header *header;
+	uint8_t *records;
+	size_t map_len;
+	unsigned int drain_rate;
+	uint64_t last_reconnect_ms;
+	// Set while a drain is running, only one runs at a time
+	bool draining;
+	// Records dropped after redis kept rejecting them
+	uint64_t n_dropped;
+	struct element_entry_spool_stream streams[ELEMENT_ENTRY_SPOOL_MAX_STREAMS];
+	pthread_mutex_t lock;
+};
+
+// Opens (or creates) a spool backed by the file at path. If the file
+//	already holds a spool of the same size then any records left in
+//	it from a previous run are recovered and will be drained. drain_rate
+//	is the max number of entries per second per stream that will be
+//	sent to redis when draining.
+struct element_entry_spool *element_entry_spool_init(
+	const char *path,
+	size_t size,
+	unsigned int drain_rate);
+
+// Unmaps and closes the spool. Records still pending are left in the
+//	file for the next run.
+void element_entry_spool_cleanup(
+	struct element_entry_spool *spool);
+
+// Appends an entry to the spool. The entry is drained with the same
+//	trimming it was written with: everything before minid if minid is
+//	non-NULL and not empty, with maxlen as a ceiling if it's not
+//	REDIS_XADD_NO_MAXLEN. Returns false if there's not enough room for it.
+bool element_entry_spool_append(
+	struct element_entry_spool *spool,
+	const char *stream,
+	const struct redis_xadd_info *items,
+	size_t n_items,
+	int maxlen,
+	const char *minid);
+
+// Returns true if the spool has entries pending for the stream. If stream
+//	is NULL then returns true if the spool has any entries pending.
+bool element_entry_spool_pending(
+	struct element_entry_spool *spool,
+	const char *stream);
+
+// Returns the number of entries in the spool
+size_t element_entry_spool_size(
+	struct element_entry_spool *spool);
+
+// Returns the number of entries dropped since redis kept rejecting them
+uint64_t element_entry_spool_dropped(
+	struct element_entry_spool *spool);
+
+// Drains the spool into redis with pipelined XADDs, reconnecting the
+//	context if needed. Ordering is preserved within each stream and each
+//	stream is held to the drain rate. A record redis rejects holds up only
+//	its own stream, and is dropped after ELEMENT_ENTRY_SPOOL_MAX_REJECTS
+//	drains. A rejected record can land behind the records of its stream
+//	that were pipelined after it. Returns the number of entries written or
+//	-1 if redis is still unreachable.
+int element_entry_spool_drain(
+	redisContext *ctx,
+	struct element_entry_spool *spool);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_ELEMENT_ENTRY_SPOOL_H
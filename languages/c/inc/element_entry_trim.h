@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_trim.h
+//
+//  @brief Header for consumer-aware trimming of data streams
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_ELEMENT_ENTRY_TRIM_H
+#define __ATOM_ELEMENT_ENTRY_TRIM_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "atom.h"
+#include "redis.h"
+
+// Prefix for the hash of durable consumer positions on a stream. The hash
+//	is keyed on the full stream name, each field is a consumer name and
+//	its value is the ID of the last entry the consumer is done with.
+#define ELEMENT_ENTRY_TRIM_CONSUMERS_PREFIX "consumers:"
+
+// Pass as the max age/max bytes to not have that ceiling
+#define ELEMENT_ENTRY_TRIM_NO_MAX_AGE 0
+#define ELEMENT_ENTRY_TRIM_NO_MAX_BYTES 0
+
+// Default for how often the writer re-reads the consumer positions
+#define ELEMENT_ENTRY_TRIM_DEFAULT_REFRESH_MS 1000
+
+// Consumer-aware trimming for a stream. The writer trims with MINID at
+//	the slowest registered consumer's position. Since a consumer that
+//	stops reporting would otherwise pin the stream forever this is
+//	capped by a hard age ceiling, nothing older than max_age_ms is
+//	kept, and a hard size ceiling, the stream is never longer than
+//	max_bytes worth of entries at the average entry size seen so far.
+struct element_entry_trim {
+	uint64_t max_age_ms;
+	size_t max_bytes;
+	uint64_t refresh_ms;
+
+	// Monotonic time of the last refresh of the consumer positions,
+	//	0 if we haven't done one yet
+	uint64_t refreshed_ms;
+
+	// Slowest consumer as of the last refresh
+	size_t n_consumers;
+	uint64_t slowest_ms;
+	uint64_t slowest_seq;
+
+	// Running average of the entry size, in bytes
+	double entry_bytes;
+
+	// What the next write trims with. minid is empty if there's nothing
+	//	to trim by and maxlen is REDIS_XADD_NO_MAXLEN if there's no
+	//	size ceiling.
+	char minid[STREAM_ID_BUFFLEN];
+	int maxlen;
+};
+
+// Initializes trimming for a stream
+void element_entry_trim_init(
+	struct element_entry_trim *trim,
+	uint64_t max_age_ms,
+	size_t max_bytes,
+	uint64_t refresh_ms);
+
+// Reports a durable consumer's position on a stream. Entries up to
+//	last_id may be trimmed once every other consumer is past them too.
+//	Reporting registers the consumer if it isn't already.
+enum atom_error_t element_entry_trim_report(
+	redisContext *ctx,
+	const char *element,
+	const char *stream,
+	const char *consumer,
+	const char *last_id);
+
+// Unregisters a durable consumer s.t. it no longer holds back trimming
+enum atom_error_t element_entry_trim_unregister(
+	redisContext *ctx,
+	const char *element,
+	const char *stream,
+	const char *consumer);
+
+// Updates the trim for a write of the items to the stream, re-reading
+//	the consumer positions if they're due. maxlen is what the write
+//	would have used without consumer-aware trimming and is used when
+//	there are no consumers and no age ceiling.
+void element_entry_trim_update(
+	redisContext *ctx,
+	struct element_entry_trim *trim,
+	const char *stream_name,
+	const struct redis_xadd_info *items,
+	size_t n_items,
+	int maxlen);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_ELEMENT_ENTRY_TRIM_H
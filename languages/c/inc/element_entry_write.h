@@ -17,6 +17,9 @@
 
 #include "atom.h"
 #include "redis.h"
+#include "element_entry_spool.h"
+#include "element_entry_trim.h"
+#include "element_entry_ephemeral.h"
 
 // Defaults for the data stream.
 #define ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP 0
@@ -33,6 +36,10 @@ struct element_entry_write_info {
 	struct redis_xadd_info *items;
 	size_t n_items;
 	char stream[STREAM_ID_BUFFLEN];
+	struct element_entry_spool *spool;
+	struct element_entry_trim *trim;
+	bool ephemeral;
+	struct element_entry_ephemeral_ids ephemeral_ids;
 };
 
 // Initializes a stream. Once this is done
@@ -49,6 +56,29 @@ void element_entry_write_cleanup(
 	redisContext *ctx,
 	struct element_entry_write_info *stream);
 
+// Sets the spool that writes on this stream will fall back to when
+//	redis is unreachable. Pass NULL to disable spooling. The spool
+//	is not owned by the info and can be shared between infos.
+void element_entry_write_set_spool(
+	struct element_entry_write_info *info,
+	struct element_entry_spool *spool);
+
+// Sets consumer-aware trimming for writes on this stream. Pass NULL to
+//	go back to trimming with the maxlen passed to each write. The trim
+//	is not owned by the info.
+void element_entry_write_set_trim(
+	struct element_entry_write_info *info,
+	struct element_entry_trim *trim);
+
+// Makes the stream ephemeral. Writes on an ephemeral stream are published
+//	over redis pub/sub rather than added to a redis stream, so only
+//	readers listening with element_entry_read_ephemeral_loop() at the
+//	time will get them and redis keeps no history. Spooling, trimming
+//	and the maxlen passed to each write don't apply.
+void element_entry_write_set_ephemeral(
+	struct element_entry_write_info *info,
+	bool ephemeral);
+
 // Adds data to an element stream. The stream struct contains
 //	an aray of XADD infos where the user will be responsible for filling
 //	out the value for each piece of data.
@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_slow_op.h
+//
+//  @brief Header for the slow operation journal. Keeps the last N commands,
+//			writes and read callbacks that took longer than a threshold.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_ELEMENT_SLOW_OP_H
+#define __ATOM_ELEMENT_SLOW_OP_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <hiredis/hiredis.h>
+#include "atom.h"
+
+// Forward declaration of the element struct
+struct element;
+
+// Reserved command that every element with the journal on answers with a
+//	dump of it, one op per line
+#define ELEMENT_SLOW_OP_COMMAND_STR "__slow_ops__"
+#define ELEMENT_SLOW_OP_COMMAND_TIMEOUT_MS 1000
+
+// Default number of ops to keep and threshold for an op to be slow
+#define ELEMENT_SLOW_OP_DEFAULT_N_OPS 256
+#define ELEMENT_SLOW_OP_DEFAULT_THRESHOLD_US 50000
+
+// Longest stream or command name we keep for an op, longer ones are cut
+#define ELEMENT_SLOW_OP_NAME_MAXLEN 64
+
+// Kinds of ops in the journal. Each is split into up to two phases:
+//	COMMAND_HANDLE: running the command, sending the response
+//	COMMAND_SEND: sending the command and getting the ACK, waiting on
+//		the response
+//	ENTRY_WRITE: draining the spool and working out the trim, the XADD
+//	ENTRY_READ_CB: the user callback
+enum element_slow_op_type {
+	ELEMENT_SLOW_OP_COMMAND_HANDLE,
+	ELEMENT_SLOW_OP_COMMAND_SEND,
+	ELEMENT_SLOW_OP_ENTRY_WRITE,
+	ELEMENT_SLOW_OP_ENTRY_READ_CB,
+	ELEMENT_SLOW_OP_N_TYPES,
+};
+
+#define ELEMENT_SLOW_OP_N_PHASES 2
+
+// A single slow op. start_ms is wall clock s.t. it can be lined up with
+//	logs, the rest is monotonic.
+struct element_slow_op {
+	enum element_slow_op_type type;
+	char name[ELEMENT_SLOW_OP_NAME_MAXLEN];
+	uint64_t start_ms;
+	uint64_t total_us;
+	uint64_t phase_us[ELEMENT_SLOW_OP_N_PHASES];
+	size_t request_bytes;
+	size_t response_bytes;
+	long thread;
+};
+
+// Whether the journal is on. Ops only read the clock when it is, s.t. the
+//	cost with it off is this check.
+extern volatile bool element_slow_op_on;
+
+// Turns the journal on for the process, keeping the last n_ops ops that
+//	take at least threshold_us. The ring is allocated on the first call and
+//	is the size from then on; later calls only change the threshold.
+bool element_slow_op_enable(
+	size_t n_ops,
+	uint64_t threshold_us);
+
+// Turns the journal off. Ops already in it stay.
+void element_slow_op_disable(void);
+
+// Returns the current monotonic time in microseconds, to time ops with
+uint64_t element_slow_op_now_us(void);
+
+// Finishes an op started at start_us, as long as the journal was on then.
+//	If split_us is nonzero it's when the op moved on to its second phase.
+//	Only takes the journal lock if the op was slow.
+void element_slow_op_finish(
+	enum element_slow_op_type type,
+	const char *name,
+	uint64_t start_us,
+	uint64_t split_us,
+	size_t request_bytes,
+	size_t response_bytes);
+
+// Returns the number of ops in the journal
+size_t element_slow_op_count(void);
+
+// Copies up to max_ops of the ops in the journal, oldest first, and
+//	returns how many were copied
+size_t element_slow_op_get(
+	struct element_slow_op *ops,
+	size_t max_ops);
+
+// Formats an op as a single line, cut to fit in len. Returns the length
+//	of the line. Doesn't use snprintf s.t. it's safe in a signal handler.
+int element_slow_op_format(
+	const struct element_slow_op *op,
+	char *buf,
+	size_t len);
+
+// Adds the reserved command that dumps the journal to the element
+bool element_slow_op_add_command(
+	struct element *elem);
+
+// Dumps the journal to stderr whenever the process gets signum. The dump
+//	is done from the signal handler without the journal lock, so an op
+//	being recorded at the same time may come out garbled.
+bool element_slow_op_dump_on_signal(
+	int signum);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_ELEMENT_SLOW_OP_H
@@ -39,7 +39,16 @@
 //	where the reply is an array type of key, value pairs that have
 //	been received at a particular id. The stream info will also
 //	be updated to keep track of the last ID seen on the stream s.t. subsequent
-//	calls to the stream will block properly and get all of the data
+//	calls to the stream will block properly and get all of the data.
+//
+//	When XREADing multiple streams the entries in the reply are dispatched
+//	deficit-round-robin across the streams, weight entries from each
+//	stream per round, s.t. a busy stream can't hold up a quiet one. If
+//	max_count is set then at most that many entries are delivered from the
+//	stream per XREAD and the rest are left for the next one. The XREAD's
+//	COUNT is the largest max_count of the streams, so while any stream has
+//	one the streams without are read at most that many at a time too.
+#define REDIS_STREAM_DEFAULT_WEIGHT 1
 struct redis_stream_info {
 	const char *name;
 	bool (*data_cb)(
@@ -49,6 +58,8 @@ struct redis_stream_info {
 	char last_id[STREAM_ID_BUFFLEN];
 	void *user_data;
 	size_t items_read;
+	unsigned int weight;
+	size_t max_count;
 };
 
 // Struct that contains info for data to be written. Each piece of data
@@ -74,7 +85,8 @@ struct redis_xread_kv_item {
 // Initializes a stream info s.t. it's ready for pub-sub like blocking
 //	for xread. CTX may be NULL if last_id is provided. If last_id is NULL
 //	then ctx will be used to get the current time and use that as the
-//	last seen ID.
+//	last seen ID. The weight is set to REDIS_STREAM_DEFAULT_WEIGHT and
+//	max_count to REDIS_XREAD_NOMAXCOUNT.
 bool redis_init_stream_info(
 	redisContext *ctx,
 	struct redis_stream_info *info,
@@ -92,6 +104,7 @@ bool redis_init_stream_info(
 #define REDIS_XREAD_BLOCK_INDEFINITE 0
 #define REDIS_XREAD_DONTBLOCK -1
 #define REDIS_XREAD_NOMAXCOUNT 0
+#define REDIS_XREAD_MAX_STREAMS 29
 bool redis_xread(
 	redisContext *ctx,
 	struct redis_stream_info *infos,
@@ -116,6 +129,19 @@ bool redis_xrevrange(
 	size_t n,
 	void *user_data);
 
+// Gets the most recent entry on each of the streams as an atomic snapshot
+//	in a single round trip. The callback is called with user_data[i] for
+//	each stream i that isn't empty.
+bool redis_xrevrange_latest_multi(
+	redisContext *ctx,
+	const char **names,
+	size_t n_names,
+	bool (*data_cb)(const char *id, const struct redisReply *reply, void *data),
+	void **user_data);
+
+// Max number of (key, value) pairs that can be written in a single XADD
+#define REDIS_XADD_MAX_ITEMS 29
+
 // Adds data to ,a stream with a given max length.
 #define REDIS_XADD_NO_MAXLEN (-1)
 bool redis_xadd(
@@ -127,6 +153,61 @@ bool redis_xadd(
 	bool approx_maxlen,
 	char ret_id[STREAM_ID_BUFFLEN]);
 
+// Appends an XADD to the context without waiting for the reply.
+//	Used to pipeline writes, the replies must be collected with
+//	redis_pipeline_get_replies()
+bool redis_xadd_append(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	int maxlen,
+	bool approx_maxlen);
+
+// Same as redis_xadd_append but trims everything with an ID older than
+//	minid, and if maxlen is not REDIS_XADD_NO_MAXLEN appends an XTRIM to
+//	maxlen after the XADD. Returns the number of commands appended, whose
+//	replies are the XADD's ID and then the XTRIM's count, or -1 if
+//	nothing could be appended.
+int redis_xadd_minid_append(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const char *minid,
+	int maxlen,
+	bool approx);
+
+// Adds data to a stream, trimming everything with an ID older than minid.
+//	If maxlen is not REDIS_XADD_NO_MAXLEN then the stream is also
+//	trimmed to maxlen in the same round trip.
+bool redis_xadd_minid(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const char *minid,
+	int maxlen,
+	bool approx,
+	char ret_id[STREAM_ID_BUFFLEN]);
+
+// Collects the replies for n pipelined commands. Returns the number of
+//	leading replies that matched the expected reply type or -1 if the
+//	connection was lost.
+int redis_pipeline_get_replies(
+	redisContext *ctx,
+	size_t n,
+	int expected_type);
+
+// Collects the replies for n pipelined commands, noting in ok whether
+//	each one matched the expected reply type. Returns the number that did
+//	or -1 if the connection was lost.
+int redis_pipeline_get_reply_status(
+	redisContext *ctx,
+	size_t n,
+	int expected_type,
+	bool *ok);
+
 // Calls the callback with each key that matches the
 //	pattern. NOTE: the scanning API currently can be prone
 //	to duplicates. Returns the number of times the callback
@@ -146,6 +227,133 @@ bool redis_remove_key(
 	const char *key,
 	bool unlink);
 
+// Increments an integer key, optionally returning the new value
+bool redis_incr(
+	redisContext *ctx,
+	const char *key,
+	long long *value);
+
+// Sets an integer key
+bool redis_set_int(
+	redisContext *ctx,
+	const char *key,
+	long long value);
+
+// Gets an integer key. A key that doesn't exist reads as 0.
+bool redis_get_int(
+	redisContext *ctx,
+	const char *key,
+	long long *value);
+
+// Pushes data onto the tail of a list. If ttl_ms is nonzero then the
+//	list is also set to expire after ttl_ms, pipelined with the push.
+bool redis_list_push(
+	redisContext *ctx,
+	const char *key,
+	const uint8_t *data,
+	size_t data_len,
+	int ttl_ms);
+
+// Pops from the head of a list, blocking for up to timeout_ms or forever
+//	if timeout_ms is 0. popped notes whether there was anything to pop and
+//	if so the callback is called with it.
+bool redis_list_pop(
+	redisContext *ctx,
+	const char *key,
+	int timeout_ms,
+	bool (*data_cb)(
+		const uint8_t *data,
+		size_t data_len,
+		void *user_data),
+	void *user_data,
+	bool *popped);
+
+// Same as a redis_list_push() onto push_key followed by a redis_list_pop()
+//	from pop_key but pipelined s.t. it's a single round trip
+bool redis_list_push_pop(
+	redisContext *ctx,
+	const char *push_key,
+	const uint8_t *data,
+	size_t data_len,
+	const char *pop_key,
+	int timeout_ms,
+	bool (*data_cb)(
+		const uint8_t *data,
+		size_t data_len,
+		void *user_data),
+	void *user_data,
+	bool *popped);
+
+// Publishes a message on a pub/sub channel, optionally returning the
+//	number of subscribers that got it
+bool redis_publish(
+	redisContext *ctx,
+	const char *channel,
+	const uint8_t *data,
+	size_t data_len,
+	long long *n_subscribers);
+
+// Subscribes to a set of pub/sub channels. Once this succeeds the context
+//	is in subscribe mode and can only be used with redis_get_message()
+//	until redis_unsubscribe() is called on it.
+bool redis_subscribe(
+	redisContext *ctx,
+	const char **channels,
+	size_t n_channels);
+
+// Unsubscribes from all channels, dropping any messages that come in
+//	while we wait for redis to confirm. The context can be used as
+//	normal afterwards.
+bool redis_unsubscribe(
+	redisContext *ctx);
+
+// Blocks until the next message on a subscribed channel and calls the
+//	callback with it
+bool redis_get_message(
+	redisContext *ctx,
+	bool (*message_cb)(
+		const char *channel,
+		const uint8_t *data,
+		size_t data_len,
+		void *user_data),
+	void *user_data);
+
+// Sets a field in a hash
+bool redis_hash_set(
+	redisContext *ctx,
+	const char *key,
+	const char *field,
+	const char *value);
+
+// Removes a field from a hash
+bool redis_hash_del(
+	redisContext *ctx,
+	const char *key,
+	const char *field);
+
+// Calls the callback with each (field, value) in a hash. Returns the
+//	number of fields in the hash or -1 on error.
+int redis_hash_get_all(
+	redisContext *ctx,
+	const char *key,
+	bool (*data_cb)(const char *field, const char *value, void *user_data),
+	void *user_data);
+
+// Gets all of the fields of a set of hashes in one pipelined round trip,
+//	calling the callback with the index of the key in keys along with
+//	each (field, value). Missing keys are empty hashes. Returns the
+//	number of fields over all of the hashes or -1 on error.
+int redis_hash_get_all_multi(
+	redisContext *ctx,
+	const char * const *keys,
+	size_t n_keys,
+	bool (*data_cb)(
+		size_t key_idx,
+		const char *field,
+		const char *value,
+		void *user_data),
+	void *user_data);
+
 // Prints out a redis reply recursively. To print out a top-level
 //	reply, call with (0, 0, reply).
 void redis_print_reply(
@@ -161,9 +369,30 @@ void redis_print_xread_kv_items(
 // Gets a redis context
 redisContext *redis_context_init(void);
 
+// Gets a redis context on a unix socket
+redisContext *redis_context_init_local(const char *socket);
+
 // Frees a redis context
 void redis_context_cleanup(redisContext *ctx);
 
+// Reconnects a context if it's had an error. Returns true if the
+//	context is usable
+bool redis_context_reconnect(redisContext *ctx);
+
+// Replication state of a redis server, from INFO replication. For a
+//	primary offset is the master_repl_offset, for a replica it's the
+//	slave_repl_offset and link_up notes if it's connected to its primary.
+struct redis_replication_info {
+	bool is_replica;
+	bool link_up;
+	long long offset;
+};
+
+// Gets the replication state of the server the context is connected to
+bool redis_get_replication_info(
+	redisContext *ctx,
+	struct redis_replication_info *info);
+
 #ifdef __cplusplus
  }
 #endif
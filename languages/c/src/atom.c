@@ -13,10 +13,13 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <assert.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "redis.h"
 #include "atom.h"
@@ -24,6 +27,37 @@
 
 #define ATOM_LOG_DEFAULT_ELEMENT_NAME "none"
 
+// Number of log call sites we can rate limit
+#define ATOM_LOG_N_SITES 256
+
+// Rate limit state for a log call site, keyed on its format string or,
+//	for messages that are already formatted, an address from the site
+struct atom_log_site {
+	const void *key;
+	double tokens;
+	uint64_t last_ms;
+	uint64_t suppressed;
+};
+
+// Last message logged, to hold back repeats of it
+struct atom_log_last_msg {
+	int level;
+	char element[ATOM_NAME_MAXLEN];
+	size_t element_len;
+	char msg[ATOM_LOG_MAXLEN];
+	size_t msg_len;
+	uint64_t repeats;
+	uint64_t last_ms;
+};
+
+// Log limiting settings and state, all under the lock
+static pthread_mutex_t atom_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int atom_log_site_rate = ATOM_LOG_NO_LIMIT;
+static unsigned int atom_log_site_burst = ATOM_LOG_DEFAULT_SITE_BURST;
+static int atom_log_repeat_summary_ms = ATOM_LOG_NO_LIMIT;
+static struct atom_log_site atom_log_sites[ATOM_LOG_N_SITES];
+static struct atom_log_last_msg atom_log_last = { .level = -1 };
+
 // User data callback to send to the redis helper for finding elements
 struct atom_get_element_cb_info {
 	bool (*user_cb)(const char *key, void *user_data);
@@ -273,6 +307,127 @@ enum atom_error_t atom_get_all_data_streams(
 		result);
 }
 
+// User data for parsing the command registries into command infos
+struct atom_get_commands_cb_info {
+	bool (*user_cb)(const struct atom_command_info *info, void *user_data);
+	void *user_data;
+	const char **elements;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Parses a command registry entry and passes it along to the user
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool atom_get_commands_cb(
+	size_t key_idx,
+	const char *field,
+	const char *value,
+	void *user_data)
+{
+	struct atom_get_commands_cb_info *info;
+	struct atom_command_info cmd_info;
+	char *end;
+
+	info = (struct atom_get_commands_cb_info *)user_data;
+
+	cmd_info.element = info->elements[key_idx];
+	cmd_info.command = field;
+	cmd_info.timeout = strtol(value, &end, 10);
+	if ((end == value) || ((*end != ' ') && (*end != '\0'))) {
+		atom_logf(NULL, NULL, LOG_ERR,
+			"Invalid registry entry for %s:%s", cmd_info.element, field);
+		return false;
+	}
+	cmd_info.description = (*end == ' ') ? (end + 1) : end;
+
+	return info->user_cb(&cmd_info, info->user_data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Calls a callback for each command in the command registry.
+//			Finds the registries with a scan and then reads all of them
+//			in one pipeline.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_get_all_commands_cb(
+	redisContext *ctx,
+	const char *element,
+	bool (*data_cb)(const struct atom_command_info *info, void *user_data),
+	void *user_data)
+{
+	struct atom_get_commands_cb_info info;
+	struct atom_list_node *registries = NULL;
+	struct atom_list_node *iter;
+	const char **keys = NULL;
+	char pattern[ATOM_NAME_MAXLEN];
+	size_t n_keys = 0;
+	size_t i;
+	enum atom_error_t err = ATOM_INTERNAL_ERROR;
+
+	// Find the registries
+	if (element != NULL) {
+		if (atom_get_command_registry_str(element, pattern) == NULL) {
+			goto done;
+		}
+	} else {
+		strncpy(pattern, ATOM_COMMAND_REGISTRY_PREFIX "*", sizeof(pattern));
+	}
+
+	if (redis_get_matching_keys(ctx,
+		pattern,
+		atom_add_to_list,
+		&registries) < 0)
+	{
+		atom_logf(ctx, NULL, LOG_ERR, "Failed to check for command registries");
+		err = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	for (iter = registries; iter != NULL; iter = iter->next) {
+		++n_keys;
+	}
+	if (n_keys == 0) {
+		err = ATOM_NO_ERROR;
+		goto done;
+	}
+
+	// Make the list of keys and the element each belongs to
+	keys = malloc(2 * n_keys * sizeof(const char *));
+	assert(keys != NULL);
+	for (i = 0, iter = registries; iter != NULL; ++i, iter = iter->next) {
+		keys[i] = iter->name;
+		keys[n_keys + i] =
+			&iter->name[CONST_STRLEN(ATOM_COMMAND_REGISTRY_PREFIX)];
+	}
+
+	info.user_cb = data_cb;
+	info.user_data = user_data;
+	info.elements = &keys[n_keys];
+
+	// And read them all at once
+	if (redis_hash_get_all_multi(ctx,
+		keys,
+		n_keys,
+		atom_get_commands_cb,
+		&info) < 0)
+	{
+		atom_logf(ctx, NULL, LOG_ERR, "Failed to read command registries");
+		err = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	err = ATOM_NO_ERROR;
+
+done:
+	if (keys != NULL) {
+		free(keys);
+	}
+	atom_list_free(registries);
+	return err;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Make sure the element name is valid
@@ -337,6 +492,120 @@ char *atom_get_response_stream_str(
 	return ret;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the response cache version key for an element. If buffer is
+//			non-NULL will write the output into the buffer, else will
+//			allocate the string and return it.
+//
+////////////////////////////////////////////////////////////////////////////////
+char *atom_get_cache_version_str(
+	const char *element,
+	char buffer[ATOM_NAME_MAXLEN])
+{
+	char *ret = NULL;
+
+	if (!atom_element_name_is_valid(element)) {
+		return NULL;
+	}
+
+	if (buffer != NULL) {
+		if (snprintf(
+			buffer,
+			ATOM_NAME_MAXLEN,
+			ATOM_CACHE_VERSION_PREFIX "%s",
+			element) >= ATOM_NAME_MAXLEN)
+		{
+			atom_logf(NULL, NULL, LOG_ERR, "Key name too long!");
+		} else {
+			ret = buffer;
+		}
+	} else {
+		asprintf(
+			&ret,
+			ATOM_CACHE_VERSION_PREFIX "%s",
+			element);
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the command registry hash for an element. If buffer is
+//			non-NULL will write the output into the buffer, else will
+//			allocate the string and return it.
+//
+////////////////////////////////////////////////////////////////////////////////
+char *atom_get_command_registry_str(
+	const char *element,
+	char buffer[ATOM_NAME_MAXLEN])
+{
+	char *ret = NULL;
+
+	if (!atom_element_name_is_valid(element)) {
+		return NULL;
+	}
+
+	if (buffer != NULL) {
+		if (snprintf(
+			buffer,
+			ATOM_NAME_MAXLEN,
+			ATOM_COMMAND_REGISTRY_PREFIX "%s",
+			element) >= ATOM_NAME_MAXLEN)
+		{
+			atom_logf(NULL, NULL, LOG_ERR, "Key name too long!");
+		} else {
+			ret = buffer;
+		}
+	} else {
+		asprintf(
+			&ret,
+			ATOM_COMMAND_REGISTRY_PREFIX "%s",
+			element);
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the list RPC request list for an element. If buffer is
+//			non-NULL will write the output into the buffer, else will
+//			allocate the string and return it.
+//
+////////////////////////////////////////////////////////////////////////////////
+char *atom_get_command_list_str(
+	const char *element,
+	char buffer[ATOM_NAME_MAXLEN])
+{
+	char *ret = NULL;
+
+	if (!atom_element_name_is_valid(element)) {
+		return NULL;
+	}
+
+	if (buffer != NULL) {
+		if (snprintf(
+			buffer,
+			ATOM_NAME_MAXLEN,
+			ATOM_COMMAND_LIST_PREFIX "%s",
+			element) >= ATOM_NAME_MAXLEN)
+		{
+			atom_logf(NULL, NULL, LOG_ERR, "Key name too long!");
+		} else {
+			ret = buffer;
+		}
+	} else {
+		asprintf(
+			&ret,
+			ATOM_COMMAND_LIST_PREFIX "%s",
+			element);
+	}
+
+	return ret;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Gets request stream for an element. If buffer is non-NULL
@@ -432,16 +701,289 @@ char *atom_get_data_stream_str(
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Logs a message to the global log stream.
-//			- ctx can be NULL, but this is not recommended if it can be avoided
-//			as it's a performance hit to make the context.
-//			- element can be NULL as well, and if so the default element
-//			name will be logged
+//  @brief Gets the name of a partition of a stream. If buffer is non-NULL
+//			will write the output into the buffer, else will allocate the
+//			string and return it.
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t atom_log(
+char *atom_get_partition_stream_name(
+	const char *name,
+	int partition,
+	char buffer[ATOM_NAME_MAXLEN])
+{
+	char *ret = NULL;
+
+	if ((partition < 0) || (partition >= ATOM_MAX_PARTITIONS)) {
+		return NULL;
+	}
+
+	if (buffer != NULL) {
+		if (snprintf(
+			buffer,
+			ATOM_NAME_MAXLEN,
+			"%s" ATOM_PARTITION_SUFFIX "%d",
+			name,
+			partition) >= ATOM_NAME_MAXLEN)
+		{
+			atom_logf(NULL, NULL, LOG_ERR, "Stream name too long!");
+		} else {
+			ret = buffer;
+		}
+	} else {
+		asprintf(
+			&ret,
+			"%s" ATOM_PARTITION_SUFFIX "%d",
+			name,
+			partition);
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the key holding the number of partitions of a stream. The
+//			key is on the full stream name s.t. the stream can be given
+//			either as an element and a name or, with a NULL element, as a
+//			raw stream name. If buffer is non-NULL will write the output
+//			into the buffer, else will allocate the string and return it.
+//
+////////////////////////////////////////////////////////////////////////////////
+char *atom_get_partitions_str(
+	const char *element,
+	const char *name,
+	char buffer[ATOM_NAME_MAXLEN])
+{
+	char stream_buffer[ATOM_NAME_MAXLEN];
+	const char *stream;
+	char *ret = NULL;
+
+	stream = atom_get_data_stream_str(element, name, stream_buffer);
+	if (stream == NULL) {
+		return NULL;
+	}
+
+	if (buffer != NULL) {
+		if (snprintf(
+			buffer,
+			ATOM_NAME_MAXLEN,
+			ATOM_PARTITIONS_PREFIX "%s",
+			stream) >= ATOM_NAME_MAXLEN)
+		{
+			atom_logf(NULL, NULL, LOG_ERR, "Key name too long!");
+		} else {
+			ret = buffer;
+		}
+	} else {
+		asprintf(
+			&ret,
+			ATOM_PARTITIONS_PREFIX "%s",
+			stream);
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the partition for a partition key value, using 32-bit
+//			FNV-1a s.t. every client agrees on it
+//
+////////////////////////////////////////////////////////////////////////////////
+int atom_partition_for_key(
+	const uint8_t *key,
+	size_t key_len,
+	int n_partitions)
+{
+	uint32_t hash = 2166136261u;
+
+	if (n_partitions <= 1) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < key_len; ++i) {
+		hash ^= key[i];
+		hash *= 16777619u;
+	}
+
+	return (int)(hash % (uint32_t)n_partitions);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Publishes the number of partitions of a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_set_partition_count(
 	redisContext *ctx,
-	struct element *element,
+	const char *element,
+	const char *name,
+	int n_partitions)
+{
+	char key[ATOM_NAME_MAXLEN];
+
+	if ((n_partitions < 1) || (n_partitions > ATOM_MAX_PARTITIONS)) {
+		atom_logf(ctx, NULL, LOG_ERR,
+			"Invalid number of partitions %d", n_partitions);
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	if (atom_get_partitions_str(element, name, key) == NULL) {
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	if (!redis_set_int(ctx, key, n_partitions)) {
+		atom_logf(ctx, NULL, LOG_ERR,
+			"Failed to set partitions for %s", key);
+		return ATOM_REDIS_ERROR;
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of partitions of a stream, 0 if it isn't
+//			partitioned
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_get_partition_count(
+	redisContext *ctx,
+	const char *element,
+	const char *name,
+	int *n_partitions)
+{
+	char key[ATOM_NAME_MAXLEN];
+	long long value;
+
+	if (atom_get_partitions_str(element, name, key) == NULL) {
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	if (!redis_get_int(ctx, key, &value)) {
+		return ATOM_REDIS_ERROR;
+	}
+
+	*n_partitions = ((value > 0) && (value <= ATOM_MAX_PARTITIONS)) ?
+		(int)value : 0;
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the current monotonic time in milliseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t atom_log_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets how noisy logs are limited
+//
+////////////////////////////////////////////////////////////////////////////////
+void atom_log_limit_set(
+	unsigned int site_rate,
+	unsigned int site_burst,
+	int repeat_summary_ms)
+{
+	pthread_mutex_lock(&atom_log_lock);
+
+	atom_log_site_rate = site_rate;
+	atom_log_site_burst = (site_burst > 0) ? site_burst : 1;
+	atom_log_repeat_summary_ms = repeat_summary_ms;
+
+	// Start everyone over with a full bucket under the new limits
+	memset(atom_log_sites, 0, sizeof(atom_log_sites));
+	atom_log_last.level = -1;
+	atom_log_last.repeats = 0;
+
+	pthread_mutex_unlock(&atom_log_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks whether a log call site is under its rate. Sites are
+//			token buckets keyed on the format string, or some other
+//			address unique to the site, s.t. this is done before
+//			formatting. If we're let through then suppressed is set to how
+//			many logs from the site were dropped since it was last let
+//			through.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool atom_log_site_allow(
+	const void *key,
+	uint64_t *suppressed)
+{
+	struct atom_log_site *site = NULL;
+	uint64_t now_ms;
+	size_t hash;
+	size_t i;
+	bool allow = true;
+
+	*suppressed = 0;
+
+	pthread_mutex_lock(&atom_log_lock);
+
+	if (atom_log_site_rate == ATOM_LOG_NO_LIMIT) {
+		goto done;
+	}
+
+	// Find the site, or a free slot for it. If we're out of slots the
+	//	site just isn't limited.
+	hash = ((uintptr_t)key >> 3) % ATOM_LOG_N_SITES;
+	for (i = 0; i < ATOM_LOG_N_SITES; ++i) {
+		site = &atom_log_sites[(hash + i) % ATOM_LOG_N_SITES];
+		if ((site->key == key) || (site->key == NULL)) {
+			break;
+		}
+		site = NULL;
+	}
+	if (site == NULL) {
+		goto done;
+	}
+
+	now_ms = atom_log_now_ms();
+	if (site->key == NULL) {
+		site->key = key;
+		site->tokens = atom_log_site_burst;
+	} else {
+		site->tokens += (double)(now_ms - site->last_ms) *
+			atom_log_site_rate / 1000.0;
+		if (site->tokens > atom_log_site_burst) {
+			site->tokens = atom_log_site_burst;
+		}
+	}
+	site->last_ms = now_ms;
+
+	if (site->tokens < 1.0) {
+		site->suppressed++;
+		allow = false;
+		goto done;
+	}
+
+	site->tokens -= 1.0;
+	*suppressed = site->suppressed;
+	site->suppressed = 0;
+
+done:
+	pthread_mutex_unlock(&atom_log_lock);
+	return allow;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a message to the global log stream
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t atom_log_send(
+	redisContext *ctx,
+	const char *element_name,
+	size_t element_name_len,
 	int level,
 	const char *msg,
 	size_t msg_len)
@@ -456,12 +998,6 @@ enum atom_error_t atom_log(
 	bool made_context = false;
 	FILE *f;
 
-	// Check the level
-	if ((level < LOG_EMERG) || (level > LOG_DEBUG)) {
-		err = ATOM_COMMAND_INVALID_DATA;
-		goto done;
-	}
-
 	// If we haven't gotten the hostname, we need to do so
 	if (hostname_len == 0) {
 		assert(gethostname(hostname, sizeof(hostname)) == 0);
@@ -489,13 +1025,8 @@ enum atom_error_t atom_log(
 	infos[LOG_KEY_ELEMENT].key = LOG_KEY_ELEMENT_STR;
 	infos[LOG_KEY_ELEMENT].key_len = sizeof(LOG_KEY_ELEMENT_STR) - 1;
 
-	if (element != NULL) {
-		infos[LOG_KEY_ELEMENT].data = (const uint8_t*)element->name.str;
-		infos[LOG_KEY_ELEMENT].data_len = element->name.len;
-	} else {
-		infos[LOG_KEY_ELEMENT].data = (const uint8_t*)ATOM_LOG_DEFAULT_ELEMENT_NAME;
-		infos[LOG_KEY_ELEMENT].data_len = sizeof(ATOM_LOG_DEFAULT_ELEMENT_NAME) - 1;
-	}
+	infos[LOG_KEY_ELEMENT].data = (const uint8_t*)element_name;
+	infos[LOG_KEY_ELEMENT].data_len = element_name_len;
 
 	infos[LOG_KEY_MESSAGE].key = LOG_KEY_MESSAGE_STR;
 	infos[LOG_KEY_MESSAGE].key_len = sizeof(LOG_KEY_MESSAGE_STR) - 1;
@@ -528,11 +1059,12 @@ enum atom_error_t atom_log(
 	// And if we're printing logs to stdout we should do so
 	#ifdef ATOM_PRINT_LOGS
 		f = (level <= LOG_ERR) ? stderr : stdout;
-		fprintf(f, "Level: %d, Host: %s, Element: %s, Msg: %s\n",
+		fprintf(f, "Level: %d, Host: %s, Element: %.*s, Msg: %.*s\n",
 			level,
 			hostname,
-			(element != NULL) ?
-				element->name.str : ATOM_LOG_DEFAULT_ELEMENT_NAME,
+			(int)element_name_len,
+			element_name,
+			(int)msg_len,
 			msg);
 	#endif
 
@@ -542,6 +1074,195 @@ done:
 	return err;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends the summary of the repeats of a message that were held back
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t atom_log_send_summary(
+	redisContext *ctx,
+	const char *element_name,
+	size_t element_name_len,
+	int level,
+	uint64_t repeats)
+{
+	char summary[64];
+	int summary_len;
+
+	summary_len = snprintf(summary, sizeof(summary),
+		"Last message repeated %llu times", (unsigned long long)repeats);
+
+	return atom_log_send(ctx, element_name, element_name_len, level,
+		summary, summary_len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends the summary of any repeats that are being held back
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_log_flush(
+	redisContext *ctx)
+{
+	char summary_element[ATOM_NAME_MAXLEN];
+	size_t summary_element_len;
+	int summary_level;
+	uint64_t repeats;
+
+	pthread_mutex_lock(&atom_log_lock);
+
+	repeats = atom_log_last.repeats;
+	if (repeats == 0) {
+		pthread_mutex_unlock(&atom_log_lock);
+		return ATOM_NO_ERROR;
+	}
+
+	summary_level = atom_log_last.level;
+	summary_element_len = atom_log_last.element_len;
+	memcpy(summary_element, atom_log_last.element, summary_element_len);
+	atom_log_last.repeats = 0;
+	atom_log_last.last_ms = atom_log_now_ms();
+
+	pthread_mutex_unlock(&atom_log_lock);
+
+	return atom_log_send_summary(
+		ctx, summary_element, summary_element_len, summary_level, repeats);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Logs a message to the global log stream.
+//			- ctx can be NULL, but this is not recommended if it can be avoided
+//			as it's a performance hit to make the context.
+//			- element can be NULL as well, and if so the default element
+//			name will be logged
+//			Consecutive repeats of the same message are held back and
+//			summed up in a "repeated N times" message, sent once a
+//			different message comes along, on the first repeat after each
+//			repeat summary period or on atom_log_flush(). Elements flush
+//			when they're cleaned up.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_log(
+	redisContext *ctx,
+	struct element *element,
+	int level,
+	const char *msg,
+	size_t msg_len)
+{
+	const char *element_name;
+	size_t element_name_len;
+	char summary_element[ATOM_NAME_MAXLEN];
+	size_t summary_element_len = 0;
+	int summary_level = 0;
+	uint64_t repeats = 0;
+	uint64_t now_ms;
+	bool repeat;
+	enum atom_error_t err;
+
+	// Check the level
+	if ((level < LOG_EMERG) || (level > LOG_DEBUG)) {
+		return ATOM_COMMAND_INVALID_DATA;
+	}
+
+	if (element != NULL) {
+		element_name = element->name.str;
+		element_name_len = element->name.len;
+	} else {
+		element_name = ATOM_LOG_DEFAULT_ELEMENT_NAME;
+		element_name_len = sizeof(ATOM_LOG_DEFAULT_ELEMENT_NAME) - 1;
+	}
+
+	pthread_mutex_lock(&atom_log_lock);
+
+	if (atom_log_repeat_summary_ms == ATOM_LOG_NO_LIMIT) {
+		pthread_mutex_unlock(&atom_log_lock);
+		return atom_log_send(
+			ctx, element_name, element_name_len, level, msg, msg_len);
+	}
+
+	now_ms = atom_log_now_ms();
+	repeat = (level == atom_log_last.level) &&
+		(msg_len == atom_log_last.msg_len) &&
+		(element_name_len == atom_log_last.element_len) &&
+		!memcmp(msg, atom_log_last.msg, msg_len) &&
+		!memcmp(element_name, atom_log_last.element, element_name_len);
+
+	// Hold back repeats until it's time to sum them up
+	if (repeat) {
+		atom_log_last.repeats++;
+		if (now_ms - atom_log_last.last_ms <
+			(uint64_t)atom_log_repeat_summary_ms)
+		{
+			pthread_mutex_unlock(&atom_log_lock);
+			return ATOM_NO_ERROR;
+		}
+	}
+
+	// Note the repeats of the last message that we need to sum up
+	if (atom_log_last.repeats > 0) {
+		repeats = atom_log_last.repeats;
+		summary_level = atom_log_last.level;
+		summary_element_len = atom_log_last.element_len;
+		memcpy(summary_element, atom_log_last.element, summary_element_len);
+	}
+	atom_log_last.repeats = 0;
+	atom_log_last.last_ms = now_ms;
+
+	// And note this message as the last one, if it fits
+	if (!repeat) {
+		if ((msg_len <= sizeof(atom_log_last.msg)) &&
+			(element_name_len <= sizeof(atom_log_last.element)))
+		{
+			atom_log_last.level = level;
+			atom_log_last.msg_len = msg_len;
+			memcpy(atom_log_last.msg, msg, msg_len);
+			atom_log_last.element_len = element_name_len;
+			memcpy(atom_log_last.element, element_name, element_name_len);
+		} else {
+			atom_log_last.level = -1;
+		}
+	}
+
+	pthread_mutex_unlock(&atom_log_lock);
+
+	if (repeats > 0) {
+		err = atom_log_send_summary(ctx, summary_element,
+			summary_element_len, summary_level, repeats);
+		if (err != ATOM_NO_ERROR) {
+			return err;
+		}
+	}
+
+	// The summary stands in for the repeat
+	if (repeat) {
+		return ATOM_NO_ERROR;
+	}
+
+	return atom_log_send(
+		ctx, element_name, element_name_len, level, msg, msg_len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds how many logs from the site were dropped to a message of
+//			len bytes in a buffer of ATOM_LOG_MAXLEN. Returns the new len.
+//
+////////////////////////////////////////////////////////////////////////////////
+static size_t atom_log_note_suppressed(
+	char *log_buffer,
+	size_t len,
+	uint64_t suppressed)
+{
+	len += snprintf(log_buffer + len, ATOM_LOG_MAXLEN - len,
+		" [%llu more suppressed]", (unsigned long long)suppressed);
+	if (len >= ATOM_LOG_MAXLEN) {
+		len = ATOM_LOG_MAXLEN - 1;
+	}
+
+	return len;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Logs a message to the global log stream using variadic args
@@ -556,13 +1277,65 @@ enum atom_error_t atom_vlogf(
 {
     char log_buffer[ATOM_LOG_MAXLEN];
     size_t len;
+    uint64_t suppressed = 0;
+
+    // Drop the log if its call site is over its rate, before we bother
+    //  formatting it
+    if ((level >= LOG_EMERG) && (level <= LOG_DEBUG) &&
+        !atom_log_site_allow(fmt, &suppressed))
+    {
+        return ATOM_NO_ERROR;
+    }
 
     // Use the variadic version of snprintf
     len = vsnprintf(log_buffer, sizeof(log_buffer), fmt, args);
+    if (len >= sizeof(log_buffer)) {
+        len = sizeof(log_buffer) - 1;
+    }
+
+    // Let the reader know if we dropped any
+    if (suppressed > 0) {
+        len = atom_log_note_suppressed(log_buffer, len, suppressed);
+    }
 
    	return atom_log(ctx, element, level, log_buffer, len);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Logs an already formatted message, rate limited on its call site
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_log_limited(
+	redisContext *ctx,
+	struct element *element,
+	int level,
+	const void *site,
+	const char *msg,
+	size_t msg_len)
+{
+	char log_buffer[ATOM_LOG_MAXLEN];
+	size_t len;
+	uint64_t suppressed = 0;
+
+	if ((site != NULL) && (level >= LOG_EMERG) && (level <= LOG_DEBUG) &&
+		!atom_log_site_allow(site, &suppressed))
+	{
+		return ATOM_NO_ERROR;
+	}
+
+	if (suppressed == 0) {
+		return atom_log(ctx, element, level, msg, msg_len);
+	}
+
+	// Need a copy to let the reader know we dropped some
+	len = (msg_len < sizeof(log_buffer)) ? msg_len : sizeof(log_buffer) - 1;
+	memcpy(log_buffer, msg, len);
+	len = atom_log_note_suppressed(log_buffer, len, suppressed);
+
+	return atom_log(ctx, element, level, log_buffer, len);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Logs a message to the global log stream using printf-style formats
@@ -128,6 +128,9 @@ static void element_free_command(
 		if (cmd->name != NULL) {
 			free(cmd->name);
 		}
+		if (cmd->description != NULL) {
+			free(cmd->description);
+		}
 		free(cmd);
 	}
 }
@@ -164,8 +167,28 @@ void element_cleanup(
 	redisContext *ctx,
 	struct element *elem)
 {
+	char list[ATOM_NAME_MAXLEN];
+	char registry[ATOM_NAME_MAXLEN];
+
 	if (elem != NULL) {
 
+		// Don't lose track of repeats that are still being held back
+		atom_log_flush(ctx);
+
+		// Drop any list RPC requests nobody's going to handle
+		if ((elem->name.str != NULL) &&
+			(atom_get_command_list_str(elem->name.str, list) != NULL))
+		{
+			redis_remove_key(ctx, list, true);
+		}
+
+		// And our commands from the registry
+		if ((elem->name.str != NULL) &&
+			(atom_get_command_registry_str(elem->name.str, registry) != NULL))
+		{
+			redis_remove_key(ctx, registry, true);
+		}
+
 		// Clean up the name
 		if (elem->name.str != NULL) {
 			free(elem->name.str);
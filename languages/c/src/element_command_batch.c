@@ -0,0 +1,160 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_command_batch.c
+//
+//  @brief Implements the encoding for batched commands
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "atom.h"
+#include "element_command_batch.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a big-endian uint32 to the buffer
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint8_t *element_command_batch_put_u32(
+	uint8_t *buf,
+	uint32_t value)
+{
+	value = htonl(value);
+	memcpy(buf, &value, sizeof(value));
+	return buf + sizeof(value);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads a big-endian uint32 from the buffer if there's room,
+//			advancing the offset
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_batch_get_u32(
+	const uint8_t *data,
+	size_t len,
+	size_t *offset,
+	uint32_t *value)
+{
+	if ((len - *offset) < sizeof(uint32_t)) {
+		return false;
+	}
+
+	memcpy(value, data + *offset, sizeof(uint32_t));
+	*value = ntohl(*value);
+	*offset += sizeof(uint32_t);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Encodes a batch request or response
+//
+////////////////////////////////////////////////////////////////////////////////
+uint8_t *element_command_batch_encode(
+	const struct element_command_batch_item *items,
+	size_t n_items,
+	bool response,
+	size_t *len)
+{
+	uint8_t *buf;
+	uint8_t *ptr;
+	size_t total;
+	size_t i;
+
+	// Figure out how much space we need
+	total = sizeof(uint32_t);
+	for (i = 0; i < n_items; ++i) {
+		total += 2 * sizeof(uint32_t) + items[i].data_len;
+		if (!response) {
+			total += items[i].name_len;
+		}
+	}
+
+	buf = malloc(total);
+	assert(buf != NULL);
+
+	// And fill it in
+	ptr = element_command_batch_put_u32(buf, n_items);
+	for (i = 0; i < n_items; ++i) {
+		if (response) {
+			ptr = element_command_batch_put_u32(ptr, (uint32_t)items[i].err_code);
+		} else {
+			ptr = element_command_batch_put_u32(ptr, items[i].name_len);
+			memcpy(ptr, items[i].name, items[i].name_len);
+			ptr += items[i].name_len;
+		}
+
+		ptr = element_command_batch_put_u32(ptr, items[i].data_len);
+		if (items[i].data_len > 0) {
+			memcpy(ptr, items[i].data, items[i].data_len);
+			ptr += items[i].data_len;
+		}
+	}
+
+	*len = total;
+	return buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Parses a batch request or response. Names aren't NULL-terminated
+//			in the buffer, use name_len.
+//
+////////////////////////////////////////////////////////////////////////////////
+int element_command_batch_parse(
+	const uint8_t *data,
+	size_t len,
+	bool response,
+	struct element_command_batch_item *items,
+	size_t max_items)
+{
+	size_t offset = 0;
+	uint32_t n_items;
+	uint32_t value;
+	size_t i;
+
+	if ((data == NULL) ||
+		!element_command_batch_get_u32(data, len, &offset, &n_items) ||
+		(n_items > max_items))
+	{
+		return -1;
+	}
+
+	for (i = 0; i < n_items; ++i) {
+		memset(&items[i], 0, sizeof(struct element_command_batch_item));
+
+		if (!element_command_batch_get_u32(data, len, &offset, &value)) {
+			return -1;
+		}
+
+		if (response) {
+			items[i].err_code = (int32_t)value;
+		} else {
+			if ((len - offset) < value) {
+				return -1;
+			}
+			items[i].name = (const char *)(data + offset);
+			items[i].name_len = value;
+			offset += value;
+		}
+
+		if (!element_command_batch_get_u32(data, len, &offset, &value) ||
+			((len - offset) < value))
+		{
+			return -1;
+		}
+		items[i].data = data + offset;
+		items[i].data_len = value;
+		offset += value;
+	}
+
+	return n_items;
+}
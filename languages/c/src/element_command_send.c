@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <malloc.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "redis.h"
 #include "atom.h"
@@ -46,6 +47,10 @@ struct element_response_stream_data {
 struct element_command_ack_data {
 	bool found_ack;
 	int timeout;
+	int cache_ttl;
+	bool rpc;
+	bool found_upload;
+	bool upload;
 };
 
 // Data we want to obtain from the response
@@ -58,6 +63,7 @@ struct element_command_response_data {
 	int error_code;
 	char *error_str;
 	void *user_data;
+	size_t response_len;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -191,6 +197,30 @@ static bool element_command_ack_callback(
 		data->found_ack = true;
 	}
 
+	// Older elements won't send a cache TTL, which is the same as
+	//	the response not being cacheable
+	if (kv_items[ACK_KEY_CACHE_TTL].found &&
+		(kv_items[ACK_KEY_CACHE_TTL].reply->type == REDIS_REPLY_STRING))
+	{
+		data->cache_ttl = atoi(kv_items[ACK_KEY_CACHE_TTL].reply->str);
+	}
+
+	// Same for list RPC
+	if (kv_items[ACK_KEY_RPC].found &&
+		(kv_items[ACK_KEY_RPC].reply->type == REDIS_REPLY_STRING))
+	{
+		data->rpc = (atoi(kv_items[ACK_KEY_RPC].reply->str) != 0);
+	}
+
+	// Elements from before chunked requests won't say whether they'll
+	//	read the upload stream, which the sender needs to know
+	if (kv_items[ACK_KEY_UPLOAD].found &&
+		(kv_items[ACK_KEY_UPLOAD].reply->type == REDIS_REPLY_STRING))
+	{
+		data->found_upload = true;
+		data->upload = (atoi(kv_items[ACK_KEY_UPLOAD].reply->str) != 0);
+	}
+
 	return true;
 }
 
@@ -229,6 +259,9 @@ static bool element_command_response_callback(
 
 			// Note that there's no error, for now
 			data->error_code = ATOM_NO_ERROR;
+			if (kv_items[RESPONSE_KEY_DATA].found) {
+				data->response_len = kv_items[RESPONSE_KEY_DATA].reply->len;
+			}
 
 			// If there's data then we want to call the user-supplied
 			//	callback, if there is one
@@ -311,12 +344,22 @@ static void element_command_init_ack_data(
 	// Note that we haven't found the ack
 	ack_data->found_ack = false;
 
-	// And reset the timeout
+	// And reset the timeout and cache TTL
 	ack_data->timeout = 0;
+	ack_data->cache_ttl = ELEMENT_COMMAND_NO_CACHE;
+	ack_data->rpc = false;
+	ack_data->found_upload = false;
+	ack_data->upload = false;
 
 	// We also want to fill in the non-shared parts of the ack items
 	ack_items[ACK_KEY_TIMEOUT].key = ACK_KEY_TIMEOUT_STR;
 	ack_items[ACK_KEY_TIMEOUT].key_len = CONST_STRLEN(ACK_KEY_TIMEOUT_STR);
+	ack_items[ACK_KEY_CACHE_TTL].key = ACK_KEY_CACHE_TTL_STR;
+	ack_items[ACK_KEY_CACHE_TTL].key_len = CONST_STRLEN(ACK_KEY_CACHE_TTL_STR);
+	ack_items[ACK_KEY_RPC].key = ACK_KEY_RPC_STR;
+	ack_items[ACK_KEY_RPC].key_len = CONST_STRLEN(ACK_KEY_RPC_STR);
+	ack_items[ACK_KEY_UPLOAD].key = ACK_KEY_UPLOAD_STR;
+	ack_items[ACK_KEY_UPLOAD].key_len = CONST_STRLEN(ACK_KEY_UPLOAD_STR);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -348,6 +391,9 @@ static void element_command_init_response_data(
 	// Note the error string
 	response_data->error_str = NULL;
 
+	// And that we haven't gotten any data
+	response_data->response_len = 0;
+
 	// We also want to fill in the non-shared parts of the ack items
 	response_items[RESPONSE_KEY_CMD].key = RESPONSE_KEY_CMD_STR;
 	response_items[RESPONSE_KEY_CMD].key_len = CONST_STRLEN(RESPONSE_KEY_CMD_STR);
@@ -359,6 +405,42 @@ static void element_command_init_response_data(
 	response_items[RESPONSE_KEY_DATA].key_len = CONST_STRLEN(RESPONSE_KEY_DATA_STR);
 }
 
+// Sends a command, optionally with chunked request data
+static enum atom_error_t element_command_send_internal(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	const char *upload_stream,
+	bool (*chunk_cb)(
+		const uint8_t **chunk,
+		size_t *chunk_len,
+		bool *last,
+		void *user_data),
+	void *chunk_user_data,
+	bool block,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str,
+	struct element_command_ack_info *ack_info);
+
+// Uploads the data for a chunked command
+static enum atom_error_t element_command_upload(
+	redisContext *ctx,
+	struct element *elem,
+	const char *upload_stream,
+	bool (*chunk_cb)(
+		const uint8_t **chunk,
+		size_t *chunk_len,
+		bool *last,
+		void *user_data),
+	void *chunk_user_data);
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Sends a command to another element. If block=TRUE
@@ -381,10 +463,276 @@ enum atom_error_t element_command_send(
 		void *user_data),
 	void *user_data,
 	char **error_str)
+{
+	return element_command_send_cacheable(
+		ctx,
+		elem,
+		cmd_elem,
+		cmd,
+		data,
+		data_len,
+		block,
+		response_cb,
+		user_data,
+		error_str,
+		NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element and notes how long the
+//			element said the response can be cached for
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_cacheable(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str,
+	int *cache_ttl)
+{
+	struct element_command_ack_info ack_info;
+	enum atom_error_t ret;
+
+	ret = element_command_send_negotiate(
+		ctx,
+		elem,
+		cmd_elem,
+		cmd,
+		data,
+		data_len,
+		block,
+		response_cb,
+		user_data,
+		error_str,
+		&ack_info);
+
+	if (cache_ttl != NULL) {
+		*cache_ttl = ack_info.cache_ttl;
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element and notes what the element
+//			told us about the command in its ACK
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_negotiate(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str,
+	struct element_command_ack_info *ack_info)
+{
+	return element_command_send_internal(
+		ctx,
+		elem,
+		cmd_elem,
+		cmd,
+		data,
+		data_len,
+		NULL,
+		NULL,
+		NULL,
+		block,
+		response_cb,
+		user_data,
+		error_str,
+		ack_info);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command with its request data in chunks
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_chunked(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	bool (*chunk_cb)(
+		const uint8_t **chunk,
+		size_t *chunk_len,
+		bool *last,
+		void *user_data),
+	void *chunk_user_data,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str)
+{
+	static unsigned long upload_count = 0;
+	char upload_stream[ATOM_NAME_MAXLEN];
+	enum atom_error_t ret;
+
+	// Upload stream needs to be unique to the call
+	if (snprintf(upload_stream, sizeof(upload_stream),
+		ATOM_UPLOAD_STREAM_PREFIX "%s:%s:%d:%lu", cmd_elem, elem->name.str,
+		getpid(), __sync_fetch_and_add(&upload_count, 1)) >=
+			(int)sizeof(upload_stream))
+	{
+		atom_logf(NULL, elem, LOG_ERR, "Stream name too long!");
+		if (error_str != NULL) {
+			*error_str = NULL;
+		}
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	ret = element_command_send_internal(
+		ctx,
+		elem,
+		cmd_elem,
+		cmd,
+		NULL,
+		0,
+		upload_stream,
+		chunk_cb,
+		chunk_user_data,
+		true,
+		response_cb,
+		user_data,
+		error_str,
+		NULL);
+
+	// We're the last ones to use the upload stream, whether or not the
+	//	element got around to reading it
+	redis_remove_key(ctx, upload_stream, true);
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Uploads the request data for a chunked command, chunk by chunk.
+//			If we fail to get a chunk then we still send a last chunk,
+//			marked as aborted, s.t. the element isn't left waiting.
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t element_command_upload(
+	redisContext *ctx,
+	struct element *elem,
+	const char *upload_stream,
+	bool (*chunk_cb)(
+		const uint8_t **chunk,
+		size_t *chunk_len,
+		bool *last,
+		void *user_data),
+	void *chunk_user_data)
+{
+	struct redis_xadd_info chunk_data[UPLOAD_N_KEYS];
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	const uint8_t *chunk;
+	size_t chunk_len;
+	size_t n_items;
+	bool last = false;
+
+	chunk_data[UPLOAD_KEY_DATA].key = UPLOAD_KEY_DATA_STR;
+	chunk_data[UPLOAD_KEY_DATA].key_len = CONST_STRLEN(UPLOAD_KEY_DATA_STR);
+	chunk_data[UPLOAD_KEY_LAST].key = UPLOAD_KEY_LAST_STR;
+	chunk_data[UPLOAD_KEY_LAST].key_len = CONST_STRLEN(UPLOAD_KEY_LAST_STR);
+	chunk_data[UPLOAD_KEY_LAST].data = (const uint8_t *)"1";
+	chunk_data[UPLOAD_KEY_LAST].data_len = 1;
+	chunk_data[UPLOAD_KEY_ABORT].key = UPLOAD_KEY_ABORT_STR;
+	chunk_data[UPLOAD_KEY_ABORT].key_len = CONST_STRLEN(UPLOAD_KEY_ABORT_STR);
+	chunk_data[UPLOAD_KEY_ABORT].data = (const uint8_t *)"1";
+	chunk_data[UPLOAD_KEY_ABORT].data_len = 1;
+
+	while (!last) {
+		chunk = NULL;
+		chunk_len = 0;
+
+		if (!chunk_cb(&chunk, &chunk_len, &last, chunk_user_data)) {
+			atom_logf(NULL, elem, LOG_ERR, "Failed to get chunk, aborting");
+			ret = ATOM_CALLBACK_FAILED;
+			last = true;
+			chunk = NULL;
+			chunk_len = 0;
+		}
+
+		chunk_data[UPLOAD_KEY_DATA].data = chunk;
+		chunk_data[UPLOAD_KEY_DATA].data_len = chunk_len;
+
+		// Only the last chunk has the last key, and the abort key if
+		//	we're giving up
+		if (!last) {
+			n_items = UPLOAD_KEY_LAST;
+		} else if (ret == ATOM_NO_ERROR) {
+			n_items = UPLOAD_KEY_ABORT;
+		} else {
+			n_items = UPLOAD_N_KEYS;
+		}
+
+		// The element deletes nothing until it has it all, so no trimming
+		if (!redis_xadd(ctx, upload_stream, chunk_data, n_items,
+			REDIS_XADD_NO_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN, NULL))
+		{
+			atom_logf(ctx, elem, LOG_ERR, "Failed to XADD chunk");
+			return ATOM_REDIS_ERROR;
+		}
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element. If upload_stream is non-NULL
+//			then the request data comes from the chunk callback and is
+//			uploaded on that stream once the element has ACKed.
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t element_command_send_internal(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	const char *upload_stream,
+	bool (*chunk_cb)(
+		const uint8_t **chunk,
+		size_t *chunk_len,
+		bool *last,
+		void *user_data),
+	void *chunk_user_data,
+	bool block,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str,
+	struct element_command_ack_info *ack_info)
 {
 	int ret;
+	enum atom_error_t upload_ret;
+	size_t n_cmd_items;
 	struct redis_stream_info stream_info;
-	struct redis_xadd_info cmd_data[CMD_N_KEYS];
+	struct redis_xadd_info cmd_data[CMD_N_OPTIONAL_KEYS];
 	char cmd_elem_stream[ATOM_NAME_MAXLEN];
 	char cmd_id[STREAM_ID_BUFFLEN];
 
@@ -396,22 +744,46 @@ enum atom_error_t element_command_send(
 	struct element_command_response_data response_data;
 	struct redis_xread_kv_item response_items[RESPONSE_N_KEYS];
 
-	// Initialize the error code and error string
+	uint64_t slow_op_start = 0;
+	uint64_t slow_op_split = 0;
+
+	if (element_slow_op_on) {
+		slow_op_start = element_slow_op_now_us();
+	}
+
+	// Initialize the error code, error string and ACK info
 	ret = ATOM_INTERNAL_ERROR;
+	upload_ret = ATOM_NO_ERROR;
+	response_data.response_len = 0;
 	if (error_str != NULL) {
 		*error_str = NULL;
 	}
+	if (ack_info != NULL) {
+		ack_info->timeout = 0;
+		ack_info->cache_ttl = ELEMENT_COMMAND_NO_CACHE;
+		ack_info->rpc = false;
+	}
 
 	// Want to set up the data for the command
 	element_command_init_data(
 		cmd_data, elem->name.str, elem->name.len, cmd, data, data_len);
+	n_cmd_items = CMD_N_KEYS;
+
+	// And let the element know where to find the data if it's chunked
+	if (upload_stream != NULL) {
+		cmd_data[CMD_KEY_UPLOAD].key = COMMAND_KEY_UPLOAD_STR;
+		cmd_data[CMD_KEY_UPLOAD].key_len = CONST_STRLEN(COMMAND_KEY_UPLOAD_STR);
+		cmd_data[CMD_KEY_UPLOAD].data = (const uint8_t *)upload_stream;
+		cmd_data[CMD_KEY_UPLOAD].data_len = strlen(upload_stream);
+		n_cmd_items = CMD_N_OPTIONAL_KEYS;
+	}
 
 	// Get the name of the element stream we want to write to
 	atom_get_command_stream_str(cmd_elem, cmd_elem_stream);
 
 	// Now, call the XADD to send the data over to the element. We want to
 	//	note the command ID since we'll expect it back in the ACK and response
-	if (!redis_xadd(ctx, cmd_elem_stream, cmd_data, CMD_N_KEYS,
+	if (!redis_xadd(ctx, cmd_elem_stream, cmd_data, n_cmd_items,
 		ELEMENT_COMMAND_STREAM_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN, cmd_id))
 	{
 		atom_logf(ctx, elem, LOG_ERR, "Failed to XADD command data to stream");
@@ -445,6 +817,40 @@ enum atom_error_t element_command_send(
 		}
 	}
 
+	// Note what the element told us about the command. The cache TTL
+	//	only counts once we've gotten a good response.
+	if (ack_info != NULL) {
+		ack_info->timeout = ack_data.timeout;
+		ack_info->rpc = ack_data.rpc;
+	}
+
+	if (slow_op_start != 0) {
+		slow_op_split = element_slow_op_now_us();
+	}
+
+	// An element that predates chunked requests ignores the upload key
+	//	and runs the command without any data, so there's no point in
+	//	uploading or waiting on its response
+	if ((upload_stream != NULL) && !ack_data.found_upload) {
+		atom_logf(ctx, elem, LOG_ERR,
+			"Element %s doesn't support chunked requests", cmd_elem);
+		ret = ATOM_COMMAND_UNSUPPORTED;
+		goto done;
+	}
+
+	// Upload the data for a chunked command. The element works on each
+	//	chunk as it comes in, and the response timeout starts once it
+	//	has the last one. If it won't take the upload for this command
+	//	then its response tells us why.
+	if ((upload_stream != NULL) && ack_data.upload) {
+		upload_ret = element_command_upload(
+			ctx, elem, upload_stream, chunk_cb, chunk_user_data);
+		if (upload_ret == ATOM_REDIS_ERROR) {
+			ret = upload_ret;
+			goto done;
+		}
+	}
+
 	// Now, if we're not blocking then we're all done! We can just return
 	//	out noting the success. Else we need to again do an XREAD on the
 	//	stream and pass the data along to the command handler.
@@ -482,7 +888,173 @@ enum atom_error_t element_command_send(
 	}
 
 	// If we got here then we got the response. We can set our status
-	//	to that returned by the response
+	//	to that returned by the response, unless we gave up on the upload
+	ret = (upload_ret != ATOM_NO_ERROR) ?
+		upload_ret : response_data.error_code;
+	if ((ack_info != NULL) && (ret == ATOM_NO_ERROR)) {
+		ack_info->cache_ttl = ack_data.cache_ttl;
+	}
+	if (response_data.error_str != NULL) {
+		if (error_str != NULL) {
+			*error_str = response_data.error_str;
+		} else {
+			free(response_data.error_str);
+		}
+	}
+
+done:
+	element_slow_op_finish(ELEMENT_SLOW_OP_COMMAND_SEND, cmd, slow_op_start,
+		slow_op_split, data_len, response_data.response_len);
+	return ret;
+}
+
+// Data we want to obtain from a list RPC response
+struct element_command_rpc_response_data {
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data);
+	void *user_data;
+	int error_code;
+	char *error_str;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for when we pop the response to a list RPC. It's a
+//			single item batch response.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_rpc_response_callback(
+	const uint8_t *response,
+	size_t response_len,
+	void *user_data)
+{
+	struct element_command_rpc_response_data *data;
+	struct element_command_batch_item item;
+
+	data = (struct element_command_rpc_response_data *)user_data;
+
+	if (element_command_batch_parse(
+		response, response_len, true, &item, 1) != 1)
+	{
+		atom_logf(NULL, NULL, LOG_ERR, "Invalid RPC response!");
+		data->error_code = ATOM_COMMAND_INVALID_DATA;
+		return true;
+	}
+
+	data->error_code = item.err_code;
+	if (item.err_code == ATOM_NO_ERROR) {
+		if ((data->response_cb != NULL) &&
+			!data->response_cb(item.data, item.data_len, data->user_data))
+		{
+			data->error_code = ATOM_CALLBACK_FAILED;
+		}
+	} else if (item.data_len > 0) {
+		data->error_str = strndup((const char *)item.data, item.data_len);
+		assert(data->error_str != NULL);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command using list RPC. Pushes the request onto the
+//			element's command list and waits on a key of our own for the
+//			response, in a single round trip.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_rpc(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	int timeout,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str)
+{
+	static unsigned long call_count = 0;
+	struct element_command_batch_item items[2];
+	struct element_command_rpc_response_data response_data;
+	char list[ATOM_NAME_MAXLEN];
+	char reply_key[ATOM_NAME_MAXLEN];
+	char ttl_str[16];
+	int reply_key_len;
+	int ttl_len;
+	uint8_t *request;
+	size_t request_len;
+	bool popped;
+	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+
+	if (error_str != NULL) {
+		*error_str = NULL;
+	}
+
+	if (atom_get_command_list_str(cmd_elem, list) == NULL) {
+		goto done;
+	}
+
+	// Key for the response needs to be unique to the call
+	reply_key_len = snprintf(reply_key, sizeof(reply_key),
+		ATOM_COMMAND_REPLY_PREFIX "%s:%d:%lu", elem->name.str, getpid(),
+		__sync_fetch_and_add(&call_count, 1));
+	if (reply_key_len >= (int)sizeof(reply_key)) {
+		atom_logf(NULL, elem, LOG_ERR, "Key name too long!");
+		goto done;
+	}
+	ttl_len = snprintf(ttl_str, sizeof(ttl_str), "%d",
+		timeout + ELEMENT_COMMAND_RPC_REPLY_TTL_MARGIN_MS);
+
+	// Request is the key to respond on with its TTL and then the command
+	memset(items, 0, sizeof(items));
+	items[0].name = reply_key;
+	items[0].name_len = reply_key_len;
+	items[0].data = (const uint8_t *)ttl_str;
+	items[0].data_len = ttl_len;
+	items[1].name = cmd;
+	items[1].name_len = strlen(cmd);
+	items[1].data = data;
+	items[1].data_len = data_len;
+
+	request = element_command_batch_encode(items, 2, false, &request_len);
+	if (request == NULL) {
+		goto done;
+	}
+
+	response_data.response_cb = response_cb;
+	response_data.user_data = user_data;
+	response_data.error_code = ATOM_INTERNAL_ERROR;
+	response_data.error_str = NULL;
+
+	if (!redis_list_push_pop(
+		ctx,
+		list,
+		request,
+		request_len,
+		reply_key,
+		timeout,
+		element_command_rpc_response_callback,
+		&response_data,
+		&popped))
+	{
+		atom_logf(ctx, elem, LOG_ERR, "Failed to send RPC");
+		ret = ATOM_REDIS_ERROR;
+		goto free_request;
+	}
+
+	if (!popped) {
+		atom_logf(ctx, elem, LOG_ERR, "Failed to get RPC response");
+		ret = ATOM_COMMAND_NO_RESPONSE;
+		goto free_request;
+	}
+
 	ret = response_data.error_code;
 	if (response_data.error_str != NULL) {
 		if (error_str != NULL) {
@@ -492,6 +1064,8 @@ enum atom_error_t element_command_send(
 		}
 	}
 
+free_request:
+	free(request);
 done:
 	return ret;
 }
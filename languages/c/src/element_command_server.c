@@ -19,12 +19,19 @@
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
+#include "atom_probes.h"
 
 // This value is returned to the caller when the command they
 //	request is not supported. It tells them how long to wait for our
 //	error response
 #define ELEMENT_NO_COMMAND_TIMEOUT_MS 1000
 
+// Stand-in command for batches s.t. the response goes out with the
+//	batch command name like any other
+static struct element_command element_command_batch_info = {
+	.name = (char *)ELEMENT_COMMAND_BATCH_STR,
+};
+
 // Struct of user data for when we get a callback on the element command
 //	stream
 struct element_command_cb_data {
@@ -87,6 +94,151 @@ static struct element_command *element_command_get(
 	return cmd;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Looks up a command in a batch. The name isn't NULL-terminated
+//			in the batch so needs to be copied out first.
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct element_command *element_command_batch_get(
+	struct element *elem,
+	const struct element_command_batch_item *item)
+{
+	char name[ATOM_NAME_MAXLEN];
+
+	if (item->name_len >= sizeof(name)) {
+		return NULL;
+	}
+
+	memcpy(name, item->name, item->name_len);
+	name[item->name_len] = '\0';
+
+	return element_command_get(elem, name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the timeout for a batch, which is the sum of the
+//			timeouts of the commands in it since they're run one at
+//			a time
+//
+////////////////////////////////////////////////////////////////////////////////
+static int element_command_batch_timeout(
+	struct element *elem,
+	const uint8_t *data,
+	size_t data_len)
+{
+	struct element_command_batch_item items[ELEMENT_COMMAND_BATCH_MAX_ITEMS];
+	struct element_command *cmd;
+	int n_items;
+	int timeout = 0;
+	int i;
+
+	n_items = element_command_batch_parse(
+		data, data_len, false, items, ELEMENT_COMMAND_BATCH_MAX_ITEMS);
+	if (n_items < 0) {
+		return ELEMENT_NO_COMMAND_TIMEOUT_MS;
+	}
+
+	for (i = 0; i < n_items; ++i) {
+		cmd = element_command_batch_get(elem, &items[i]);
+		if (cmd != NULL) {
+			timeout += cmd->timeout;
+		}
+	}
+
+	return (timeout > 0) ? timeout : ELEMENT_NO_COMMAND_TIMEOUT_MS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs each of the commands in a batch and encodes their results
+//			into a single batch response. Returns the error for the batch
+//			as a whole, the errors for each command are in the response.
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t element_command_run_batch(
+	struct element *elem,
+	const uint8_t *data,
+	size_t data_len,
+	uint8_t **batch_response,
+	size_t *batch_response_len,
+	char **batch_error_str)
+{
+	struct element_command_batch_item items[ELEMENT_COMMAND_BATCH_MAX_ITEMS];
+	struct element_command *cmds[ELEMENT_COMMAND_BATCH_MAX_ITEMS];
+	uint8_t *responses[ELEMENT_COMMAND_BATCH_MAX_ITEMS];
+	char *error_strs[ELEMENT_COMMAND_BATCH_MAX_ITEMS];
+	void *cleanup_ptrs[ELEMENT_COMMAND_BATCH_MAX_ITEMS];
+	size_t response_len;
+	int n_items;
+	int ret;
+	int i;
+
+	n_items = element_command_batch_parse(
+		data, data_len, false, items, ELEMENT_COMMAND_BATCH_MAX_ITEMS);
+	if (n_items < 0) {
+		atom_logf(elem->command.ctx, elem, LOG_ERR, "Invalid batch!");
+		*batch_error_str = strdup("Invalid batch");
+		return ATOM_COMMAND_INVALID_DATA;
+	}
+
+	// Run each of the commands in turn, holding onto the results until
+	//	they've been encoded
+	for (i = 0; i < n_items; ++i) {
+		responses[i] = NULL;
+		error_strs[i] = NULL;
+		cleanup_ptrs[i] = NULL;
+		response_len = 0;
+
+		cmds[i] = element_command_batch_get(elem, &items[i]);
+		if (cmds[i] == NULL) {
+			items[i].err_code = ATOM_COMMAND_UNSUPPORTED;
+			items[i].data = NULL;
+			items[i].data_len = 0;
+			continue;
+		}
+
+		ret = cmds[i]->cb(
+			(uint8_t *)items[i].data,
+			items[i].data_len,
+			&responses[i],
+			&response_len,
+			&error_strs[i],
+			cmds[i]->user_data,
+			&cleanup_ptrs[i]);
+
+		// Send back the error string on an error, else the response
+		if (ret != 0) {
+			items[i].err_code = ATOM_USER_ERRORS_BEGIN + ret;
+			items[i].data = (uint8_t *)error_strs[i];
+			items[i].data_len = (error_strs[i] != NULL) ?
+				strlen(error_strs[i]) : 0;
+		} else {
+			items[i].err_code = ATOM_NO_ERROR;
+			items[i].data = responses[i];
+			items[i].data_len = (responses[i] != NULL) ? response_len : 0;
+		}
+	}
+
+	*batch_response = element_command_batch_encode(
+		items, n_items, true, batch_response_len);
+
+	// And now that it's encoded we can clean up after each command
+	for (i = 0; i < n_items; ++i) {
+		if (cleanup_ptrs[i] != NULL) {
+			if (cmds[i]->cleanup != NULL) {
+				cmds[i]->cleanup(cleanup_ptrs[i]);
+			}
+		} else {
+			free(responses[i]);
+			free(error_strs[i]);
+		}
+	}
+
+	return ATOM_NO_ERROR;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Initializes the shared aspects of the element command data
@@ -124,12 +276,17 @@ static bool element_command_send_ack(
 	struct element *elem,
 	const char *id,
 	const char *req_elem,
-	int timeout)
+	int timeout,
+	int cache_ttl,
+	bool rpc,
+	bool upload)
 {
 	struct redis_xadd_info ack_info[ACK_N_KEYS];
 	bool ret_val = false;
 	char timeout_buffer[32];
 	size_t timeout_len;
+	char cache_ttl_buffer[32];
+	size_t cache_ttl_len;
 	char req_elem_stream[ATOM_NAME_MAXLEN];
 
 	// Need to set up the XADD info to send back
@@ -144,6 +301,26 @@ static bool element_command_send_ack(
 	ack_info[ACK_KEY_TIMEOUT].data = (uint8_t*)timeout_buffer;
 	ack_info[ACK_KEY_TIMEOUT].data_len = timeout_len;
 
+	// And let the caller know how long they can cache the response for
+	ack_info[ACK_KEY_CACHE_TTL].key = ACK_KEY_CACHE_TTL_STR;
+	ack_info[ACK_KEY_CACHE_TTL].key_len = CONST_STRLEN(ACK_KEY_CACHE_TTL_STR);
+	cache_ttl_len = snprintf(
+		cache_ttl_buffer, sizeof(cache_ttl_buffer), "%d", cache_ttl);
+	ack_info[ACK_KEY_CACHE_TTL].data = (uint8_t*)cache_ttl_buffer;
+	ack_info[ACK_KEY_CACHE_TTL].data_len = cache_ttl_len;
+
+	// And whether they can use list RPC for the command from now on
+	ack_info[ACK_KEY_RPC].key = ACK_KEY_RPC_STR;
+	ack_info[ACK_KEY_RPC].key_len = CONST_STRLEN(ACK_KEY_RPC_STR);
+	ack_info[ACK_KEY_RPC].data = (uint8_t*)(rpc ? "1" : "0");
+	ack_info[ACK_KEY_RPC].data_len = 1;
+
+	// And whether we'll read the request data off of its upload stream
+	ack_info[ACK_KEY_UPLOAD].key = ACK_KEY_UPLOAD_STR;
+	ack_info[ACK_KEY_UPLOAD].key_len = CONST_STRLEN(ACK_KEY_UPLOAD_STR);
+	ack_info[ACK_KEY_UPLOAD].data = (uint8_t*)(upload ? "1" : "0");
+	ack_info[ACK_KEY_UPLOAD].data_len = 1;
+
 	// And want to call the XADD to send the info back to the caller
 	if (!redis_xadd(
 		ctx, req_elem_stream, ack_info, ACK_N_KEYS,
@@ -242,6 +419,173 @@ done:
 	return ret_val;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Calls the user callback for a command. Errors from the user are
+//			put atop the internal element errors.
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t element_command_run(
+	struct element_command *cmd,
+	uint8_t *data,
+	size_t data_len,
+	uint8_t **response,
+	size_t *response_len,
+	char **error_str,
+	void **cleanup_ptr)
+{
+	int ret;
+
+	// Initialize the response
+	*response = NULL;
+	*response_len = 0;
+	*error_str = NULL;
+
+	ret = cmd->cb(
+		data,
+		data_len,
+		response,
+		response_len,
+		error_str,
+		cmd->user_data,
+		cleanup_ptr);
+
+	return (ret != 0) ? (ATOM_USER_ERRORS_BEGIN + ret) : ATOM_NO_ERROR;
+}
+
+// Struct of user data for when we get a chunk on an upload stream
+struct element_command_upload_data {
+	struct element *elem;
+	struct element_command *cmd;
+	struct redis_xread_kv_item kv_items[UPLOAD_N_KEYS];
+	size_t n_chunks;
+	bool done;
+	enum atom_error_t err_code;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for each chunk on an upload stream. Once the command
+//			fails we keep reading s.t. we know when the last chunk is in,
+//			but stop passing chunks along.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_upload_cb(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	struct element_command_upload_data *data;
+	int ret;
+
+	data = (struct element_command_upload_data *)user_data;
+
+	if (data->done) {
+		return true;
+	}
+
+	if (!redis_xread_parse_kv(reply, data->kv_items, UPLOAD_N_KEYS)) {
+		atom_logf(NULL, data->elem, LOG_ERR, "Failed to parse chunk!");
+		data->err_code = ATOM_COMMAND_INVALID_DATA;
+		return false;
+	}
+
+	if ((data->err_code == ATOM_NO_ERROR) &&
+		data->kv_items[UPLOAD_KEY_DATA].found &&
+		(data->kv_items[UPLOAD_KEY_DATA].reply->len > 0))
+	{
+		ret = data->cmd->chunk_cb(
+			(const uint8_t *)data->kv_items[UPLOAD_KEY_DATA].reply->str,
+			data->kv_items[UPLOAD_KEY_DATA].reply->len,
+			data->cmd->user_data);
+		data->n_chunks++;
+		if (ret != 0) {
+			data->err_code = ATOM_USER_ERRORS_BEGIN + ret;
+		}
+	}
+
+	if (data->kv_items[UPLOAD_KEY_LAST].found) {
+		data->done = true;
+		if (data->kv_items[UPLOAD_KEY_ABORT].found &&
+			(data->err_code == ATOM_NO_ERROR))
+		{
+			atom_logf(NULL, data->elem, LOG_ERR, "Upload aborted by caller");
+			data->err_code = ATOM_COMMAND_INVALID_DATA;
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads a chunked request off of its upload stream, passing each
+//			chunk to the command as it comes in. The caller cleans up the
+//			upload stream once it has the response.
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t element_command_receive_upload(
+	struct element *elem,
+	struct element_command *cmd,
+	const char *upload_stream)
+{
+	struct element_command_upload_data upload;
+	struct redis_stream_info stream_info;
+
+	if (cmd->chunk_cb == NULL) {
+		atom_logf(elem->command.ctx, elem, LOG_ERR,
+			"Command %s doesn't take chunked requests!", cmd->name);
+		return ATOM_COMMAND_UNSUPPORTED;
+	}
+
+	upload.elem = elem;
+	upload.cmd = cmd;
+	upload.n_chunks = 0;
+	upload.done = false;
+	upload.err_code = ATOM_NO_ERROR;
+	upload.kv_items[UPLOAD_KEY_DATA].key = UPLOAD_KEY_DATA_STR;
+	upload.kv_items[UPLOAD_KEY_DATA].key_len = CONST_STRLEN(UPLOAD_KEY_DATA_STR);
+	upload.kv_items[UPLOAD_KEY_LAST].key = UPLOAD_KEY_LAST_STR;
+	upload.kv_items[UPLOAD_KEY_LAST].key_len = CONST_STRLEN(UPLOAD_KEY_LAST_STR);
+	upload.kv_items[UPLOAD_KEY_ABORT].key = UPLOAD_KEY_ABORT_STR;
+	upload.kv_items[UPLOAD_KEY_ABORT].key_len = CONST_STRLEN(UPLOAD_KEY_ABORT_STR);
+
+	// Read the upload from the beginning since the caller may have
+	//	started on it before we got here
+	if (!redis_init_stream_info(
+		NULL,
+		&stream_info,
+		upload_stream,
+		element_command_upload_cb,
+		"0",
+		&upload))
+	{
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	while (!upload.done) {
+		if (!redis_xread(
+			elem->command.ctx,
+			&stream_info,
+			1,
+			cmd->timeout,
+			REDIS_XREAD_NOMAXCOUNT))
+		{
+			atom_logf(elem->command.ctx, elem, LOG_ERR,
+				"Timed out waiting for chunk");
+			upload.err_code = ATOM_COMMAND_INVALID_DATA;
+			break;
+		}
+	}
+
+	// Let the command know that it won't be getting the rest
+	if ((upload.err_code != ATOM_NO_ERROR) && (upload.n_chunks > 0)) {
+		cmd->chunk_cb(NULL, 0, cmd->user_data);
+	}
+
+	return upload.err_code;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Element callback from XREAD for when we get a command. Will check
@@ -258,11 +602,14 @@ static bool element_cmd_rep_xread_cb(
 	bool ret_val = false;
 	struct element_command_cb_data *data;
 	struct element_command *cmd;
-	int ret, timeout;
+	int timeout;
 	uint8_t *response = NULL;
 	size_t response_len = 0;
 	char *error_str = NULL;
 	void *cleanup_ptr = NULL;
+	bool batch;
+	uint64_t slow_op_start = 0;
+	uint64_t slow_op_split = 0;
 
 	// Want to cast the user data to our expected data struct
 	data = (struct element_command_cb_data *)user_data;
@@ -288,6 +635,12 @@ static bool element_cmd_rep_xread_cb(
 		goto done;
 	}
 
+	ATOM_PROBE2(command_received,
+		data->kv_items[CMD_KEY_CMD].found ?
+			data->kv_items[CMD_KEY_CMD].reply->str : NULL,
+		data->kv_items[CMD_KEY_DATA].found ?
+			data->kv_items[CMD_KEY_DATA].reply->len : 0);
+
 	// Want to try to get the command s.t. we can get the timeout
 	//	length to send back to the caller in the ACK
 	cmd = data->kv_items[CMD_KEY_CMD].found ?
@@ -296,6 +649,20 @@ static bool element_cmd_rep_xread_cb(
 		NULL;
 	timeout = (cmd != NULL) ? cmd->timeout : ELEMENT_NO_COMMAND_TIMEOUT_MS;
 
+	// Batches are handled by us rather than by a user command
+	batch = (cmd == NULL) && data->kv_items[CMD_KEY_CMD].found &&
+		!strcmp(data->kv_items[CMD_KEY_CMD].reply->str,
+			ELEMENT_COMMAND_BATCH_STR);
+	if (batch) {
+		cmd = &element_command_batch_info;
+		timeout = element_command_batch_timeout(
+			data->elem,
+			data->kv_items[CMD_KEY_DATA].found ?
+				(uint8_t*)data->kv_items[CMD_KEY_DATA].reply->str : NULL,
+			data->kv_items[CMD_KEY_DATA].found ?
+				data->kv_items[CMD_KEY_DATA].reply->len : 0);
+	}
+
 	// At this point we know that we got a message and have a caller
 	//	to respond back to, so we need to send an ACK
 	if (!element_command_send_ack(
@@ -303,12 +670,24 @@ static bool element_cmd_rep_xread_cb(
 		data->elem,
 		id,
 		data->kv_items[CMD_KEY_ELEMENT].reply->str,
-		timeout))
+		timeout,
+		(cmd != NULL) ? cmd->cache_ttl : ELEMENT_COMMAND_NO_CACHE,
+		(cmd != NULL) && cmd->rpc,
+		!batch && (cmd != NULL) && (cmd->chunk_cb != NULL) &&
+			data->kv_items[CMD_KEY_UPLOAD].found))
 	{
 		atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
 			"Failed to send ACK to caller");
 		goto done;
 	}
+	ATOM_PROBE2(command_acked,
+		data->kv_items[CMD_KEY_CMD].found ?
+			data->kv_items[CMD_KEY_CMD].reply->str : NULL,
+		timeout);
+
+	if (element_slow_op_on) {
+		slow_op_start = element_slow_op_now_us();
+	}
 
 	// Now, if we're missing the command it's either because the user
 	//	didn't supply one or we don't support the requested command.
@@ -324,15 +703,41 @@ static bool element_cmd_rep_xread_cb(
 			data->err_code = ATOM_COMMAND_INVALID_DATA;
 		}
 
-	// Otherwise we want to try to call the user callback for the command
-	} else {
+	// Run all of the commands in a batch
+	} else if (batch) {
+		data->err_code = element_command_run_batch(
+			data->elem,
+			data->kv_items[CMD_KEY_DATA].found ?
+				(uint8_t*)data->kv_items[CMD_KEY_DATA].reply->str : NULL,
+			data->kv_items[CMD_KEY_DATA].found ?
+				data->kv_items[CMD_KEY_DATA].reply->len : 0,
+			&response,
+			&response_len,
+			&error_str);
 
-		// Initialize the response
-		response = NULL;
-		response_len = 0;
-		error_str = NULL;
+	// Chunked requests get their data off of the upload stream as it
+	//	comes in and then the command is run with no data
+	} else if (data->kv_items[CMD_KEY_UPLOAD].found) {
+		data->err_code = element_command_receive_upload(
+			data->elem,
+			cmd,
+			data->kv_items[CMD_KEY_UPLOAD].reply->str);
 
-		ret = cmd->cb(
+		if (data->err_code == ATOM_NO_ERROR) {
+			data->err_code = element_command_run(
+				cmd,
+				NULL,
+				0,
+				&response,
+				&response_len,
+				&error_str,
+				&cleanup_ptr);
+		}
+
+	// Otherwise we want to try to call the user callback for the command
+	} else {
+		data->err_code = element_command_run(
+			cmd,
 			data->kv_items[CMD_KEY_DATA].found ?
 				(uint8_t*)data->kv_items[CMD_KEY_DATA].reply->str : NULL,
 			data->kv_items[CMD_KEY_DATA].found ?
@@ -340,16 +745,16 @@ static bool element_cmd_rep_xread_cb(
 			&response,
 			&response_len,
 			&error_str,
-			cmd->user_data,
 			&cleanup_ptr);
+	}
 
-		// If the return is an error, we want to append it atop the internal
-		//	element errors
-		if (ret != 0) {
-			data->err_code = ATOM_USER_ERRORS_BEGIN + ret;
-		} else {
-			data->err_code = ATOM_NO_ERROR;
-		}
+	ATOM_PROBE2(command_handled,
+		data->kv_items[CMD_KEY_CMD].found ?
+			data->kv_items[CMD_KEY_CMD].reply->str : NULL,
+		data->err_code);
+
+	if (slow_op_start != 0) {
+		slow_op_split = element_slow_op_now_us();
 	}
 
 	// Now we want to send the response out to the caller
@@ -368,11 +773,27 @@ static bool element_cmd_rep_xread_cb(
 			"Failed to send response to caller");
 		goto done;
 	}
+	ATOM_PROBE2(command_responded,
+		data->kv_items[CMD_KEY_CMD].found ?
+			data->kv_items[CMD_KEY_CMD].reply->str : NULL,
+		response_len);
 
 	// Note the success
 	ret_val = true;
 
 done:
+	// Slow ops that failed are still slow. We only start timing once the
+	//	request has parsed, so the items are good if we did.
+	if (slow_op_start != 0) {
+		element_slow_op_finish(ELEMENT_SLOW_OP_COMMAND_HANDLE,
+			data->kv_items[CMD_KEY_CMD].found ?
+				data->kv_items[CMD_KEY_CMD].reply->str : NULL,
+			slow_op_start, slow_op_split,
+			data->kv_items[CMD_KEY_DATA].found ?
+				data->kv_items[CMD_KEY_DATA].reply->len : 0,
+			response_len);
+	}
+
 	if (cleanup_ptr != NULL) {
 		if (cmd->cleanup != NULL) {
 			cmd->cleanup(cleanup_ptr);
@@ -409,7 +830,7 @@ enum atom_error_t element_command_loop(
 {
 	struct redis_stream_info stream_info;
 	struct element_command_cb_data cmd_data;
-	struct redis_xread_kv_item cmd_kv_items[CMD_N_KEYS];
+	struct redis_xread_kv_item cmd_kv_items[CMD_N_OPTIONAL_KEYS];
 	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
 
 	// Set up the kv items
@@ -419,11 +840,13 @@ enum atom_error_t element_command_loop(
 	cmd_kv_items[CMD_KEY_CMD].key_len = CONST_STRLEN(COMMAND_KEY_COMMAND_STR);
 	cmd_kv_items[CMD_KEY_DATA].key = COMMAND_KEY_DATA_STR;
 	cmd_kv_items[CMD_KEY_DATA].key_len = CONST_STRLEN(COMMAND_KEY_DATA_STR);
+	cmd_kv_items[CMD_KEY_UPLOAD].key = COMMAND_KEY_UPLOAD_STR;
+	cmd_kv_items[CMD_KEY_UPLOAD].key_len = CONST_STRLEN(COMMAND_KEY_UPLOAD_STR);
 
 	// Set up the command data
 	cmd_data.elem = elem;
 	cmd_data.kv_items = cmd_kv_items;
-	cmd_data.n_kv_items = CMD_N_KEYS;
+	cmd_data.n_kv_items = CMD_N_OPTIONAL_KEYS;
 	cmd_data.err_code = ATOM_INTERNAL_ERROR;
 
 	// Want to set up the XREAD. Should be a pretty straightforward
@@ -469,6 +892,271 @@ done:
 	return ret;
 }
 
+// Struct of user data for when we pop a list RPC request
+struct element_command_rpc_data {
+	redisContext *ctx;
+	struct element *elem;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for when we pop a list RPC request. The request is a
+//			two item batch, the first item names the key to respond on and
+//			has the TTL for it as its data and the second is the command.
+//			The response is a single item batch response.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_rpc_cb(
+	const uint8_t *request,
+	size_t request_len,
+	void *user_data)
+{
+	struct element_command_rpc_data *data;
+	struct element_command_batch_item items[2];
+	struct element_command *cmd = NULL;
+	char reply_key[ATOM_NAME_MAXLEN];
+	char ttl_str[16];
+	int ttl;
+	enum atom_error_t err_code;
+	uint8_t *response = NULL;
+	size_t response_len = 0;
+	char *error_str = NULL;
+	void *cleanup_ptr = NULL;
+	uint8_t *rpc_response;
+	size_t rpc_response_len;
+	bool ret_val = false;
+	uint64_t slow_op_start = 0;
+	uint64_t slow_op_split = 0;
+
+	data = (struct element_command_rpc_data *)user_data;
+
+	if ((element_command_batch_parse(
+			request, request_len, false, items, 2) != 2) ||
+		(items[0].name_len >= sizeof(reply_key)) ||
+		(items[0].data_len >= sizeof(ttl_str)))
+	{
+		// Nobody to respond to, just drop it
+		atom_logf(NULL, data->elem, LOG_ERR, "Invalid RPC request!");
+		ret_val = true;
+		goto done;
+	}
+
+	memcpy(reply_key, items[0].name, items[0].name_len);
+	reply_key[items[0].name_len] = '\0';
+	memcpy(ttl_str, items[0].data, items[0].data_len);
+	ttl_str[items[0].data_len] = '\0';
+	ttl = atoi(ttl_str);
+
+	if (element_slow_op_on) {
+		slow_op_start = element_slow_op_now_us();
+	}
+
+	// Only commands we've opted in to list RPC can be called this way, the
+	//	caller will go back to the streams if we tell them it's unsupported
+	cmd = element_command_batch_get(data->elem, &items[1]);
+	if ((cmd == NULL) || !cmd->rpc) {
+		cmd = NULL;
+		err_code = ATOM_COMMAND_UNSUPPORTED;
+	} else {
+		err_code = element_command_run(
+			cmd,
+			(uint8_t *)items[1].data,
+			items[1].data_len,
+			&response,
+			&response_len,
+			&error_str,
+			&cleanup_ptr);
+	}
+
+	if (slow_op_start != 0) {
+		slow_op_split = element_slow_op_now_us();
+	}
+
+	// Send back the error string on an error, else the response
+	items[0].err_code = err_code;
+	if (err_code != ATOM_NO_ERROR) {
+		items[0].data = (uint8_t *)error_str;
+		items[0].data_len = (error_str != NULL) ? strlen(error_str) : 0;
+	} else {
+		items[0].data = response;
+		items[0].data_len = (response != NULL) ? response_len : 0;
+	}
+
+	rpc_response = element_command_batch_encode(
+		items, 1, true, &rpc_response_len);
+	if (rpc_response == NULL) {
+		atom_logf(NULL, data->elem, LOG_ERR, "Failed to encode RPC response!");
+		goto cleanup;
+	}
+
+	if (!redis_list_push(
+		data->ctx, reply_key, rpc_response, rpc_response_len, ttl))
+	{
+		atom_logf(data->ctx, data->elem, LOG_ERR, "Failed to send RPC response");
+		free(rpc_response);
+		goto cleanup;
+	}
+	free(rpc_response);
+
+	// Note the success
+	ret_val = true;
+
+cleanup:
+	// Slow ops that failed are still slow
+	element_slow_op_finish(ELEMENT_SLOW_OP_COMMAND_HANDLE,
+		(cmd != NULL) ? cmd->name : NULL, slow_op_start, slow_op_split,
+		items[1].data_len, response_len);
+
+	if (cleanup_ptr != NULL) {
+		if (cmd->cleanup != NULL) {
+			cmd->cleanup(cleanup_ptr);
+		}
+	} else {
+		free(response);
+		free(error_str);
+	}
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Lets callers send a command's request data in chunks
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_command_set_chunked(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	int (*chunk_cb)(
+		const uint8_t *chunk,
+		size_t chunk_len,
+		void *user_data))
+{
+	struct element_command *cmd;
+
+	cmd = element_command_get(elem, command);
+	if (cmd == NULL) {
+		atom_logf(ctx, elem, LOG_ERR, "No command %s to chunk", command);
+		return false;
+	}
+
+	cmd->chunk_cb = chunk_cb;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs the list RPC loop
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_rpc_loop(
+	redisContext *ctx,
+	struct element *elem,
+	bool loop,
+	int timeout)
+{
+	struct element_command_rpc_data rpc_data;
+	char list[ATOM_NAME_MAXLEN];
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	bool popped;
+
+	if (atom_get_command_list_str(elem->name.str, list) == NULL) {
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	rpc_data.ctx = ctx;
+	rpc_data.elem = elem;
+
+	while (true) {
+		if (!redis_list_pop(
+			ctx, list, timeout, element_command_rpc_cb, &rpc_data, &popped))
+		{
+			atom_logf(ctx, elem, LOG_ERR, "Redis issue");
+			ret = ATOM_REDIS_ERROR;
+
+		// Timed out waiting for a request. Only worth reporting if we
+		//	were after a single one, otherwise keep waiting.
+		} else if (!popped) {
+			ret = ATOM_COMMAND_NO_RESPONSE;
+		} else {
+			ret = ATOM_NO_ERROR;
+		}
+
+		// And if we shouldn't be looping then break out
+		if (!loop) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Opts a command in or out of list RPC
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_command_set_rpc(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	bool rpc)
+{
+	struct element_command *cmd;
+
+	cmd = element_command_get(elem, command);
+	if (cmd == NULL) {
+		atom_logf(ctx, elem, LOG_ERR, "No command %s for RPC", command);
+		return false;
+	}
+
+	cmd->rpc = rpc;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Publishes a command in the element's command registry
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_register(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_command *cmd)
+{
+	char registry[ATOM_NAME_MAXLEN];
+	const char *description;
+	char *value = NULL;
+	int value_len;
+	bool ret = false;
+
+	if (atom_get_command_registry_str(elem->name.str, registry) == NULL) {
+		goto done;
+	}
+
+	// Value is "<timeout> <description>"
+	description = (cmd->description != NULL) ? cmd->description : "";
+	value_len = snprintf(NULL, 0, "%d %s", cmd->timeout, description);
+	value = malloc(value_len + 1);
+	assert(value != NULL);
+	snprintf(value, value_len + 1, "%d %s", cmd->timeout, description);
+
+	if (!redis_hash_set(ctx, registry, cmd->name, value)) {
+		atom_logf(ctx, elem, LOG_ERR,
+			"Failed to register command %s", cmd->name);
+		goto done;
+	}
+
+	ret = true;
+
+done:
+	if (value != NULL) {
+		free(value);
+	}
+	return ret;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Adds a command to an element. This will create a node in
@@ -509,11 +1197,15 @@ bool element_command_add(
 	// Start with the name
 	cmd->name = strdup(command);
 	assert(cmd->name != NULL);
+	cmd->description = NULL;
 
 	// Now fill in the callback, user data and the timeout
 	cmd->cb = cb;
 	cmd->cleanup = cleanup;
 	cmd->timeout = timeout;
+	cmd->cache_ttl = ELEMENT_COMMAND_NO_CACHE;
+	cmd->rpc = false;
+	cmd->chunk_cb = NULL;
 	cmd->user_data = user_data;
 
 	// Get the hash for the element
@@ -527,5 +1219,83 @@ bool element_command_add(
 	cmd->next = elem->command.hash[hash];
 	elem->command.hash[hash] = cmd;
 
+	// Let everyone know we have it. The command still works if this
+	//	fails, it just can't be discovered.
+	element_command_register(elem->command.ctx, elem, cmd);
+
 	return true;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the description of a command in the command registry
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_command_set_description(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	const char *description)
+{
+	struct element_command *cmd;
+
+	cmd = element_command_get(elem, command);
+	if (cmd == NULL) {
+		atom_logf(ctx, elem, LOG_ERR, "No command %s to describe", command);
+		return false;
+	}
+
+	if (cmd->description != NULL) {
+		free(cmd->description);
+	}
+	cmd->description = strdup(description);
+	assert(cmd->description != NULL);
+
+	return element_command_register(ctx, elem, cmd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Marks a command as cacheable by callers. Also bumps the cache
+//			version s.t. nothing callers cached from a previous run of the
+//			element is served.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_command_set_cacheable(
+	redisContext *ctx,
+	struct element *elem,
+	const char *command,
+	int ttl)
+{
+	struct element_command *cmd;
+
+	cmd = element_command_get(elem, command);
+	if (cmd == NULL) {
+		atom_logf(ctx, elem, LOG_ERR, "No command %s to cache", command);
+		return false;
+	}
+
+	cmd->cache_ttl = ttl;
+
+	return (element_command_cache_invalidate(ctx, elem) == ATOM_NO_ERROR);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Invalidates everything callers have cached from this element
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_cache_invalidate(
+	redisContext *ctx,
+	struct element *elem)
+{
+	char key[ATOM_NAME_MAXLEN];
+
+	atom_get_cache_version_str(elem->name.str, key);
+	if (!redis_incr(ctx, key, NULL)) {
+		atom_logf(ctx, elem, LOG_ERR, "Failed to bump cache version");
+		return ATOM_REDIS_ERROR;
+	}
+
+	return ATOM_NO_ERROR;
+}
@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_ephemeral.c
+//
+//  @brief Implements the encoding for entries on ephemeral streams. An
+//			entry is its ID followed by a count of keys and then each key
+//			and value, with every string as a big-endian uint32 length,
+//			the bytes and a NULL terminator s.t. decoded strings can be
+//			used in place.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "atom.h"
+#include "element_entry_ephemeral.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes the next ID. Same as redis, the sequence number restarts
+//			each millisecond and the clock going backwards is ignored.
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_ephemeral_next_id(
+	struct element_entry_ephemeral_ids *ids,
+	char id[STREAM_ID_BUFFLEN])
+{
+	struct timespec now;
+	uint64_t now_ms;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	now_ms = ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+
+	if (now_ms > ids->last_ms) {
+		ids->last_ms = now_ms;
+		ids->seq = 0;
+	} else {
+		ids->seq += 1;
+	}
+
+	snprintf(id, STREAM_ID_BUFFLEN, "%lu-%lu",
+		(unsigned long)ids->last_ms, (unsigned long)ids->seq);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a string to the buffer
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint8_t *element_entry_ephemeral_put_str(
+	uint8_t *buf,
+	const void *str,
+	size_t len)
+{
+	uint32_t len_be = htonl(len);
+
+	memcpy(buf, &len_be, sizeof(len_be));
+	buf += sizeof(len_be);
+	if (len > 0) {
+		memcpy(buf, str, len);
+	}
+	buf[len] = '\0';
+	return buf + len + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads a string from the buffer into a reply if there's room,
+//			advancing the offset
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_entry_ephemeral_get_str(
+	const uint8_t *data,
+	size_t len,
+	size_t *offset,
+	redisReply *str)
+{
+	uint32_t str_len;
+
+	if ((len - *offset) < sizeof(str_len)) {
+		return false;
+	}
+	memcpy(&str_len, data + *offset, sizeof(str_len));
+	str_len = ntohl(str_len);
+	*offset += sizeof(str_len);
+
+	if ((len - *offset) < ((size_t)str_len + 1) ||
+		(data[*offset + str_len] != '\0'))
+	{
+		return false;
+	}
+
+	memset(str, 0, sizeof(redisReply));
+	str->type = REDIS_REPLY_STRING;
+	str->str = (char *)(data + *offset);
+	str->len = str_len;
+	*offset += str_len + 1;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Encodes an entry
+//
+////////////////////////////////////////////////////////////////////////////////
+uint8_t *element_entry_ephemeral_encode(
+	const char *id,
+	const struct redis_xadd_info *items,
+	size_t n_items,
+	size_t *len)
+{
+	uint8_t *buf;
+	uint8_t *ptr;
+	uint32_t n_items_be;
+	size_t total;
+	size_t i;
+
+	// Readers won't decode anything with more keys than this
+	if (n_items > ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS) {
+		return NULL;
+	}
+
+	total = sizeof(uint32_t) + strlen(id) + 1 + sizeof(uint32_t);
+	for (i = 0; i < n_items; ++i) {
+		total += (2 * (sizeof(uint32_t) + 1)) +
+			items[i].key_len + items[i].data_len;
+	}
+
+	buf = malloc(total);
+	if (buf == NULL) {
+		return NULL;
+	}
+
+	ptr = element_entry_ephemeral_put_str(buf, id, strlen(id));
+	n_items_be = htonl(n_items);
+	memcpy(ptr, &n_items_be, sizeof(n_items_be));
+	ptr += sizeof(n_items_be);
+
+	for (i = 0; i < n_items; ++i) {
+		ptr = element_entry_ephemeral_put_str(
+			ptr, items[i].key, items[i].key_len);
+		ptr = element_entry_ephemeral_put_str(
+			ptr, items[i].data, items[i].data_len);
+	}
+
+	*len = total;
+	return buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Decodes an entry
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_entry_ephemeral_decode(
+	const uint8_t *data,
+	size_t len,
+	struct element_entry_ephemeral_entry *entry)
+{
+	redisReply id;
+	uint32_t n_items;
+	size_t offset = 0;
+	size_t i;
+
+	if (!element_entry_ephemeral_get_str(data, len, &offset, &id) ||
+		(id.len >= sizeof(entry->id)))
+	{
+		return false;
+	}
+	memcpy(entry->id, id.str, id.len + 1);
+
+	if ((len - offset) < sizeof(n_items)) {
+		return false;
+	}
+	memcpy(&n_items, data + offset, sizeof(n_items));
+	n_items = ntohl(n_items);
+	offset += sizeof(n_items);
+
+	if (n_items > ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS) {
+		return false;
+	}
+
+	for (i = 0; i < (2 * n_items); ++i) {
+		if (!element_entry_ephemeral_get_str(
+			data, len, &offset, &entry->strs[i]))
+		{
+			return false;
+		}
+		entry->elements[i] = &entry->strs[i];
+	}
+
+	memset(&entry->reply, 0, sizeof(entry->reply));
+	entry->reply.type = REDIS_REPLY_ARRAY;
+	entry->reply.elements = 2 * n_items;
+	entry->reply.element = entry->elements;
+
+	return (offset == len);
+}
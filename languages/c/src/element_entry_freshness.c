@@ -0,0 +1,285 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_freshness.c
+//
+//  @brief Implements freshness tracking for entries delivered to a reader.
+//			Costs a single clock read and some integer math per entry.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <hiredis/hiredis.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "redis.h"
+#include "atom.h"
+#include "element_entry_freshness.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Parses the leading decimal digits of a string into an integer.
+//			If frac_digits is nonzero then also parses up to that many digits
+//			after a decimal point, s.t. "1.5" with 3 frac digits gives 1500.
+//			Returns false if there are no leading digits.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_entry_freshness_parse_uint(
+	const char *str,
+	size_t len,
+	int frac_digits,
+	uint64_t *value)
+{
+	size_t i = 0;
+	uint64_t val = 0;
+	int n_frac = 0;
+
+	while ((i < len) && (str[i] >= '0') && (str[i] <= '9')) {
+		val = (val * 10) + (str[i] - '0');
+		++i;
+	}
+
+	if (i == 0) {
+		return false;
+	}
+
+	if ((frac_digits > 0) && (i < len) && (str[i] == '.')) {
+		++i;
+		while ((i < len) && (n_frac < frac_digits) &&
+			(str[i] >= '0') && (str[i] <= '9'))
+		{
+			val = (val * 10) + (str[i] - '0');
+			++n_frac;
+			++i;
+		}
+	}
+
+	for (; n_frac < frac_digits; ++n_frac) {
+		val *= 10;
+	}
+
+	*value = val;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds an age to a histogram
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_freshness_hist_add(
+	struct element_entry_freshness_hist *hist,
+	uint64_t age_us)
+{
+	int bucket;
+
+	bucket = (age_us == 0) ? 0 : (64 - __builtin_clzll(age_us));
+	if (bucket >= ELEMENT_ENTRY_FRESHNESS_N_BUCKETS) {
+		bucket = ELEMENT_ENTRY_FRESHNESS_N_BUCKETS - 1;
+	}
+
+	hist->buckets[bucket] += 1;
+	hist->count += 1;
+	hist->sum_us += age_us;
+	if (age_us > hist->max_us) {
+		hist->max_us = age_us;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Initializes a freshness tracker
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_freshness_init(
+	struct element_entry_freshness *freshness,
+	uint64_t budget_us,
+	void (*violation_cb)(
+		const char *id,
+		uint64_t age_us,
+		void *user_data),
+	void *user_data)
+{
+	memset(freshness, 0, sizeof(struct element_entry_freshness));
+	freshness->budget_us = budget_us;
+	freshness->violation_cb = violation_cb;
+	freshness->user_data = user_data;
+	pthread_mutex_init(&freshness->lock, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Clears the stats and sets a new budget on a tracker that's in use
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_freshness_reset(
+	struct element_entry_freshness *freshness,
+	uint64_t budget_us,
+	void (*violation_cb)(
+		const char *id,
+		uint64_t age_us,
+		void *user_data),
+	void *user_data)
+{
+	pthread_mutex_lock(&freshness->lock);
+	memset(&freshness->redis_age, 0, sizeof(freshness->redis_age));
+	memset(&freshness->producer_age, 0, sizeof(freshness->producer_age));
+	freshness->violations = 0;
+	freshness->budget_us = budget_us;
+	freshness->violation_cb = violation_cb;
+	freshness->user_data = user_data;
+	pthread_mutex_unlock(&freshness->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Copies the stats of a tracker out under its lock
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_freshness_snapshot(
+	struct element_entry_freshness *freshness,
+	struct element_entry_freshness *snapshot)
+{
+	pthread_mutex_lock(&freshness->lock);
+	memcpy(snapshot, freshness, sizeof(struct element_entry_freshness));
+	pthread_mutex_unlock(&freshness->lock);
+
+	// Don't hand back a copy of a held lock
+	pthread_mutex_init(&snapshot->lock, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Cleans up a freshness tracker
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_freshness_cleanup(
+	struct element_entry_freshness *freshness)
+{
+	pthread_mutex_destroy(&freshness->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Records the age of an entry at delivery. Both the stream ID and
+//			the producer timestamp are wall-clock times so this is only as
+//			good as the clock sync between the hosts involved. Entries
+//			from the future are counted as 0us old.
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_freshness_record(
+	struct element_entry_freshness *freshness,
+	const char *id,
+	const redisReply *reply)
+{
+	struct timespec now;
+	uint64_t now_us;
+	uint64_t id_ms;
+	uint64_t ts;
+	uint64_t ts_us;
+	uint64_t age_us;
+	int idx;
+	void (*violation_cb)(const char *, uint64_t, void *) = NULL;
+	void *user_data = NULL;
+
+	// Single clock read for the entry
+	clock_gettime(CLOCK_REALTIME, &now);
+	now_us = ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+
+	// Redis age, from the millisecond part of the ID
+	if (!element_entry_freshness_parse_uint(id, strlen(id), 0, &id_ms)) {
+		return;
+	}
+	age_us = (now_us > (id_ms * 1000)) ? (now_us - (id_ms * 1000)) : 0;
+
+	pthread_mutex_lock(&freshness->lock);
+	element_entry_freshness_hist_add(&freshness->redis_age, age_us);
+
+	// Producer age, if the entry has a timestamp
+	if (reply != NULL) {
+		for (idx = 0; (idx + 1) < reply->elements; idx += 2) {
+			if ((reply->element[idx]->len != CONST_STRLEN(DATA_KEY_TIMESTAMP_STR)) ||
+				strncmp(reply->element[idx]->str, DATA_KEY_TIMESTAMP_STR,
+					CONST_STRLEN(DATA_KEY_TIMESTAMP_STR)))
+			{
+				continue;
+			}
+
+			// Parse with 6 fractional digits s.t. a timestamp in seconds
+			//	comes out in microseconds
+			if (!element_entry_freshness_parse_uint(
+				reply->element[idx + 1]->str,
+				reply->element[idx + 1]->len,
+				6,
+				&ts))
+			{
+				break;
+			}
+
+			// Anything too big to be in seconds is in milliseconds
+			if (ts >= (ELEMENT_ENTRY_FRESHNESS_TIMESTAMP_MS_MIN * 1000000)) {
+				ts_us = ts / 1000;
+			} else {
+				ts_us = ts;
+			}
+
+			if (ts_us != 0) {
+				age_us = (now_us > ts_us) ? (now_us - ts_us) : 0;
+				element_entry_freshness_hist_add(
+					&freshness->producer_age, age_us);
+			}
+			break;
+		}
+	}
+
+	// And check the budget. If we didn't get a producer age then age_us
+	//	is still the redis age
+	if ((freshness->budget_us != ELEMENT_ENTRY_FRESHNESS_NO_BUDGET) &&
+		(age_us > freshness->budget_us))
+	{
+		freshness->violations += 1;
+		violation_cb = freshness->violation_cb;
+		user_data = freshness->user_data;
+	}
+	pthread_mutex_unlock(&freshness->lock);
+
+	// Call out without the lock held s.t. the callback can take a snapshot
+	if (violation_cb != NULL) {
+		violation_cb(id, age_us, user_data);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the upper bound of the bucket holding the percentile
+//
+////////////////////////////////////////////////////////////////////////////////
+uint64_t element_entry_freshness_percentile(
+	const struct element_entry_freshness_hist *hist,
+	double pct)
+{
+	uint64_t target;
+	uint64_t seen = 0;
+	int i;
+
+	if (hist->count == 0) {
+		return 0;
+	}
+
+	target = (uint64_t)((pct / 100.0) * hist->count);
+	if (target == 0) {
+		target = 1;
+	}
+
+	for (i = 0; i < ELEMENT_ENTRY_FRESHNESS_N_BUCKETS - 1; ++i) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			return (i == 0) ? 0 : ((1ULL << i) - 1);
+		}
+	}
+
+	return hist->max_us;
+}
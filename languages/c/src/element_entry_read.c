@@ -15,10 +15,12 @@
 #include <assert.h>
 #include <malloc.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
+#include "atom_probes.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -34,6 +36,9 @@ static bool element_entry_read_cb(
 {
 	bool ret_val = false;
 	struct element_entry_read_info *info;
+	uint64_t slow_op_start = 0;
+	size_t n_bytes;
+	size_t i;
 
 	// Cast the user data
 	info = (struct element_entry_read_info *)user_data;
@@ -44,12 +49,33 @@ static bool element_entry_read_cb(
 		goto done;
 	}
 
+	// Note how old the entry is now that it's being delivered
+	if (info->freshness != NULL) {
+		element_entry_freshness_record(info->freshness, id, reply);
+	}
+
+	if (element_slow_op_on) {
+		slow_op_start = element_slow_op_now_us();
+	}
+
 	// Send the kv items along to the user response
+	ATOM_PROBE3(entry_delivered, info->stream, id, reply->elements / 2);
 	if (!info->response_cb(id, info->kv_items, info->n_kv_items, info->user_data)) {
 		atom_logf(NULL, NULL, LOG_ERR,
 			"Failed to call user response callback with kv items");
+		ATOM_PROBE3(entry_handled, info->stream, id, false);
 		goto done;
 	}
+	ATOM_PROBE3(entry_handled, info->stream, id, true);
+
+	if (slow_op_start != 0) {
+		n_bytes = 0;
+		for (i = 0; i < reply->elements; ++i) {
+			n_bytes += reply->element[i]->len;
+		}
+		element_slow_op_finish(ELEMENT_SLOW_OP_ENTRY_READ_CB, info->stream,
+			slow_op_start, 0, n_bytes, 0);
+	}
 
 	// Note the success
 	ret_val = true;
@@ -58,6 +84,139 @@ done:
 	return ret_val;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Initializes adaptive batching settings
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_read_batching_init(
+	struct element_entry_read_batching *batching,
+	size_t min_count,
+	size_t max_count,
+	int spin_us)
+{
+	memset(batching, 0, sizeof(struct element_entry_read_batching));
+	batching->min_count = (min_count > 0) ? min_count : 1;
+	batching->max_count = (max_count > batching->min_count) ?
+		max_count : batching->min_count;
+	batching->spin_us = spin_us;
+	batching->count = batching->min_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the current monotonic time in microseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t element_entry_read_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Does a single XREAD for the read loop. Without batching this is
+//			just a blocking XREAD. With batching, if we were caught up after
+//			the last XREAD then we'll spin for a bit before blocking, and
+//			after the XREAD we'll grow or shrink the COUNT based on whether
+//			any of the streams came back full.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_entry_read_loop_xread(
+	redisContext *ctx,
+	struct redis_stream_info *stream_info,
+	size_t n_infos,
+	int timeout,
+	struct element_entry_read_batching *batching)
+{
+	uint64_t spin_start;
+	size_t n_read;
+	bool backlog;
+	int i;
+
+	if (batching == NULL) {
+		return redis_xread(
+			ctx,
+			stream_info,
+			n_infos,
+			timeout,
+			REDIS_XREAD_NOMAXCOUNT);
+	}
+
+	n_read = 0;
+
+	// If we were caught up then spin for a bit with non-blocking XREADs
+	//	before paying for a blocking one
+	if ((batching->spin_us > 0) && (batching->count <= batching->min_count)) {
+		spin_start = element_entry_read_now_us();
+		do {
+			if (!redis_xread(
+				ctx,
+				stream_info,
+				n_infos,
+				REDIS_XREAD_DONTBLOCK,
+				batching->count))
+			{
+				return false;
+			}
+			batching->spin_reads += 1;
+
+			for (i = 0; i < n_infos; ++i) {
+				n_read += stream_info[i].items_read;
+			}
+		} while ((n_read == 0) &&
+			((element_entry_read_now_us() - spin_start) < batching->spin_us));
+
+		if (n_read > 0) {
+			batching->spin_hits += 1;
+		}
+	}
+
+	// Block if we didn't get anything spinning
+	if (n_read == 0) {
+		if (!redis_xread(
+			ctx,
+			stream_info,
+			n_infos,
+			timeout,
+			batching->count))
+		{
+			return false;
+		}
+		batching->block_reads += 1;
+
+		for (i = 0; i < n_infos; ++i) {
+			n_read += stream_info[i].items_read;
+		}
+	}
+
+	// If any stream came back full then there's likely more waiting,
+	//	so grow the COUNT. Otherwise we're caught up and want the
+	//	lowest latency we can get.
+	backlog = false;
+	for (i = 0; i < n_infos; ++i) {
+		if (stream_info[i].items_read >= batching->count) {
+			backlog = true;
+			break;
+		}
+	}
+
+	if (backlog) {
+		batching->count *= 2;
+		if (batching->count > batching->max_count) {
+			batching->count = batching->max_count;
+		}
+	} else {
+		batching->count = batching->min_count;
+	}
+
+	batching->entries += n_read;
+
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Allows the element to listen for data on a set of streams.
@@ -75,6 +234,30 @@ enum atom_error_t element_entry_read_loop(
 	size_t n_infos,
 	bool loop_forever,
 	int timeout)
+{
+	return element_entry_read_loop_adaptive(
+		ctx,
+		elem,
+		infos,
+		n_infos,
+		loop_forever,
+		timeout,
+		NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Read loop with optional adaptive batching of the XREADs
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_read_loop_adaptive(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_read_info *infos,
+	size_t n_infos,
+	bool loop_forever,
+	int timeout,
+	struct element_entry_read_batching *batching)
 {
 	int ret;
 	struct redis_stream_info *stream_info = NULL;
@@ -109,64 +292,191 @@ enum atom_error_t element_entry_read_loop(
 			NULL,
 			&infos[i]);
 
+		// Schedule the stream per the info
+		if (infos[i].weight > 0) {
+			stream_info[i].weight = infos[i].weight;
+		}
+		stream_info[i].max_count = infos[i].max_count;
+
 		// Note that we haven't read any items yet
 		infos[i].items_read = 0;
 		infos[i].xreads = 0;
 	}
 
-	// If we want to loop forever
-	if (loop_forever) {
+	// Loop, XREADing, until either there's an issue or, if we're not
+	//	looping forever, we've read the min items on each stream
+	while (true) {
 
-		// Loop forever, XREADing
-		while (true) {
-			if (!redis_xread(
-				ctx,
-				stream_info,
-				n_infos,
-				timeout,
-				REDIS_XREAD_NOMAXCOUNT))
-			{
-				atom_logf(ctx, elem, LOG_ERR, "Redis issue/timeout");
-				ret = ATOM_REDIS_ERROR;
-				goto done;
+		// Do the XREAD
+		if (!element_entry_read_loop_xread(
+			ctx,
+			stream_info,
+			n_infos,
+			timeout,
+			batching))
+		{
+			atom_logf(ctx, elem, LOG_ERR, "Redis issue/timeout");
+			ret = ATOM_REDIS_ERROR;
+			goto done;
+		}
+
+		if (loop_forever) {
+			continue;
+		}
+
+		// For each stream, note the number of items that
+		//	we read
+		done = true;
+		for (i = 0; i < n_infos; ++i) {
+			infos[i].items_read += stream_info[i].items_read;
+			if (infos[i].items_read < infos[i].items_to_read) {
+				done = false;
 			}
+
+			infos[i].xreads += 1;
 		}
 
-	// Otherwise we loop until we've read the min items
-	//	on each stream
-	} else {
+		// If we're done, then break
+		if (done) {
+			break;
+		}
+	}
 
-		while (true) {
-			// Do the XREAD
-			if (!redis_xread(
-				ctx,
-				stream_info,
-				n_infos,
-				timeout,
-				REDIS_XREAD_NOMAXCOUNT))
-			{
-				atom_logf(ctx, elem, LOG_ERR, "Redis issue/timeout");
+	// If we got here then it was a success!
+	ret = ATOM_NO_ERROR;
+
+done:
+	for (i = 0; i < n_infos; ++i) {
+		free((char*)stream_info[i].name);
+	}
+	free(stream_info);
+	return ret;
+}
+
+// Struct of user data for when we get a message on an ephemeral stream
+struct element_entry_read_ephemeral_data {
+	char **names;
+	struct element_entry_read_info *infos;
+	size_t n_infos;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for when we get a message on an ephemeral stream.
+//			Decodes the entry and passes it along the same as an entry
+//			from an XREAD.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_entry_read_ephemeral_cb(
+	const char *channel,
+	const uint8_t *message,
+	size_t message_len,
+	void *user_data)
+{
+	struct element_entry_read_ephemeral_data *data;
+	struct element_entry_ephemeral_entry entry;
+	size_t i;
+
+	data = (struct element_entry_read_ephemeral_data *)user_data;
+
+	for (i = 0; i < data->n_infos; ++i) {
+		if (!strcmp(channel, data->names[i])) {
+			break;
+		}
+	}
+
+	if (i == data->n_infos) {
+		atom_logf(NULL, NULL, LOG_ERR, "Message on unknown stream %s", channel);
+		return false;
+	}
+
+	if (!element_entry_ephemeral_decode(message, message_len, &entry)) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to decode ephemeral entry");
+		return false;
+	}
+
+	data->infos[i].items_read += 1;
+
+	return element_entry_read_cb(entry.id, &entry.reply, &data->infos[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Read loop for ephemeral streams
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_read_ephemeral_loop(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_read_info *infos,
+	size_t n_infos,
+	bool loop_forever)
+{
+	int ret;
+	struct element_entry_read_ephemeral_data data;
+	size_t i;
+	bool done;
+
+	// Initialize the return to an internal error
+	ret = ATOM_INTERNAL_ERROR;
+
+	data.infos = infos;
+	data.n_infos = n_infos;
+	data.names = malloc(n_infos * sizeof(char *));
+	assert(data.names != NULL);
+
+	// Get the full stream name, which is also the channel, for each of
+	//	the streams
+	for (i = 0; i < n_infos; ++i) {
+		data.names[i] = atom_get_data_stream_str(
+			infos[i].element, infos[i].stream, NULL);
+		assert(data.names[i] != NULL);
+
+		infos[i].items_read = 0;
+		infos[i].xreads = 0;
+	}
+
+	if (!redis_subscribe(ctx, (const char **)data.names, n_infos)) {
+		atom_logf(NULL, elem, LOG_ERR, "Failed to subscribe");
+		ret = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	// Loop until either there's an issue or, if we're not looping
+	//	forever, we've gotten the min items on each stream
+	while (true) {
+		if (!redis_get_message(ctx, element_entry_read_ephemeral_cb, &data)) {
+			// A bad message is dropped, only a broken context ends the loop
+			if (ctx->err) {
+				atom_logf(NULL, elem, LOG_ERR, "Redis issue");
 				ret = ATOM_REDIS_ERROR;
 				goto done;
 			}
+			continue;
+		}
 
-			// For each stream, note the number of items that
-			//	we read
-			done = true;
-			for (i = 0; i < n_infos; ++i) {
-				infos[i].items_read += stream_info[i].items_read;
-				if (infos[i].items_read < infos[i].items_to_read) {
-					done = false;
-				}
-
-				infos[i].xreads += 1;
-			}
+		if (loop_forever) {
+			continue;
+		}
 
-			// If we're done, then break
-			if (done) {
+		done = true;
+		for (i = 0; i < n_infos; ++i) {
+			if (infos[i].items_read < infos[i].items_to_read) {
+				done = false;
 				break;
 			}
 		}
+
+		if (done) {
+			break;
+		}
+	}
+
+	// Put the context back the way we found it
+	if (!redis_unsubscribe(ctx)) {
+		atom_logf(NULL, elem, LOG_ERR, "Failed to unsubscribe");
+		ret = ATOM_REDIS_ERROR;
+		goto done;
 	}
 
 	// If we got here then it was a success!
@@ -174,9 +484,9 @@ enum atom_error_t element_entry_read_loop(
 
 done:
 	for (i = 0; i < n_infos; ++i) {
-		free((char*)stream_info[i].name);
+		free(data.names[i]);
 	}
-	free(stream_info);
+	free(data.names);
 	return ret;
 }
 
@@ -193,10 +503,16 @@ enum atom_error_t element_entry_read_n(
 {
 	int ret = ATOM_INTERNAL_ERROR;
 	char stream_name[ATOM_NAME_MAXLEN];
+	struct element_entry_freshness *freshness;
 
 	// Get the stream name
 	atom_get_data_stream_str(info->element, info->stream, stream_name);
 
+	// These are historical reads, not deliveries, so we don't want them
+	//	counted towards freshness
+	freshness = info->freshness;
+	info->freshness = NULL;
+
 	// Want to initialize the stream info
 	if (!redis_xrevrange(ctx, stream_name, element_entry_read_cb, n, info)) {
 		atom_logf(ctx, elem, LOG_ERR, "Failed to call XREVRANGE");
@@ -208,6 +524,69 @@ enum atom_error_t element_entry_read_n(
 	ret = ATOM_NO_ERROR;
 
 done:
+	info->freshness = freshness;
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Get the most recent item on each of a set of streams
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_read_latest_multi(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_read_info *infos,
+	size_t n_infos)
+{
+	int ret = ATOM_INTERNAL_ERROR;
+	char **stream_names;
+	void **user_data;
+	struct element_entry_freshness **freshness;
+	int i;
+
+	stream_names = malloc(n_infos * sizeof(char *));
+	assert(stream_names != NULL);
+	user_data = malloc(n_infos * sizeof(void *));
+	assert(user_data != NULL);
+	freshness = malloc(n_infos * sizeof(struct element_entry_freshness *));
+	assert(freshness != NULL);
+
+	for (i = 0; i < n_infos; ++i) {
+		stream_names[i] = atom_get_data_stream_str(
+			infos[i].element, infos[i].stream, NULL);
+		assert(stream_names[i] != NULL);
+		user_data[i] = &infos[i];
+
+		// Snapshots aren't deliveries so they don't count towards
+		//	freshness either
+		freshness[i] = infos[i].freshness;
+		infos[i].freshness = NULL;
+	}
+
+	if (!redis_xrevrange_latest_multi(
+		ctx,
+		(const char **)stream_names,
+		n_infos,
+		element_entry_read_cb,
+		user_data))
+	{
+		atom_logf(ctx, elem, LOG_ERR, "Failed to read latest entries");
+		ret = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	// Note the success
+	ret = ATOM_NO_ERROR;
+
+done:
+	for (i = 0; i < n_infos; ++i) {
+		infos[i].freshness = freshness[i];
+		free(stream_names[i]);
+	}
+	free(freshness);
+	free(user_data);
+	free(stream_names);
 	return ret;
 }
 
@@ -0,0 +1,800 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_spool.c
+//
+//  @brief Implements the local write-ahead spool for entry writes. Entries
+//			that couldn't be written to redis are appended to a ring in a
+//			memory-mapped file and drained back to redis with pipelined
+//			XADDs once the nucleus is reachable again.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "redis.h"
+#include "atom.h"
+#include "element.h"
+
+// Magic number at the beginning of the file. "ATOMSPL2", bumped when the
+//	record header changes s.t. old files start fresh
+#define ELEMENT_ENTRY_SPOOL_MAGIC 0x324c50534d4f5441ULL
+
+// Records are aligned to this many bytes within the ring
+#define ELEMENT_ENTRY_SPOOL_ALIGN 8
+#define ELEMENT_ENTRY_SPOOL_ALIGN_UP(x) \
+	(((x) + (ELEMENT_ENTRY_SPOOL_ALIGN - 1)) & ~(ELEMENT_ENTRY_SPOOL_ALIGN - 1))
+
+// Record flags. Records that are sent or dropped are done and can be
+//	reclaimed once they reach the head.
+#define ELEMENT_ENTRY_SPOOL_RECORD_SENT 0x1
+#define ELEMENT_ENTRY_SPOOL_RECORD_DROPPED 0x2
+#define ELEMENT_ENTRY_SPOOL_RECORD_DONE \
+	(ELEMENT_ENTRY_SPOOL_RECORD_SENT | ELEMENT_ENTRY_SPOOL_RECORD_DROPPED)
+
+// Header for each record in the ring. A length of 0 marks that the
+//	writer wrapped around to the beginning of the ring. Followed by the
+//	stream name and then for each item the key length, data length, key
+//	and data. minid is empty if the record isn't trimmed by ID.
+struct element_entry_spool_record {
+	uint32_t len;
+	uint32_t flags;
+	uint32_t n_items;
+	int32_t maxlen;
+	uint32_t stream_len;
+	uint32_t n_rejected;
+	char minid[STREAM_ID_BUFFLEN];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the current monotonic time in milliseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t element_entry_spool_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Stream name hash function. For now just djb2, same as the
+//			command hashtable
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint32_t element_entry_spool_hash_fn(
+	const char *name,
+	size_t len)
+{
+	uint32_t hash = 5381;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash = ((hash << 5) + hash) + (uint8_t)name[i]; /* hash * 33 + c */
+	}
+
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the per-stream state for a stream, allocating a slot for it
+//			if it hasn't been seen yet. If we run out of slots then the
+//			stream shares the slot of its hash bin which keeps ordering
+//			conservative.
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct element_entry_spool_stream *element_entry_spool_get_stream(
+	struct element_entry_spool *spool,
+	const char *name,
+	size_t len)
+{
+	uint32_t hash;
+	int bin, i, idx;
+	struct element_entry_spool_stream *stream;
+
+	hash = element_entry_spool_hash_fn(name, len);
+	bin = hash & (ELEMENT_ENTRY_SPOOL_MAX_STREAMS - 1);
+
+	// Linear probe for the stream or a free slot
+	for (i = 0; i < ELEMENT_ENTRY_SPOOL_MAX_STREAMS; ++i) {
+		idx = (bin + i) & (ELEMENT_ENTRY_SPOOL_MAX_STREAMS - 1);
+		stream = &spool->streams[idx];
+
+		if (stream->in_use && (stream->hash == hash)) {
+			return stream;
+		}
+
+		if (!stream->in_use) {
+			stream->in_use = true;
+			stream->hash = hash;
+			stream->pending = 0;
+			stream->tokens = spool->drain_rate;
+			stream->last_refill_ms = element_entry_spool_now_ms();
+			stream->blocked = false;
+			return stream;
+		}
+	}
+
+	return &spool->streams[bin];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the record at the offset, moving the offset back to the
+//			beginning of the ring if the writer wrapped at this point
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct element_entry_spool_record *element_entry_spool_record_at(
+	struct element_entry_spool *spool,
+	uint64_t *offset,
+	bool update_used)
+{
+	struct element_entry_spool_record *rec;
+	uint64_t capacity = spool->header->capacity;
+
+	if ((capacity - *offset) >= sizeof(struct element_entry_spool_record)) {
+		rec = (struct element_entry_spool_record *)&spool->records[*offset];
+		if (rec->len != 0) {
+			return rec;
+		}
+	}
+
+	// Writer wrapped here, the rest of the ring is padding
+	if (update_used) {
+		spool->header->used -= (capacity - *offset);
+	}
+	*offset = 0;
+
+	return (struct element_entry_spool_record *)spool->records;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Converts a record back into XADD infos pointing into the ring.
+//			Returns the stream name of the record through stream.
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_spool_record_parse(
+	struct element_entry_spool_record *rec,
+	char stream[ATOM_NAME_MAXLEN],
+	struct redis_xadd_info *items)
+{
+	uint8_t *ptr;
+	uint32_t key_len, data_len;
+	size_t i, stream_len;
+
+	ptr = (uint8_t *)(rec + 1);
+
+	stream_len = (rec->stream_len < ATOM_NAME_MAXLEN) ?
+		rec->stream_len : (ATOM_NAME_MAXLEN - 1);
+	memcpy(stream, ptr, stream_len);
+	stream[stream_len] = '\0';
+	ptr += rec->stream_len;
+
+	for (i = 0; i < rec->n_items; ++i) {
+		memcpy(&key_len, ptr, sizeof(key_len));
+		ptr += sizeof(key_len);
+		memcpy(&data_len, ptr, sizeof(data_len));
+		ptr += sizeof(data_len);
+
+		items[i].key = (const char *)ptr;
+		items[i].key_len = key_len;
+		ptr += key_len;
+
+		items[i].data = ptr;
+		items[i].data_len = data_len;
+		ptr += data_len;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Moves the head of the ring past all of the records at the
+//			head which have been sent to redis
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_spool_advance_head(
+	struct element_entry_spool *spool)
+{
+	struct element_entry_spool_header *header = spool->header;
+	struct element_entry_spool_record *rec;
+
+	while (header->n_records > 0) {
+		rec = element_entry_spool_record_at(spool, &header->head, true);
+		if (!(rec->flags & ELEMENT_ENTRY_SPOOL_RECORD_DONE)) {
+			break;
+		}
+
+		header->head += rec->len;
+		header->used -= rec->len;
+		header->n_records -= 1;
+	}
+
+	// If the ring is empty we can start over at the beginning
+	if (header->n_records == 0) {
+		header->head = 0;
+		header->tail = 0;
+		header->used = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Rebuilds the per-stream pending counts from records recovered
+//			from the spool file
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_spool_recover(
+	struct element_entry_spool *spool)
+{
+	struct element_entry_spool_record *rec;
+	struct element_entry_spool_stream *stream;
+	uint64_t offset = spool->header->head;
+	uint64_t i;
+
+	for (i = 0; i < spool->header->n_records; ++i) {
+		rec = element_entry_spool_record_at(spool, &offset, false);
+		if (!(rec->flags & ELEMENT_ENTRY_SPOOL_RECORD_DONE)) {
+			stream = element_entry_spool_get_stream(
+				spool, (const char *)(rec + 1), rec->stream_len);
+			stream->pending += 1;
+		}
+		offset += rec->len;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Opens or creates the spool file and maps it into memory. If the
+//			file holds a valid spool of the same size then its pending
+//			records are recovered.
+//
+////////////////////////////////////////////////////////////////////////////////
+struct element_entry_spool *element_entry_spool_init(
+	const char *path,
+	size_t size,
+	unsigned int drain_rate)
+{
+	struct element_entry_spool *spool = NULL;
+	struct stat st;
+	void *map;
+
+	// Allocate the spool
+	spool = malloc(sizeof(struct element_entry_spool));
+	assert(spool != NULL);
+	memset(spool, 0, sizeof(struct element_entry_spool));
+	spool->fd = -1;
+	spool->drain_rate = drain_rate;
+	pthread_mutex_init(&spool->lock, NULL);
+
+	spool->path = strdup(path);
+	assert(spool->path != NULL);
+
+	// Open the file, creating it if needed
+	size = ELEMENT_ENTRY_SPOOL_ALIGN_UP(size);
+	spool->map_len = sizeof(struct element_entry_spool_header) + size;
+	spool->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (spool->fd < 0) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to open spool file %s", path);
+		goto err_cleanup;
+	}
+
+	// Size the file to hold the header and the ring
+	if (fstat(spool->fd, &st) != 0) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to stat spool file %s", path);
+		goto err_cleanup;
+	}
+	if ((size_t)st.st_size != spool->map_len) {
+		if (ftruncate(spool->fd, spool->map_len) != 0) {
+			atom_logf(NULL, NULL, LOG_ERR,
+				"Failed to size spool file %s", path);
+			goto err_cleanup;
+		}
+	}
+
+	// And map it
+	map = mmap(NULL, spool->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		spool->fd, 0);
+	if (map == MAP_FAILED) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to map spool file %s", path);
+		goto err_cleanup;
+	}
+	spool->header = (struct element_entry_spool_header *)map;
+	spool->records = (uint8_t *)map + sizeof(struct element_entry_spool_header);
+
+	// If the file doesn't hold a spool of the size we expect then we'll
+	//	start fresh, otherwise we'll pick up where we left off
+	if ((spool->header->magic != ELEMENT_ENTRY_SPOOL_MAGIC) ||
+		(spool->header->capacity != size))
+	{
+		memset(spool->header, 0, sizeof(struct element_entry_spool_header));
+		spool->header->capacity = size;
+		spool->header->magic = ELEMENT_ENTRY_SPOOL_MAGIC;
+	} else {
+		element_entry_spool_recover(spool);
+	}
+
+	goto done;
+
+err_cleanup:
+	element_entry_spool_cleanup(spool);
+	spool = NULL;
+done:
+	return spool;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unmaps and closes the spool. Anything pending stays in the file.
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_spool_cleanup(
+	struct element_entry_spool *spool)
+{
+	if (spool != NULL) {
+		if (spool->header != NULL) {
+			msync(spool->header, spool->map_len, MS_SYNC);
+			munmap(spool->header, spool->map_len);
+		}
+		if (spool->fd >= 0) {
+			close(spool->fd);
+		}
+		if (spool->path != NULL) {
+			free(spool->path);
+		}
+		pthread_mutex_destroy(&spool->lock);
+		free(spool);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends an entry to the tail of the ring. Returns false if
+//			there's not enough contiguous room for it.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_entry_spool_append(
+	struct element_entry_spool *spool,
+	const char *stream,
+	const struct redis_xadd_info *items,
+	size_t n_items,
+	int maxlen,
+	const char *minid)
+{
+	struct element_entry_spool_header *header = spool->header;
+	struct element_entry_spool_record *rec;
+	struct element_entry_spool_stream *stream_state;
+	size_t stream_len, len, i;
+	uint32_t key_len, data_len;
+	uint8_t *ptr;
+	bool ret_val = false;
+
+	// Figure out how much room the record needs
+	stream_len = strlen(stream);
+	len = sizeof(struct element_entry_spool_record) + stream_len;
+	for (i = 0; i < n_items; ++i) {
+		len += sizeof(key_len) + sizeof(data_len) + items[i].data_len +
+			((items[i].key_len != 0) ? items[i].key_len : strlen(items[i].key));
+	}
+	len = ELEMENT_ENTRY_SPOOL_ALIGN_UP(len);
+
+	pthread_mutex_lock(&spool->lock);
+
+	if ((len > header->capacity) || (n_items > REDIS_XADD_MAX_ITEMS)) {
+		goto done;
+	}
+
+	// If the ring is empty start back at the beginning
+	if (header->n_records == 0) {
+		header->head = 0;
+		header->tail = 0;
+		header->used = 0;
+	}
+
+	// If the ring isn't wrapped then the free space is at the end and
+	//	before the head, otherwise it's between the tail and the head
+	if ((header->n_records == 0) || (header->tail > header->head)) {
+		if ((header->capacity - header->tail) < len) {
+			if (header->head < len) {
+				goto done;
+			}
+
+			// Mark the wrap if there's room for it, else the reader will
+			//	know that there's not enough room for a record
+			if ((header->capacity - header->tail) >=
+				sizeof(struct element_entry_spool_record))
+			{
+				rec = (struct element_entry_spool_record *)
+					&spool->records[header->tail];
+				rec->len = 0;
+			}
+			header->used += header->capacity - header->tail;
+			header->tail = 0;
+		}
+	} else if ((header->head - header->tail) < len) {
+		goto done;
+	}
+
+	// Write the record
+	rec = (struct element_entry_spool_record *)&spool->records[header->tail];
+	rec->flags = 0;
+	rec->n_items = n_items;
+	rec->maxlen = maxlen;
+	rec->stream_len = stream_len;
+	rec->n_rejected = 0;
+	memset(rec->minid, 0, sizeof(rec->minid));
+	if (minid != NULL) {
+		strncpy(rec->minid, minid, sizeof(rec->minid) - 1);
+	}
+
+	ptr = (uint8_t *)(rec + 1);
+	memcpy(ptr, stream, stream_len);
+	ptr += stream_len;
+
+	for (i = 0; i < n_items; ++i) {
+		key_len = (items[i].key_len != 0) ?
+			items[i].key_len : strlen(items[i].key);
+		data_len = items[i].data_len;
+
+		memcpy(ptr, &key_len, sizeof(key_len));
+		ptr += sizeof(key_len);
+		memcpy(ptr, &data_len, sizeof(data_len));
+		ptr += sizeof(data_len);
+		memcpy(ptr, items[i].key, key_len);
+		ptr += key_len;
+		memcpy(ptr, items[i].data, data_len);
+		ptr += data_len;
+	}
+
+	// Only publish the length once the record is complete s.t. a crash
+	//	mid-write can't leave a partial record in the ring
+	__sync_synchronize();
+	rec->len = len;
+
+	header->tail += len;
+	header->used += len;
+	header->n_records += 1;
+
+	// Note that the stream has an entry pending
+	stream_state = element_entry_spool_get_stream(spool, stream, stream_len);
+	stream_state->pending += 1;
+
+	ret_val = true;
+
+done:
+	pthread_mutex_unlock(&spool->lock);
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks to see if there are entries pending for a stream, or any
+//			entries at all if the stream is NULL
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_entry_spool_pending(
+	struct element_entry_spool *spool,
+	const char *stream)
+{
+	bool pending;
+
+	pthread_mutex_lock(&spool->lock);
+	if (stream == NULL) {
+		pending = (spool->header->n_records > 0);
+	} else {
+		pending = (spool->header->n_records > 0) &&
+			(element_entry_spool_get_stream(
+				spool, stream, strlen(stream))->pending > 0);
+	}
+	pthread_mutex_unlock(&spool->lock);
+
+	return pending;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the number of entries in the spool
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t element_entry_spool_size(
+	struct element_entry_spool *spool)
+{
+	size_t size;
+
+	pthread_mutex_lock(&spool->lock);
+	size = spool->header->n_records;
+	pthread_mutex_unlock(&spool->lock);
+
+	return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the number of entries dropped after redis kept rejecting
+//			them
+//
+////////////////////////////////////////////////////////////////////////////////
+uint64_t element_entry_spool_dropped(
+	struct element_entry_spool *spool)
+{
+	uint64_t dropped;
+
+	pthread_mutex_lock(&spool->lock);
+	dropped = spool->n_dropped;
+	pthread_mutex_unlock(&spool->lock);
+
+	return dropped;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Refills the drain tokens for each stream and clears the
+//			blocked state from the last drain
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_spool_refill(
+	struct element_entry_spool *spool)
+{
+	struct element_entry_spool_stream *stream;
+	uint64_t now = element_entry_spool_now_ms();
+	int i;
+
+	for (i = 0; i < ELEMENT_ENTRY_SPOOL_MAX_STREAMS; ++i) {
+		stream = &spool->streams[i];
+		if (!stream->in_use) {
+			continue;
+		}
+
+		stream->blocked = false;
+		if (spool->drain_rate != ELEMENT_ENTRY_SPOOL_NO_RATE_LIMIT) {
+			stream->tokens += ((double)spool->drain_rate *
+				(now - stream->last_refill_ms)) / 1000.0;
+			if (stream->tokens > spool->drain_rate) {
+				stream->tokens = spool->drain_rate;
+			}
+		}
+		stream->last_refill_ms = now;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Drains the spool into redis. Walks the ring from the head,
+//			pipelining XADDs for each record whose stream still has drain
+//			budget. Once a stream runs out of budget none of its later
+//			records are sent in this drain s.t. per-stream ordering is
+//			preserved, but other streams can keep draining behind it.
+//			Delivery is at-least-once: if the connection drops with
+//			replies outstanding those records are sent again.
+//
+//			Each reply is checked on its own. Records redis took are
+//			marked sent wherever they are in the batch. A record redis
+//			rejected blocks only its own stream until the next drain,
+//			and is dropped once it's been rejected
+//			ELEMENT_ENTRY_SPOOL_MAX_REJECTS times s.t. one bad record
+//			can't hold up its stream forever. Records of its stream
+//			later in the same pipeline have already landed, so a
+//			rejected record can end up behind them.
+//
+//			Each batch is copied out of the ring under the lock and sent
+//			without it s.t. writers can keep spooling during the round
+//			trip. Only one drain runs at a time; if another thread is
+//			already draining this returns 0 straight away. Records stay
+//			put while unlocked since only the drain moves the head.
+//
+////////////////////////////////////////////////////////////////////////////////
+int element_entry_spool_drain(
+	redisContext *ctx,
+	struct element_entry_spool *spool)
+{
+	struct element_entry_spool_header *header = spool->header;
+	struct element_entry_spool_record *rec;
+	struct element_entry_spool_record *batch[ELEMENT_ENTRY_SPOOL_PIPELINE_DEPTH];
+	size_t batch_offset[ELEMENT_ENTRY_SPOOL_PIPELINE_DEPTH];
+	int batch_cmds[ELEMENT_ENTRY_SPOOL_PIPELINE_DEPTH];
+	bool trim_ok;
+	struct element_entry_spool_stream *stream;
+	struct redis_xadd_info items[REDIS_XADD_MAX_ITEMS];
+	char stream_name[ATOM_NAME_MAXLEN];
+	uint8_t *copy = NULL;
+	uint8_t *new_copy;
+	size_t copy_len = 0;
+	size_t copy_cap = 0;
+	uint64_t offset, remaining, now;
+	bool ok[ELEMENT_ENTRY_SPOOL_PIPELINE_DEPTH];
+	int n_batch, n_sent, n_ok, ret, i;
+	int n_written = 0;
+	bool reconnect = false;
+	bool append_failed = false;
+
+	pthread_mutex_lock(&spool->lock);
+
+	if (spool->draining || (header->n_records == 0)) {
+		pthread_mutex_unlock(&spool->lock);
+		return 0;
+	}
+	spool->draining = true;
+
+	// Make sure the context is usable. Don't hammer the server with
+	//	reconnects if it's still down.
+	if (ctx->err != 0) {
+		now = element_entry_spool_now_ms();
+		if ((now - spool->last_reconnect_ms) <
+			ELEMENT_ENTRY_SPOOL_RECONNECT_INTERVAL_MS)
+		{
+			n_written = -1;
+			goto done;
+		}
+		spool->last_reconnect_ms = now;
+		reconnect = true;
+	}
+
+	if (reconnect) {
+		pthread_mutex_unlock(&spool->lock);
+		if (!redis_context_reconnect(ctx)) {
+			n_written = -1;
+		}
+		pthread_mutex_lock(&spool->lock);
+
+		if (n_written < 0) {
+			goto done;
+		}
+	}
+
+	element_entry_spool_refill(spool);
+
+	// Walk the ring from the head, sending pipelined batches
+	offset = header->head;
+	remaining = header->n_records;
+	while ((remaining > 0) && !append_failed) {
+
+		// Copy the next batch out of the ring
+		n_batch = 0;
+		copy_len = 0;
+		while ((remaining > 0) && (n_batch < ELEMENT_ENTRY_SPOOL_PIPELINE_DEPTH)) {
+			rec = element_entry_spool_record_at(spool, &offset, false);
+			offset += rec->len;
+			remaining -= 1;
+
+			if (rec->flags & ELEMENT_ENTRY_SPOOL_RECORD_DONE) {
+				continue;
+			}
+
+			// If the stream is out of budget then hold all of its
+			//	records until the next drain
+			stream = element_entry_spool_get_stream(
+				spool, (const char *)(rec + 1), rec->stream_len);
+			if (stream->blocked ||
+				((spool->drain_rate != ELEMENT_ENTRY_SPOOL_NO_RATE_LIMIT) &&
+					(stream->tokens < 1.0)))
+			{
+				stream->blocked = true;
+				continue;
+			}
+
+			if ((copy_len + rec->len) > copy_cap) {
+				new_copy = realloc(copy, (copy_len + rec->len) * 2);
+				if (new_copy == NULL) {
+					atom_logf(NULL, NULL, LOG_ERR,
+						"Failed to allocate spool drain buffer");
+					append_failed = true;
+					break;
+				}
+				copy = new_copy;
+				copy_cap = (copy_len + rec->len) * 2;
+			}
+			memcpy(&copy[copy_len], rec, rec->len);
+
+			stream->tokens -= 1.0;
+			batch[n_batch] = rec;
+			batch_offset[n_batch] = copy_len;
+			copy_len += rec->len;
+			n_batch++;
+		}
+
+		if (n_batch == 0) {
+			break;
+		}
+
+		pthread_mutex_unlock(&spool->lock);
+
+		// Pipeline the XADDs, trimming the same as the write would have,
+		//	and get the replies. Records trimmed by ID with a ceiling have
+		//	an XTRIM after their XADD, whose reply we only need to consume.
+		n_sent = 0;
+		for (i = 0; i < n_batch; ++i) {
+			rec = (struct element_entry_spool_record *)&copy[batch_offset[i]];
+			element_entry_spool_record_parse(rec, stream_name, items);
+			if (rec->minid[0] != '\0') {
+				batch_cmds[i] = redis_xadd_minid_append(ctx, stream_name,
+					items, rec->n_items, rec->minid, rec->maxlen,
+					ATOM_DEFAULT_APPROX_MAXLEN);
+			} else {
+				batch_cmds[i] = redis_xadd_append(ctx, stream_name, items,
+					rec->n_items, rec->maxlen, ATOM_DEFAULT_APPROX_MAXLEN) ?
+					1 : -1;
+			}
+			if (batch_cmds[i] < 0) {
+				append_failed = true;
+				break;
+			}
+			n_sent++;
+		}
+
+		n_ok = 0;
+		for (i = 0; (i < n_sent) && (n_ok >= 0); ++i) {
+			ret = redis_pipeline_get_reply_status(
+				ctx, 1, REDIS_REPLY_STRING, &ok[i]);
+			if ((ret >= 0) && (batch_cmds[i] > 1)) {
+				ret = (redis_pipeline_get_reply_status(ctx,
+					batch_cmds[i] - 1, REDIS_REPLY_INTEGER, &trim_ok) < 0) ?
+					-1 : ret;
+			}
+			n_ok = (ret < 0) ? -1 : (n_ok + ret);
+		}
+
+		pthread_mutex_lock(&spool->lock);
+
+		// Give back the budget for anything that didn't go out
+		for (i = n_sent; i < n_batch; ++i) {
+			stream = element_entry_spool_get_stream(
+				spool, (const char *)(batch[i] + 1), batch[i]->stream_len);
+			stream->tokens += 1.0;
+		}
+
+		if (n_ok < 0) {
+			n_written = (n_written > 0) ? n_written : -1;
+			break;
+		}
+
+		// Mark everything that made it in and hold back the streams of
+		//	anything that didn't
+		for (i = 0; i < n_sent; ++i) {
+			stream = element_entry_spool_get_stream(
+				spool, (const char *)(batch[i] + 1), batch[i]->stream_len);
+
+			if (ok[i]) {
+				batch[i]->flags |= ELEMENT_ENTRY_SPOOL_RECORD_SENT;
+				stream->pending -= 1;
+				n_written++;
+				continue;
+			}
+
+			stream->blocked = true;
+			batch[i]->n_rejected += 1;
+			if (batch[i]->n_rejected >= ELEMENT_ENTRY_SPOOL_MAX_REJECTS) {
+				element_entry_spool_record_parse(batch[i], stream_name, items);
+				atom_logf(NULL, NULL, LOG_ERR,
+					"Redis rejected spooled entry for %s %d times, dropping it",
+					stream_name, (int)batch[i]->n_rejected);
+				batch[i]->flags |= ELEMENT_ENTRY_SPOOL_RECORD_DROPPED;
+				stream->pending -= 1;
+				spool->n_dropped += 1;
+			}
+		}
+	}
+
+	element_entry_spool_advance_head(spool);
+
+done:
+	spool->draining = false;
+	pthread_mutex_unlock(&spool->lock);
+	free(copy);
+	return n_written;
+}
@@ -0,0 +1,283 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_entry_trim.c
+//
+//  @brief Implements consumer-aware trimming of data streams. Durable
+//			consumers report their positions into a hash next to the
+//			stream and the writer trims with MINID at the slowest one.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <hiredis/hiredis.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+#include "redis.h"
+#include "atom.h"
+#include "element_entry_trim.h"
+
+// Weight of each new entry in the running average of the entry size
+#define ELEMENT_ENTRY_TRIM_SIZE_ALPHA (1.0 / 16.0)
+
+// State for finding the slowest consumer in the positions hash
+struct element_entry_trim_slowest {
+	size_t n_consumers;
+	uint64_t ms;
+	uint64_t seq;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the current time on the passed clock in milliseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t element_entry_trim_now_ms(
+	clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Parses a stream ID of the form ms-seq. The seq is optional.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_entry_trim_parse_id(
+	const char *id,
+	uint64_t *ms,
+	uint64_t *seq)
+{
+	char *end;
+
+	*ms = strtoull(id, &end, 10);
+	if (end == id) {
+		return false;
+	}
+
+	*seq = 0;
+	if (*end == '-') {
+		*seq = strtoull(end + 1, NULL, 10);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the name of the consumer positions hash for a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_trim_consumers_key(
+	const char *stream_name,
+	char buffer[ATOM_NAME_MAXLEN])
+{
+	snprintf(buffer, ATOM_NAME_MAXLEN,
+		ELEMENT_ENTRY_TRIM_CONSUMERS_PREFIX "%s", stream_name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for each consumer in the positions hash
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_entry_trim_consumer_cb(
+	const char *consumer,
+	const char *last_id,
+	void *user_data)
+{
+	struct element_entry_trim_slowest *slowest;
+	uint64_t ms;
+	uint64_t seq;
+
+	slowest = (struct element_entry_trim_slowest *)user_data;
+
+	// Skip anything we can't make sense of rather than failing the
+	//	whole refresh
+	if (!element_entry_trim_parse_id(last_id, &ms, &seq)) {
+		fprintf(stderr, "Bad position %s for consumer %s\n", last_id, consumer);
+		return true;
+	}
+
+	if ((slowest->n_consumers == 0) ||
+		(ms < slowest->ms) ||
+		((ms == slowest->ms) && (seq < slowest->seq)))
+	{
+		slowest->ms = ms;
+		slowest->seq = seq;
+	}
+	slowest->n_consumers += 1;
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Initializes trimming for a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_trim_init(
+	struct element_entry_trim *trim,
+	uint64_t max_age_ms,
+	size_t max_bytes,
+	uint64_t refresh_ms)
+{
+	memset(trim, 0, sizeof(struct element_entry_trim));
+	trim->max_age_ms = max_age_ms;
+	trim->max_bytes = max_bytes;
+	trim->refresh_ms = refresh_ms;
+	trim->maxlen = REDIS_XADD_NO_MAXLEN;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reports a durable consumer's position on a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_trim_report(
+	redisContext *ctx,
+	const char *element,
+	const char *stream,
+	const char *consumer,
+	const char *last_id)
+{
+	char stream_name[ATOM_NAME_MAXLEN];
+	char key[ATOM_NAME_MAXLEN];
+
+	if (atom_get_data_stream_str(element, stream, stream_name) == NULL) {
+		return ATOM_INTERNAL_ERROR;
+	}
+	element_entry_trim_consumers_key(stream_name, key);
+
+	if (!redis_hash_set(ctx, key, consumer, last_id)) {
+		return ATOM_REDIS_ERROR;
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unregisters a durable consumer
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_trim_unregister(
+	redisContext *ctx,
+	const char *element,
+	const char *stream,
+	const char *consumer)
+{
+	char stream_name[ATOM_NAME_MAXLEN];
+	char key[ATOM_NAME_MAXLEN];
+
+	if (atom_get_data_stream_str(element, stream, stream_name) == NULL) {
+		return ATOM_INTERNAL_ERROR;
+	}
+	element_entry_trim_consumers_key(stream_name, key);
+
+	if (!redis_hash_del(ctx, key, consumer)) {
+		return ATOM_REDIS_ERROR;
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Updates the MINID and MAXLEN for the next write. The consumer
+//			positions are cached for refresh_ms s.t. this is an extra
+//			round trip only every so often. If a refresh fails we keep
+//			trimming at the last positions we saw, which can only be
+//			behind where the consumers actually are.
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_trim_update(
+	redisContext *ctx,
+	struct element_entry_trim *trim,
+	const char *stream_name,
+	const struct redis_xadd_info *items,
+	size_t n_items,
+	int maxlen)
+{
+	struct element_entry_trim_slowest slowest;
+	char key[ATOM_NAME_MAXLEN];
+	uint64_t now_ms;
+	uint64_t floor_ms;
+	size_t entry_bytes;
+	double n_entries;
+	size_t i;
+
+	// Refresh the consumer positions if they're due
+	now_ms = element_entry_trim_now_ms(CLOCK_MONOTONIC);
+	if ((trim->refreshed_ms == 0) ||
+		((now_ms - trim->refreshed_ms) >= trim->refresh_ms))
+	{
+		element_entry_trim_consumers_key(stream_name, key);
+		memset(&slowest, 0, sizeof(slowest));
+		if (redis_hash_get_all(
+			ctx, key, element_entry_trim_consumer_cb, &slowest) >= 0)
+		{
+			trim->n_consumers = slowest.n_consumers;
+			trim->slowest_ms = slowest.ms;
+			trim->slowest_seq = slowest.seq;
+		}
+		trim->refreshed_ms = now_ms;
+	}
+
+	// Oldest entry the age ceiling lets us keep. Stream IDs are in
+	//	the redis server's wall-clock time so this is only as good as
+	//	the clock sync with the nucleus.
+	floor_ms = 0;
+	if (trim->max_age_ms != ELEMENT_ENTRY_TRIM_NO_MAX_AGE) {
+		now_ms = element_entry_trim_now_ms(CLOCK_REALTIME);
+		if (now_ms > trim->max_age_ms) {
+			floor_ms = now_ms - trim->max_age_ms;
+		}
+	}
+
+	// Trim at the slowest consumer, unless it's past the age ceiling
+	if ((trim->n_consumers > 0) && (trim->slowest_ms >= floor_ms)) {
+		snprintf(trim->minid, STREAM_ID_BUFFLEN, "%lu-%lu",
+			trim->slowest_ms, trim->slowest_seq);
+	} else if (floor_ms > 0) {
+		snprintf(trim->minid, STREAM_ID_BUFFLEN, "%lu-0", floor_ms);
+	} else {
+		trim->minid[0] = '\0';
+	}
+
+	// Size ceiling. Redis can only trim on the number of entries so
+	//	convert from bytes using the average size of what we've written
+	trim->maxlen = REDIS_XADD_NO_MAXLEN;
+	if (trim->max_bytes != ELEMENT_ENTRY_TRIM_NO_MAX_BYTES) {
+		entry_bytes = 0;
+		for (i = 0; i < n_items; ++i) {
+			entry_bytes += items[i].key_len + items[i].data_len;
+		}
+
+		if (trim->entry_bytes == 0) {
+			trim->entry_bytes = entry_bytes;
+		} else {
+			trim->entry_bytes += ELEMENT_ENTRY_TRIM_SIZE_ALPHA *
+				(entry_bytes - trim->entry_bytes);
+		}
+
+		n_entries = trim->max_bytes / ((trim->entry_bytes > 1) ?
+			trim->entry_bytes : 1);
+		trim->maxlen = (n_entries < 1) ? 1 :
+			((n_entries > INT_MAX) ? INT_MAX : (int)n_entries);
+	}
+
+	// With nothing to trim by fall back to the usual MAXLEN, but never
+	//	past the size ceiling
+	if ((trim->minid[0] == '\0') && (maxlen != REDIS_XADD_NO_MAXLEN) &&
+		((trim->maxlen == REDIS_XADD_NO_MAXLEN) || (maxlen < trim->maxlen)))
+	{
+		trim->maxlen = maxlen;
+	}
+}
@@ -50,6 +50,14 @@ struct element_entry_write_info *element_entry_write_init(
 	// Note the number of droplet items
 	info->n_items = n_items;
 
+	// No spool or consumer-aware trimming by default
+	info->spool = NULL;
+	info->trim = NULL;
+
+	// Streams are persisted in redis unless made ephemeral
+	info->ephemeral = false;
+	memset(&info->ephemeral_ids, 0, sizeof(info->ephemeral_ids));
+
 	// Return the info
 	return info;
 }
@@ -78,6 +86,80 @@ void element_entry_write_cleanup(
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the spool that the info will fall back to if redis can't
+//			be reached
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_write_set_spool(
+	struct element_entry_write_info *info,
+	struct element_entry_spool *spool)
+{
+	info->spool = spool;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets consumer-aware trimming for the info
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_write_set_trim(
+	struct element_entry_write_info *info,
+	struct element_entry_trim *trim)
+{
+	info->trim = trim;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes the info ephemeral or not
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_write_set_ephemeral(
+	struct element_entry_write_info *info,
+	bool ephemeral)
+{
+	info->ephemeral = ephemeral;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Publishes an entry on an ephemeral stream
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t element_entry_write_ephemeral(
+	redisContext *ctx,
+	struct element_entry_write_info *info,
+	size_t n_items)
+{
+	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+	char id[STREAM_ID_BUFFLEN];
+	uint8_t *data;
+	size_t data_len;
+
+	element_entry_ephemeral_next_id(&info->ephemeral_ids, id);
+
+	data = element_entry_ephemeral_encode(id, info->items, n_items, &data_len);
+	if (data == NULL) {
+		atom_logf(ctx, NULL, LOG_ERR, "Failed to encode ephemeral entry");
+		goto done;
+	}
+
+	if (!redis_publish(ctx, info->stream, data, data_len, NULL)) {
+		atom_logf(ctx, NULL, LOG_ERR, "Failed to PUBLISH data to stream");
+		ret = ATOM_REDIS_ERROR;
+		goto free_data;
+	}
+
+	// Note the success
+	ret = ATOM_NO_ERROR;
+
+free_data:
+	free(data);
+done:
+	return ret;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -95,6 +177,15 @@ enum atom_error_t element_entry_write(
 	size_t n_items;
 	char timestamp_buffer[64];
 	size_t timestamp_buffer_len;
+	bool xadd_ok;
+	uint64_t slow_op_start = 0;
+	uint64_t slow_op_split = 0;
+	size_t n_bytes;
+	size_t i;
+
+	if (element_slow_op_on) {
+		slow_op_start = element_slow_op_now_us();
+	}
 
 	// Initialize the number of infos to that of the stream itself
 	n_items = info->n_items;
@@ -122,18 +213,67 @@ enum atom_error_t element_entry_write(
 		++n_items;
 	}
 
+	// Ephemeral streams skip redis streams altogether
+	if (info->ephemeral) {
+		ret = element_entry_write_ephemeral(ctx, info, n_items);
+		goto done;
+	}
+
+	// If we have a spool with something in it then try to drain it first.
+	//	If there's still something pending for this stream then we need
+	//	to go to the back of the line to keep the stream in order.
+	if ((info->spool != NULL) &&
+		element_entry_spool_pending(info->spool, NULL))
+	{
+		element_entry_spool_drain(ctx, info->spool);
+
+		if (element_entry_spool_pending(info->spool, info->stream)) {
+			goto spool;
+		}
+	}
+
+	// If we're trimming based on our consumers then figure out where
+	if (info->trim != NULL) {
+		element_entry_trim_update(
+			ctx, info->trim, info->stream, info->items, n_items, maxlen);
+	}
+
+	if (slow_op_start != 0) {
+		slow_op_split = element_slow_op_now_us();
+	}
+
 	// And we want to XADD the data to the stream to create it. This will
 	//	also put the ID of the item in the stream that we added with our
 	//	info into our last id
-	if (!redis_xadd(
-		ctx,
-		info->stream,
-		info->items,
-		n_items,
-		maxlen,
-		ATOM_DEFAULT_APPROX_MAXLEN,
-		NULL))
-	{
+	if ((info->trim != NULL) && (info->trim->minid[0] != '\0')) {
+		xadd_ok = redis_xadd_minid(
+			ctx,
+			info->stream,
+			info->items,
+			n_items,
+			info->trim->minid,
+			info->trim->maxlen,
+			ATOM_DEFAULT_APPROX_MAXLEN,
+			NULL);
+	} else {
+		xadd_ok = redis_xadd(
+			ctx,
+			info->stream,
+			info->items,
+			n_items,
+			(info->trim != NULL) ? info->trim->maxlen : maxlen,
+			ATOM_DEFAULT_APPROX_MAXLEN,
+			NULL);
+	}
+
+	if (!xadd_ok) {
+		// Only spool when we lost the connection. If redis replied with
+		//	an error then the entry would never drain and would block the
+		//	rest of the stream behind it.
+		if ((info->spool != NULL) && (ctx->err != 0)) {
+			goto spool;
+		}
+
 		atom_logf(ctx, NULL, LOG_ERR, "Failed to XADD data to stream");
 		ret = ATOM_REDIS_ERROR;
 		goto done;
@@ -141,7 +281,32 @@ enum atom_error_t element_entry_write(
 
 	// Note the success
 	ret = ATOM_NO_ERROR;
+	goto done;
+
+spool:
+	// Redis isn't taking writes for this stream right now, hold onto the
+	//	entry locally until it can be drained
+	if (!element_entry_spool_append(info->spool, info->stream, info->items,
+		n_items, (info->trim != NULL) ? info->trim->maxlen : maxlen,
+		(info->trim != NULL) ? info->trim->minid : NULL))
+	{
+		atom_logf(NULL, NULL, LOG_ERR,
+			"Failed to spool entry for stream %s", info->stream);
+		ret = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	// Note the success
+	ret = ATOM_NO_ERROR;
 
 done:
+	if (slow_op_start != 0) {
+		n_bytes = 0;
+		for (i = 0; i < n_items; ++i) {
+			n_bytes += info->items[i].data_len;
+		}
+		element_slow_op_finish(ELEMENT_SLOW_OP_ENTRY_WRITE, info->stream,
+			slow_op_start, slow_op_split, n_bytes, 0);
+	}
 	return ret;
 }
@@ -0,0 +1,409 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_slow_op.c
+//
+//  @brief Implements the slow operation journal. Ops under the threshold
+//			cost two clock reads and a compare, only slow ones are locked
+//			into the ring.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "atom.h"
+#include "element.h"
+#include "element_command_server.h"
+#include "element_slow_op.h"
+
+// Ring of the most recent slow ops. next is where the next op goes and
+//	count is how many are in the ring, up to n_ops.
+struct element_slow_op_journal {
+	pthread_mutex_t lock;
+	struct element_slow_op *ops;
+	size_t n_ops;
+	size_t next;
+	size_t count;
+	uint64_t threshold_us;
+};
+
+volatile bool element_slow_op_on = false;
+
+static struct element_slow_op_journal journal = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.ops = NULL,
+	.n_ops = 0,
+	.next = 0,
+	.count = 0,
+	.threshold_us = ELEMENT_SLOW_OP_DEFAULT_THRESHOLD_US,
+};
+
+static const char *element_slow_op_type_str[ELEMENT_SLOW_OP_N_TYPES] = {
+	"command_handle",
+	"command_send",
+	"entry_write",
+	"entry_read_cb",
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Turns the journal on
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_slow_op_enable(
+	size_t n_ops,
+	uint64_t threshold_us)
+{
+	pthread_mutex_lock(&journal.lock);
+
+	if (journal.ops == NULL) {
+		if (n_ops == 0) {
+			pthread_mutex_unlock(&journal.lock);
+			return false;
+		}
+		journal.ops = calloc(n_ops, sizeof(struct element_slow_op));
+		assert(journal.ops != NULL);
+		journal.n_ops = n_ops;
+	}
+	journal.threshold_us = threshold_us;
+	element_slow_op_on = true;
+
+	pthread_mutex_unlock(&journal.lock);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Turns the journal off
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_slow_op_disable(void)
+{
+	element_slow_op_on = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the current monotonic time in microseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+uint64_t element_slow_op_now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Finishes an op, putting it in the journal if it was slow
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_slow_op_finish(
+	enum element_slow_op_type type,
+	const char *name,
+	uint64_t start_us,
+	uint64_t split_us,
+	size_t request_bytes,
+	size_t response_bytes)
+{
+	struct element_slow_op *op;
+	struct timespec now;
+	uint64_t end_us;
+	uint64_t total_us;
+
+	// Journal was off when the op started
+	if (start_us == 0) {
+		return;
+	}
+
+	end_us = element_slow_op_now_us();
+	total_us = end_us - start_us;
+	if (total_us < journal.threshold_us) {
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	pthread_mutex_lock(&journal.lock);
+
+	op = &journal.ops[journal.next];
+	op->type = type;
+	snprintf(op->name, sizeof(op->name), "%s", (name != NULL) ? name : "");
+	op->start_ms = ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000) -
+		(total_us / 1000);
+	op->total_us = total_us;
+	if (split_us != 0) {
+		op->phase_us[0] = split_us - start_us;
+		op->phase_us[1] = end_us - split_us;
+	} else {
+		op->phase_us[0] = total_us;
+		op->phase_us[1] = 0;
+	}
+	op->request_bytes = request_bytes;
+	op->response_bytes = response_bytes;
+	op->thread = syscall(SYS_gettid);
+
+	journal.next = (journal.next + 1) % journal.n_ops;
+	if (journal.count < journal.n_ops) {
+		journal.count++;
+	}
+
+	pthread_mutex_unlock(&journal.lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the number of ops in the journal
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t element_slow_op_count(void)
+{
+	size_t count;
+
+	pthread_mutex_lock(&journal.lock);
+	count = journal.count;
+	pthread_mutex_unlock(&journal.lock);
+
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Copies the ops out of the journal, oldest first
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t element_slow_op_get(
+	struct element_slow_op *ops,
+	size_t max_ops)
+{
+	size_t first;
+	size_t n;
+	size_t i;
+
+	pthread_mutex_lock(&journal.lock);
+
+	if (journal.count == 0) {
+		pthread_mutex_unlock(&journal.lock);
+		return 0;
+	}
+
+	n = (journal.count < max_ops) ? journal.count : max_ops;
+	first = (journal.next + journal.n_ops - journal.count) % journal.n_ops;
+	for (i = 0; i < n; ++i) {
+		ops[i] = journal.ops[(first + i) % journal.n_ops];
+	}
+
+	pthread_mutex_unlock(&journal.lock);
+	return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends a string to the line, cutting it to fit
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_slow_op_put_str(
+	char *buf,
+	size_t len,
+	size_t *pos,
+	const char *str)
+{
+	while ((*str != '\0') && ((*pos + 1) < len)) {
+		buf[(*pos)++] = *str++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends an unsigned integer to the line in decimal
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_slow_op_put_uint(
+	char *buf,
+	size_t len,
+	size_t *pos,
+	unsigned long long val)
+{
+	char digits[24];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + (val % 10);
+		val /= 10;
+	} while (val != 0);
+
+	while ((n > 0) && ((*pos + 1) < len)) {
+		buf[(*pos)++] = digits[--n];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Formats an op as a single line. Done by hand rather than with
+//			snprintf s.t. it's async-signal-safe.
+//
+////////////////////////////////////////////////////////////////////////////////
+int element_slow_op_format(
+	const struct element_slow_op *op,
+	char *buf,
+	size_t len)
+{
+	size_t pos = 0;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	element_slow_op_put_uint(buf, len, &pos, op->start_ms);
+	element_slow_op_put_str(buf, len, &pos, " ");
+	element_slow_op_put_str(buf, len, &pos,
+		(op->type < ELEMENT_SLOW_OP_N_TYPES) ?
+			element_slow_op_type_str[op->type] : "unknown");
+	element_slow_op_put_str(buf, len, &pos, " ");
+	element_slow_op_put_str(buf, len, &pos, op->name);
+	element_slow_op_put_str(buf, len, &pos, " total_us=");
+	element_slow_op_put_uint(buf, len, &pos, op->total_us);
+	element_slow_op_put_str(buf, len, &pos, " phase_us=");
+	element_slow_op_put_uint(buf, len, &pos, op->phase_us[0]);
+	element_slow_op_put_str(buf, len, &pos, ",");
+	element_slow_op_put_uint(buf, len, &pos, op->phase_us[1]);
+	element_slow_op_put_str(buf, len, &pos, " req_bytes=");
+	element_slow_op_put_uint(buf, len, &pos, op->request_bytes);
+	element_slow_op_put_str(buf, len, &pos, " res_bytes=");
+	element_slow_op_put_uint(buf, len, &pos, op->response_bytes);
+	element_slow_op_put_str(buf, len, &pos, " thread=");
+	element_slow_op_put_uint(buf, len, &pos, (unsigned long)op->thread);
+	element_slow_op_put_str(buf, len, &pos, "\n");
+	buf[pos] = '\0';
+
+	return (int)pos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for the reserved command. Responds with the journal,
+//			one op per line.
+//
+////////////////////////////////////////////////////////////////////////////////
+static int element_slow_op_command_cb(
+	uint8_t *data,
+	size_t data_len,
+	uint8_t **response,
+	size_t *response_len,
+	char **error_str,
+	void *user_data,
+	void **cleanup_ptr)
+{
+	struct element_slow_op *ops;
+	size_t n_ops;
+	size_t max_len;
+	size_t len = 0;
+	char *buf;
+	size_t i;
+
+	// Nothing to dump
+	n_ops = element_slow_op_count();
+	if (n_ops == 0) {
+		return 0;
+	}
+
+	ops = malloc(n_ops * sizeof(struct element_slow_op));
+	assert(ops != NULL);
+	n_ops = element_slow_op_get(ops, n_ops);
+
+	// Each line is at most the name plus the numbers
+	max_len = n_ops * (ELEMENT_SLOW_OP_NAME_MAXLEN + 256) + 1;
+	buf = malloc(max_len);
+	assert(buf != NULL);
+
+	for (i = 0; i < n_ops; ++i) {
+		len += element_slow_op_format(&ops[i], buf + len, max_len - len);
+	}
+	free(ops);
+
+	// Default cleanup frees the response for us
+	*response = (uint8_t *)buf;
+	*response_len = len;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds the reserved command that dumps the journal
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_slow_op_add_command(
+	struct element *elem)
+{
+	return element_command_add(
+		elem,
+		ELEMENT_SLOW_OP_COMMAND_STR,
+		element_slow_op_command_cb,
+		NULL,
+		NULL,
+		ELEMENT_SLOW_OP_COMMAND_TIMEOUT_MS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Signal handler that dumps the journal to stderr. Doesn't take
+//			the lock since whoever holds it may be who we interrupted, and
+//			only formats by hand and calls write() s.t. it's
+//			async-signal-safe.
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_slow_op_signal_handler(
+	int signum)
+{
+	char line[ELEMENT_SLOW_OP_NAME_MAXLEN + 256];
+	size_t n_ops;
+	size_t first;
+	size_t i;
+	int len;
+
+	n_ops = journal.count;
+	if (n_ops == 0) {
+		return;
+	}
+
+	first = (journal.next + journal.n_ops - n_ops) % journal.n_ops;
+	for (i = 0; i < n_ops; ++i) {
+		len = element_slow_op_format(
+			&journal.ops[(first + i) % journal.n_ops], line, sizeof(line));
+		if ((len > 0) && (write(STDERR_FILENO, line, len) < 0)) {
+			return;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Dumps the journal to stderr on a signal
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_slow_op_dump_on_signal(
+	int signum)
+{
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = element_slow_op_signal_handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(signum, &action, NULL) != 0) {
+		fprintf(stderr, "Failed to set slow op signal handler!\n");
+		return false;
+	}
+
+	return true;
+}
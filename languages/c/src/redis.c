@@ -13,8 +13,10 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "redis.h"
+#include "atom_probes.h"
 
 // If this is 1 then will print out each redis command before sending
 //	it s.t. we can see what's going on in the system
@@ -26,14 +28,24 @@
 #define REDIS_XADD_CMD_STR "XADD"
 #define REDIS_XADD_ID_STR "*"
 #define REDIS_XADD_MAXLEN_STR "MAXLEN"
+#define REDIS_XADD_MINID_STR "MINID"
 #define REDIS_XADD_MAXLEN_APPROX_STR "~"
 #define REDIS_XADD_MAXLEN_BUFFLEN 32
+#define REDIS_XADD_N_FIXED_ARGS 6
+#if ((REDIS_XADD_N_FIXED_ARGS + 2 * REDIS_XADD_MAX_ITEMS) > REDIS_XADD_MAX_ARGS)
+	#error "REDIS_XADD_MAX_ITEMS won't fit in REDIS_XADD_MAX_ARGS!"
+#endif
 
 #define REDIS_XREAD_MAX_ARGS 64
 #define REDIS_XREAD_CMD_STR "XREAD"
 #define REDIS_XREAD_BLOCK_STR "BLOCK"
 #define REDIS_XREAD_COUNT_STR "COUNT"
 #define REDIS_XREAD_STREAMS_STR "STREAMS"
+#define REDIS_XREAD_N_FIXED_ARGS 6
+
+#if ((REDIS_XREAD_N_FIXED_ARGS + (2 * REDIS_XREAD_MAX_STREAMS)) > REDIS_XREAD_MAX_ARGS)
+	#error "REDIS_XREAD_MAX_STREAMS too large for REDIS_XREAD_MAX_ARGS!"
+#endif
 
 #define REDIS_SCAN_BEGIN_ITERATOR "0"
 #define REDIS_SCAN_ITERATOR_BUFFLEN 32
@@ -133,7 +145,13 @@ void redis_print_xread_kv_items(
 //  @brief Handles the response from an xread. Will loop over the streams
 //			and pass along the data from the response to each of the given
 //			callbacks. Will also update the last known ID in the stream infos
-//			s.t. on our next call we get the correct data
+//			s.t. on our next call we get the correct data.
+//
+//			Entries are dispatched deficit-round-robin across the streams:
+//			each round every stream with entries left gets its weight added
+//			to its deficit and delivers that many entries. A stream that's
+//			hit its max_count stops delivering and its last ID is left at
+//			the last entry delivered s.t. the rest come in the next XREAD.
 //
 ////////////////////////////////////////////////////////////////////////////////
 static bool redis_xread_process_response(
@@ -143,9 +161,13 @@ static bool redis_xread_process_response(
 {
 	bool ret_val = false;
 	redisReply *stream_array, *data_array, *data_point;
+	redisReply *pending[REDIS_XREAD_MAX_STREAMS];
+	size_t next_point[REDIS_XREAD_MAX_STREAMS];
+	size_t deficit[REDIS_XREAD_MAX_STREAMS];
 	const char *name;
-	size_t stream, point;
+	size_t stream;
 	int info;
+	int n_pending;
 	struct redis_stream_info *found_info;
 
 	// The first element of the reply should be an array
@@ -154,6 +176,14 @@ static bool redis_xread_process_response(
 		goto done;
 	}
 
+	// Nothing pending on any stream until we find it in the reply
+	for (info = 0; info < n_infos; ++info) {
+		pending[info] = NULL;
+		next_point[info] = 0;
+		deficit[info] = 0;
+	}
+	n_pending = 0;
+
 	// Now, we want to loop over the elements of the array. Each element
 	//	should again be an array where the first item in the array is
 	//	a stream name
@@ -199,44 +229,80 @@ static bool redis_xread_process_response(
 			goto done;
 		}
 
-		// Note how many elements we read
-		found_info->items_read = data_array->elements;
-
-		// Now, we want to loop over the datapoints in the data array
-		for (point = 0; point < data_array->elements; ++point) {
-
-			// Note the data point
-			data_point = data_array->element[point];
-			if (data_point->type != REDIS_REPLY_ARRAY) {
-				fprintf(stderr, "Data point is not an array!\n");
-				goto done;
-			}
+		// Note that the stream has data to dispatch
+		if ((data_array->elements > 0) && (pending[info] == NULL)) {
+			pending[info] = data_array;
+			++n_pending;
+		}
+	}
 
-			// Now, the first item in the array should be a string and the
-			//	second should be an array of data that we'll pass to the
-			//	callback handler. Want to note that we saw this point, since
-			//	even if the handler fails we did process the data
-			if (data_point->element[0]->type != REDIS_REPLY_STRING) {
-				fprintf(stderr, "Item ID is not string!\n");
-				goto done;
-			}
-			// Update the last seen ID for the stream
-			strncpy(found_info->last_id, data_point->element[0]->str,
-				sizeof(found_info->last_id));
+	// Now dispatch the data round-robin until all of the streams are
+	//	either out of data or at their max count
+	while (n_pending > 0) {
+		for (info = 0; info < n_infos; ++info) {
 
-			if (data_point->element[1]->type != REDIS_REPLY_ARRAY) {
-				fprintf(stderr, "Item value is not array!\n");
-				goto done;
+			if (pending[info] == NULL) {
+				continue;
 			}
 
-			// Finally, now that we've verified all of this we're ready to
-			//	go ahead and send the data to the callback
-			if (!found_info->data_cb(
-				data_point->element[0]->str,
-				data_point->element[1],
-				found_info->user_data))
-			{
-				fprintf(stderr, "Failed data callback\n");
+			found_info = &infos[info];
+			data_array = pending[info];
+			deficit[info] += (found_info->weight > 0) ? found_info->weight : 1;
+
+			while (deficit[info] > 0) {
+
+				// If the stream's out of data or at its max count then it's
+				//	done for this XREAD
+				if ((next_point[info] >= data_array->elements) ||
+					((found_info->max_count != REDIS_XREAD_NOMAXCOUNT) &&
+						(found_info->items_read >= found_info->max_count)))
+				{
+					pending[info] = NULL;
+					deficit[info] = 0;
+					--n_pending;
+					break;
+				}
+
+				// Note the data point
+				data_point = data_array->element[next_point[info]];
+				if ((data_point->type != REDIS_REPLY_ARRAY) ||
+					(data_point->elements != 2))
+				{
+					fprintf(stderr, "Data point is not an array!\n");
+					goto done;
+				}
+
+				// Now, the first item in the array should be a string and the
+				//	second should be an array of data that we'll pass to the
+				//	callback handler. Want to note that we saw this point, since
+				//	even if the handler fails we did process the data
+				if (data_point->element[0]->type != REDIS_REPLY_STRING) {
+					fprintf(stderr, "Item ID is not string!\n");
+					goto done;
+				}
+				// Update the last seen ID for the stream
+				strncpy(found_info->last_id, data_point->element[0]->str,
+					sizeof(found_info->last_id));
+
+				if (data_point->element[1]->type != REDIS_REPLY_ARRAY) {
+					fprintf(stderr, "Item value is not array!\n");
+					goto done;
+				}
+
+				// Note that we've used up some of the stream's turn
+				++next_point[info];
+				++found_info->items_read;
+				--deficit[info];
+
+				// Finally, now that we've verified all of this we're ready to
+				//	go ahead and send the data to the callback
+				if (!found_info->data_cb(
+					data_point->element[0]->str,
+					data_point->element[1],
+					found_info->user_data))
+				{
+					fprintf(stderr, "Failed data callback\n");
+				}
 			}
 		}
 	}
@@ -275,6 +341,35 @@ bool redis_xread(
 	bool ret_val = false;
 	int i;
 	struct redisReply *reply;
+	size_t stream_maxcount;
+
+	// Make sure we can fit all of the streams
+	if (n_infos > REDIS_XREAD_MAX_STREAMS) {
+		fprintf(stderr, "Too many streams!\n");
+		goto done;
+	}
+
+	// Nothing read yet on any of the streams
+	for (i = 0; i < n_infos; ++i) {
+		infos[i].items_read = 0;
+	}
+
+	// COUNT in an XREAD is per stream, so if any of the streams have a
+	//	max count then we don't need any more than the largest of them.
+	//	Streams without one are read up to that as well s.t. the caps
+	//	actually bound the reply, and any stream with a smaller max count
+	//	is held to it when we dispatch the reply.
+	stream_maxcount = REDIS_XREAD_NOMAXCOUNT;
+	for (i = 0; i < n_infos; ++i) {
+		if (infos[i].max_count > stream_maxcount) {
+			stream_maxcount = infos[i].max_count;
+		}
+	}
+	if ((stream_maxcount != REDIS_XREAD_NOMAXCOUNT) &&
+		((maxcount == REDIS_XREAD_NOMAXCOUNT) || (stream_maxcount < maxcount)))
+	{
+		maxcount = stream_maxcount;
+	}
 
 	// Put in the XREAD command
 	argv[argc] = REDIS_XREAD_CMD_STR;
@@ -326,11 +421,15 @@ bool redis_xread(
 
 	// Now we should have a constructed XREAD command which we
 	//	can send to redis and then attempt to get the reply
+	ATOM_PROBE3(xread_block, (n_infos > 0) ? infos[0].name : NULL, n_infos,
+		block);
 	reply = redisCommandArgv(ctx, argc, argv, argvlen);
 	if (reply == NULL) {
 		fprintf(stderr, "NULL from redisCommand\n");
 		goto done;
 	}
+	ATOM_PROBE2(xread_wake, (n_infos > 0) ? infos[0].name : NULL,
+		reply->type != REDIS_REPLY_NIL);
 
 	// Otherwise we have a reply. If we timed out then there are no
 	//	callbacks to call so we can just note that. This is an acceptable
@@ -352,6 +451,7 @@ bool redis_xread(
 
 free_reply:
 	freeReplyObject(reply);
+	ATOM_PROBE2(xread_return, (n_infos > 0) ? infos[0].name : NULL, ret_val);
 done:
 	return ret_val;
 }
@@ -520,28 +620,142 @@ done:
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// 	@brief	Adds the array of (key, value) pairs to the redis stream.
-//			Pass maxlen == REDIS_XADD_NO_MAXLEN to not use the maxlen
-//			parameter
+// 	@brief	Gets the most recent entry on each of the streams in a single
+//			round trip. The XREVRANGEs are pipelined inside a MULTI/EXEC
+//			s.t. the entries are a consistent snapshot, nothing can be
+//			written to any of the streams between the reads. The callback
+//			is called with the user data for the stream for each stream
+//			that has an entry, empty streams are skipped.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool redis_xadd(
+bool redis_xrevrange_latest_multi(
 	redisContext *ctx,
+	const char **names,
+	size_t n_names,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	void **user_data)
+{
+	bool ret_val = false;
+	struct redisReply *reply = NULL;
+	struct redisReply *stream_reply, *reply_item;
+	size_t i;
+	int n_ok;
+
+	// Queue up the transaction
+	if (redisAppendCommand(ctx, "MULTI") != REDIS_OK) {
+		fprintf(stderr, "Failed to append MULTI\n");
+		goto done;
+	}
+
+	for (i = 0; i < n_names; ++i) {
+		if (redisAppendCommand(ctx, "XREVRANGE %s + - COUNT 1",
+			names[i]) != REDIS_OK)
+		{
+			fprintf(stderr, "Failed to append XREVRANGE\n");
+			goto done;
+		}
+	}
+
+	if (redisAppendCommand(ctx, "EXEC") != REDIS_OK) {
+		fprintf(stderr, "Failed to append EXEC\n");
+		goto done;
+	}
+
+	// The MULTI and each of the queued commands give back a status. Need
+	//	to read the EXEC reply either way to keep the context in sync.
+	n_ok = redis_pipeline_get_replies(ctx, n_names + 1, REDIS_REPLY_STATUS);
+	if (n_ok < 0) {
+		goto done;
+	}
+
+	if (redisGetReply(ctx, (void**)&reply) != REDIS_OK) {
+		fprintf(stderr, "Failed to get EXEC reply\n");
+		goto done;
+	}
+
+	if (n_ok != (n_names + 1)) {
+		fprintf(stderr, "Failed to queue XREVRANGE %d\n", n_ok - 1);
+		goto free_reply;
+	}
+
+	if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != n_names)) {
+		fprintf(stderr, "EXEC reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Each element of the EXEC reply is the XREVRANGE reply for the stream
+	for (i = 0; i < n_names; ++i) {
+		stream_reply = reply->element[i];
+		if (stream_reply->type != REDIS_REPLY_ARRAY) {
+			fprintf(stderr, "Reply for %s not array!\n", names[i]);
+			goto free_reply;
+		}
+
+		if (stream_reply->elements == 0) {
+			continue;
+		}
+
+		reply_item = stream_reply->element[0];
+		if ((reply_item->type != REDIS_REPLY_ARRAY) ||
+			(reply_item->elements != 2) ||
+			(reply_item->element[0]->type != REDIS_REPLY_STRING) ||
+			(reply_item->element[1]->type != REDIS_REPLY_ARRAY))
+		{
+			fprintf(stderr, "Reply item doesn't have proper data!\n");
+			goto free_reply;
+		}
+
+		if (!data_cb(
+			reply_item->element[0]->str,
+			reply_item->element[1],
+			user_data[i]))
+		{
+			fprintf(stderr, "Data cb failed!\n");
+			goto free_reply;
+		}
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Fills out the argv for an XADD of the array of (key, value) pairs
+//			to the redis stream. The maxlen buffer must remain valid until
+//			the command has been sent/appended. If minid is non-NULL then
+//			the stream is trimmed with MINID instead of MAXLEN. Returns the
+//			number of args or -1 if there are too many (key, value) pairs.
+//
+////////////////////////////////////////////////////////////////////////////////
+static int redis_xadd_init_argv(
 	const char *stream_name,
 	struct redis_xadd_info *infos,
 	size_t info_len,
 	int maxlen,
+	const char *minid,
 	bool approx_maxlen,
-	char ret_id[STREAM_ID_BUFFLEN])
+	const char *argv[REDIS_XADD_MAX_ARGS],
+	size_t argvlen[REDIS_XADD_MAX_ARGS],
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN])
 {
-	struct redisReply *reply;
 	int argc = 0;
-	const char *argv[REDIS_XADD_MAX_ARGS];
-	size_t argvlen[REDIS_XADD_MAX_ARGS];
-	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
 	int maxlen_bytes;
 	int i;
-	bool ret_val = false;
+
+	// Make sure that all of the args will fit
+	if (info_len > REDIS_XADD_MAX_ITEMS) {
+		fprintf(stderr, "Too many XADD items: %lu\n", info_len);
+		return -1;
+	}
 
 	// First, want to put the XADD and stream name
 	argv[argc] = REDIS_XADD_CMD_STR;
@@ -550,8 +764,22 @@ bool redis_xadd(
 	argv[argc] = stream_name;
 	argvlen[argc++] = strlen(stream_name);
 
-	// Now, if we have a max length then we want to use that
-	if (maxlen != REDIS_XADD_NO_MAXLEN) {
+	// Now, if we have a min ID then we want to trim to that. MINID and
+	//	MAXLEN can't both be used in the same XADD.
+	if (minid != NULL) {
+		argv[argc] = REDIS_XADD_MINID_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MINID_STR);
+
+		if (approx_maxlen) {
+			argv[argc] = REDIS_XADD_MAXLEN_APPROX_STR;
+			argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MAXLEN_APPROX_STR);
+		}
+
+		argv[argc] = minid;
+		argvlen[argc++] = strlen(minid);
+
+	// Otherwise, if we have a max length then we want to use that
+	} else if (maxlen != REDIS_XADD_NO_MAXLEN) {
 		argv[argc] = REDIS_XADD_MAXLEN_STR;
 		argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MAXLEN_STR);
 
@@ -594,7 +822,62 @@ bool redis_xadd(
 		fprintf(stderr, "\n");
 	#endif
 
+	return argc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Returns the number of bytes in a command's args, for probes
+//
+////////////////////////////////////////////////////////////////////////////////
+static inline size_t redis_argv_bytes(
+	int argc,
+	const size_t *argvlen)
+{
+	size_t n_bytes = 0;
+	int i;
+
+	for (i = 0; i < argc; ++i) {
+		n_bytes += argvlen[i];
+	}
+
+	return n_bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Adds the array of (key, value) pairs to the redis stream.
+//			Pass maxlen == REDIS_XADD_NO_MAXLEN to not use the maxlen
+//			parameter
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xadd(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	int maxlen,
+	bool approx_maxlen,
+	char ret_id[STREAM_ID_BUFFLEN])
+{
+	struct redisReply *reply;
+	int argc;
+	const char *argv[REDIS_XADD_MAX_ARGS];
+	size_t argvlen[REDIS_XADD_MAX_ARGS];
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
+	int i;
+	bool ret_val = false;
+
+	// Set up the arguments
+	argc = redis_xadd_init_argv(stream_name, infos, info_len, maxlen,
+		NULL, approx_maxlen, argv, argvlen, maxlen_buffer);
+	if (argc < 0) {
+		goto done;
+	}
+
 	// Now we're ready to send the redis command
+	ATOM_PROBE3(xadd_start, stream_name, info_len,
+		redis_argv_bytes(argc, argvlen));
 	reply = redisCommandArgv(ctx, argc, argv, argvlen);
 	if (reply == NULL){
 		fprintf(stderr, "Bad XADD\n");
@@ -623,88 +906,318 @@ bool redis_xadd(
 
 free_reply:
 	freeReplyObject(reply);
+	ATOM_PROBE2(xadd_end, stream_name, ret_val);
 done:
 	return ret_val;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// 	@brief	Calls the callback function for each key that matches the
-//			string passed. Redis supports different types of wildcard/pattern
-//			in the pattern string, mainly '*' for wildcard matching.
-//			See the redis KEYS documentation: https://redis.io/commands/keys
+// 	@brief	Appends an XADD to the context's output buffer without waiting
+//			for the reply. hiredis formats the command immediately so
+//			none of the passed buffers need to outlive this call. The
+//			replies must be collected with redis_pipeline_get_replies().
 //
 ////////////////////////////////////////////////////////////////////////////////
-int redis_get_matching_keys(
+bool redis_xadd_append(
 	redisContext *ctx,
-	const char *pattern,
-	bool (*data_cb)(const char *key, void *user_data),
-	void *user_data)
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	int maxlen,
+	bool approx_maxlen)
 {
-	int n_keys = 0;
-	int i;
-	redisReply *reply = NULL;
-	redisReply *matching_keys;
-	char iterator[REDIS_SCAN_ITERATOR_BUFFLEN];
-	bool first_attempt = true;
-	const char *argv[REDIS_SCAN_N_ARGS];
-	size_t argvlen[REDIS_SCAN_N_ARGS];
+	int argc;
+	const char *argv[REDIS_XADD_MAX_ARGS];
+	size_t argvlen[REDIS_XADD_MAX_ARGS];
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
 
-	// Want to initialize the iterator to the starting iterator
-	memcpy(iterator, REDIS_SCAN_BEGIN_ITERATOR,
-		sizeof(REDIS_SCAN_BEGIN_ITERATOR));
+	// Set up the arguments
+	argc = redis_xadd_init_argv(stream_name, infos, info_len, maxlen,
+		NULL, approx_maxlen, argv, argvlen, maxlen_buffer);
+	if (argc < 0) {
+		return false;
+	}
 
-	// Want to set up the arguments for the SCAN call
-	argv[0] = REDIS_SCAN_CMD_STR;
-	argvlen[0] = CONST_STRLEN(REDIS_SCAN_CMD_STR);
+	// And append them to the output buffer
+	if (redisAppendCommandArgv(ctx, argc, argv, argvlen) != REDIS_OK) {
+		fprintf(stderr, "Failed to append XADD\n");
+		return false;
+	}
 
-	argv[1] = iterator;
-	argvlen[1] = CONST_STRLEN(REDIS_SCAN_BEGIN_ITERATOR);
+	return true;
+}
 
-	argv[2] = REDIS_SCAN_MATCH_STR;
-	argvlen[2] = CONST_STRLEN(REDIS_SCAN_MATCH_STR);
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Appends an XADD that trims everything before minid to the
+//			context's output buffer, and an XTRIM MAXLEN after it if
+//			maxlen is not REDIS_XADD_NO_MAXLEN. Returns the number of
+//			commands appended or -1 if we couldn't append the XADD.
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_xadd_minid_append(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const char *minid,
+	int maxlen,
+	bool approx)
+{
+	int argc;
+	const char *argv[REDIS_XADD_MAX_ARGS];
+	size_t argvlen[REDIS_XADD_MAX_ARGS];
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
 
-	argv[3] = pattern;
-	argvlen[3] = strlen(pattern);
+	// Set up the arguments for the XADD
+	argc = redis_xadd_init_argv(stream_name, infos, info_len,
+		REDIS_XADD_NO_MAXLEN, minid, approx, argv, argvlen, maxlen_buffer);
+	if (argc < 0) {
+		return -1;
+	}
 
+	ATOM_PROBE3(xadd_start, stream_name, info_len,
+		redis_argv_bytes(argc, argvlen));
+	if (redisAppendCommandArgv(ctx, argc, argv, argvlen) != REDIS_OK) {
+		fprintf(stderr, "Failed to append XADD\n");
+		return -1;
+	}
 
-	// Want to keep calling SCAN until we're not on the first attempt
-	//	and the iterator is not equal to the beginning iterator
-	while (first_attempt ||
-		(strcmp(iterator, REDIS_SCAN_BEGIN_ITERATOR) != 0))
+	// And the XTRIM for the ceiling, if there is one
+	if (maxlen == REDIS_XADD_NO_MAXLEN) {
+		return 1;
+	}
+
+	if (redisAppendCommand(ctx, "XTRIM %s MAXLEN %s %d",
+		stream_name, approx ? REDIS_XADD_MAXLEN_APPROX_STR : "=",
+		maxlen) != REDIS_OK)
 	{
-		// Make the call to SCAN
-		reply = redisCommandArgv(ctx, REDIS_SCAN_N_ARGS, argv, argvlen);
-		if (reply == NULL) {
-			fprintf(stderr, "NULL reply!\n");
-			goto done;
-		}
+		fprintf(stderr, "Failed to append XTRIM\n");
+		return -1;
+	}
 
-		// Check the reply type
-		if (reply->type != REDIS_REPLY_ARRAY) {
-			fprintf(stderr, "SCAN return is not an array!\n");
-			goto done;
-		}
+	return 2;
+}
 
-		// The first element in the array is the new iterator
-		if (reply->element[0]->type != REDIS_REPLY_STRING) {
-			fprintf(stderr, "Iterator is not a string!\n");
-			goto done;
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Adds the array of (key, value) pairs to the redis stream and
+//			trims everything before minid. If maxlen is not
+//			REDIS_XADD_NO_MAXLEN then also pipelines an XTRIM MAXLEN
+//			s.t. the stream can't grow past maxlen no matter how far
+//			behind minid is. Needs redis >= 6.2 for MINID.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xadd_minid(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const char *minid,
+	int maxlen,
+	bool approx,
+	char ret_id[STREAM_ID_BUFFLEN])
+{
+	redisReply *reply = NULL;
+	bool ret_val = false;
 
-		// Update the iterator and its length in the argument list
-		strncpy(iterator, reply->element[0]->str, sizeof(iterator));
-		argvlen[1] = strlen(iterator);
+	if (redis_xadd_minid_append(ctx, stream_name, infos, info_len, minid,
+		maxlen, approx) < 0)
+	{
+		goto done;
+	}
 
-		// The second element in the array is an array of strings for the keys
-		matching_keys = reply->element[1];
-		if (matching_keys->type != REDIS_REPLY_ARRAY) {
-			fprintf(stderr, "Key array is not an array!\n");
-			goto done;
-		}
+	// Get the XADD reply with the ID
+	if (redisGetReply(ctx, (void**)&reply) != REDIS_OK) {
+		fprintf(stderr, "Bad XADD\n");
+		goto done;
+	}
 
-		// Now, we want to loop over the keys that we got in the reply
-		for (i = 0; i < matching_keys->elements; ++i) {
+	if (reply->type != REDIS_REPLY_STRING) {
+		fprintf(stderr, "Reply was not string!\n");
+	} else {
+		if (ret_id != NULL) {
+			strncpy(ret_id, reply->str, STREAM_ID_BUFFLEN);
+		}
+		ret_val = true;
+	}
+	freeReplyObject(reply);
+
+	// And the XTRIM reply, which is the number of entries trimmed
+	if ((maxlen != REDIS_XADD_NO_MAXLEN) &&
+		(redis_pipeline_get_replies(ctx, 1, REDIS_REPLY_INTEGER) != 1))
+	{
+		fprintf(stderr, "Bad XTRIM\n");
+		ret_val = false;
+	}
+	ATOM_PROBE2(xadd_end, stream_name, ret_val);
+
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Reads the replies for n pipelined commands. Returns the number
+//			of leading replies that were of the expected type, i.e. the
+//			index of the first failed command, or -1 if we lost the
+//			connection and couldn't read all of the replies. All n replies
+//			are always consumed while the connection is good s.t. the
+//			context stays in sync.
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_pipeline_get_replies(
+	redisContext *ctx,
+	size_t n,
+	int expected_type)
+{
+	redisReply *reply;
+	size_t i;
+	int n_ok = 0;
+	bool all_ok = true;
+
+	for (i = 0; i < n; ++i) {
+
+		// Get the reply. If this fails then the connection is gone
+		if (redisGetReply(ctx, (void**)&reply) != REDIS_OK) {
+			fprintf(stderr, "Failed to get pipelined reply\n");
+			return -1;
+		}
+
+		// Count the leading successes
+		if (all_ok && (reply != NULL) && (reply->type == expected_type)) {
+			++n_ok;
+		} else {
+			all_ok = false;
+		}
+
+		if (reply != NULL) {
+			freeReplyObject(reply);
+		}
+	}
+
+	return n_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Reads the replies for n pipelined commands, noting whether
+//			each one was of the expected type s.t. a failure part way
+//			through doesn't hide the commands after it that succeeded.
+//			Returns the number of replies of the expected type or -1 if
+//			we lost the connection and couldn't read all of the replies.
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_pipeline_get_reply_status(
+	redisContext *ctx,
+	size_t n,
+	int expected_type,
+	bool *ok)
+{
+	redisReply *reply;
+	size_t i;
+	int n_ok = 0;
+
+	for (i = 0; i < n; ++i) {
+
+		// Get the reply. If this fails then the connection is gone
+		if (redisGetReply(ctx, (void**)&reply) != REDIS_OK) {
+			fprintf(stderr, "Failed to get pipelined reply\n");
+			return -1;
+		}
+
+		ok[i] = (reply != NULL) && (reply->type == expected_type);
+		if (ok[i]) {
+			++n_ok;
+		}
+
+		if (reply != NULL) {
+			freeReplyObject(reply);
+		}
+	}
+
+	return n_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Calls the callback function for each key that matches the
+//			string passed. Redis supports different types of wildcard/pattern
+//			in the pattern string, mainly '*' for wildcard matching.
+//			See the redis KEYS documentation: https://redis.io/commands/keys
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_get_matching_keys(
+	redisContext *ctx,
+	const char *pattern,
+	bool (*data_cb)(const char *key, void *user_data),
+	void *user_data)
+{
+	int n_keys = 0;
+	int i;
+	redisReply *reply = NULL;
+	redisReply *matching_keys;
+	char iterator[REDIS_SCAN_ITERATOR_BUFFLEN];
+	bool first_attempt = true;
+	const char *argv[REDIS_SCAN_N_ARGS];
+	size_t argvlen[REDIS_SCAN_N_ARGS];
+
+	// Want to initialize the iterator to the starting iterator
+	memcpy(iterator, REDIS_SCAN_BEGIN_ITERATOR,
+		sizeof(REDIS_SCAN_BEGIN_ITERATOR));
+
+	// Want to set up the arguments for the SCAN call
+	argv[0] = REDIS_SCAN_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_SCAN_CMD_STR);
+
+	argv[1] = iterator;
+	argvlen[1] = CONST_STRLEN(REDIS_SCAN_BEGIN_ITERATOR);
+
+	argv[2] = REDIS_SCAN_MATCH_STR;
+	argvlen[2] = CONST_STRLEN(REDIS_SCAN_MATCH_STR);
+
+	argv[3] = pattern;
+	argvlen[3] = strlen(pattern);
+
+
+	// Want to keep calling SCAN until we're not on the first attempt
+	//	and the iterator is not equal to the beginning iterator
+	while (first_attempt ||
+		(strcmp(iterator, REDIS_SCAN_BEGIN_ITERATOR) != 0))
+	{
+		// Make the call to SCAN
+		reply = redisCommandArgv(ctx, REDIS_SCAN_N_ARGS, argv, argvlen);
+		if (reply == NULL) {
+			fprintf(stderr, "NULL reply!\n");
+			goto done;
+		}
+
+		// Check the reply type
+		if (reply->type != REDIS_REPLY_ARRAY) {
+			fprintf(stderr, "SCAN return is not an array!\n");
+			goto done;
+		}
+
+		// The first element in the array is the new iterator
+		if (reply->element[0]->type != REDIS_REPLY_STRING) {
+			fprintf(stderr, "Iterator is not a string!\n");
+			goto done;
+		}
+
+		// Update the iterator and its length in the argument list
+		strncpy(iterator, reply->element[0]->str, sizeof(iterator));
+		argvlen[1] = strlen(iterator);
+
+		// The second element in the array is an array of strings for the keys
+		matching_keys = reply->element[1];
+		if (matching_keys->type != REDIS_REPLY_ARRAY) {
+			fprintf(stderr, "Key array is not an array!\n");
+			goto done;
+		}
+
+		// Now, we want to loop over the keys that we got in the reply
+		for (i = 0; i < matching_keys->elements; ++i) {
 
 			// Make sure each key is a string
 			if (matching_keys->element[i]->type != REDIS_REPLY_STRING) {
@@ -829,41 +1342,830 @@ void redis_context_cleanup(redisContext * ctx)
 	redisFree(ctx);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Checks to see if a context is usable and if it's not attempts
+//			to reconnect it to the same server it was originally
+//			connected to. Returns true if the context is good to use.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_context_reconnect(redisContext *ctx)
+{
+	if (ctx->err == 0) {
+		return true;
+	}
+
+	if (redisReconnect(ctx) != REDIS_OK) {
+		return false;
+	}
+
+	return (ctx->err == 0);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// 	@brief	Initializes a new stream info. Will set up all of the fields
-//			of the info for use with the XREAD function. If time_ctx is
-//			non-NULL then will quert redis for the current TIME and set the
-//			last_seen_id to the current time. Otherwise will leave the
-//			last_seen_id untouched and the user can choose how to implement
-//			it.
+// 	@brief	Increments an integer key, creating it at 0 if it doesn't
+//			exist. If value is non-NULL then the new value is put there.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool redis_init_stream_info(
+bool redis_incr(
 	redisContext *ctx,
-	struct redis_stream_info *info,
-	const char *name,
-	bool (*data_cb)(
-		const char *id,
-		const struct redisReply *reply,
-		void *user_data),
-	const char *last_id,
-	void *user_data)
+	const char *key,
+	long long *value)
 {
+	redisReply *reply;
 	bool ret_val = false;
-	struct redisReply *reply;
 
-	// Make sure we either got a context or a last_id
-	if ((ctx == NULL) && (last_id == NULL)) {
-		fprintf(stderr, "Either conext or last_id needs to be non-NULL!\n");
+	reply = redisCommand(ctx, "INCR %s", key);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
 		goto done;
 	}
 
-	// Set the name, data callback and user data
-	info->name = name;
-	info->data_cb = data_cb;
-	info->user_data = user_data;
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	if (value != NULL) {
+		*value = reply->integer;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Sets an integer key
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_set_int(
+	redisContext *ctx,
+	const char *key,
+	long long value)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	reply = redisCommand(ctx, "SET %s %lld", key, value);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type != REDIS_REPLY_STATUS) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets an integer key. A key that doesn't exist reads as 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_get_int(
+	redisContext *ctx,
+	const char *key,
+	long long *value)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	reply = redisCommand(ctx, "GET %s", key);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type == REDIS_REPLY_NIL) {
+		*value = 0;
+	} else if (reply->type == REDIS_REPLY_STRING) {
+		*value = strtoll(reply->str, NULL, 10);
+	} else {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Pushes data onto a list and optionally sets it to expire
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_list_push(
+	redisContext *ctx,
+	const char *key,
+	const uint8_t *data,
+	size_t data_len,
+	int ttl_ms)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	if (redisAppendCommand(ctx, "RPUSH %s %b", key, data, data_len) != REDIS_OK) {
+		fprintf(stderr, "Failed to append RPUSH!\n");
+		goto done;
+	}
+
+	if ((ttl_ms > 0) &&
+		(redisAppendCommand(ctx, "PEXPIRE %s %d", key, ttl_ms) != REDIS_OK))
+	{
+		fprintf(stderr, "Failed to append PEXPIRE!\n");
+		goto done;
+	}
+
+	// RPUSH reply
+	if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+	ret_val = (reply->type == REDIS_REPLY_INTEGER);
+	freeReplyObject(reply);
+
+	// PEXPIRE reply
+	if (ttl_ms > 0) {
+		if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+			fprintf(stderr, "Failed to get reply!\n");
+			ret_val = false;
+			goto done;
+		}
+		ret_val = ret_val && (reply->type == REDIS_REPLY_INTEGER);
+		freeReplyObject(reply);
+	}
+
+	if (!ret_val) {
+		fprintf(stderr, "Reply invalid!\n");
+	}
+
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Appends a BLPOP. Redis takes the timeout in seconds.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_append_blpop(
+	redisContext *ctx,
+	const char *key,
+	int timeout_ms)
+{
+	char timeout_str[32];
+
+	snprintf(timeout_str, sizeof(timeout_str), "%d.%03d",
+		timeout_ms / 1000, timeout_ms % 1000);
+
+	if (redisAppendCommand(ctx, "BLPOP %s %s", key, timeout_str) != REDIS_OK) {
+		fprintf(stderr, "Failed to append BLPOP!\n");
+		return false;
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the reply to a BLPOP. A nil reply means we timed out.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_get_blpop_reply(
+	redisContext *ctx,
+	bool (*data_cb)(
+		const uint8_t *data,
+		size_t data_len,
+		void *user_data),
+	void *user_data,
+	bool *popped)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	*popped = false;
+
+	if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type == REDIS_REPLY_NIL) {
+		ret_val = true;
+		goto free_reply;
+	}
+
+	// Reply is the key and then the value
+	if ((reply->type != REDIS_REPLY_ARRAY) ||
+		(reply->elements != 2) ||
+		(reply->element[1]->type != REDIS_REPLY_STRING))
+	{
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	*popped = true;
+	if (!data_cb(
+		(const uint8_t *)reply->element[1]->str,
+		reply->element[1]->len,
+		user_data))
+	{
+		fprintf(stderr, "Data callback failed!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Pops from the head of a list, blocking
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_list_pop(
+	redisContext *ctx,
+	const char *key,
+	int timeout_ms,
+	bool (*data_cb)(
+		const uint8_t *data,
+		size_t data_len,
+		void *user_data),
+	void *user_data,
+	bool *popped)
+{
+	*popped = false;
+
+	if (!redis_append_blpop(ctx, key, timeout_ms)) {
+		return false;
+	}
+
+	return redis_get_blpop_reply(ctx, data_cb, user_data, popped);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Pushes onto one list and then pops from another in one round
+//			trip
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_list_push_pop(
+	redisContext *ctx,
+	const char *push_key,
+	const uint8_t *data,
+	size_t data_len,
+	const char *pop_key,
+	int timeout_ms,
+	bool (*data_cb)(
+		const uint8_t *data,
+		size_t data_len,
+		void *user_data),
+	void *user_data,
+	bool *popped)
+{
+	redisReply *reply;
+	bool push_ok;
+
+	*popped = false;
+
+	if (redisAppendCommand(
+		ctx, "RPUSH %s %b", push_key, data, data_len) != REDIS_OK)
+	{
+		fprintf(stderr, "Failed to append RPUSH!\n");
+		return false;
+	}
+
+	if (!redis_append_blpop(ctx, pop_key, timeout_ms)) {
+		return false;
+	}
+
+	// RPUSH reply. Still need to read the BLPOP reply if it failed
+	//	s.t. the context is left in a good state
+	if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+		fprintf(stderr, "Failed to get reply!\n");
+		return false;
+	}
+	push_ok = (reply->type == REDIS_REPLY_INTEGER);
+	freeReplyObject(reply);
+
+	if (!redis_get_blpop_reply(ctx, data_cb, user_data, popped)) {
+		return false;
+	}
+
+	if (!push_ok) {
+		fprintf(stderr, "Reply invalid!\n");
+	}
+
+	return push_ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Publishes a message on a pub/sub channel
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_publish(
+	redisContext *ctx,
+	const char *channel,
+	const uint8_t *data,
+	size_t data_len,
+	long long *n_subscribers)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	reply = redisCommand(ctx, "PUBLISH %s %b", channel, data, data_len);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	if (n_subscribers != NULL) {
+		*n_subscribers = reply->integer;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Checks that a subscribe mode reply is an array of the
+//			expected kind, i.e. message, subscribe or unsubscribe
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_check_push(
+	const redisReply *reply,
+	const char *kind)
+{
+	return (reply->type == REDIS_REPLY_ARRAY) &&
+		(reply->elements == 3) &&
+		(reply->element[0]->type == REDIS_REPLY_STRING) &&
+		!strcmp(reply->element[0]->str, kind);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Subscribes to a set of channels. Pipelines the SUBSCRIBE and
+//			then waits for redis to confirm each channel.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_subscribe(
+	redisContext *ctx,
+	const char **channels,
+	size_t n_channels)
+{
+	redisReply *reply;
+	const char **argv;
+	size_t *argvlen;
+	size_t i;
+	bool ret_val = false;
+
+	argv = malloc((n_channels + 1) * sizeof(const char *));
+	argvlen = malloc((n_channels + 1) * sizeof(size_t));
+	if ((argv == NULL) || (argvlen == NULL)) {
+		fprintf(stderr, "Failed to allocate SUBSCRIBE args!\n");
+		goto done;
+	}
+
+	argv[0] = "SUBSCRIBE";
+	argvlen[0] = CONST_STRLEN("SUBSCRIBE");
+	for (i = 0; i < n_channels; ++i) {
+		argv[i + 1] = channels[i];
+		argvlen[i + 1] = strlen(channels[i]);
+	}
+
+	if (redisAppendCommandArgv(
+		ctx, n_channels + 1, argv, argvlen) != REDIS_OK)
+	{
+		fprintf(stderr, "Failed to append SUBSCRIBE!\n");
+		goto done;
+	}
+
+	// One confirmation per channel
+	for (i = 0; i < n_channels; ++i) {
+		if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+			fprintf(stderr, "Failed to get reply!\n");
+			goto done;
+		}
+
+		if (!redis_check_push(reply, "subscribe")) {
+			fprintf(stderr, "Reply invalid!\n");
+			freeReplyObject(reply);
+			goto done;
+		}
+		freeReplyObject(reply);
+	}
+
+	// Note the success
+	ret_val = true;
+
+done:
+	free(argv);
+	free(argvlen);
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Unsubscribes from all channels. Redis confirms each channel
+//			with the number still subscribed, we're done at 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_unsubscribe(
+	redisContext *ctx)
+{
+	redisReply *reply;
+	bool done = false;
+
+	if (redisAppendCommand(ctx, "UNSUBSCRIBE") != REDIS_OK) {
+		fprintf(stderr, "Failed to append UNSUBSCRIBE!\n");
+		return false;
+	}
+
+	while (!done) {
+		if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+			fprintf(stderr, "Failed to get reply!\n");
+			return false;
+		}
+
+		done = redis_check_push(reply, "unsubscribe") &&
+			(reply->element[2]->type == REDIS_REPLY_INTEGER) &&
+			(reply->element[2]->integer == 0);
+		freeReplyObject(reply);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the next message on a subscribed channel
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_get_message(
+	redisContext *ctx,
+	bool (*message_cb)(
+		const char *channel,
+		const uint8_t *data,
+		size_t data_len,
+		void *user_data),
+	void *user_data)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (!redis_check_push(reply, "message") ||
+		(reply->element[2]->type != REDIS_REPLY_STRING))
+	{
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	if (!message_cb(
+		reply->element[1]->str,
+		(const uint8_t *)reply->element[2]->str,
+		reply->element[2]->len,
+		user_data))
+	{
+		fprintf(stderr, "Message callback failed!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Sets a field in a hash
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_hash_set(
+	redisContext *ctx,
+	const char *key,
+	const char *field,
+	const char *value)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	reply = redisCommand(ctx, "HSET %s %s %s", key, field, value);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	// Reply is the number of new fields
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Removes a field from a hash. Not an error if it isn't there.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_hash_del(
+	redisContext *ctx,
+	const char *key,
+	const char *field)
+{
+	redisReply *reply;
+	bool ret_val = false;
+
+	reply = redisCommand(ctx, "HDEL %s %s", key, field);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	// Reply is the number of fields removed
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Calls the callback with each (field, value) in a hash. Returns
+//			the number of fields or -1 on error. A missing key is an
+//			empty hash.
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_hash_get_all(
+	redisContext *ctx,
+	const char *key,
+	bool (*data_cb)(const char *field, const char *value, void *user_data),
+	void *user_data)
+{
+	redisReply *reply;
+	int ret_val = -1;
+	size_t i;
+
+	reply = redisCommand(ctx, "HGETALL %s", key);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Reply is a flat array of field, value
+	for (i = 0; (i + 1) < reply->elements; i += 2) {
+		if ((reply->element[i]->type != REDIS_REPLY_STRING) ||
+			(reply->element[i + 1]->type != REDIS_REPLY_STRING))
+		{
+			fprintf(stderr, "Hash item invalid!\n");
+			goto free_reply;
+		}
+
+		if (!data_cb(
+			reply->element[i]->str,
+			reply->element[i + 1]->str,
+			user_data))
+		{
+			fprintf(stderr, "Data cb failed!\n");
+			goto free_reply;
+		}
+	}
+
+	// Note the success
+	ret_val = reply->elements / 2;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Calls the callback with each (field, value) in each of a set of
+//			hashes. All of the HGETALLs go out in one pipeline. Returns
+//			the number of fields over all of the hashes or -1 on error.
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_hash_get_all_multi(
+	redisContext *ctx,
+	const char * const *keys,
+	size_t n_keys,
+	bool (*data_cb)(
+		size_t key_idx,
+		const char *field,
+		const char *value,
+		void *user_data),
+	void *user_data)
+{
+	redisReply *reply;
+	int ret_val = 0;
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < n_keys; ++i) {
+		if (redisAppendCommand(ctx, "HGETALL %s", keys[i]) != REDIS_OK) {
+			fprintf(stderr, "Failed to append HGETALL\n");
+			return -1;
+		}
+	}
+
+	// Read all of the replies, even after a failure, s.t. the context
+	//	stays in sync
+	for (i = 0; i < n_keys; ++i) {
+		if (redisGetReply(ctx, (void**)&reply) != REDIS_OK) {
+			fprintf(stderr, "Failed to get pipelined reply\n");
+			return -1;
+		}
+
+		if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY)) {
+			fprintf(stderr, "Reply invalid!\n");
+			ret_val = -1;
+		}
+
+		// Reply is a flat array of field, value
+		for (j = 0; (ret_val >= 0) && ((j + 1) < reply->elements); j += 2) {
+			if ((reply->element[j]->type != REDIS_REPLY_STRING) ||
+				(reply->element[j + 1]->type != REDIS_REPLY_STRING))
+			{
+				fprintf(stderr, "Hash item invalid!\n");
+				ret_val = -1;
+			} else if (!data_cb(
+				i,
+				reply->element[j]->str,
+				reply->element[j + 1]->str,
+				user_data))
+			{
+				fprintf(stderr, "Data cb failed!\n");
+				ret_val = -1;
+			} else {
+				++ret_val;
+			}
+		}
+
+		if (reply != NULL) {
+			freeReplyObject(reply);
+		}
+	}
+
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the replication state of the server from INFO replication.
+//			The reply is a bulk string of "field:value" lines.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_get_replication_info(
+	redisContext *ctx,
+	struct redis_replication_info *info)
+{
+	redisReply *reply;
+	bool ret_val = false;
+	const char *offset_field;
+	const char *field;
+
+	reply = redisCommand(ctx, "INFO replication");
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type != REDIS_REPLY_STRING) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Figure out which side of replication we're on
+	info->is_replica = (strstr(reply->str, "role:slave") != NULL);
+	info->link_up = (strstr(reply->str, "master_link_status:up") != NULL);
+
+	// And get the offset
+	offset_field = info->is_replica ? "slave_repl_offset:" : "master_repl_offset:";
+	field = strstr(reply->str, offset_field);
+	if (field == NULL) {
+		fprintf(stderr, "Missing %s in INFO\n", offset_field);
+		goto free_reply;
+	}
+	info->offset = strtoll(field + strlen(offset_field), NULL, 10);
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Initializes a new stream info. Will set up all of the fields
+//			of the info for use with the XREAD function. If time_ctx is
+//			non-NULL then will quert redis for the current TIME and set the
+//			last_seen_id to the current time. Otherwise will leave the
+//			last_seen_id untouched and the user can choose how to implement
+//			it.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_init_stream_info(
+	redisContext *ctx,
+	struct redis_stream_info *info,
+	const char *name,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	const char *last_id,
+	void *user_data)
+{
+	bool ret_val = false;
+	struct redisReply *reply;
+
+	// Make sure we either got a context or a last_id
+	if ((ctx == NULL) && (last_id == NULL)) {
+		fprintf(stderr, "Either conext or last_id needs to be non-NULL!\n");
+		goto done;
+	}
+
+	// Set the name, data callback and user data
+	info->name = name;
+	info->data_cb = data_cb;
+	info->user_data = user_data;
+
+	// Default scheduling
+	info->items_read = 0;
+	info->weight = REDIS_STREAM_DEFAULT_WEIGHT;
+	info->max_count = REDIS_XREAD_NOMAXCOUNT;
 
 	// Prefer to use the last ID.
 	if (last_id != NULL) {
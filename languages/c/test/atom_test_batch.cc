@@ -0,0 +1,57 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file atom_test_batch.cc
+//
+//  @brief Tests for the command batch encoding
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <gtest/gtest.h>
+#include <string.h>
+#include <stdlib.h>
+#include "atom.h"
+#include "element_command_batch.h"
+
+// Makes sure that requests and responses come back out the way they went in
+TEST(AtomBatchTest, round_trip) {
+	struct element_command_batch_item items[3];
+	struct element_command_batch_item parsed[3];
+	const char *data = "some data";
+	uint8_t *buf;
+	size_t len;
+
+	memset(items, 0, sizeof(items));
+	items[0].name = "hello";
+	items[0].name_len = strlen("hello");
+	items[1].name = "echo";
+	items[1].name_len = strlen("echo");
+	items[1].data = (const uint8_t *)data;
+	items[1].data_len = strlen(data);
+	items[2].name = "fail";
+	items[2].name_len = strlen("fail");
+	items[2].err_code = ATOM_USER_ERRORS_BEGIN + 1;
+
+	// Requests carry names and data
+	buf = element_command_batch_encode(items, 3, false, &len);
+	ASSERT_NE(buf, (uint8_t *)NULL);
+	ASSERT_EQ(element_command_batch_parse(buf, len, false, parsed, 3), 3);
+	EXPECT_EQ(std::string(parsed[0].name, parsed[0].name_len), "hello");
+	EXPECT_EQ(parsed[0].data_len, 0U);
+	EXPECT_EQ(std::string(parsed[1].name, parsed[1].name_len), "echo");
+	EXPECT_EQ(std::string((const char *)parsed[1].data, parsed[1].data_len), data);
+
+	// Too many items or a truncated batch are both errors
+	EXPECT_EQ(element_command_batch_parse(buf, len, false, parsed, 2), -1);
+	EXPECT_EQ(element_command_batch_parse(buf, len - 1, false, parsed, 3), -1);
+	free(buf);
+
+	// Responses carry errors and data
+	buf = element_command_batch_encode(items, 3, true, &len);
+	ASSERT_NE(buf, (uint8_t *)NULL);
+	ASSERT_EQ(element_command_batch_parse(buf, len, true, parsed, 3), 3);
+	EXPECT_EQ(parsed[0].err_code, ATOM_NO_ERROR);
+	EXPECT_EQ(std::string((const char *)parsed[1].data, parsed[1].data_len), data);
+	EXPECT_EQ(parsed[2].err_code, ATOM_USER_ERRORS_BEGIN + 1);
+	free(buf);
+}
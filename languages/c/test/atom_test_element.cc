@@ -9,12 +9,17 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <gtest/gtest.h>
 #include <string.h>
+#include <stdlib.h>
 #include <list>
 #include <hiredis/hiredis.h>
 #include "atom.h"
 #include "redis.h"
 #include "element.h"
 
+// Stream the batching test writes to. Its IDs are in the future so it
+//	has to be gone before and after the test, even if the test fails.
+#define TEST_BATCH_STREAM "stream:test_element:batch"
+
 //
 // Tests for valid element names
 //
@@ -29,14 +34,24 @@ protected:
 		ctx = redisConnectUnix("/shared/redis.sock");
 		elem = element_init(ctx, "test_element");
 		ASSERT_NE(elem, (struct element *)NULL);
+		delete_key(TEST_BATCH_STREAM);
 	};
 
 	virtual void TearDown() {
+		delete_key(TEST_BATCH_STREAM);
 		element_cleanup(ctx, elem);
 		redisFree(ctx);
 		ctx = NULL;
 		elem = NULL;
 	};
+
+	// Deletes a key, if it's there
+	void delete_key(const char *key) {
+		redisReply *reply = (redisReply *)redisCommand(ctx, "DEL %s", key);
+		if (reply != NULL) {
+			freeReplyObject(reply);
+		}
+	}
 };
 
 // Tests the SetUp and TearDown functions which
@@ -47,3 +62,111 @@ protected:
 TEST_F(AtomElementTest, setup_teardown) {
 	ASSERT_EQ(1, 1);
 }
+
+static bool batch_read_cb(
+	const char *id,
+	const struct redis_xread_kv_item *kv_items,
+	int n_kv_items,
+	void *user_data)
+{
+	*(int *)user_data += 1;
+	return true;
+}
+
+// Tests that the read loop grows the COUNT while it's behind and drops
+//	it back down once it's caught up
+TEST_F(AtomElementTest, read_loop_adaptive_batching) {
+	struct element_entry_read_info info;
+	struct element_entry_read_batching batching;
+	struct redis_xread_kv_item kv_item;
+	redisReply *reply;
+	int n_read = 0;
+
+	// Write the entries in the future s.t. they're after the
+	//	loop's starting ID
+	reply = (redisReply *)redisCommand(ctx, "TIME");
+	ASSERT_NE(reply, (redisReply *)NULL);
+	long long future_ms = (atoll(reply->element[0]->str) + 60) * 1000;
+	freeReplyObject(reply);
+	for (int i = 0; i < 8; ++i) {
+		reply = (redisReply *)redisCommand(ctx,
+			"XADD %s %lld-%d foo bar", TEST_BATCH_STREAM, future_ms, i);
+		ASSERT_NE(reply, (redisReply *)NULL);
+		ASSERT_NE(reply->type, REDIS_REPLY_ERROR);
+		freeReplyObject(reply);
+	}
+
+	kv_item.key = "foo";
+	kv_item.key_len = strlen("foo");
+
+	memset(&info, 0, sizeof(info));
+	info.element = "test_element";
+	info.stream = "batch";
+	info.kv_items = &kv_item;
+	info.n_kv_items = 1;
+	info.user_data = &n_read;
+	info.response_cb = batch_read_cb;
+	info.items_to_read = 8;
+
+	element_entry_read_batching_init(&batching, 1, 4, ELEMENT_ENTRY_READ_BATCHING_NO_SPIN);
+
+	ASSERT_EQ(element_entry_read_loop_adaptive(
+		ctx, elem, &info, 1, false, ELEMENT_ENTRY_READ_LOOP_FOREVER, &batching),
+		ATOM_NO_ERROR);
+
+	// Should have read 1, 2, 4 then the last 1 and be caught up
+	EXPECT_EQ(n_read, 8);
+	EXPECT_EQ(batching.entries, 8U);
+	EXPECT_EQ(batching.block_reads, 4U);
+	EXPECT_EQ(batching.count, 1U);
+}
+
+// Tests that the writer trims at the slowest durable consumer and that
+//	the age and size ceilings hold regardless
+TEST_F(AtomElementTest, consumer_aware_trim) {
+	struct element_entry_trim trim;
+	struct redis_xadd_info item;
+
+	item.key = "foo";
+	item.key_len = strlen("foo");
+	item.data = (const uint8_t *)"0123456";
+	item.data_len = strlen("0123456");
+
+	ASSERT_EQ(element_entry_trim_report(
+		ctx, "test_element", "trim", "fast", "2000-5"), ATOM_NO_ERROR);
+	ASSERT_EQ(element_entry_trim_report(
+		ctx, "test_element", "trim", "slow", "1000-3"), ATOM_NO_ERROR);
+
+	// No age ceiling, so trim at the slow consumer. 100 bytes of
+	//	10 byte entries is 10 entries.
+	element_entry_trim_init(&trim, ELEMENT_ENTRY_TRIM_NO_MAX_AGE, 100, 0);
+	element_entry_trim_update(
+		ctx, &trim, "stream:test_element:trim", &item, 1, 1024);
+	EXPECT_EQ(trim.n_consumers, 2U);
+	EXPECT_STREQ(trim.minid, "1000-3");
+	EXPECT_EQ(trim.maxlen, 10);
+
+	// Once the slow consumer is gone it's the fast one
+	ASSERT_EQ(element_entry_trim_unregister(
+		ctx, "test_element", "trim", "slow"), ATOM_NO_ERROR);
+	element_entry_trim_update(
+		ctx, &trim, "stream:test_element:trim", &item, 1, 1024);
+	EXPECT_STREQ(trim.minid, "2000-5");
+
+	// The consumer is way too far behind for a 1 minute age ceiling
+	element_entry_trim_init(&trim, 60000, ELEMENT_ENTRY_TRIM_NO_MAX_BYTES, 0);
+	element_entry_trim_update(
+		ctx, &trim, "stream:test_element:trim", &item, 1, 1024);
+	EXPECT_STRNE(trim.minid, "2000-5");
+	EXPECT_EQ(trim.maxlen, REDIS_XADD_NO_MAXLEN);
+
+	// And with no consumers and no ceilings it's the usual MAXLEN
+	ASSERT_EQ(element_entry_trim_unregister(
+		ctx, "test_element", "trim", "fast"), ATOM_NO_ERROR);
+	element_entry_trim_init(&trim, ELEMENT_ENTRY_TRIM_NO_MAX_AGE,
+		ELEMENT_ENTRY_TRIM_NO_MAX_BYTES, 0);
+	element_entry_trim_update(
+		ctx, &trim, "stream:test_element:trim", &item, 1, 1024);
+	EXPECT_STREQ(trim.minid, "");
+	EXPECT_EQ(trim.maxlen, 1024);
+}
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file atom_test_ephemeral.cc
+//
+//  @brief Tests for the ephemeral entry encoding
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <gtest/gtest.h>
+#include <string.h>
+#include <stdlib.h>
+#include <hiredis/hiredis.h>
+#include "atom.h"
+#include "redis.h"
+#include "element_entry_ephemeral.h"
+
+// Makes sure that an entry decodes into the same key, value array that
+//	XREAD would give us
+TEST(AtomEphemeralTest, round_trip) {
+	struct redis_xadd_info items[2];
+	struct element_entry_ephemeral_entry entry;
+	struct element_entry_ephemeral_ids ids;
+	char id[STREAM_ID_BUFFLEN];
+	uint8_t *buf;
+	size_t len;
+
+	memset(&ids, 0, sizeof(ids));
+	element_entry_ephemeral_next_id(&ids, id);
+
+	items[0].key = "foo";
+	items[0].key_len = strlen("foo");
+	items[0].data = (const uint8_t *)"hello";
+	items[0].data_len = strlen("hello");
+	items[1].key = "bar";
+	items[1].key_len = strlen("bar");
+	items[1].data = NULL;
+	items[1].data_len = 0;
+
+	buf = element_entry_ephemeral_encode(id, items, 2, &len);
+	ASSERT_NE(buf, (uint8_t *)NULL);
+	ASSERT_TRUE(element_entry_ephemeral_decode(buf, len, &entry));
+
+	EXPECT_STREQ(entry.id, id);
+	ASSERT_EQ(entry.reply.type, REDIS_REPLY_ARRAY);
+	ASSERT_EQ(entry.reply.elements, 4U);
+	EXPECT_STREQ(entry.reply.element[0]->str, "foo");
+	EXPECT_STREQ(entry.reply.element[1]->str, "hello");
+	EXPECT_EQ(entry.reply.element[1]->len, strlen("hello"));
+	EXPECT_STREQ(entry.reply.element[2]->str, "bar");
+	EXPECT_EQ(entry.reply.element[3]->len, 0U);
+
+	// A truncated entry doesn't decode
+	EXPECT_FALSE(element_entry_ephemeral_decode(buf, len - 1, &entry));
+	free(buf);
+}
+
+// Makes sure that we won't encode an entry with more keys than a reader
+//	will decode
+TEST(AtomEphemeralTest, max_keys) {
+	struct redis_xadd_info items[ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS + 1];
+	char id[STREAM_ID_BUFFLEN] = "1-0";
+	uint8_t *buf;
+	size_t len;
+
+	for (int i = 0; i <= ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS; ++i) {
+		items[i].key = "foo";
+		items[i].key_len = strlen("foo");
+		items[i].data = NULL;
+		items[i].data_len = 0;
+	}
+
+	buf = element_entry_ephemeral_encode(
+		id, items, ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS, &len);
+	ASSERT_NE(buf, (uint8_t *)NULL);
+	free(buf);
+
+	EXPECT_EQ(element_entry_ephemeral_encode(
+		id, items, ELEMENT_ENTRY_EPHEMERAL_MAX_KEYS + 1, &len),
+		(uint8_t *)NULL);
+}
+
+// Makes sure that IDs always go up
+TEST(AtomEphemeralTest, ids) {
+	struct element_entry_ephemeral_ids ids;
+	char first[STREAM_ID_BUFFLEN];
+	char second[STREAM_ID_BUFFLEN];
+
+	memset(&ids, 0, sizeof(ids));
+	element_entry_ephemeral_next_id(&ids, first);
+	ids.last_ms += 1000;
+	element_entry_ephemeral_next_id(&ids, second);
+
+	EXPECT_STRNE(first, second);
+	EXPECT_EQ(ids.seq, 1U);
+	EXPECT_EQ(strchr(second, '-')[1], '1');
+}
@@ -0,0 +1,152 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file atom_test_freshness.cc
+//
+//  @brief Tests for entry freshness tracking
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <gtest/gtest.h>
+#include <string.h>
+#include <time.h>
+#include <hiredis/hiredis.h>
+#include "atom.h"
+#include "redis.h"
+#include "element_entry_freshness.h"
+
+class AtomFreshnessTest : public testing::Test
+{
+
+protected:
+	struct element_entry_freshness freshness;
+	redisReply key;
+	redisReply value;
+	redisReply *kv[2];
+	redisReply reply;
+	char value_str[64];
+	size_t n_violations;
+
+	virtual void SetUp() {
+		n_violations = 0;
+		memset(&key, 0, sizeof(key));
+		memset(&value, 0, sizeof(value));
+		memset(&reply, 0, sizeof(reply));
+		key.type = REDIS_REPLY_STRING;
+		key.str = (char*)DATA_KEY_TIMESTAMP_STR;
+		key.len = strlen(DATA_KEY_TIMESTAMP_STR);
+		value.type = REDIS_REPLY_STRING;
+		value.str = value_str;
+		kv[0] = &key;
+		kv[1] = &value;
+		reply.type = REDIS_REPLY_ARRAY;
+		reply.element = kv;
+		reply.elements = 2;
+	};
+
+	// Returns the current time in milliseconds since the epoch
+	uint64_t now_ms() {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		return ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+	}
+
+	// Sets the producer timestamp on the entry
+	void set_timestamp(const char *fmt, uint64_t ts) {
+		value.len = snprintf(value_str, sizeof(value_str), fmt, ts);
+	}
+
+	static void violation_cb(const char *id, uint64_t age_us, void *user_data) {
+		((AtomFreshnessTest *)user_data)->n_violations += 1;
+	}
+};
+
+// Makes sure that the age from the ID and from the producer timestamp
+//	land in the right place
+TEST_F(AtomFreshnessTest, ages) {
+	char id[64];
+
+	element_entry_freshness_init(
+		&freshness, ELEMENT_ENTRY_FRESHNESS_NO_BUDGET, NULL, NULL);
+
+	// Entry that landed in redis 1s ago and was produced 2s ago, with the
+	//	timestamp in milliseconds
+	snprintf(id, sizeof(id), "%lu-0", now_ms() - 1000);
+	set_timestamp("%lu", now_ms() - 2000);
+	element_entry_freshness_record(&freshness, id, &reply);
+
+	EXPECT_EQ(freshness.redis_age.count, 1U);
+	EXPECT_GE(freshness.redis_age.max_us, 1000000U);
+	EXPECT_LT(freshness.redis_age.max_us, 1500000U);
+	EXPECT_EQ(freshness.producer_age.count, 1U);
+	EXPECT_GE(freshness.producer_age.max_us, 2000000U);
+	EXPECT_LT(freshness.producer_age.max_us, 2500000U);
+
+	// Same but with the timestamp in seconds
+	set_timestamp("%lu", (now_ms() / 1000) - 10);
+	element_entry_freshness_record(&freshness, id, &reply);
+	EXPECT_EQ(freshness.producer_age.count, 2U);
+	EXPECT_GE(freshness.producer_age.max_us, 9000000U);
+	EXPECT_LT(freshness.producer_age.max_us, 12000000U);
+
+	// And an entry with no timestamp only counts towards the redis age
+	element_entry_freshness_record(&freshness, id, NULL);
+	EXPECT_EQ(freshness.redis_age.count, 3U);
+	EXPECT_EQ(freshness.producer_age.count, 2U);
+
+	// Everything should be in the [2^19, 2^20) us bucket
+	EXPECT_EQ(element_entry_freshness_percentile(&freshness.redis_age, 50),
+		(1ULL << 20) - 1);
+}
+
+// Makes sure that the violation callback is called for entries
+//	over budget only
+TEST_F(AtomFreshnessTest, budget) {
+	char id[64];
+
+	element_entry_freshness_init(&freshness, 500000, violation_cb, this);
+
+	snprintf(id, sizeof(id), "%lu-0", now_ms());
+	element_entry_freshness_record(&freshness, id, NULL);
+	EXPECT_EQ(n_violations, 0U);
+
+	snprintf(id, sizeof(id), "%lu-0", now_ms() - 1000);
+	element_entry_freshness_record(&freshness, id, NULL);
+	EXPECT_EQ(n_violations, 1U);
+	EXPECT_EQ(freshness.violations, 1U);
+
+	// The producer timestamp takes precedence when it's there
+	set_timestamp("%lu", now_ms());
+	element_entry_freshness_record(&freshness, id, &reply);
+	EXPECT_EQ(n_violations, 1U);
+}
+
+// Makes sure that a snapshot carries the stats and that a reset clears
+//	them without needing the tracker to be initialized again
+TEST_F(AtomFreshnessTest, snapshot_reset) {
+	struct element_entry_freshness snapshot;
+	char id[64];
+
+	element_entry_freshness_init(&freshness, 500000, violation_cb, this);
+
+	snprintf(id, sizeof(id), "%lu-0", now_ms() - 1000);
+	element_entry_freshness_record(&freshness, id, NULL);
+	element_entry_freshness_record(&freshness, id, NULL);
+
+	element_entry_freshness_snapshot(&freshness, &snapshot);
+	EXPECT_EQ(snapshot.redis_age.count, 2U);
+	EXPECT_EQ(snapshot.violations, 2U);
+	element_entry_freshness_cleanup(&snapshot);
+
+	element_entry_freshness_reset(
+		&freshness, ELEMENT_ENTRY_FRESHNESS_NO_BUDGET, NULL, NULL);
+	EXPECT_EQ(freshness.redis_age.count, 0U);
+	EXPECT_EQ(freshness.violations, 0U);
+
+	element_entry_freshness_record(&freshness, id, NULL);
+	EXPECT_EQ(freshness.redis_age.count, 1U);
+	EXPECT_EQ(freshness.violations, 0U);
+	EXPECT_EQ(n_violations, 2U);
+
+	element_entry_freshness_cleanup(&freshness);
+}
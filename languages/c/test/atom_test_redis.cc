@@ -239,3 +239,85 @@ TEST_F(AtomRedisTest, multiple_streams_multiple_elements_with_filter) {
 		"hello"
 	});
 }
+
+// Records which stream each XREAD callback came from
+struct xread_order_data {
+	std::vector<std::string> *order;
+	std::string name;
+};
+
+static bool xread_order_cb(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	struct xread_order_data *data = (struct xread_order_data *)user_data;
+	data->order->push_back(data->name);
+	return true;
+}
+
+// Tests that a quiet stream isn't stuck behind a noisy one in the same
+//	XREAD and that max_count holds a stream to its count
+TEST_F(AtomRedisTest, xread_fair_dispatch) {
+	std::vector<std::string> order;
+	struct xread_order_data noisy_data = { &order, "noisy" };
+	struct xread_order_data quiet_data = { &order, "quiet" };
+	struct redis_stream_info infos[2];
+
+	for (int i = 0; i < 10; ++i) {
+		add_stream("stream:noisy");
+	}
+	add_stream("stream:quiet");
+
+	ASSERT_TRUE(redis_init_stream_info(
+		ctx, &infos[0], "stream:noisy", xread_order_cb, "0", &noisy_data));
+	ASSERT_TRUE(redis_init_stream_info(
+		ctx, &infos[1], "stream:quiet", xread_order_cb, "0", &quiet_data));
+	infos[0].max_count = 4;
+	infos[1].weight = 2;
+
+	// Quiet entry should go out in the first round
+	ASSERT_TRUE(redis_xread(ctx, infos, 2, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	ASSERT_EQ(order, std::vector<std::string>({"noisy", "quiet", "noisy", "noisy", "noisy"}));
+	EXPECT_EQ(infos[0].items_read, 4U);
+	EXPECT_EQ(infos[1].items_read, 1U);
+
+	// And the rest of the noisy entries come in the following reads
+	order.clear();
+	ASSERT_TRUE(redis_xread(ctx, infos, 2, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	EXPECT_EQ(infos[0].items_read, 4U);
+	EXPECT_EQ(infos[1].items_read, 0U);
+	ASSERT_TRUE(redis_xread(ctx, infos, 2, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	EXPECT_EQ(infos[0].items_read, 2U);
+	EXPECT_EQ(order.size(), 6U);
+}
+
+// Tests that a capped stream bounds the XREAD for an uncapped one as well
+TEST_F(AtomRedisTest, xread_max_count_bounds_uncapped) {
+	std::vector<std::string> order;
+	struct xread_order_data capped_data = { &order, "capped" };
+	struct xread_order_data uncapped_data = { &order, "uncapped" };
+	struct redis_stream_info infos[2];
+
+	for (int i = 0; i < 5; ++i) {
+		add_stream("stream:capped");
+		add_stream("stream:uncapped");
+	}
+
+	ASSERT_TRUE(redis_init_stream_info(
+		ctx, &infos[0], "stream:capped", xread_order_cb, "0", &capped_data));
+	ASSERT_TRUE(redis_init_stream_info(
+		ctx, &infos[1], "stream:uncapped", xread_order_cb, "0", &uncapped_data));
+	infos[0].max_count = 2;
+
+	ASSERT_TRUE(redis_xread(ctx, infos, 2, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	EXPECT_EQ(infos[0].items_read, 2U);
+	EXPECT_EQ(infos[1].items_read, 2U);
+
+	// Nothing's lost, the uncapped stream just takes more reads
+	ASSERT_TRUE(redis_xread(ctx, infos, 2, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	ASSERT_TRUE(redis_xread(ctx, infos, 2, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	EXPECT_EQ(infos[0].items_read, 1U);
+	EXPECT_EQ(infos[1].items_read, 1U);
+	EXPECT_EQ(order.size(), 10U);
+}
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file atom_test_slow_op.cc
+//
+//  @brief Tests for the slow operation journal
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "atom.h"
+#include "element_slow_op.h"
+
+// Makes sure only slow ops are kept, that the ring keeps the newest ones
+//	and that the phases are split where the op said
+TEST(AtomSlowOpTest, journal) {
+	struct element_slow_op ops[8];
+	uint64_t now;
+	char line[256];
+	size_t n;
+
+	ASSERT_TRUE(element_slow_op_enable(4, 10000));
+	ASSERT_TRUE(element_slow_op_on);
+
+	// Fast ops don't make it in
+	now = element_slow_op_now_us();
+	element_slow_op_finish(
+		ELEMENT_SLOW_OP_ENTRY_WRITE, "fast", now, 0, 10, 0);
+	n = element_slow_op_get(ops, 8);
+	for (size_t i = 0; i < n; ++i) {
+		EXPECT_STRNE(ops[i].name, "fast");
+	}
+
+	// Slow ones do, and the oldest drop out once the ring is full
+	for (int i = 0; i < 6; ++i) {
+		now = element_slow_op_now_us();
+		element_slow_op_finish(
+			ELEMENT_SLOW_OP_COMMAND_SEND,
+			std::to_string(i).c_str(),
+			now - 50000,
+			now - 20000,
+			i,
+			2 * i);
+	}
+
+	n = element_slow_op_get(ops, 8);
+	ASSERT_EQ(n, 4U);
+	ASSERT_EQ(element_slow_op_count(), 4U);
+	for (int i = 0; i < 4; ++i) {
+		EXPECT_EQ(std::string(ops[i].name), std::to_string(i + 2));
+		EXPECT_EQ(ops[i].type, ELEMENT_SLOW_OP_COMMAND_SEND);
+		EXPECT_GE(ops[i].total_us, 50000U);
+		EXPECT_EQ(ops[i].phase_us[0], 30000U);
+		EXPECT_GE(ops[i].phase_us[1], 20000U);
+		EXPECT_EQ(ops[i].request_bytes, (size_t)(i + 2));
+		EXPECT_EQ(ops[i].response_bytes, (size_t)(2 * (i + 2)));
+	}
+
+	ASSERT_GT(element_slow_op_format(&ops[3], line, sizeof(line)), 0);
+	EXPECT_NE(strstr(line, "command_send 5 "), (char *)NULL);
+
+	// A line that doesn't fit is cut short rather than overrun
+	char short_line[8];
+	EXPECT_EQ(element_slow_op_format(&ops[3], short_line, sizeof(short_line)),
+		(int)sizeof(short_line) - 1);
+	EXPECT_EQ(strlen(short_line), sizeof(short_line) - 1);
+
+	// Ops started while the journal was off aren't kept
+	element_slow_op_disable();
+	element_slow_op_finish(
+		ELEMENT_SLOW_OP_ENTRY_READ_CB, "off", 0, 0, 0, 0);
+	n = element_slow_op_get(ops, 8);
+	EXPECT_EQ(std::string(ops[n - 1].name), "5");
+}
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file atom_test_spool.cc
+//
+//  @brief Tests for the entry write-ahead spool
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <gtest/gtest.h>
+#include <string.h>
+#include <unistd.h>
+#include <hiredis/hiredis.h>
+#include "atom.h"
+#include "redis.h"
+#include "element_entry_spool.h"
+
+#define TEST_SPOOL_PATH "/tmp/atom_test_spool"
+#define TEST_SPOOL_SIZE (64 * 1024)
+#define TEST_SPOOL_STREAM "stream:test_spool:data"
+
+class AtomSpoolTest : public testing::Test
+{
+
+protected:
+	redisContext *ctx;
+	struct element_entry_spool *spool;
+	struct redis_xadd_info items[2];
+
+	virtual void SetUp() {
+		unlink(TEST_SPOOL_PATH);
+		ctx = redisConnectUnix("/shared/redis.sock");
+		ASSERT_NE(ctx, (void*)NULL);
+		redis_remove_key(ctx, TEST_SPOOL_STREAM, true);
+		spool = element_entry_spool_init(
+			TEST_SPOOL_PATH,
+			TEST_SPOOL_SIZE,
+			ELEMENT_ENTRY_SPOOL_NO_RATE_LIMIT);
+		ASSERT_NE(spool, (struct element_entry_spool *)NULL);
+
+		items[0].key = "foo";
+		items[0].key_len = strlen("foo");
+		items[0].data = (const uint8_t*)"bar";
+		items[0].data_len = strlen("bar");
+		items[1].key = "hello";
+		items[1].key_len = strlen("hello");
+		items[1].data = (const uint8_t*)"world";
+		items[1].data_len = strlen("world");
+	};
+
+	virtual void TearDown() {
+		if (spool != NULL) {
+			element_entry_spool_cleanup(spool);
+		}
+		redis_remove_key(ctx, TEST_SPOOL_STREAM, true);
+		redisFree(ctx);
+		unlink(TEST_SPOOL_PATH);
+	};
+
+	// Returns the length of the test stream
+	long long stream_len() {
+		redisReply *reply = (redisReply *)redisCommand(
+			ctx, "XLEN %s", TEST_SPOOL_STREAM);
+		EXPECT_NE(reply, (redisReply *)NULL);
+		EXPECT_EQ(reply->type, REDIS_REPLY_INTEGER);
+		long long len = reply->integer;
+		freeReplyObject(reply);
+		return len;
+	}
+};
+
+// Spools a few entries and makes sure they all end up in redis,
+//	in order, once drained
+TEST_F(AtomSpoolTest, append_drain) {
+	char buffer[16];
+
+	for (int i = 0; i < 10; ++i) {
+		snprintf(buffer, sizeof(buffer), "%d", i);
+		items[0].data = (const uint8_t*)buffer;
+		items[0].data_len = strlen(buffer);
+		ASSERT_TRUE(element_entry_spool_append(
+			spool, TEST_SPOOL_STREAM, items, 2, ATOM_DEFAULT_MAXLEN, NULL));
+	}
+
+	EXPECT_EQ(element_entry_spool_size(spool), 10U);
+	EXPECT_TRUE(element_entry_spool_pending(spool, TEST_SPOOL_STREAM));
+	EXPECT_FALSE(element_entry_spool_pending(spool, "stream:test_spool:other"));
+
+	EXPECT_EQ(element_entry_spool_drain(ctx, spool), 10);
+	EXPECT_EQ(element_entry_spool_size(spool), 0U);
+	EXPECT_FALSE(element_entry_spool_pending(spool, NULL));
+	EXPECT_EQ(stream_len(), 10);
+
+	redisReply *reply = (redisReply *)redisCommand(
+		ctx, "XRANGE %s - +", TEST_SPOOL_STREAM);
+	ASSERT_NE(reply, (redisReply *)NULL);
+	ASSERT_EQ(reply->type, REDIS_REPLY_ARRAY);
+	ASSERT_EQ(reply->elements, 10U);
+	for (int i = 0; i < (int)reply->elements; ++i) {
+		redisReply *kvs = reply->element[i]->element[1];
+		ASSERT_EQ(kvs->elements, 4U);
+		snprintf(buffer, sizeof(buffer), "%d", i);
+		EXPECT_STREQ(kvs->element[1]->str, buffer);
+		EXPECT_STREQ(kvs->element[3]->str, "world");
+	}
+	freeReplyObject(reply);
+}
+
+// Makes sure that we refuse appends once the spool is full and
+//	that the space is reclaimed once it's drained
+TEST_F(AtomSpoolTest, full) {
+	size_t n_appended = 0;
+
+	while (element_entry_spool_append(
+		spool, TEST_SPOOL_STREAM, items, 2, ATOM_DEFAULT_MAXLEN, NULL))
+	{
+		++n_appended;
+		ASSERT_LT(n_appended, (size_t)TEST_SPOOL_SIZE);
+	}
+
+	EXPECT_GT(n_appended, 0U);
+	EXPECT_EQ(element_entry_spool_size(spool), n_appended);
+
+	EXPECT_EQ(element_entry_spool_drain(ctx, spool), (int)n_appended);
+	EXPECT_TRUE(element_entry_spool_append(
+		spool, TEST_SPOOL_STREAM, items, 2, ATOM_DEFAULT_MAXLEN, NULL));
+}
+
+// Makes sure that entries left in the spool are recovered when it's
+//	reopened, i.e. after a crash or restart
+TEST_F(AtomSpoolTest, recover) {
+	for (int i = 0; i < 5; ++i) {
+		ASSERT_TRUE(element_entry_spool_append(
+			spool, TEST_SPOOL_STREAM, items, 2, ATOM_DEFAULT_MAXLEN, NULL));
+	}
+
+	element_entry_spool_cleanup(spool);
+	spool = element_entry_spool_init(
+		TEST_SPOOL_PATH,
+		TEST_SPOOL_SIZE,
+		ELEMENT_ENTRY_SPOOL_NO_RATE_LIMIT);
+	ASSERT_NE(spool, (struct element_entry_spool *)NULL);
+
+	EXPECT_EQ(element_entry_spool_size(spool), 5U);
+	EXPECT_TRUE(element_entry_spool_pending(spool, TEST_SPOOL_STREAM));
+	EXPECT_EQ(element_entry_spool_drain(ctx, spool), 5);
+	EXPECT_EQ(stream_len(), 5);
+}
+
+// Makes sure that a record redis rejects only holds up its own stream,
+//	that everything else in the pipeline is marked as sent, and that the
+//	record is dropped once it's been rejected too many times
+TEST_F(AtomSpoolTest, rejected) {
+	const char *bad_stream = "stream:test_spool:bad";
+
+	// XADD to a string fails with WRONGTYPE
+	redisReply *reply = (redisReply *)redisCommand(
+		ctx, "SET %s not_a_stream", bad_stream);
+	ASSERT_NE(reply, (redisReply *)NULL);
+	freeReplyObject(reply);
+
+	for (int i = 0; i < 2; ++i) {
+		ASSERT_TRUE(element_entry_spool_append(
+			spool, TEST_SPOOL_STREAM, items, 2, ATOM_DEFAULT_MAXLEN, NULL));
+		ASSERT_TRUE(element_entry_spool_append(
+			spool, bad_stream, items, 2, ATOM_DEFAULT_MAXLEN, NULL));
+	}
+
+	EXPECT_EQ(element_entry_spool_drain(ctx, spool), 2);
+	EXPECT_EQ(stream_len(), 2);
+	EXPECT_FALSE(element_entry_spool_pending(spool, TEST_SPOOL_STREAM));
+	EXPECT_TRUE(element_entry_spool_pending(spool, bad_stream));
+	EXPECT_EQ(element_entry_spool_dropped(spool), 0U);
+
+	// Nothing was sent twice
+	for (int i = 1; i < ELEMENT_ENTRY_SPOOL_MAX_REJECTS; ++i) {
+		EXPECT_EQ(element_entry_spool_drain(ctx, spool), 0);
+	}
+	EXPECT_EQ(stream_len(), 2);
+
+	EXPECT_FALSE(element_entry_spool_pending(spool, NULL));
+	EXPECT_EQ(element_entry_spool_size(spool), 0U);
+	EXPECT_EQ(element_entry_spool_dropped(spool), 2U);
+
+	reply = (redisReply *)redisCommand(ctx, "DEL %s", bad_stream);
+	ASSERT_NE(reply, (redisReply *)NULL);
+	freeReplyObject(reply);
+}
+
+// Makes sure that spooled entries are trimmed by ID when they're drained,
+//	and that the XTRIM for the ceiling doesn't throw off the replies of
+//	the rest of the pipeline
+TEST_F(AtomSpoolTest, minid) {
+	for (int i = 1; i <= 250; ++i) {
+		redisAppendCommand(ctx, "XADD %s %d-0 foo bar", TEST_SPOOL_STREAM, i);
+	}
+	ASSERT_EQ(redis_pipeline_get_replies(ctx, 250, REDIS_REPLY_STRING), 250);
+
+	ASSERT_TRUE(element_entry_spool_append(
+		spool, TEST_SPOOL_STREAM, items, 2, ATOM_DEFAULT_MAXLEN, "201-0"));
+	ASSERT_TRUE(element_entry_spool_append(
+		spool, TEST_SPOOL_STREAM, items, 2, REDIS_XADD_NO_MAXLEN, NULL));
+
+	EXPECT_EQ(element_entry_spool_drain(ctx, spool), 2);
+	EXPECT_EQ(element_entry_spool_size(spool), 0U);
+
+	// MINID is approximate so only whole nodes before 201-0 go, which
+	//	still leaves out everything up to the node 201-0 is in
+	long long len = stream_len();
+	EXPECT_GE(len, 52);
+	EXPECT_LT(len, 152);
+}
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file batching_client.h
+//
+//  @brief Client that coalesces small commands to an element into batches
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_BATCHING_CLIENT_H
+#define __ATOM_CPP_BATCHING_CLIENT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "atom/element_command_batch.h"
+#include "element_response.h"
+
+// Default number of commands that can go out in a single batch
+#define BATCHING_CLIENT_DEFAULT_MAX_BATCH 16
+
+// Default time to wait for more commands before sending a batch out
+#define BATCHING_CLIENT_DEFAULT_WINDOW_US 500
+
+namespace atom {
+
+// Forward declaration for the element class
+class Element;
+
+// Batching client. Commands sent through it are queued and sent out by a
+//	worker thread, which waits up to the window for more commands to show
+//	up and then sends everything it has as a single batch command. The
+//	element runs the commands in the batch one at a time and sends back all
+//	of the responses at once, s.t. N small commands cost a single round
+//	trip instead of N. A command that's alone in its window is sent as-is,
+//	as are all commands if the element turns out not to support batches.
+//	Results are handed back through a future per command.
+class BatchingClient {
+
+	// A command waiting to go out
+	struct Pending {
+		std::string command;
+		std::string data;
+		std::promise<ElementResponse> promise;
+	};
+
+	Element &elem;
+	std::string target;
+	size_t max_batch;
+	int window_us;
+
+	// Commands waiting to go out
+	std::vector<std::unique_ptr<Pending>> queue;
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool stop;
+
+	// Set once we find out the element doesn't do batches
+	bool unsupported;
+
+	// Worker thread
+	std::thread thread;
+
+	// Loop run by the worker thread
+	void run();
+
+	// Sends a single command
+	void sendOne(
+		Pending &pending);
+
+	// Sends a set of commands as a batch
+	void sendBatch(
+		std::vector<std::unique_ptr<Pending>> &batch);
+
+public:
+
+	// Constructor. Commands go to the target element. Batches are capped
+	//	at both max_batch and ELEMENT_COMMAND_BATCH_MAX_ITEMS.
+	BatchingClient(
+		Element &e,
+		std::string t,
+		size_t max = BATCHING_CLIENT_DEFAULT_MAX_BATCH,
+		int window = BATCHING_CLIENT_DEFAULT_WINDOW_US);
+
+	// Destructor. Sends anything still queued before returning.
+	~BatchingClient();
+
+	// No copying the client
+	BatchingClient(const BatchingClient &) = delete;
+	BatchingClient &operator=(const BatchingClient &) = delete;
+
+	// Queues a command to be sent. The future is ready once the response
+	//	comes back.
+	std::future<ElementResponse> sendCommand(
+		std::string command,
+		const uint8_t *data,
+		size_t data_len);
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_BATCHING_CLIENT_H
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file circuit_breaker.h
+//
+//  @brief Circuit breaker for commands sent to an element
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_CIRCUIT_BREAKER_H
+#define __ATOM_CPP_CIRCUIT_BREAKER_H
+
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+
+#include "atom/atom.h"
+
+// Default number of recent commands the failure rate is taken over
+#define CIRCUIT_BREAKER_DEFAULT_WINDOW 20
+
+// Default number of commands in the window before the breaker can open
+#define CIRCUIT_BREAKER_DEFAULT_MIN_CALLS 5
+
+// Default failure rate at which the breaker opens
+#define CIRCUIT_BREAKER_DEFAULT_FAILURE_RATE 0.5
+
+// Default time the breaker stays open before letting a probe through
+#define CIRCUIT_BREAKER_DEFAULT_OPEN_MS 5000
+
+// Probe token for commands that aren't the probe
+#define CIRCUIT_BREAKER_NO_PROBE 0
+
+namespace atom {
+
+// Circuit breaker for the commands sent to a single element. While closed
+//	commands go through and their outcomes are noted. Once at least
+//	min_calls of the last window commands have gone out and failure_rate
+//	of them failed, the breaker opens and commands fail right away without
+//	going to the element. After open_ms a single command is let through as
+//	a probe, half-open. If it succeeds the breaker closes, else it opens
+//	again. Only failures that mean the element isn't there count, see
+//	isFailure(). Each probe gets a token from allow() that's passed back
+//	to record() s.t. commands that went out before the breaker opened
+//	can't decide the probe. Not thread-safe, the owner locks around it.
+class CircuitBreaker {
+public:
+
+	enum State {
+		CLOSED,
+		OPEN,
+		HALF_OPEN,
+	};
+
+	CircuitBreaker(
+		size_t window = CIRCUIT_BREAKER_DEFAULT_WINDOW,
+		size_t min_calls = CIRCUIT_BREAKER_DEFAULT_MIN_CALLS,
+		double failure_rate = CIRCUIT_BREAKER_DEFAULT_FAILURE_RATE,
+		int open_ms = CIRCUIT_BREAKER_DEFAULT_OPEN_MS);
+
+	// Returns whether a command can go out now. A true in the half-open
+	//	state makes the command the probe and sets probe to its token,
+	//	else probe is CIRCUIT_BREAKER_NO_PROBE.
+	bool allow(
+		uint64_t &probe);
+
+	// Notes the outcome of a command that allow() let through, along with
+	//	the probe token allow() gave it. While half-open only the outcome
+	//	of the current probe counts.
+	void record(
+		enum atom_error_t err,
+		uint64_t probe);
+
+	// Returns the state the breaker is in
+	State getState() const;
+
+	// Returns whether an error means that the element isn't there
+	static bool isFailure(
+		enum atom_error_t err);
+
+private:
+	size_t window;
+	size_t min_calls;
+	double failure_rate;
+	std::chrono::milliseconds open_time;
+
+	State state;
+	std::chrono::steady_clock::time_point opened;
+	bool probing;
+	uint64_t probe_token;
+
+	// Ring of the outcomes of the last window commands, true on a failure
+	std::vector<bool> outcomes;
+	size_t next;
+	size_t n_calls;
+	size_t n_failures;
+
+	// Opens the breaker and clears out the outcomes
+	void open();
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_CIRCUIT_BREAKER_H
@@ -32,6 +32,13 @@ typedef bool (*command_handler_t)(
 // Default command timeout of 1s
 #define COMMAND_DEFAULT_TIMEOUT_MS 1000
 
+// User errors for each stage of handling a command that can fail. A
+//	chunk that onChunk() can't handle counts as failing to deserialize.
+#define COMMAND_ERROR_DESERIALIZE 101
+#define COMMAND_ERROR_VALIDATE 102
+#define COMMAND_ERROR_RUN 103
+#define COMMAND_ERROR_SERIALIZE 104
+
 // Base command class. Virtual deserialize and serialize
 //	functions MUST be implemented by any inheriting class
 class Command {
@@ -160,6 +167,47 @@ public:
 	virtual bool serialize() { return true; }
 };
 
+// Command whose request data can be sent in chunks, see
+//	Element::sendCommandChunked(). Each chunk is passed to onChunk() in
+//	order as it comes in and run() is called once the last one is in, s.t.
+//	the command can work on the request without holding all of it. Data
+//	sent all at once is passed to onChunk() as a single chunk.
+class StreamingCommand : public Command {
+public:
+	// Set once we've started on the chunks for a call s.t. we don't
+	//	lose them to the _init() before run()
+	bool started;
+
+	StreamingCommand(
+		std::string n,
+		std::string d,
+		int t = COMMAND_DEFAULT_TIMEOUT_MS) :
+		Command(n, d, t),
+		started(false) {}
+
+	// Called with each chunk of the request in order
+	virtual bool onChunk(
+		const uint8_t *chunk,
+		size_t chunk_len) = 0;
+
+	// Passes any data sent all at once along as a single chunk
+	virtual bool deserialize(
+		const uint8_t *data,
+		size_t data_len)
+	{
+		if (data_len == 0) {
+			return true;
+		}
+		return onChunk(data, data_len);
+	}
+
+	// Validator just passes everything
+	virtual bool validate() { return true; }
+
+	// Serialization. Nothing to do here
+	virtual bool serialize() { return true; }
+};
+
 // Msgpack message template with both request and response
 template <class Req, class Res>
 class CommandMsgpack : public Command {
@@ -0,0 +1,65 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file command_stats.h
+//
+//  @brief Per-command CPU, data and allocation accounting
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_COMMAND_STATS_H
+#define __ATOM_CPP_COMMAND_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// Reserved command that an element with command stats on answers with
+//	them, one command per line
+#define COMMAND_STATS_COMMAND_STR "__command_stats__"
+
+namespace atom {
+
+// Allocations made by a thread. Only counted if the allocator hook is in,
+//	either the operator new replacement built in with ATOM_CPP_ALLOC_HOOK
+//	or the application's own allocator calling commandAllocNote().
+struct CommandAllocCounters {
+	uint64_t count;
+	uint64_t bytes;
+};
+
+extern thread_local CommandAllocCounters command_alloc_counters;
+
+// Notes an allocation on the calling thread. For allocator hooks.
+inline void commandAllocNote(
+	size_t bytes)
+{
+	command_alloc_counters.count++;
+	command_alloc_counters.bytes += bytes;
+}
+
+// Totals for all of the calls to a command. CPU time is the handling
+//	thread's, from CLOCK_THREAD_CPUTIME_ID, s.t. time spent blocked
+//	doesn't count.
+struct CommandStats {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t cpu_ns;
+	uint64_t max_cpu_ns;
+	uint64_t request_bytes;
+	uint64_t response_bytes;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+
+	CommandStats() : calls(0), errors(0), cpu_ns(0), max_cpu_ns(0),
+		request_bytes(0), response_bytes(0), allocs(0), alloc_bytes(0) {}
+
+	// Formats the stats as a single line
+	std::string format(
+		const std::string &name) const;
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_COMMAND_STATS_H
@@ -11,31 +11,105 @@
 #define __ATOM_CPP_ELEMENT_H
 
 #include <queue>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
 #include <syslog.h>
 #include <iostream>
 
 #include "atom/atom.h"
 #include "atom/redis.h"
 #include "atom/element_entry_write.h"
+#include "atom/element_entry_spool.h"
+#include "atom/element_entry_trim.h"
 #include "atom/element_entry_read.h"
 #include "atom/element_command_server.h"
 #include "atom/element_command_send.h"
+#include "atom/element_slow_op.h"
 #include "element_response.h"
 #include "element_read_map.h"
+#include "subscription_mux.h"
 #include "command.h"
+#include "circuit_breaker.h"
+#include "command_stats.h"
+#include "entry_read_request.h"
 
 #define ELEMENT_DEFAULT_N_CONTEXTS 20
 
+// Defaults for the bulk and background context pools, see ContextClass
+#define ELEMENT_DEFAULT_N_BULK_CONTEXTS 4
+#define ELEMENT_DEFAULT_N_BACKGROUND_CONTEXTS 2
+
+// Entry writes and command requests at least this many bytes, and reads
+//	of at least this many entries, go over the bulk contexts
+#define ELEMENT_BULK_MIN_BYTES (64 * 1024)
+#define ELEMENT_BULK_READ_MIN_N 100
+
+// Number of keys a one-off read can have before it needs to allocate
+//	for them, see EntryReadRequest for reads that never do
+#define ELEMENT_READ_N_STACK_KEYS 16
+
+// Number of shards the stream writers are split over. Each has its own
+//	lock s.t. threads writing different streams rarely contend.
+#define ELEMENT_N_WRITER_SHARDS 16
+
+// Defaults for the read replica. Reads of history at least this many
+//	entries long go to the replica, and the replica is only used while it's
+//	within the max lag, in bytes of replication offset, of the primary.
+#define ELEMENT_DEFAULT_N_REPLICA_CONTEXTS 4
+#define ELEMENT_REPLICA_DEFAULT_HISTORY_MIN_N 100
+#define ELEMENT_REPLICA_DEFAULT_MAX_LAG (1024 * 1024)
+#define ELEMENT_REPLICA_LAG_CHECK_INTERVAL_MS 1000
+
+// Default max number of responses to cacheable commands we'll keep
+#define ELEMENT_DEFAULT_RESPONSE_CACHE_SIZE 256
+
+// How long sendCommand() trusts the cache version it last got for an
+//	element before getting it from redis again. A cached response can be
+//	served for up to this long after the element invalidates it.
+#define ELEMENT_CACHE_VERSION_REFRESH_MS 50
+
 #define ELEMENT_INFINITE_COMMAND_LOOPS 0
 
 #define ELEMENT_INFINITE_READ_LOOPS 0
 
+// Call site to rate limit an already formatted log() on, unique to the
+//	file and line it's used on
+#define ELEMENT_LOG_SITE_STR(x) #x
+#define ELEMENT_LOG_SITE_LINE(x) ELEMENT_LOG_SITE_STR(x)
+#define ELEMENT_LOG_SITE (__FILE__ ":" ELEMENT_LOG_SITE_LINE(__LINE__))
+
 namespace atom {
 
 // Entry value
 typedef std::map<std::string, std::string> entry_data_t;
 
+// A command from the command registry
+struct CommandInfo {
+	std::string element;
+	std::string command;
+	std::string description;
+	int timeout;
+};
+
+// Classes of redis traffic. Each class has its own pool of contexts, so
+//	a big write on one connection doesn't hold up a command or a log that
+//	would otherwise be queued behind it. Control is commands, ACKs,
+//	responses and small entry reads and writes. Bulk is big entry writes
+//	and command requests and long reads. Background is logs and
+//	housekeeping like spool drains and consumer reports.
+enum ContextClass {
+	CONTEXT_CONTROL,
+	CONTEXT_BULK,
+	CONTEXT_BACKGROUND,
+	CONTEXT_N_CLASSES,
+};
+
 // Entry Class
 class Entry {
 	std::string id;
@@ -55,17 +129,17 @@ public:
 		size_t data_len);
 
 	// Get the ID of the entry
-	const std::string &getID();
+	const std::string &getID() const;
 
 	// Get the data of the entry
-	const entry_data_t &getData();
+	const entry_data_t &getData() const;
 
 	// Get the size of the entry
-	size_t size();
+	size_t size() const;
 
 	// Get a key in the entry
 	const std::string &getKey(
-		const std::string &key);
+		const std::string &key) const;
 };
 
 // Element class itself
@@ -77,28 +151,241 @@ class Element {
 	// C element
 	struct element *elem;
 
-	// Redis context pool
-	std::queue<redisContext *>context_pool;
-	mutable std::mutex context_mutex;
-
-	// Streams that we're currently publishing on
-	std::map<std::string, struct element_entry_write_info *> streams;
+	// Redis context pools, one for each traffic class. Getting a context
+	//	waits for one to be free. Classes without any contexts of their
+	//	own use the control pool.
+	struct ContextPool {
+		std::queue<redisContext *> contexts;
+		size_t size;
+		std::mutex mutex;
+		std::condition_variable available;
+
+		ContextPool() : size(0) {}
+	};
+	ContextPool context_pools[CONTEXT_N_CLASSES];
+
+	// Writer for a stream that we're publishing on. Its lock is held for
+	//	the whole of a write since the write info points at the data
+	//	being written. Writers for partitioned streams have no write info
+	//	of their own, just the names of their partitions, and hand each
+	//	write off to the writer for one of them.
+	struct StreamWriter {
+		std::mutex mutex;
+		struct element_entry_write_info *info;
+		std::vector<std::string> partitions;
+		std::string partition_key;
+		unsigned int next_partition;
+
+		StreamWriter() : info(NULL), next_partition(0) {}
+	};
+
+	// Streams that we're currently publishing on, sharded on the stream
+	//	name. Writers aren't removed until we're destroyed s.t. a writer
+	//	can be used once found without holding its shard's lock.
+	struct WriterShard {
+		std::unordered_map<std::string, std::unique_ptr<StreamWriter>> writers;
+		std::mutex mutex;
+	};
+	WriterShard writer_shards[ELEMENT_N_WRITER_SHARDS];
+
+	// Guards the spool, trim and ephemeral settings for the streams
+	//	we write
+	std::mutex writer_config_mutex;
+
+	// Read replica context pool. Reads that aren't latency critical are
+	//	routed here while the replica is caught up with the primary
+	std::queue<redisContext *> replica_pool;
+	std::mutex replica_mutex;
+	size_t replica_history_min_n;
+	long long replica_max_lag;
+	bool replica_healthy;
+	std::chrono::steady_clock::time_point replica_checked;
+
+	// Subscriptions we've made through the subscription mux
+	std::vector<int> subscriptions;
+	std::mutex subscriptions_mutex;
+
+	// Spool that entry writes fall back to when redis is unreachable
+	struct element_entry_spool *spool;
+
+	// Consumer-aware trimming for the streams we write, keyed on the
+	//	stream name. Map s.t. pointers to the trims stay valid.
+	std::map<std::string, struct element_entry_trim> trims;
+
+	// Streams we write that are ephemeral
+	std::set<std::string> ephemeral_streams;
+
+	// Freshness trackers for the streams we read, keyed on
+	//	element:stream. Map s.t. pointers to the trackers stay valid.
+	std::map<std::string, struct element_entry_freshness> freshness;
+	std::mutex freshness_mutex;
 
 	// List of commands we currently have support for
 	std::map<std::string, Command *> commands;
 
-	// Functions for getting redis contexts
+	// Cached responses to commands that the element we sent them to
+	//	said were cacheable. Keyed on element, command and a hash of the
+	//	request data with the most recently used at the front of the list.
+	struct ResponseCacheEntry {
+		std::string key;
+		std::string data;
+		long long version;
+		std::chrono::steady_clock::time_point expires;
+	};
+	std::list<ResponseCacheEntry> response_cache_lru;
+	std::unordered_map<std::string,
+		std::list<ResponseCacheEntry>::iterator> response_cache;
+	size_t response_cache_max;
+
+	// Element, command pairs we've seen a cache TTL for. We start
+	//	caching on the second call since we need the cache version
+	//	from before the command was sent.
+	std::set<std::string> response_cacheable;
+
+	// Cache versions of the elements we cache responses from, and when
+	//	we got them from redis
+	struct ResponseCacheVersion {
+		long long version;
+		std::chrono::steady_clock::time_point checked;
+	};
+	std::unordered_map<std::string, ResponseCacheVersion>
+		response_cache_versions;
+	std::mutex response_cache_mutex;
+
+	// Element, command pairs that have told us they take list RPC, with
+	//	the timeout from their ACK
+	std::unordered_map<std::string, int> rpc_commands;
+	std::mutex rpc_mutex;
+
+	// Whether we've added the command that dumps the slow op journal
+	bool slow_op_command;
+
+	// Circuit breakers for the elements we send commands to, made from
+	//	circuit_breaker_proto as we see each element. Only used once
+	//	they've been turned on.
+	std::unordered_map<std::string, CircuitBreaker> circuit_breakers;
+	CircuitBreaker circuit_breaker_proto;
+	bool circuit_breaker_on;
+	std::mutex circuit_breaker_mutex;
+
+	// Stats for each of our commands, if we're keeping them
+	std::unordered_map<std::string, CommandStats> command_stats;
+	bool command_stats_on;
+	std::mutex command_stats_mutex;
+
+	// Checks with and updates the circuit breaker for an element
+	bool circuitBreakerAllow(
+		const std::string &element,
+		uint64_t &probe);
+	void circuitBreakerRecord(
+		const std::string &element,
+		enum atom_error_t err,
+		uint64_t probe);
+
+	// Functions for getting redis contexts. Contexts need to be released
+	//	with the class they were gotten with.
 	void initContextPool(
+		ContextClass cls,
 		int n_contexts);
 	void cleanupContextPool();
-	redisContext *getContext();
+	ContextPool &contextPool(
+		ContextClass cls);
+	redisContext *getContext(
+		ContextClass cls = CONTEXT_CONTROL);
 	void releaseContext(
-		redisContext *ctx);
+		redisContext *ctx,
+		ContextClass cls = CONTEXT_CONTROL);
+
+	// Functions for getting read replica contexts. getReplicaContext()
+	//	returns NULL if there's no replica or it's lagging
+	redisContext *getReplicaContext();
+	void releaseReplicaContext(
+		redisContext *ctx,
+		bool healthy);
+	bool replicaCaughtUp(
+		redisContext *replica_ctx);
+
+	// Runs a read on the replica if replica_ok and the replica is usable,
+	//	else on the primary with a context of class cls. If the read fails
+	//	on the replica then reset is called to undo anything it did and
+	//	the read is retried on the primary.
+	enum atom_error_t routeRead(
+		bool replica_ok,
+		ContextClass cls,
+		const std::function<enum atom_error_t(redisContext *)> &fn,
+		const std::function<void()> &reset);
+
+	// Functions for the response cache
+	bool responseCacheVersion(
+		const std::string &element,
+		ContextClass cls,
+		long long &version);
+	bool responseCacheGet(
+		const std::string &key,
+		long long version,
+		ElementResponse &response);
+	void responseCachePut(
+		const std::string &key,
+		long long version,
+		int ttl,
+		ElementResponse &response);
 
 	// Function for converting a readMap into element_entry_read_info
 	struct element_entry_read_info *readMapToEntryInfo(
 		ElementReadMap &m);
 
+	// Returns the writer for a stream, making it if asked to. NULL if
+	//	it doesn't exist and we weren't.
+	StreamWriter *getWriter(
+		const std::string &stream,
+		bool create);
+
+	// Returns the partition of a partitioned stream that an entry goes to.
+	//	Called with the writer's lock held.
+	const std::string &partitionFor(
+		StreamWriter *writer,
+		const entry_data_t &data);
+
+	// Sets up the write info for a stream we're writing with data's keys,
+	//	cleaning up any old write info for it. Called with the writer's
+	//	lock held.
+	void initWriter(
+		redisContext *ctx,
+		StreamWriter *writer,
+		const std::string &stream,
+		entry_data_t &data);
+
+	// Publishes a command's description in the command registry
+	void setCommandDescription(
+		const std::string &name,
+		const std::string &description);
+
+	// Returns the key a stream's freshness is tracked under
+	static std::string freshnessKey(
+		const std::string &element,
+		const std::string &stream);
+
+	// Returns the freshness tracker for a stream or NULL if it's not
+	//	being tracked
+	struct element_entry_freshness *getFreshness(
+		const std::string &element,
+		const std::string &stream);
+
+	// Does the reads for entryReadN() and entryReadSince() with read
+	//	info that's already been filled in with the stream and keys
+	enum atom_error_t readN(
+		struct element_entry_read_info &read_info,
+		size_t n,
+		std::vector<Entry> &ret);
+	enum atom_error_t readSince(
+		struct element_entry_read_info &read_info,
+		const std::string &element,
+		const std::string &stream,
+		size_t n,
+		std::vector<Entry> &ret,
+		const std::string &last_id,
+		int timeout);
+
 	// Function for freeing entry info
 	void freeEntryInfo(
 		struct element_entry_read_info *info,
@@ -158,10 +445,14 @@ class Element {
 
 public:
 
-	// Constructors
+	// Constructors. n_contexts is the number of control contexts, see
+	//	ContextClass. Pass 0 for either of the other classes to have it
+	//	share the control contexts.
 	Element(
 		std::string n,
-		int n_contexts = ELEMENT_DEFAULT_N_CONTEXTS);
+		int n_contexts = ELEMENT_DEFAULT_N_CONTEXTS,
+		int n_bulk_contexts = ELEMENT_DEFAULT_N_BULK_CONTEXTS,
+		int n_background_contexts = ELEMENT_DEFAULT_N_BACKGROUND_CONTEXTS);
 
 	// Destructor
 	~Element();
@@ -169,6 +460,18 @@ public:
 	// Returns the name of the element
 	const std::string &getName();
 
+	// Enables routing of history and discovery reads to a read-only
+	//	replica of the nucleus redis at the given unix socket. Real-time
+	//	reads and all writes stay on the primary. entryReadN calls for at
+	//	least history_min_n entries are routed to the replica and the
+	//	replica is skipped while it's more than max_lag bytes of
+	//	replication offset behind the primary.
+	enum atom_error_t replicaEnable(
+		std::string socket,
+		int n_contexts = ELEMENT_DEFAULT_N_REPLICA_CONTEXTS,
+		size_t history_min_n = ELEMENT_REPLICA_DEFAULT_HISTORY_MIN_N,
+		long long max_lag = ELEMENT_REPLICA_DEFAULT_MAX_LAG);
+
 	// Returns a list of all elements
 	enum atom_error_t getAllElements(
 		std::vector<std::string> &elem_list);
@@ -181,6 +484,13 @@ public:
 		std::vector<std::string> &stream_list,
 		std::string element);
 
+	// Returns the commands that elements have published in the command
+	//	registry, for all elements or just the one passed. All of the
+	//	registries are read in a single round trip.
+	enum atom_error_t getAllCommands(
+		std::vector<CommandInfo> &commands,
+		const std::string &element = "");
+
 	// Adds support for a barebones command. Takes a command name,
 	//	handler function and timeout to be returned to callers of this
 	//	command
@@ -202,21 +512,119 @@ public:
 	enum atom_error_t commandLoop(
 		int n_loops = ELEMENT_INFINITE_COMMAND_LOOPS);
 
-	// Sends a command to a given element
+	// Marks one of our commands as cacheable by callers for up to ttl_ms.
+	//	Only for commands whose response depends on nothing but the
+	//	request and state that we call commandCacheInvalidate() for
+	//	when it changes.
+	enum atom_error_t commandSetCacheable(
+		std::string name,
+		int ttl_ms);
+
+	// Invalidates the responses callers have cached from us
+	enum atom_error_t commandCacheInvalidate();
+
+	// Lets callers use list RPC for one of our commands, see
+	//	element_command_set_rpc(). Needs commandRpcLoop() to be running.
+	enum atom_error_t commandSetRpc(
+		std::string name,
+		bool rpc = true);
+
+	// Handles list RPC requests. Same as commandLoop() but for requests
+	//	to commands set up with commandSetRpc(). Runs alongside
+	//	commandLoop(), typically on a thread of its own.
+	enum atom_error_t commandRpcLoop(
+		int n_loops = ELEMENT_INFINITE_COMMAND_LOOPS);
+
+	// Sets the max number of responses to cacheable commands that
+	//	sendCommand() keeps. 0 disables the cache.
+	void responseCacheSize(
+		size_t max_entries);
+
+	// Turns on accounting of the CPU time, data and, with the allocator
+	//	hook, allocations of each of our commands, see CommandStats. Also
+	//	adds the reserved command that responds with the stats. Call
+	//	before commandLoop().
+	void commandStatsEnable();
+
+	// Returns whether we're keeping command stats
+	bool commandStatsEnabled() const {
+		return command_stats_on;
+	}
+
+	// Adds a call to the stats for a command. Called by the command
+	//	handler.
+	void commandStatsRecord(
+		const std::string &command,
+		const CommandStats &call);
+
+	// Gets the stats for all of our commands
+	void commandStatsGet(
+		std::unordered_map<std::string, CommandStats> &ret);
+
+	// Turns on circuit breakers for the commands we send, one per element,
+	//	see CircuitBreaker. While an element's breaker is open commands to
+	//	it fail right away with ATOM_COMMAND_CIRCUIT_OPEN rather than
+	//	waiting out the ACK timeout.
+	void commandCircuitBreakerEnable(
+		size_t window = CIRCUIT_BREAKER_DEFAULT_WINDOW,
+		size_t min_calls = CIRCUIT_BREAKER_DEFAULT_MIN_CALLS,
+		double failure_rate = CIRCUIT_BREAKER_DEFAULT_FAILURE_RATE,
+		int open_ms = CIRCUIT_BREAKER_DEFAULT_OPEN_MS);
+
+	// Gets the state of the circuit breaker for an element
+	CircuitBreaker::State commandCircuitBreakerState(
+		std::string element);
+
+	// Turns on the slow op journal, which is shared by the whole process,
+	//	and adds the reserved command that dumps it to this element. If
+	//	signum is nonzero the journal is also dumped to stderr on that
+	//	signal. Call before commandLoop().
+	enum atom_error_t slowOpEnable(
+		size_t n_ops = ELEMENT_SLOW_OP_DEFAULT_N_OPS,
+		uint64_t threshold_us = ELEMENT_SLOW_OP_DEFAULT_THRESHOLD_US,
+		int signum = 0);
+
+	// Gets the ops in the slow op journal, oldest first
+	void slowOpGet(
+		std::vector<struct element_slow_op> &ret);
+
+	// Sends a command to a given element. If the element has marked the
+	//	command as cacheable then the response may come from our cache.
+	//	If the element takes list RPC for the command then blocking calls
+	//	after the first use it.
 	enum atom_error_t sendCommand(
 		ElementResponse &response,
-		std::string element,
-		std::string command,
+		const std::string &element,
+		const std::string &command,
 		const uint8_t *data,
 		size_t data_len,
 		bool block = true);
 
+	// Sends a command to a given element with its request data in chunks,
+	//	for streaming commands. source is called for each chunk in turn
+	//	and sets last on the final one. Returning false aborts the upload
+	//	and fails the command. Always blocks.
+	enum atom_error_t sendCommandChunked(
+		ElementResponse &response,
+		const std::string &element,
+		const std::string &command,
+		std::function<bool(std::string &chunk, bool &last)> source);
+
+	// Sends data to a streaming command in chunks of up to chunk_size
+	enum atom_error_t sendCommandChunked(
+		ElementResponse &response,
+		const std::string &element,
+		const std::string &command,
+		const uint8_t *data,
+		size_t data_len,
+		size_t chunk_size);
+
 	// Sends a commad using msgpack for serialization and deserialization
 	template <typename Req, typename Res>
 	enum atom_error_t sendCommand(
 		ElementResponse &response,
-		std::string element,
-		std::string command,
+		const std::string &element,
+		const std::string &command,
 		Req &req_data,
 		Res &res_data,
 		bool block = true)
@@ -251,8 +659,8 @@ public:
 	template <typename Res>
 	enum atom_error_t sendCommandNoReq(
 		ElementResponse &response,
-		std::string element,
-		std::string command,
+		const std::string &element,
+		const std::string &command,
 		Res &res_data,
 		bool block = true)
 	{
@@ -279,8 +687,8 @@ public:
 	template <typename Req>
 	enum atom_error_t sendCommandNoRes(
 		ElementResponse &response,
-		std::string element,
-		std::string command,
+		const std::string &element,
+		const std::string &command,
 		Req &req_data,
 		bool block = true)
 	{
@@ -312,39 +720,186 @@ public:
 		ElementReadMap &m,
 		int loops = ELEMENT_INFINITE_READ_LOOPS);
 
+	// Subscribes to a stream through the process-wide subscription mux.
+	//	All subscribers to a stream in the process share a single XREAD
+	//	and each entry is decoded once and shared between them. The handler
+	//	is called on the mux thread. As with reads, an empty element means
+	//	stream is a raw stream name. Only entries written after this is
+	//	called are delivered. Returns an ID for entryUnsubscribe(), or -1
+	//	if the mux is already at SUBSCRIPTION_MUX_MAX_STREAMS streams.
+	int entrySubscribe(
+		std::string element,
+		std::string stream,
+		sharedReadHandlerFn fn,
+		void *user_data = NULL);
+
+	// Removes a subscription made with entrySubscribe()
+	void entryUnsubscribe(
+		int id);
+
 	// Reads N entries from the stream, returning them in order from
 	//	newest to oldest. As such the most recent value is always
 	//	at index 0 in the list
 	enum atom_error_t entryReadN(
-		std::string element,
-		std::string stream,
-		std::vector<std::string> &keys,
+		const std::string &element,
+		const std::string &stream,
+		const std::vector<std::string> &keys,
+		size_t n,
+		std::vector<Entry> &ret);
+
+	// Reads N entries with a reusable request, see EntryReadRequest
+	enum atom_error_t entryReadN(
+		EntryReadRequest &req,
 		size_t n,
 		std::vector<Entry> &ret);
 
+	// Reads the most recent entry on each of the streams, given as
+	//	(element, stream) pairs, as a single consistent snapshot in one
+	//	round trip. keys[i] are the keys to read from streams[i] and
+	//	ret[i] is the entry from streams[i], with an empty ID if the
+	//	stream has no entries.
+	enum atom_error_t entryReadLatestMulti(
+		const std::vector<std::pair<std::string, std::string>> &streams,
+		const std::vector<std::vector<std::string>> &keys,
+		std::vector<Entry> &ret);
+
 	// Reads at most N entries from the stream since the passed ID
 	//	Default nonblocking. Pass 0 for timeout to block indefinitely,
 	//	else a value in milliseconds
 	enum atom_error_t entryReadSince(
-		std::string element,
-		std::string stream,
-		std::vector<std::string> &keys,
+		const std::string &element,
+		const std::string &stream,
+		const std::vector<std::string> &keys,
 		size_t n,
 		std::vector<Entry> &ret,
-		std::string last_id = "",
+		const std::string &last_id = "",
 		int timeout=REDIS_XREAD_DONTBLOCK);
 
-	// Writes an entry to a data stream
-	enum atom_error_t entryWrite(
+	// Reads at most N entries since the passed ID with a reusable request,
+	//	see EntryReadRequest
+	enum atom_error_t entryReadSince(
+		EntryReadRequest &req,
+		size_t n,
+		std::vector<Entry> &ret,
+		const std::string &last_id = "",
+		int timeout=REDIS_XREAD_DONTBLOCK);
+
+	// Starts tracking the freshness of entries delivered from a stream
+	//	by the read loop and by reads since. If budget_us is set then
+	//	violation_cb will be called for each entry delivered older than it.
+	void entryFreshnessTrack(
+		std::string element,
+		std::string stream,
+		uint64_t budget_us = ELEMENT_ENTRY_FRESHNESS_NO_BUDGET,
+		void (*violation_cb)(const char *, uint64_t, void *) = NULL,
+		void *user_data = NULL);
+
+	// Gets a snapshot of the freshness of a stream. Returns false if the
+	//	stream isn't being tracked
+	bool entryFreshnessGet(
+		std::string element,
 		std::string stream,
+		struct element_entry_freshness &ret);
+
+	// Writes an entry to a data stream. Threads can write to different
+	//	streams at once, writes to the same stream are serialized.
+	enum atom_error_t entryWrite(
+		const std::string &stream,
 		entry_data_t &data,
 		int timestamp = ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP,
 		int maxlen = ELEMENT_DATA_WRITE_DEFAULT_MAXLEN);
 
-	// Writes an entry to the logs
+	// Partitions a stream we write into n_partitions streams of its own,
+	//	"<stream>:p0" through "<stream>:p<n_partitions - 1>", s.t. writes
+	//	and reads of a hot stream are spread over that many redis keys.
+	//	entryWrite() to the stream then writes each entry to one of the
+	//	partitions, chosen by the value of its partition key if it has
+	//	one s.t. entries with the same value stay in order, else
+	//	round-robin. Spool, trim and ephemeral settings are per partition.
+	enum atom_error_t entryPartitionEnable(
+		const std::string &stream,
+		int n_partitions,
+		const std::string &partition_key = "");
+
+	// Gets the number of partitions of a stream, 0 if it isn't partitioned.
+	//	As with reads, an empty element means stream is a raw stream name.
+	enum atom_error_t entryPartitionCount(
+		const std::string &element,
+		const std::string &stream,
+		int &n_partitions);
+
+	// Reads the N most recent entries across all of the partitions of a
+	//	stream, newest first like entryReadN(). Order across partitions
+	//	is by the millisecond of the entry ID, i.e. when redis took each
+	//	entry. Entries from different partitions in the same millisecond
+	//	come back in an unspecified order, and which of them make the cut
+	//	at N is unspecified too. Reads streams that aren't partitioned as
+	//	they are.
+	enum atom_error_t entryReadPartitionedN(
+		const std::string &element,
+		const std::string &stream,
+		const std::vector<std::string> &keys,
+		size_t n,
+		std::vector<Entry> &ret);
+
+	// Enables the local write-ahead spool. While redis is unreachable
+	//	entry writes are held in the spool file at path and are drained
+	//	back into redis, at most drain_rate entries per second per stream,
+	//	once it comes back.
+	enum atom_error_t entrySpoolEnable(
+		std::string path,
+		size_t size = ELEMENT_ENTRY_SPOOL_DEFAULT_SIZE,
+		unsigned int drain_rate = ELEMENT_ENTRY_SPOOL_NO_RATE_LIMIT);
+
+	// Drains the spool into redis. Writes will drain the spool as they go,
+	//	this is for elements that want to drain without writing. Returns
+	//	the number of entries written or -1 if redis is still unreachable
+	int entrySpoolDrain();
+
+	// Returns the number of entries waiting in the spool
+	size_t entrySpoolSize();
+
+	// Trims the stream based on where its durable consumers are rather
+	//	than on the maxlen passed to entryWrite(). Nothing older than
+	//	max_age_ms and no more than max_bytes worth of entries is kept
+	//	no matter where the consumers are.
+	enum atom_error_t entryTrimEnable(
+		std::string stream,
+		uint64_t max_age_ms,
+		size_t max_bytes = ELEMENT_ENTRY_TRIM_NO_MAX_BYTES,
+		uint64_t refresh_ms = ELEMENT_ENTRY_TRIM_DEFAULT_REFRESH_MS);
+
+	// Makes a stream we write ephemeral. Entries are published over redis
+	//	pub/sub instead of being added to a redis stream, so only readers
+	//	that are listening at the time get them and redis keeps no history.
+	//	Readers need to call setEphemeral() on their ElementReadMap.
+	enum atom_error_t entryEphemeralEnable(
+		std::string stream);
+
+	// Reports our position on a stream as a durable consumer s.t. the
+	//	writer won't trim anything after last_id
+	enum atom_error_t entryConsumerReport(
+		std::string element,
+		std::string stream,
+		std::string last_id);
+
+	// Stops holding back trimming on a stream
+	enum atom_error_t entryConsumerRemove(
+		std::string element,
+		std::string stream);
+
+	// Writes an entry to the logs. Rate limited per call site once
+	//	limiting is turned on, see atom_log_limit_set(). The format string
+	//	is the call site for the variadic one, and an already formatted
+	//	message is only limited when it's passed a site, i.e.
+	//	log(ELEMENT_LOG_SITE, level, msg).
+	void log(
+		int level,
+		const std::string &msg);
 	void log(
+		const char *site,
 		int level,
-		std::string msg);
+		const std::string &msg);
 	void log(
 		int level,
 		const char *fmt,
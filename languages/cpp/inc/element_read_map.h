@@ -13,6 +13,7 @@
 
 #include "atom/atom.h"
 #include "atom/redis.h"
+#include "atom/element_entry_read.h"
 #include "element_response.h"
 #include <map>
 
@@ -27,12 +28,19 @@ typedef bool (*readHandlerFn)(
 	void *user_data);
 
 // Typedef the tuple
-typedef std::tuple<std::string, std::string, std::vector<std::string>, readHandlerFn, void*> handler_t;
+typedef std::tuple<std::string, std::string, std::vector<std::string>, readHandlerFn, void*, unsigned int, size_t> handler_t;
 
 // Response class
 class ElementReadMap {
 	std::vector<handler_t> handlers;
 
+	// Adaptive batching for the read loop, if enabled
+	bool batching_enabled;
+	struct element_entry_read_batching batching;
+
+	// Whether the streams are ephemeral
+	bool ephemeral;
+
 public:
 
 	// Constructor and destructor
@@ -54,11 +62,61 @@ public:
 		readHandlerFn fn,
 		void *user_data);
 
+	// Add in a handler with user data and scheduling. When reading from
+	//	multiple streams, entries are delivered round-robin with weight
+	//	entries from this stream per round, and at most max_count entries
+	//	from it per XREAD.
+	void addHandler(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> keys,
+		readHandlerFn fn,
+		void *user_data,
+		unsigned int weight,
+		size_t max_count = REDIS_XREAD_NOMAXCOUNT);
+
+	// Add in a handler for a partitioned stream, see
+	//	Element::entryPartitionEnable(). The read loop reads the partitions
+	//	we own with a single XREAD and calls the handler for each entry,
+	//	in order within each partition. With n_members readers splitting
+	//	up the stream, each passing its own member index, member owns
+	//	the partitions p with p % n_members == member.
+	void addPartitionedHandler(
+		std::string element,
+		std::string stream,
+		int n_partitions,
+		std::vector<std::string> keys,
+		readHandlerFn fn,
+		void *user_data = NULL,
+		int member = 0,
+		int n_members = 1);
+
 	// Gets the number of handlers
 	size_t getNumHandlers();
 
 	// Gets the info for a particular handler
 	handler_t &getHandler(int n);
+
+	// Enables adaptive batching of the XREADs in the read loop using
+	//	this map. See element_entry_read_batching.
+	void setBatching(
+		size_t min_count = ELEMENT_ENTRY_READ_BATCHING_DEFAULT_MIN_COUNT,
+		size_t max_count = ELEMENT_ENTRY_READ_BATCHING_DEFAULT_MAX_COUNT,
+		int spin_us = ELEMENT_ENTRY_READ_BATCHING_NO_SPIN);
+
+	// Gets the batching settings, including the current COUNT and the
+	//	read stats. NULL if batching isn't enabled.
+	struct element_entry_read_batching *getBatching();
+
+	// Marks the streams in this map as ephemeral, i.e. written by an
+	//	element that called entryEphemeralEnable() on them. The read loop
+	//	then gets entries pushed to it over pub/sub rather than XREADing.
+	//	Ephemeral and regular streams can't be mixed in a single map.
+	void setEphemeral(
+		bool e = true);
+
+	// Gets whether the streams in this map are ephemeral
+	bool isEphemeral();
 };
 
 } // namespace atom
@@ -0,0 +1,59 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file entry_read_request.h
+//
+//  @brief Reusable request for reading entries from a single stream
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_ENTRY_READ_REQUEST_H
+#define __ATOM_CPP_ENTRY_READ_REQUEST_H
+
+#include <string>
+#include <vector>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/element_entry_read.h"
+
+namespace atom {
+
+// A read of a single stream that's made once and then passed to
+//	Element::entryReadN() or Element::entryReadSince() over and over.
+//	The names, the keys and the C read info pointing at them are set up
+//	here once rather than on every read. A request can only be used by
+//	one read at a time.
+class EntryReadRequest {
+public:
+
+	// Pass an empty element to read a stream that isn't an element's
+	EntryReadRequest(
+		const std::string &element,
+		const std::string &stream,
+		const std::vector<std::string> &keys);
+
+	EntryReadRequest(const EntryReadRequest &) = delete;
+	EntryReadRequest &operator=(const EntryReadRequest &) = delete;
+
+	const std::string &getElement() const;
+	const std::string &getStream() const;
+	const std::vector<std::string> &getKeys() const;
+
+private:
+	friend class Element;
+
+	std::string element;
+	std::string stream;
+	std::vector<std::string> keys;
+	std::vector<struct redis_xread_kv_item> kv_items;
+
+	// Read info for the C API. Only the user data and the freshness
+	//	tracker are filled in on each read.
+	struct element_entry_read_info read_info;
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_ENTRY_READ_REQUEST_H
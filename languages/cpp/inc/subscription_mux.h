@@ -0,0 +1,163 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file subscription_mux.h
+//
+//  @brief Per-process multiplexer for stream subscriptions
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_SUBSCRIPTION_MUX_H
+#define __ATOM_CPP_SUBSCRIPTION_MUX_H
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+
+// How long the mux blocks in each XREAD. New subscriptions wake the XREAD
+//	through the mux's wakeup stream, so this only bounds how long it takes
+//	to notice that a subscription was dropped.
+#define SUBSCRIPTION_MUX_BLOCK_MS 100
+
+// Prefix of the stream each mux is woken up through. Followed by the host
+//	and pid of the process.
+#define SUBSCRIPTION_MUX_WAKEUP_PREFIX "subscription_mux:wakeup:"
+
+// Max number of streams the mux can be subscribed to at once. They're all
+//	in one XREAD, along with the wakeup stream.
+#define SUBSCRIPTION_MUX_MAX_STREAMS (REDIS_XREAD_MAX_STREAMS - 1)
+
+// How long the mux waits before retrying after a redis error
+#define SUBSCRIPTION_MUX_RETRY_MS 100
+
+namespace atom {
+
+// Forward declaration for the entry class
+class Entry;
+
+// Handler for entries from the mux. The entry is shared between all
+//	subscribers to the stream and is immutable.
+typedef bool (*sharedReadHandlerFn)(
+	std::shared_ptr<const Entry> e,
+	void *user_data);
+
+// XREAD callback for the mux, needs to be "extern C" for the atom C api
+extern "C" bool subscriptionMuxCB(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data);
+
+// Subscription multiplexer. All subscriptions in the process share a
+//	single redis context and a single XREAD over the union of the
+//	subscribed streams. Each entry is decoded once and then passed, by
+//	reference-counted pointer, to every subscriber to its stream.
+//	Handlers are called from the mux thread.
+class SubscriptionMux {
+
+	// A subscriber to a stream
+	struct Subscriber {
+		int id;
+		sharedReadHandlerFn fn;
+		void *user_data;
+		std::atomic<bool> active;
+
+		Subscriber(int i, sharedReadHandlerFn f, void *d) :
+			id(i), fn(f), user_data(d), active(true) {}
+	};
+
+	// A stream that has at least one subscriber. Never modified once it's
+	//	in the map, it's replaced with a new copy instead s.t. the mux
+	//	thread can use it without holding the lock.
+	struct Stream {
+		std::string name;
+		std::vector<std::shared_ptr<Subscriber>> subscribers;
+
+		// ID to start reading from, taken when the stream was first
+		//	subscribed to s.t. nothing written after that is missed
+		std::string start_id;
+	};
+
+	// Streams keyed on their full redis name
+	std::map<std::string, std::shared_ptr<Stream>> streams;
+	std::map<int, std::string> subscriber_streams;
+	int next_id;
+
+	// Bumped each time the set of subscriptions changes s.t. the mux
+	//	thread knows to rebuild its XREAD
+	unsigned int generation;
+
+	// Protects the above
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	// Held while calling handlers s.t. unsubscribe can wait out a
+	//	handler that's already running
+	std::mutex dispatch_mutex;
+
+	// Mux thread and its context
+	std::thread thread;
+	redisContext *ctx;
+	bool stop;
+
+	// Context for subscribe() to get start IDs and wake up the mux thread
+	//	with. Protected by mutex.
+	redisContext *cmd_ctx;
+	std::string wakeup_stream;
+
+	// Wakes up the mux thread out of its XREAD
+	void wakeup();
+
+	SubscriptionMux();
+	~SubscriptionMux();
+
+	// Loop run by the mux thread
+	void run();
+
+	// Fans an entry out to the subscribers of a stream
+	void dispatch(
+		Stream *stream,
+		const char *id,
+		const struct redisReply *reply);
+
+	friend bool subscriptionMuxCB(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data);
+
+public:
+
+	// No copying the mux
+	SubscriptionMux(const SubscriptionMux &) = delete;
+	SubscriptionMux &operator=(const SubscriptionMux &) = delete;
+
+	// Returns the mux for the process
+	static SubscriptionMux &instance();
+
+	// Subscribes to a stream. The handler will be called with each entry
+	//	written to the stream after this is called. If element is empty
+	//	then stream is the full redis name of the stream. Returns an ID for
+	//	the subscription to pass to unsubscribe(), or -1 if the mux is
+	//	already subscribed to SUBSCRIPTION_MUX_MAX_STREAMS streams.
+	int subscribe(
+		const std::string &element,
+		const std::string &stream,
+		sharedReadHandlerFn fn,
+		void *user_data);
+
+	// Unsubscribes. Once this returns the handler won't be called again.
+	//	Safe to call from within a handler.
+	void unsubscribe(
+		int id);
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_SUBSCRIPTION_MUX_H
@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file batching_client.cc
+//
+//  @brief Client that coalesces small commands to an element into batches
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <chrono>
+#include <algorithm>
+
+#include "atom/atom.h"
+#include "element.h"
+#include "batching_client.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Starts the worker thread.
+//
+////////////////////////////////////////////////////////////////////////////////
+BatchingClient::BatchingClient(
+	Element &e,
+	std::string t,
+	size_t max,
+	int window) : elem(e), target(t), max_batch(max), window_us(window),
+	stop(false), unsupported(false)
+{
+	if ((max_batch == 0) || (max_batch > ELEMENT_COMMAND_BATCH_MAX_ITEMS)) {
+		max_batch = ELEMENT_COMMAND_BATCH_MAX_ITEMS;
+	}
+
+	thread = std::thread(&BatchingClient::run, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Stops the worker thread once the queue is empty.
+//
+////////////////////////////////////////////////////////////////////////////////
+BatchingClient::~BatchingClient()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cond.notify_all();
+
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Queues a command
+//
+////////////////////////////////////////////////////////////////////////////////
+std::future<ElementResponse> BatchingClient::sendCommand(
+	std::string command,
+	const uint8_t *data,
+	size_t data_len)
+{
+	std::unique_ptr<Pending> pending(new Pending);
+	pending->command = command;
+	if ((data != NULL) && (data_len > 0)) {
+		pending->data.assign((const char *)data, data_len);
+	}
+	std::future<ElementResponse> ret = pending->promise.get_future();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back(std::move(pending));
+	}
+	cond.notify_all();
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a single command through the element
+//
+////////////////////////////////////////////////////////////////////////////////
+void BatchingClient::sendOne(
+	Pending &pending)
+{
+	ElementResponse response;
+
+	elem.sendCommand(
+		response,
+		target,
+		pending.command,
+		(const uint8_t *)pending.data.data(),
+		pending.data.size());
+
+	pending.promise.set_value(response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a set of commands as a single batch and hands each of the
+//			responses back to its command
+//
+////////////////////////////////////////////////////////////////////////////////
+void BatchingClient::sendBatch(
+	std::vector<std::unique_ptr<Pending>> &batch)
+{
+	struct element_command_batch_item items[ELEMENT_COMMAND_BATCH_MAX_ITEMS];
+	ElementResponse response;
+	uint8_t *data;
+	size_t data_len;
+	int n_items;
+
+	for (size_t i = 0; i < batch.size(); ++i) {
+		items[i].name = batch[i]->command.data();
+		items[i].name_len = batch[i]->command.size();
+		items[i].data = (const uint8_t *)batch[i]->data.data();
+		items[i].data_len = batch[i]->data.size();
+	}
+
+	data = element_command_batch_encode(items, batch.size(), false, &data_len);
+	if (data == NULL) {
+		for (auto &pending : batch) {
+			sendOne(*pending);
+		}
+		return;
+	}
+
+	enum atom_error_t err = elem.sendCommand(
+		response,
+		target,
+		ELEMENT_COMMAND_BATCH_STR,
+		data,
+		data_len);
+	free(data);
+
+	// If the element doesn't know about batches then send everything
+	//	one at a time from here on out
+	if (err == ATOM_COMMAND_UNSUPPORTED) {
+		atom_logf(NULL, NULL, LOG_INFO,
+			"%s doesn't support batches", target.c_str());
+		unsupported = true;
+		for (auto &pending : batch) {
+			sendOne(*pending);
+		}
+		return;
+	}
+
+	// Any other error on the batch as a whole goes to every command
+	if (err != ATOM_NO_ERROR) {
+		for (auto &pending : batch) {
+			pending->promise.set_value(response);
+		}
+		return;
+	}
+
+	n_items = element_command_batch_parse(
+		response.getDataPtr(),
+		response.getDataLen(),
+		true,
+		items,
+		ELEMENT_COMMAND_BATCH_MAX_ITEMS);
+	if (n_items != (int)batch.size()) {
+		atom_logf(NULL, NULL, LOG_ERR, "Invalid batch response");
+		response.setError(ATOM_COMMAND_INVALID_DATA, "Invalid batch response");
+		for (auto &pending : batch) {
+			pending->promise.set_value(response);
+		}
+		return;
+	}
+
+	for (int i = 0; i < n_items; ++i) {
+		ElementResponse item_response;
+		if (items[i].err_code != ATOM_NO_ERROR) {
+			item_response.setError(items[i].err_code,
+				std::string((const char *)items[i].data, items[i].data_len));
+		} else {
+			item_response.setData(items[i].data, items[i].data_len);
+		}
+		batch[i]->promise.set_value(item_response);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Worker thread. Waits for a command, then gives the window for
+//			more to show up before sending out everything it has.
+//
+////////////////////////////////////////////////////////////////////////////////
+void BatchingClient::run()
+{
+	while (true) {
+		std::vector<std::unique_ptr<Pending>> batch;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this]() { return stop || !queue.empty(); });
+			if (queue.empty()) {
+				break;
+			}
+
+			// Fill out the batch, unless we're on our way out
+			if (!stop && !unsupported && (queue.size() < max_batch)) {
+				cond.wait_for(
+					lock,
+					std::chrono::microseconds(window_us),
+					[this]() { return stop || (queue.size() >= max_batch); });
+			}
+
+			size_t n = std::min(queue.size(), max_batch);
+			for (size_t i = 0; i < n; ++i) {
+				batch.push_back(std::move(queue[i]));
+			}
+			queue.erase(queue.begin(), queue.begin() + n);
+		}
+
+		if ((batch.size() == 1) || unsupported) {
+			for (auto &pending : batch) {
+				sendOne(*pending);
+			}
+		} else {
+			sendBatch(batch);
+		}
+	}
+}
+
+} // namespace atom
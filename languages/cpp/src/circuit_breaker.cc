@@ -0,0 +1,164 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file circuit_breaker.cc
+//
+//  @brief Circuit breaker for commands sent to an element
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+
+#include "circuit_breaker.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Breakers start out closed.
+//
+////////////////////////////////////////////////////////////////////////////////
+CircuitBreaker::CircuitBreaker(
+	size_t w,
+	size_t min,
+	double rate,
+	int open_ms) : window((w > 0) ? w : 1), min_calls(min),
+	failure_rate(rate), open_time(open_ms), state(CLOSED), probing(false),
+	probe_token(CIRCUIT_BREAKER_NO_PROBE), outcomes(window, false), next(0),
+	n_calls(0), n_failures(0)
+{
+	if (min_calls > window) {
+		min_calls = window;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether a command can go out now
+//
+////////////////////////////////////////////////////////////////////////////////
+bool CircuitBreaker::allow(
+	uint64_t &probe)
+{
+	probe = CIRCUIT_BREAKER_NO_PROBE;
+
+	switch (state) {
+		case CLOSED:
+			return true;
+
+		// Let a single probe through once we've been open long enough
+		case OPEN:
+			if (std::chrono::steady_clock::now() - opened < open_time) {
+				return false;
+			}
+			state = HALF_OPEN;
+			break;
+
+		// Everyone else waits on the probe
+		case HALF_OPEN:
+		default:
+			if (probing) {
+				return false;
+			}
+			break;
+	}
+
+	probing = true;
+	probe_token++;
+	if (probe_token == CIRCUIT_BREAKER_NO_PROBE) {
+		probe_token++;
+	}
+	probe = probe_token;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Notes the outcome of a command
+//
+////////////////////////////////////////////////////////////////////////////////
+void CircuitBreaker::record(
+	enum atom_error_t err,
+	uint64_t probe)
+{
+	bool failed = isFailure(err);
+
+	// The probe decides whether we close or go back to open. Anything
+	//	else went out before we opened and doesn't count.
+	if (state == HALF_OPEN) {
+		if (!probing || (probe != probe_token)) {
+			return;
+		}
+
+		probing = false;
+		if (failed) {
+			open();
+		} else {
+			state = CLOSED;
+		}
+		return;
+	}
+
+	// Commands that went out before we opened don't count
+	if (state != CLOSED) {
+		return;
+	}
+
+	if (n_calls == window) {
+		if (outcomes[next]) {
+			n_failures--;
+		}
+	} else {
+		n_calls++;
+	}
+	outcomes[next] = failed;
+	if (failed) {
+		n_failures++;
+	}
+	next = (next + 1) % window;
+
+	if ((n_calls >= min_calls) &&
+		((double)n_failures >= failure_rate * (double)n_calls))
+	{
+		open();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Opens the breaker
+//
+////////////////////////////////////////////////////////////////////////////////
+void CircuitBreaker::open()
+{
+	state = OPEN;
+	opened = std::chrono::steady_clock::now();
+	std::fill(outcomes.begin(), outcomes.end(), false);
+	next = 0;
+	n_calls = 0;
+	n_failures = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the state the breaker is in
+//
+////////////////////////////////////////////////////////////////////////////////
+CircuitBreaker::State CircuitBreaker::getState() const
+{
+	return state;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether an error means the element isn't there. Errors
+//			from the element itself mean it's alive and well.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool CircuitBreaker::isFailure(
+	enum atom_error_t err)
+{
+	return (err == ATOM_COMMAND_NO_ACK) || (err == ATOM_COMMAND_NO_RESPONSE);
+}
+
+} // namespace atom
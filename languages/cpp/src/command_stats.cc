@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file command_stats.cc
+//
+//  @brief Per-command CPU, data and allocation accounting
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#include "command_stats.h"
+
+namespace atom {
+
+thread_local CommandAllocCounters command_alloc_counters = {0, 0};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Formats the stats for a command as a single line
+//
+////////////////////////////////////////////////////////////////////////////////
+std::string CommandStats::format(
+	const std::string &name) const
+{
+	char buffer[256];
+
+	snprintf(buffer, sizeof(buffer),
+		" calls=%llu errors=%llu cpu_us=%llu max_cpu_us=%llu req_bytes=%llu "
+		"res_bytes=%llu allocs=%llu alloc_bytes=%llu\n",
+		(unsigned long long)calls,
+		(unsigned long long)errors,
+		(unsigned long long)(cpu_ns / 1000),
+		(unsigned long long)(max_cpu_ns / 1000),
+		(unsigned long long)request_bytes,
+		(unsigned long long)response_bytes,
+		(unsigned long long)allocs,
+		(unsigned long long)alloc_bytes);
+
+	return name + buffer;
+}
+
+} // namespace atom
+
+#ifdef ATOM_CPP_ALLOC_HOOK
+
+// Allocator hook. Replaces operator new for the whole process s.t. the
+//	command stats can count allocations. Only built in with
+//	ATOM_CPP_ALLOC_HOOK since it's a global replacement.
+void *operator new(
+	size_t size)
+{
+	void *ptr = malloc((size > 0) ? size : 1);
+	if (ptr == NULL) {
+		throw std::bad_alloc();
+	}
+	atom::commandAllocNote(size);
+	return ptr;
+}
+
+void operator delete(
+	void *ptr) noexcept
+{
+	free(ptr);
+}
+
+#endif // ATOM_CPP_ALLOC_HOOK
@@ -9,12 +9,14 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <mutex>
 #include <queue>
+#include <algorithm>
 #include <assert.h>
 #include <string.h>
 #include <iostream>
 
 #include "atom/atom.h"
 #include "atom/redis.h"
+#include "atom/atom_probes.h"
 #include "atom/element.h"
 #include "atom/element_command_send.h"
 #include "element.h"
@@ -29,6 +31,10 @@ extern "C" {
 		const char *element,
 		void *user_data);
 
+	bool getAllCommandsCB(
+		const struct atom_command_info *info,
+		void *user_data);
+
 	bool sendCommandResponseCB(
 		const uint8_t *response,
 		size_t response_len,
@@ -50,6 +56,17 @@ extern "C" {
 
 	void commandCleanup(
 		void *cleanup_ptr);
+
+	int commandChunkCB(
+		const uint8_t *chunk,
+		size_t chunk_len,
+		void *user_data);
+
+	bool sendCommandChunkCB(
+		const uint8_t **chunk,
+		size_t *chunk_len,
+		bool *last,
+		void *user_data);
 }
 
 // Class for entry info from a handler to be passed to the callback function
@@ -112,7 +129,7 @@ void Entry::addData(
 //  @brief Get ID of an entry
 //
 ////////////////////////////////////////////////////////////////////////////////
-const std::string &Entry::getID()
+const std::string &Entry::getID() const
 {
 	return id;
 }
@@ -122,7 +139,7 @@ const std::string &Entry::getID()
 //  @brief Get data of an entry
 //
 ////////////////////////////////////////////////////////////////////////////////
-const entry_data_t &Entry::getData()
+const entry_data_t &Entry::getData() const
 {
 	return data;
 }
@@ -133,7 +150,7 @@ const entry_data_t &Entry::getData()
 //
 ////////////////////////////////////////////////////////////////////////////////
 const std::string &Entry::getKey(
-	const std::string &key)
+	const std::string &key) const
 {
 	return data.at(key);
 }
@@ -143,7 +160,7 @@ const std::string &Entry::getKey(
 //  @brief Get size
 //
 ////////////////////////////////////////////////////////////////////////////////
-size_t Entry::size()
+size_t Entry::size() const
 {
 	return data.size();
 }
@@ -155,14 +172,17 @@ size_t Entry::size()
 //
 ////////////////////////////////////////////////////////////////////////////////
 void Element::initContextPool(
+	ContextClass cls,
 	int n_contexts)
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
+	ContextPool &pool = context_pools[cls];
+	std::lock_guard<std::mutex> lock(pool.mutex);
 
 	for (int i = 0; i < n_contexts; ++i) {
 		redisContext *new_context = redis_context_init();
-		context_pool.push(new_context);
+		pool.contexts.push(new_context);
 	}
+	pool.size += n_contexts;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -172,12 +192,29 @@ void Element::initContextPool(
 ////////////////////////////////////////////////////////////////////////////////
 void Element::cleanupContextPool()
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
-	while (!context_pool.empty()) {
-		redisContext *ctx = context_pool.front();
-		redis_context_cleanup(ctx);
-		context_pool.pop();
+	for (auto &pool : context_pools) {
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		while (!pool.contexts.empty()) {
+			redisContext *ctx = pool.contexts.front();
+			redis_context_cleanup(ctx);
+			pool.contexts.pop();
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the pool for a traffic class, the control pool if the
+//			class doesn't have any contexts of its own
+//
+////////////////////////////////////////////////////////////////////////////////
+Element::ContextPool &Element::contextPool(
+	ContextClass cls)
+{
+	if (context_pools[cls].size == 0) {
+		return context_pools[CONTEXT_CONTROL];
 	}
+	return context_pools[cls];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -185,11 +222,20 @@ void Element::cleanupContextPool()
 //  @brief Gets a context from our context pool
 //
 ////////////////////////////////////////////////////////////////////////////////
-redisContext *Element::getContext()
+redisContext *Element::getContext(
+	ContextClass cls)
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
-	redisContext *ctx = context_pool.front();
-	context_pool.pop();
+	ContextPool &pool = contextPool(cls);
+	std::unique_lock<std::mutex> lock(pool.mutex);
+
+	// Wait for a context to be put back if they're all in use
+	pool.available.wait(lock, [&pool]() {
+		return !pool.contexts.empty();
+	});
+
+	redisContext *ctx = pool.contexts.front();
+	pool.contexts.pop();
+	ATOM_PROBE2(context_acquired, ctx, pool.contexts.size());
 	return ctx;
 }
 
@@ -198,10 +244,150 @@ redisContext *Element::getContext()
 //  @brief Releases a context back to the context pool
 //
 ////////////////////////////////////////////////////////////////////////////////
-void Element::releaseContext(redisContext *ctx)
+void Element::releaseContext(
+	redisContext *ctx,
+	ContextClass cls)
+{
+	ContextPool &pool = contextPool(cls);
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.contexts.push(ctx);
+		ATOM_PROBE2(context_released, ctx, pool.contexts.size());
+	}
+	pool.available.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks whether the replica is connected to the primary and
+//			within the max lag of it
+//
+////////////////////////////////////////////////////////////////////////////////
+bool Element::replicaCaughtUp(
+	redisContext *replica_ctx)
+{
+	struct redis_replication_info replica_info;
+	struct redis_replication_info primary_info;
+
+	if (!redis_context_reconnect(replica_ctx) ||
+		!redis_get_replication_info(replica_ctx, &replica_info) ||
+		!replica_info.is_replica ||
+		!replica_info.link_up)
+	{
+		return false;
+	}
+
+	// The check is housekeeping, keep it off of the control contexts
+	redisContext *ctx = getContext(CONTEXT_BACKGROUND);
+	bool primary_ok = redis_get_replication_info(ctx, &primary_info);
+	releaseContext(ctx, CONTEXT_BACKGROUND);
+	if (!primary_ok) {
+		return false;
+	}
+
+	return ((primary_info.offset - replica_info.offset) <= replica_max_lag);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets a context from the replica pool if the replica is enabled
+//			and caught up with the primary. Only rechecks the lag every
+//			ELEMENT_REPLICA_LAG_CHECK_INTERVAL_MS.
+//
+////////////////////////////////////////////////////////////////////////////////
+redisContext *Element::getReplicaContext()
+{
+	redisContext *ctx;
+	bool check = false;
+
+	{
+		std::lock_guard<std::mutex> lock(replica_mutex);
+
+		if (replica_pool.empty()) {
+			return NULL;
+		}
+
+		// Only one thread does the lag check, the rest go with the last
+		//	result until it's done
+		auto now = std::chrono::steady_clock::now();
+		if ((now - replica_checked) >=
+			std::chrono::milliseconds(ELEMENT_REPLICA_LAG_CHECK_INTERVAL_MS))
+		{
+			replica_checked = now;
+			check = true;
+		} else if (!replica_healthy) {
+			return NULL;
+		}
+
+		ctx = replica_pool.front();
+		replica_pool.pop();
+	}
+
+	// The lag check blocks on both servers so it's done without the lock
+	if (check) {
+		bool healthy = replicaCaughtUp(ctx);
+
+		std::lock_guard<std::mutex> lock(replica_mutex);
+		replica_healthy = healthy;
+		if (!healthy) {
+			replica_pool.push(ctx);
+			return NULL;
+		}
+	}
+
+	return ctx;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Releases a context back to the replica pool. If the read on it
+//			failed then we stop using the replica until the next lag check.
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::releaseReplicaContext(
+	redisContext *ctx,
+	bool healthy)
+{
+	std::lock_guard<std::mutex> lock(replica_mutex);
+	if (!healthy) {
+		replica_healthy = false;
+	}
+	replica_pool.push(ctx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs a read on the replica if possible, else on the primary
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::routeRead(
+	bool replica_ok,
+	ContextClass cls,
+	const std::function<enum atom_error_t(redisContext *)> &fn,
+	const std::function<void()> &reset)
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
-	context_pool.push(ctx);
+	enum atom_error_t err;
+
+	// Try the replica first
+	if (replica_ok) {
+		redisContext *ctx = getReplicaContext();
+		if (ctx != NULL) {
+			err = fn(ctx);
+			releaseReplicaContext(ctx, (err == ATOM_NO_ERROR));
+			if (err == ATOM_NO_ERROR) {
+				return err;
+			}
+
+			// Fall back to the primary
+			reset();
+		}
+	}
+
+	redisContext *ctx = getContext(cls);
+	err = fn(ctx);
+	releaseContext(ctx, cls);
+
+	return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -212,13 +398,22 @@ void Element::releaseContext(redisContext *ctx)
 ////////////////////////////////////////////////////////////////////////////////
 Element::Element(
 	std::string n,
-	int n_contexts) : context_pool(), context_mutex()
+	int n_contexts,
+	int n_bulk_contexts,
+	int n_background_contexts) : replica_pool(),
+		replica_mutex(), replica_history_min_n(0), replica_max_lag(0),
+		replica_healthy(false), spool(NULL),
+		response_cache_max(ELEMENT_DEFAULT_RESPONSE_CACHE_SIZE),
+		slow_op_command(false), circuit_breaker_on(false),
+		command_stats_on(false)
 {
 	// Copy over the name
 	name = n;
 
-	// Initialize the context pool
-	initContextPool(n_contexts);
+	// Initialize the context pools
+	initContextPool(CONTEXT_CONTROL, n_contexts);
+	initContextPool(CONTEXT_BULK, n_bulk_contexts);
+	initContextPool(CONTEXT_BACKGROUND, n_background_contexts);
 
 	// Get a context
 	redisContext *ctx = getContext();
@@ -238,15 +433,38 @@ Element::Element(
 ////////////////////////////////////////////////////////////////////////////////
 Element::~Element()
 {
+	// Drop any subscriptions we have s.t. handlers aren't called
+	//	once we're gone. Unsubscribing waits out a handler that's running,
+	//	which might itself (un)subscribe, so don't hold our lock for it.
+	std::vector<int> ids;
+	{
+		std::lock_guard<std::mutex> lock(subscriptions_mutex);
+		ids.swap(subscriptions);
+	}
+	for (int id : ids) {
+		SubscriptionMux::instance().unsubscribe(id);
+	}
+
 	redisContext *ctx = getContext();
 
 	// Need to clean up all of the stream infos that we're publishing
-	for (auto const &x : streams) {
-		struct element_entry_write_info *info = x.second;
-		for (size_t i = 0; i < info->n_items; ++i) {
-			free((char*)info->items[i].key);
+	for (auto &shard : writer_shards) {
+		for (auto const &x : shard.writers) {
+			struct element_entry_write_info *info = x.second->info;
+			if (info == NULL) {
+				continue;
+			}
+			for (size_t i = 0; i < info->n_items; ++i) {
+				free((char*)info->items[i].key);
+			}
+			element_entry_write_cleanup(ctx, info);
 		}
-		element_entry_write_cleanup(ctx, x.second);
+	}
+
+	// Close out the spool, anything left in it stays in the file
+	//	for the next run
+	if (spool != NULL) {
+		element_entry_spool_cleanup(spool);
 	}
 
 	//Need to delete all of the command classes associated with us
@@ -254,9 +472,20 @@ Element::~Element()
 		delete cmd.second;
 	}
 
+	for (auto &f : freshness) {
+		element_entry_freshness_cleanup(&f.second);
+	}
+
 	element_cleanup(ctx, elem);
 	releaseContext(ctx);
 	cleanupContextPool();
+
+	// And the replica contexts, if any
+	std::lock_guard<std::mutex> lock(replica_mutex);
+	while (!replica_pool.empty()) {
+		redis_context_cleanup(replica_pool.front());
+		replica_pool.pop();
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -307,24 +536,90 @@ bool getAllElementsStreamsCB(
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Returns a list of all elements
+//  @brief Callback for each command in the command registry
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::getAllElements(
-	std::vector<std::string> &elem_list)
+bool getAllCommandsCB(
+	const struct atom_command_info *info,
+	void *user_data)
 {
-	// Get a context
-	redisContext *ctx = getContext();
+	std::vector<CommandInfo> *commands = (std::vector<CommandInfo> *)user_data;
 
-	// Call the function to get all elements
-	enum atom_error_t err = atom_get_all_elements_cb(
-		ctx,
-		getAllElementsStreamsCB,
-		(void*)&elem_list);
+	commands->push_back(CommandInfo{
+		info->element,
+		info->command,
+		info->description,
+		info->timeout});
+	return true;
+}
 
-	releaseContext(ctx);
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Enables routing of history and discovery reads to a replica
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::replicaEnable(
+	std::string socket,
+	int n_contexts,
+	size_t history_min_n,
+	long long max_lag)
+{
+	std::lock_guard<std::mutex> lock(replica_mutex);
 
-	return err;
+	if (!replica_pool.empty()) {
+		log(LOG_ERR, "Replica already enabled");
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	for (int i = 0; i < n_contexts; ++i) {
+		redisContext *ctx = redis_context_init_local(socket.c_str());
+		if ((ctx == NULL) || ctx->err) {
+			log(LOG_ERR, "Failed to connect to replica at %s", socket.c_str());
+			if (ctx != NULL) {
+				redis_context_cleanup(ctx);
+			}
+			while (!replica_pool.empty()) {
+				redis_context_cleanup(replica_pool.front());
+				replica_pool.pop();
+			}
+			return ATOM_REDIS_ERROR;
+		}
+		replica_pool.push(ctx);
+	}
+
+	replica_history_min_n = history_min_n;
+	replica_max_lag = max_lag;
+
+	// Force a lag check on the first read
+	replica_healthy = false;
+	replica_checked = std::chrono::steady_clock::time_point();
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns a list of all elements
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::getAllElements(
+	std::vector<std::string> &elem_list)
+{
+	size_t start_size = elem_list.size();
+
+	// Discovery isn't latency critical, can come from the replica
+	return routeRead(
+		true,
+		CONTEXT_BACKGROUND,
+		[&](redisContext *ctx) {
+			return atom_get_all_elements_cb(
+				ctx,
+				getAllElementsStreamsCB,
+				(void*)&elem_list);
+		},
+		[&]() {
+			elem_list.resize(start_size);
+		});
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -336,19 +631,22 @@ enum atom_error_t Element::getAllStreams(
 	std::vector<std::string> &stream_list,
 	std::string element)
 {
-	// Get a context
-	redisContext *ctx = getContext();
-
-	// Call the function to get all streams
-	enum atom_error_t err = atom_get_all_data_streams_cb(
-		ctx,
-		element.c_str(),
-		getAllElementsStreamsCB,
-		(void*)&stream_list);
-
-	releaseContext(ctx);
-
-	return err;
+	size_t start_size = stream_list.size();
+
+	// Discovery isn't latency critical, can come from the replica
+	return routeRead(
+		true,
+		CONTEXT_BACKGROUND,
+		[&](redisContext *ctx) {
+			return atom_get_all_data_streams_cb(
+				ctx,
+				element.c_str(),
+				getAllElementsStreamsCB,
+				(void*)&stream_list);
+		},
+		[&]() {
+			stream_list.resize(start_size);
+		});
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -359,20 +657,24 @@ enum atom_error_t Element::getAllStreams(
 enum atom_error_t Element::getAllStreams(
 	std::map<std::string, std::vector<std::string>> &stream_map)
 {
-	// Get a context
-	redisContext *ctx = getContext();
-
 	// Make the list for all of the strings
 	std::vector<std::string> stream_list;
 
-	// Call the function to get all streams
-	enum atom_error_t err = atom_get_all_data_streams_cb(
-		ctx,
-		NULL,
-		getAllElementsStreamsCB,
-		(void*)&stream_list);
-
-	releaseContext(ctx);
+	// Call the function to get all streams. Discovery isn't latency
+	//	critical, can come from the replica
+	enum atom_error_t err = routeRead(
+		true,
+		CONTEXT_BACKGROUND,
+		[&](redisContext *ctx) {
+			return atom_get_all_data_streams_cb(
+				ctx,
+				NULL,
+				getAllElementsStreamsCB,
+				(void*)&stream_list);
+		},
+		[&]() {
+			stream_list.clear();
+		});
 
 	// Now, parse the list down into the map
 	for (auto const &x: stream_list) {
@@ -398,6 +700,34 @@ enum atom_error_t Element::getAllStreams(
 	return err;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the commands in the command registry, for all elements
+//			or just the one passed
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::getAllCommands(
+	std::vector<CommandInfo> &commands,
+	const std::string &element)
+{
+	size_t start_size = commands.size();
+
+	// Discovery isn't latency critical, can come from the replica
+	return routeRead(
+		true,
+		CONTEXT_BACKGROUND,
+		[&](redisContext *ctx) {
+			return atom_get_all_commands_cb(
+				ctx,
+				(element.size() > 0) ? element.c_str() : NULL,
+				getAllCommandsCB,
+				(void*)&commands);
+		},
+		[&]() {
+			commands.resize(start_size);
+		});
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Response callback for when we send a command. This will just
@@ -446,6 +776,11 @@ int commandCB(
 	void **cleanup_ptr)
 {
 	int error = 0;
+	bool accounting;
+	struct timespec cpu_start;
+	struct timespec cpu_end;
+	CommandAllocCounters alloc_start;
+	CommandStats call;
 
 	const char *deserializeError = "Failed to deserialize";
 	const char *validateError = "Failed to validate";
@@ -459,28 +794,42 @@ int commandCB(
 	// Cast the user data into a command
 	Command *cmd = (Command *)user_data;
 
-	// Initialize the command
-	cmd->_init();
+	// Note where we're starting from if we're keeping track of what
+	//	the command costs
+	accounting = cmd->elem->commandStatsEnabled();
+	if (accounting) {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+		alloc_start = command_alloc_counters;
+	}
+
+	// Initialize the command, unless it's a streaming command that's
+	//	already been initialized for the chunks it's gotten
+	StreamingCommand *streaming = dynamic_cast<StreamingCommand *>(cmd);
+	if ((streaming != NULL) && streaming->started) {
+		streaming->started = false;
+	} else {
+		cmd->_init();
+	}
 
 	// Run through the command functions
     if (!cmd->deserialize(data, data_len)) {
         *error_str = (char*)deserializeError;
-        error = 101;
+        error = COMMAND_ERROR_DESERIALIZE;
         goto done;
     }
     if (!cmd->validate()) {
         *error_str = (char*)validateError;
-        error = 102;
+        error = COMMAND_ERROR_VALIDATE;
         goto done;
     }
     if (!cmd->run()) {
         *error_str = (char*)runError;
-        error = 103;
+        error = COMMAND_ERROR_RUN;
         goto done;
     }
     if (!cmd->serialize()) {
         *error_str = (char*)serializeError;
-        error = 104;
+        error = COMMAND_ERROR_SERIALIZE;
         goto done;
     }
 
@@ -513,10 +862,85 @@ done:
 		cmd->elem->log(LOG_DEBUG, "Command %s: Success", cmd->name.c_str());
 	}
 
+	if (accounting) {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+		call.calls = 1;
+		call.errors = (error != 0) ? 1 : 0;
+		call.cpu_ns = ((uint64_t)(cpu_end.tv_sec - cpu_start.tv_sec) *
+			1000000000ULL) + cpu_end.tv_nsec - cpu_start.tv_nsec;
+		call.max_cpu_ns = call.cpu_ns;
+		call.request_bytes = data_len;
+		call.response_bytes = (error == 0) ? *response_len : 0;
+		call.allocs = command_alloc_counters.count - alloc_start.count;
+		call.alloc_bytes = command_alloc_counters.bytes - alloc_start.bytes;
+		cmd->elem->commandStatsRecord(cmd->name, call);
+	}
+
 	// And return the response code
 	return error;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for each chunk of a chunked request to a streaming
+//			command. A NULL chunk means the upload failed.
+//
+////////////////////////////////////////////////////////////////////////////////
+int commandChunkCB(
+	const uint8_t *chunk,
+	size_t chunk_len,
+	void *user_data)
+{
+	StreamingCommand *cmd =
+		dynamic_cast<StreamingCommand *>((Command *)user_data);
+
+	// Drop whatever we have from the chunks so far
+	if (chunk == NULL) {
+		cmd->_cleanup();
+		cmd->started = false;
+		return 0;
+	}
+
+	// Initialize the command on the first chunk
+	if (!cmd->started) {
+		cmd->_init();
+		cmd->started = true;
+	}
+
+	if (!cmd->onChunk(chunk, chunk_len)) {
+		cmd->elem->log(LOG_ERR, "Command %s: Failed to handle chunk",
+			cmd->name.c_str());
+		return COMMAND_ERROR_DESERIALIZE;
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Publishes a command's description in the command registry
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::setCommandDescription(
+	const std::string &name,
+	const std::string &description)
+{
+	if (description.size() == 0) {
+		return;
+	}
+
+	redisContext *ctx = getContext();
+	if (!element_command_set_description(
+		ctx,
+		elem,
+		name.c_str(),
+		description.c_str()))
+	{
+		log(LOG_ERR, "Failed to set description for %s", name.c_str());
+	}
+	releaseContext(ctx);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Adds a command and its handler to the map of supported commands
@@ -553,6 +977,8 @@ void Element::addCommand(
 	{
 		error("Failed to add command");
 	}
+
+	setCommandDescription(name, description);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -577,6 +1003,22 @@ void Element::addCommand(
 	{
 		error("Failed to add command");
 	}
+
+	setCommandDescription(cmd->name, cmd->desc);
+
+	// Streaming commands can have their requests sent in chunks
+	if (dynamic_cast<StreamingCommand *>(cmd) != NULL) {
+		redisContext *ctx = getContext();
+		if (!element_command_set_chunked(
+			ctx,
+			elem,
+			cmd->name.c_str(),
+			commandChunkCB))
+		{
+			error("Failed to set command as chunked");
+		}
+		releaseContext(ctx);
+	}
 }
 
 
@@ -615,39 +1057,325 @@ enum atom_error_t Element::commandLoop(
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Sends a command to another element. Note that the caller needs to
-//			delete this response upon receiving it.
+//  @brief Handles list RPC requests for our commands
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::sendCommand(
+enum atom_error_t Element::commandRpcLoop(
+	int n_loops)
+{
+	redisContext *ctx = getContext();
+	enum atom_error_t err;
+
+	if (n_loops == ELEMENT_INFINITE_COMMAND_LOOPS) {
+		err = element_command_rpc_loop(
+			ctx,
+			elem,
+			true,
+			ELEMENT_COMMAND_LOOP_NO_TIMEOUT);
+	} else {
+		for (int i = 0; i < n_loops; ++i) {
+			err = element_command_rpc_loop(
+				ctx,
+				elem,
+				false,
+				ELEMENT_COMMAND_LOOP_NO_TIMEOUT);
+			if (err != ATOM_NO_ERROR) {
+				break;
+			}
+		}
+	}
+	releaseContext(ctx);
+	return err;
+}
+
+// State for the chunk callback of a chunked command we're sending
+class SendChunkInfo {
+public:
+	std::function<bool(std::string &chunk, bool &last)> source;
+	std::string chunk;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for the next chunk of a chunked command we're sending.
+//			The chunk needs to stay around until we're asked for the
+//			next one.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool sendCommandChunkCB(
+	const uint8_t **chunk,
+	size_t *chunk_len,
+	bool *last,
+	void *user_data)
+{
+	SendChunkInfo *info = (SendChunkInfo *)user_data;
+
+	info->chunk.clear();
+	if (!info->source(info->chunk, *last)) {
+		return false;
+	}
+
+	*chunk = (const uint8_t *)info->chunk.data();
+	*chunk_len = info->chunk.size();
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element with the request data coming
+//			from source a chunk at a time
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommandChunked(
 	ElementResponse &response,
-	std::string element,
-	std::string command,
-	const uint8_t *data,
-	size_t data_len,
-	bool block)
+	const std::string &element,
+	const std::string &command,
+	std::function<bool(std::string &chunk, bool &last)> source)
 {
-	// Want to be able to get the error string
 	char *error_str = NULL;
+	SendChunkInfo info;
+	info.source = source;
 
-	// Get a redis context
-	redisContext *ctx = getContext();
+	uint64_t probe;
+	if (!circuitBreakerAllow(element, probe)) {
+		response.setError(ATOM_COMMAND_CIRCUIT_OPEN, "Circuit breaker open");
+		return ATOM_COMMAND_CIRCUIT_OPEN;
+	}
+
+	// Uploads are bulk transfers, keep them off of the control contexts
+	redisContext *ctx = getContext(CONTEXT_BULK);
 
-	// Attempt to send the command
-	enum atom_error_t err = element_command_send(
+	enum atom_error_t err = element_command_send_chunked(
 		ctx,
 		elem,
 		element.c_str(),
 		command.c_str(),
-		data,
-		data_len,
-		block,
+		sendCommandChunkCB,
+		(void*)&info,
 		sendCommandResponseCB,
 		(void*)&response,
 		&error_str);
 
+	releaseContext(ctx, CONTEXT_BULK);
+
+	circuitBreakerRecord(element, err, probe);
+
+	if (err != ATOM_NO_ERROR) {
+		response.setError(err, error_str);
+	}
+
+	if (error_str != NULL) {
+		free(error_str);
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element with the request data in
+//			chunks of up to chunk_size
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommandChunked(
+	ElementResponse &response,
+	const std::string &element,
+	const std::string &command,
+	const uint8_t *data,
+	size_t data_len,
+	size_t chunk_size)
+{
+	size_t offset = 0;
+
+	if (chunk_size == 0) {
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	return sendCommandChunked(response, element, command,
+		[&](std::string &chunk, bool &last) {
+			size_t len = std::min(chunk_size, data_len - offset);
+			chunk.assign((const char *)data + offset, len);
+			offset += len;
+			last = (offset == data_len);
+			return true;
+		});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Hashes request data for the response cache key with 64-bit
+//			FNV-1a s.t. big requests aren't copied into the key
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t responseCacheHash(
+	const uint8_t *data,
+	size_t data_len)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < data_len; ++i) {
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element. Note that the caller needs to
+//			delete this response upon receiving it.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommand(
+	ElementResponse &response,
+	const std::string &element,
+	const std::string &command,
+	const uint8_t *data,
+	size_t data_len,
+	bool block)
+{
+	// Want to be able to get the error string
+	char *error_str = NULL;
+	int cache_ttl;
+
+	// Big requests go over the bulk contexts s.t. they don't hold up
+	//	other commands
+	ContextClass cls = (data_len >= ELEMENT_BULK_MIN_BYTES) ?
+		CONTEXT_BULK : CONTEXT_CONTROL;
+
+	// If we've seen the command be cacheable before then try the cache.
+	//	Need the cache version either way s.t. if the element bumps it
+	//	while we're waiting on the response we won't cache a stale one.
+	std::string cmd_key;
+	std::string cache_key;
+	long long cache_version = 0;
+	bool cacheable = false;
+	if (block) {
+		cmd_key.reserve(element.size() + command.size() + 1);
+		cmd_key.append(element).append(1, '\0').append(command);
+		{
+			std::lock_guard<std::mutex> lock(response_cache_mutex);
+			cacheable = (response_cache_max > 0) &&
+				(response_cacheable.count(cmd_key) > 0);
+		}
+
+		if (cacheable && responseCacheVersion(element, cls, cache_version)) {
+			char hash[32];
+			snprintf(hash, sizeof(hash), "%016llx:%zu",
+				(unsigned long long)responseCacheHash(data, data_len),
+				data_len);
+			cache_key = cmd_key + '\0' + hash;
+
+			if (responseCacheGet(cache_key, cache_version, response)) {
+				return ATOM_NO_ERROR;
+			}
+		} else {
+			cacheable = false;
+		}
+	}
+
+	// Fail fast if the element looks to be down, before we tie up a
+	//	context on it
+	uint64_t probe;
+	if (!circuitBreakerAllow(element, probe)) {
+		response.setError(ATOM_COMMAND_CIRCUIT_OPEN, "Circuit breaker open");
+		return ATOM_COMMAND_CIRCUIT_OPEN;
+	}
+
+	// Get a redis context
+	redisContext *ctx = getContext(cls);
+
+	// If the element has told us it takes list RPC for the command then
+	//	use that
+	enum atom_error_t err = ATOM_COMMAND_UNSUPPORTED;
+	int rpc_timeout = 0;
+	bool rpc = false;
+	if (block) {
+		std::lock_guard<std::mutex> lock(rpc_mutex);
+		auto exists = rpc_commands.find(cmd_key);
+		if (exists != rpc_commands.end()) {
+			rpc = true;
+			rpc_timeout = exists->second;
+		}
+	}
+
+	if (rpc) {
+		err = element_command_send_rpc(
+			ctx,
+			elem,
+			element.c_str(),
+			command.c_str(),
+			data,
+			data_len,
+			rpc_timeout,
+			sendCommandResponseCB,
+			(void*)&response,
+			&error_str);
+
+		// If the element stopped taking list RPC, or isn't running its
+		//	RPC loop, then go back to the streams. Only an unsupported
+		//	request is safe to retry here since the others might have run.
+		if ((err == ATOM_COMMAND_UNSUPPORTED) ||
+			(err == ATOM_COMMAND_NO_RESPONSE) ||
+			(err == ATOM_COMMAND_NO_ACK))
+		{
+			std::lock_guard<std::mutex> lock(rpc_mutex);
+			rpc_commands.erase(cmd_key);
+		}
+
+		if ((err == ATOM_COMMAND_UNSUPPORTED) && (error_str != NULL)) {
+			free(error_str);
+			error_str = NULL;
+		}
+	}
+
+	// Otherwise, attempt to send the command over the streams
+	struct element_command_ack_info ack_info;
+	ack_info.cache_ttl = ELEMENT_COMMAND_NO_CACHE;
+	bool sent_rpc = rpc && (err != ATOM_COMMAND_UNSUPPORTED);
+	if (!sent_rpc) {
+		err = element_command_send_negotiate(
+			ctx,
+			elem,
+			element.c_str(),
+			command.c_str(),
+			data,
+			data_len,
+			block,
+			sendCommandResponseCB,
+			(void*)&response,
+			&error_str,
+			&ack_info);
+
+		// Use list RPC from here on out if we can
+		if (block && (err == ATOM_NO_ERROR) && ack_info.rpc) {
+			std::lock_guard<std::mutex> lock(rpc_mutex);
+			rpc_commands[cmd_key] = ack_info.timeout;
+		}
+	}
+	cache_ttl = ack_info.cache_ttl;
+
 	// Release the context
-	releaseContext(ctx);
+	releaseContext(ctx, cls);
+
+	circuitBreakerRecord(element, err, probe);
+
+	// Note whether the command is cacheable and cache the response
+	//	if we can. List RPC doesn't tell us about caching.
+	if (block && !sent_rpc && (err == ATOM_NO_ERROR)) {
+		if (cache_ttl > 0) {
+			if (cacheable) {
+				responseCachePut(cache_key, cache_version, cache_ttl, response);
+			} else {
+				std::lock_guard<std::mutex> lock(response_cache_mutex);
+				response_cacheable.insert(cmd_key);
+			}
+		} else if (cacheable) {
+			std::lock_guard<std::mutex> lock(response_cache_mutex);
+			response_cacheable.erase(cmd_key);
+		}
+	}
 
 	// If there's an error we want to update the response with that info
 	if (err != ATOM_NO_ERROR) {
@@ -665,380 +1393,1503 @@ enum atom_error_t Element::sendCommand(
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Callback for when we get info from a stream
+//  @brief Gets the cache version of an element. Uses the one we last got
+//			from redis until it's ELEMENT_CACHE_VERSION_REFRESH_MS old s.t.
+//			cache hits don't need a round trip.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool entryReadResponseCB(
-	const char *id,
-	const struct redis_xread_kv_item *kv_items,
-	int n_kv_items,
-	void *user_data)
+bool Element::responseCacheVersion(
+	const std::string &element,
+	ContextClass cls,
+	long long &version)
 {
-	// Cast the user data to the proper handler function
-	EntryReadInfo *udata = (EntryReadInfo *)user_data;
+	auto now = std::chrono::steady_clock::now();
 
-	// Convert the kv items into the ElementReadData
-	Entry e(id);
-	for (int i = 0; i < n_kv_items; ++i) {
-		if (kv_items[i].found) {
-			e.addData(kv_items[i].key, kv_items[i].reply->str, kv_items[i].reply->len);
-		} else {
-			atom_logf(NULL, NULL, LOG_ERR, "Couldn't find key");
+	{
+		std::lock_guard<std::mutex> lock(response_cache_mutex);
+		auto exists = response_cache_versions.find(element);
+		if ((exists != response_cache_versions.end()) &&
+			(now - exists->second.checked <
+				std::chrono::milliseconds(ELEMENT_CACHE_VERSION_REFRESH_MS)))
+		{
+			version = exists->second.version;
+			return true;
 		}
 	}
 
-	// Now, we want to call the user callback
-	if (!udata->fn(e, udata->data)) {
-		atom_logf(NULL, NULL, LOG_ERR, "User callback failed");
+	char version_key[ATOM_NAME_MAXLEN];
+	if (atom_get_cache_version_str(element.c_str(), version_key) == NULL) {
+		return false;
 	}
 
+	redisContext *ctx = getContext(cls);
+	bool ok = redis_get_int(ctx, version_key, &version);
+	releaseContext(ctx, cls);
+	if (!ok) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(response_cache_mutex);
+	ResponseCacheVersion &cached = response_cache_versions[element];
+	cached.version = version;
+	cached.checked = now;
+
 	return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads in a loop from the handlers in the ElementReadMap
+//  @brief Gets a response from the cache. Only a hit if the entry hasn't
+//			expired and was cached at the element's current version.
 //
 ////////////////////////////////////////////////////////////////////////////////
-struct element_entry_read_info *Element::readMapToEntryInfo(
-	ElementReadMap &m)
+bool Element::responseCacheGet(
+	const std::string &key,
+	long long version,
+	ElementResponse &response)
 {
-	// Need to fill out the read info.
-	size_t n_infos = m.getNumHandlers();
+	std::lock_guard<std::mutex> lock(response_cache_mutex);
 
-	struct element_entry_read_info *read_infos = (struct element_entry_read_info *)
-		malloc(n_infos * sizeof(struct element_entry_read_info));
-	assert(read_infos != NULL);
+	auto exists = response_cache.find(key);
+	if (exists == response_cache.end()) {
+		return false;
+	}
 
-	// Loop over the infos and fill them out
-	for (size_t i = 0; i < n_infos; ++i) {
-		auto handler = m.getHandler(i);
+	auto entry = exists->second;
+	if ((entry->version != version) ||
+		(std::chrono::steady_clock::now() >= entry->expires))
+	{
+		response_cache_lru.erase(entry);
+		response_cache.erase(exists);
+		return false;
+	}
 
-		// First is element, second is stream, third
-		std::string &element = std::get<0>(handler);
-		read_infos[i].element = (element.size() > 0) ? strdup(element.c_str()) : NULL;
-		read_infos[i].stream = strdup(std::get<1>(handler).c_str());
+	// Move it to the front of the LRU
+	response_cache_lru.splice(
+		response_cache_lru.begin(), response_cache_lru, entry);
 
-		// Get the keys
-		auto keys = std::get<2>(handler);
-		size_t n_keys = keys.size();
+	response.setData(entry->data);
+	return true;
+}
 
-		// Make the KV items
-		read_infos[i].kv_items = (struct redis_xread_kv_item *)
-			malloc(n_keys * sizeof(struct redis_xread_kv_item));
-		read_infos[i].n_kv_items = n_keys;
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Puts a response into the cache, evicting the least recently
+//			used if we're full
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::responseCachePut(
+	const std::string &key,
+	long long version,
+	int ttl,
+	ElementResponse &response)
+{
+	std::lock_guard<std::mutex> lock(response_cache_mutex);
 
-		// Fill in the kv items
-		for (size_t j = 0; j < n_keys; ++j) {
-			read_infos[i].kv_items[j].key = strdup(keys[j].c_str());
-			read_infos[i].kv_items[j].key_len = keys[j].size();
+	if (response_cache_max == 0) {
+		return;
+	}
+
+	auto exists = response_cache.find(key);
+	if (exists != response_cache.end()) {
+		response_cache_lru.erase(exists->second);
+		response_cache.erase(exists);
+	}
+
+	while (response_cache_lru.size() >= response_cache_max) {
+		response_cache.erase(response_cache_lru.back().key);
+		response_cache_lru.pop_back();
+	}
+
+	ResponseCacheEntry entry;
+	entry.key = key;
+	entry.data = response.getData();
+	entry.version = version;
+	entry.expires = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(ttl);
+
+	response_cache_lru.push_front(std::move(entry));
+	response_cache[key] = response_cache_lru.begin();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the max size of the response cache
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::responseCacheSize(
+	size_t max_entries)
+{
+	std::lock_guard<std::mutex> lock(response_cache_mutex);
+
+	response_cache_max = max_entries;
+	while (response_cache_lru.size() > response_cache_max) {
+		response_cache.erase(response_cache_lru.back().key);
+		response_cache_lru.pop_back();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Handler for the reserved command that responds with the
+//			command stats
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool commandStatsHandler(
+	const uint8_t *data,
+	size_t data_len,
+	ElementResponse *resp,
+	void *user_data)
+{
+	std::unordered_map<std::string, CommandStats> stats;
+	std::string ret;
+
+	((Element *)user_data)->commandStatsGet(stats);
+	for (auto const &cmd : stats) {
+		ret += cmd.second.format(cmd.first);
+	}
+
+	resp->setData(ret);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Turns on command stats
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::commandStatsEnable()
+{
+	if (command_stats_on) {
+		return;
+	}
+
+	addCommand(
+		COMMAND_STATS_COMMAND_STR,
+		"Responds with the CPU, data and allocations of each command",
+		commandStatsHandler,
+		this,
+		COMMAND_DEFAULT_TIMEOUT_MS);
+	command_stats_on = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds a call to the stats for a command
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::commandStatsRecord(
+	const std::string &command,
+	const CommandStats &call)
+{
+	std::lock_guard<std::mutex> lock(command_stats_mutex);
+
+	CommandStats &stats = command_stats[command];
+	stats.calls += call.calls;
+	stats.errors += call.errors;
+	stats.cpu_ns += call.cpu_ns;
+	stats.max_cpu_ns = std::max(stats.max_cpu_ns, call.max_cpu_ns);
+	stats.request_bytes += call.request_bytes;
+	stats.response_bytes += call.response_bytes;
+	stats.allocs += call.allocs;
+	stats.alloc_bytes += call.alloc_bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the stats for all of our commands
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::commandStatsGet(
+	std::unordered_map<std::string, CommandStats> &ret)
+{
+	std::lock_guard<std::mutex> lock(command_stats_mutex);
+	ret = command_stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Turns on circuit breakers for the commands we send
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::commandCircuitBreakerEnable(
+	size_t window,
+	size_t min_calls,
+	double failure_rate,
+	int open_ms)
+{
+	std::lock_guard<std::mutex> lock(circuit_breaker_mutex);
+
+	circuit_breaker_proto = CircuitBreaker(
+		window, min_calls, failure_rate, open_ms);
+	circuit_breakers.clear();
+	circuit_breaker_on = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the state of the circuit breaker for an element
+//
+////////////////////////////////////////////////////////////////////////////////
+CircuitBreaker::State Element::commandCircuitBreakerState(
+	std::string element)
+{
+	std::lock_guard<std::mutex> lock(circuit_breaker_mutex);
+
+	auto exists = circuit_breakers.find(element);
+	if (exists == circuit_breakers.end()) {
+		return CircuitBreaker::CLOSED;
+	}
+	return exists->second.getState();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether a command can go out to an element
+//
+////////////////////////////////////////////////////////////////////////////////
+bool Element::circuitBreakerAllow(
+	const std::string &element,
+	uint64_t &probe)
+{
+	std::lock_guard<std::mutex> lock(circuit_breaker_mutex);
+
+	probe = CIRCUIT_BREAKER_NO_PROBE;
+	if (!circuit_breaker_on) {
+		return true;
+	}
+
+	auto exists = circuit_breakers.find(element);
+	if (exists == circuit_breakers.end()) {
+		exists = circuit_breakers.emplace(element, circuit_breaker_proto).first;
+	}
+	return exists->second.allow(probe);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Notes the outcome of a command to an element
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::circuitBreakerRecord(
+	const std::string &element,
+	enum atom_error_t err,
+	uint64_t probe)
+{
+	std::lock_guard<std::mutex> lock(circuit_breaker_mutex);
+
+	if (!circuit_breaker_on) {
+		return;
+	}
+
+	auto exists = circuit_breakers.find(element);
+	if (exists != circuit_breakers.end()) {
+		exists->second.record(err, probe);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Turns on the slow op journal and adds the command to dump it
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::slowOpEnable(
+	size_t n_ops,
+	uint64_t threshold_us,
+	int signum)
+{
+	if (!element_slow_op_enable(n_ops, threshold_us)) {
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	if (!slow_op_command) {
+		if (!element_slow_op_add_command(elem)) {
+			return ATOM_INTERNAL_ERROR;
+		}
+		slow_op_command = true;
+	}
+
+	if ((signum != 0) && !element_slow_op_dump_on_signal(signum)) {
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the ops in the slow op journal
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::slowOpGet(
+	std::vector<struct element_slow_op> &ret)
+{
+	ret.resize(element_slow_op_count());
+	ret.resize(element_slow_op_get(ret.data(), ret.size()));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Marks one of our commands as cacheable
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::commandSetCacheable(
+	std::string name,
+	int ttl_ms)
+{
+	redisContext *ctx = getContext();
+	bool ok = element_command_set_cacheable(ctx, elem, name.c_str(), ttl_ms);
+	releaseContext(ctx);
+
+	return ok ? ATOM_NO_ERROR : ATOM_INTERNAL_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Lets callers use list RPC for one of our commands
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::commandSetRpc(
+	std::string name,
+	bool rpc)
+{
+	redisContext *ctx = getContext();
+	bool ok = element_command_set_rpc(ctx, elem, name.c_str(), rpc);
+	releaseContext(ctx);
+
+	return ok ? ATOM_NO_ERROR : ATOM_INTERNAL_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Invalidates the responses callers have cached from us
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::commandCacheInvalidate()
+{
+	redisContext *ctx = getContext();
+	enum atom_error_t err = element_command_cache_invalidate(ctx, elem);
+	releaseContext(ctx);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for when we get info from a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+bool entryReadResponseCB(
+	const char *id,
+	const struct redis_xread_kv_item *kv_items,
+	int n_kv_items,
+	void *user_data)
+{
+	// Cast the user data to the proper handler function
+	EntryReadInfo *udata = (EntryReadInfo *)user_data;
+
+	// Convert the kv items into the ElementReadData
+	Entry e(id);
+	for (int i = 0; i < n_kv_items; ++i) {
+		if (kv_items[i].found) {
+			e.addData(kv_items[i].key, kv_items[i].reply->str, kv_items[i].reply->len);
+		} else {
+			atom_logf(NULL, NULL, LOG_ERR, "Couldn't find key");
+		}
+	}
+
+	// Now, we want to call the user callback
+	if (!udata->fn(e, udata->data)) {
+		atom_logf(NULL, NULL, LOG_ERR, "User callback failed");
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads in a loop from the handlers in the ElementReadMap
+//
+////////////////////////////////////////////////////////////////////////////////
+struct element_entry_read_info *Element::readMapToEntryInfo(
+	ElementReadMap &m)
+{
+	// Need to fill out the read info.
+	size_t n_infos = m.getNumHandlers();
+
+	struct element_entry_read_info *read_infos = (struct element_entry_read_info *)
+		malloc(n_infos * sizeof(struct element_entry_read_info));
+	assert(read_infos != NULL);
+
+	// Loop over the infos and fill them out
+	for (size_t i = 0; i < n_infos; ++i) {
+		auto handler = m.getHandler(i);
+
+		// First is element, second is stream, third
+		std::string &element = std::get<0>(handler);
+		read_infos[i].element = (element.size() > 0) ? strdup(element.c_str()) : NULL;
+		read_infos[i].stream = strdup(std::get<1>(handler).c_str());
+
+		// Get the keys
+		auto keys = std::get<2>(handler);
+		size_t n_keys = keys.size();
+
+		// Make the KV items
+		read_infos[i].kv_items = (struct redis_xread_kv_item *)
+			malloc(n_keys * sizeof(struct redis_xread_kv_item));
+		read_infos[i].n_kv_items = n_keys;
+
+		// Fill in the kv items
+		for (size_t j = 0; j < n_keys; ++j) {
+			read_infos[i].kv_items[j].key = strdup(keys[j].c_str());
+			read_infos[i].kv_items[j].key_len = keys[j].size();
+		}
+
+		// Fill in the handler and response callback
+		read_infos[i].user_data = (void*)new EntryReadInfo(
+			std::get<3>(handler),
+			std::get<4>(handler));
+		read_infos[i].response_cb = entryReadResponseCB;
+
+		// And the freshness tracker, if we have one
+		read_infos[i].freshness = getFreshness(element, std::get<1>(handler));
+
+		// And how the stream should be scheduled against the others
+		read_infos[i].weight = std::get<5>(handler);
+		read_infos[i].max_count = std::get<6>(handler);
+	}
+
+	return read_infos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads in a loop from the handlers in the ElementReadMap
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::freeEntryInfo(
+	struct element_entry_read_info *info,
+	size_t n_infos)
+{
+	// And go ahead and free all of the info
+	if (info != NULL) {
+		for (size_t i = 0; i < n_infos; ++i) {
+			if (info[i].element != NULL) {
+				free((void*)info[i].element);
+			}
+			if (info[i].stream != NULL) {
+				free((void*)info[i].stream);
+			}
+			if (info[i].kv_items != NULL) {
+				for (size_t j = 0; j < info[i].n_kv_items; ++j) {
+					free((void*)info[i].kv_items[j].key);
+				}
+				free(info[i].kv_items);
+			}
+			if (info[i].user_data != NULL) {
+				delete (EntryReadInfo *)info[i].user_data;
+			}
+		}
+		free(info);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads in a loop from the handlers in the ElementReadMap
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadLoop(
+	ElementReadMap &m,
+	int n_loops)
+{
+	struct element_entry_read_info *read_infos = readMapToEntryInfo(m);
+	size_t n_infos = m.getNumHandlers();
+
+	// Ephemeral streams need a context of their own since it'll be in
+	//	subscribe mode for the whole loop
+	if (m.isEphemeral()) {
+		redisContext *ctx = redis_context_init();
+		if (ctx == NULL) {
+			log(LOG_ERR, "Failed to connect for ephemeral read loop");
+			freeEntryInfo(read_infos, n_infos);
+			return ATOM_REDIS_ERROR;
+		}
+
+		bool loop_forever = (n_loops == ELEMENT_INFINITE_READ_LOOPS);
+		for (size_t i = 0; i < n_infos; ++i) {
+			read_infos[i].items_to_read = loop_forever ? 0 : n_loops;
+		}
+
+		enum atom_error_t err = element_entry_read_ephemeral_loop(
+			ctx,
+			elem,
+			read_infos,
+			n_infos,
+			loop_forever);
+
+		redis_context_cleanup(ctx);
+		freeEntryInfo(read_infos, n_infos);
+		return err;
+	}
+
+	// And now call element_entry_read_loop
+	redisContext *ctx = getContext();
+
+	// And if we're looping infinitely
+	enum atom_error_t err;
+	if (n_loops == ELEMENT_INFINITE_READ_LOOPS) {
+		err = element_entry_read_loop_adaptive(
+			ctx,
+			elem,
+			read_infos,
+			n_infos,
+			true,
+			ELEMENT_ENTRY_READ_LOOP_FOREVER,
+			m.getBatching());
+	} else {
+		for (size_t i = 0; i < n_infos; ++i) {
+			read_infos[i].items_to_read = n_loops;
+		}
+
+		err = element_entry_read_loop_adaptive(
+			ctx,
+			elem,
+			read_infos,
+			n_infos,
+			false,
+			ELEMENT_ENTRY_READ_LOOP_FOREVER,
+			m.getBatching());
+	}
+
+	// Put the context back
+	releaseContext(ctx);
+
+	// And free the entry info we made
+	freeEntryInfo(read_infos, n_infos);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Subscribes to a stream through the subscription mux
+//
+////////////////////////////////////////////////////////////////////////////////
+int Element::entrySubscribe(
+	std::string element,
+	std::string stream,
+	sharedReadHandlerFn fn,
+	void *user_data)
+{
+	int id = SubscriptionMux::instance().subscribe(
+		element,
+		stream,
+		fn,
+		user_data);
+	if (id < 0) {
+		return id;
+	}
+
+	std::lock_guard<std::mutex> lock(subscriptions_mutex);
+	subscriptions.push_back(id);
+
+	return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Removes a subscription made through the subscription mux
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::entryUnsubscribe(
+	int id)
+{
+	SubscriptionMux::instance().unsubscribe(id);
+
+	std::lock_guard<std::mutex> lock(subscriptions_mutex);
+	auto exists = std::find(subscriptions.begin(), subscriptions.end(), id);
+	if (exists != subscriptions.end()) {
+		subscriptions.erase(exists);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Copies the data into the vector passed in user_data
+//
+////////////////////////////////////////////////////////////////////////////////
+bool entryCopyCB(
+	Entry &e,
+	void *user_data)
+{
+	std::vector<Entry> *user_vector =
+		(std::vector<Entry>*)user_data;
+
+	user_vector->emplace_back(std::move(e));
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Moves the data into the entry passed in user_data
+//
+////////////////////////////////////////////////////////////////////////////////
+bool entryAssignCB(
+	Entry &e,
+	void *user_data)
+{
+	*(Entry *)user_data = std::move(e);
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Points the kv items at the keys. Uses the stack items passed if
+//			there's room, else the heap items.
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct redis_xread_kv_item *keysToKVItems(
+	const std::vector<std::string> &keys,
+	struct redis_xread_kv_item *stack_items,
+	size_t n_stack_items,
+	std::vector<struct redis_xread_kv_item> &heap_items)
+{
+	struct redis_xread_kv_item *kv_items = stack_items;
+	if (keys.size() > n_stack_items) {
+		heap_items.resize(keys.size());
+		kv_items = heap_items.data();
+	}
+
+	for (size_t j = 0; j < keys.size(); ++j) {
+		kv_items[j].key = keys[j].c_str();
+		kv_items[j].key_len = keys[j].size();
+	}
+
+	return kv_items;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads N pieces of data from each stream passed
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadN(
+	const std::string &element,
+	const std::string &stream,
+	const std::vector<std::string> &keys,
+	size_t n,
+	std::vector<Entry> &ret)
+{
+	struct element_entry_read_info read_info;
+	struct redis_xread_kv_item stack_items[ELEMENT_READ_N_STACK_KEYS];
+	std::vector<struct redis_xread_kv_item> heap_items;
+
+	// Fill in the read info, pointing right at the caller's strings
+	read_info.element = (element.size() > 0) ? element.c_str() : NULL;
+	read_info.stream = stream.c_str();
+	read_info.kv_items = keysToKVItems(
+		keys, stack_items, ELEMENT_READ_N_STACK_KEYS, heap_items);
+	read_info.n_kv_items = keys.size();
+	read_info.weight = REDIS_STREAM_DEFAULT_WEIGHT;
+	read_info.max_count = REDIS_XREAD_NOMAXCOUNT;
+
+	return readN(read_info, n, ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads N pieces of data with a reusable request
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadN(
+	EntryReadRequest &req,
+	size_t n,
+	std::vector<Entry> &ret)
+{
+	return readN(req.read_info, n, ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads N pieces of data with read info that has the stream and
+//			keys filled in
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::readN(
+	struct element_entry_read_info &read_info,
+	size_t n,
+	std::vector<Entry> &ret)
+{
+	EntryReadInfo user_data(entryCopyCB, (void*)&ret);
+
+	// Fill in the handler and response callback
+	read_info.user_data = (void*)&user_data;
+	read_info.response_cb = entryReadResponseCB;
+	read_info.freshness = NULL;
+
+	// And now call element_entry_read_n. Big reads of history go to the
+	//	replica if we have one
+	size_t start_size = ret.size();
+	return routeRead(
+		(n >= replica_history_min_n),
+		(n >= ELEMENT_BULK_READ_MIN_N) ? CONTEXT_BULK : CONTEXT_CONTROL,
+		[&](redisContext *ctx) {
+			return element_entry_read_n(
+				ctx,
+				elem,
+				&read_info,
+				n);
+		},
+		[&]() {
+			ret.erase(ret.begin() + start_size, ret.end());
+		});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Orders entries from a partitioned stream newest first by ID.
+//			Sequence numbers only order entries within a partition, so
+//			entries from different partitions in the same millisecond
+//			have no real order. They're kept in read order s.t. the
+//			merge is at least deterministic.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool entryNewer(
+	const std::pair<unsigned long long, size_t> &a,
+	const std::pair<unsigned long long, size_t> &b)
+{
+	return (a.first != b.first) ? (a.first > b.first) : (a.second < b.second);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the N most recent entries across the partitions of a
+//			stream. Each partition can have at most N of them, so we read
+//			N from each and merge.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadPartitionedN(
+	const std::string &element,
+	const std::string &stream,
+	const std::vector<std::string> &keys,
+	size_t n,
+	std::vector<Entry> &ret)
+{
+	char partition[ATOM_NAME_MAXLEN];
+	std::vector<Entry> merged;
+	int n_partitions;
+
+	enum atom_error_t err = entryPartitionCount(element, stream, n_partitions);
+	if (err != ATOM_NO_ERROR) {
+		return err;
+	}
+	if (n_partitions == 0) {
+		return entryReadN(element, stream, keys, n, ret);
+	}
+
+	for (int p = 0; p < n_partitions; ++p) {
+		if (atom_get_partition_stream_name(
+			stream.c_str(), p, partition) == NULL)
+		{
+			return ATOM_INTERNAL_ERROR;
+		}
+		err = entryReadN(element, partition, keys, n, merged);
+		if (err != ATOM_NO_ERROR) {
+			return err;
+		}
+	}
+
+	// Each partition comes back newest first, so within a partition read
+	//	order is the same as sequence order
+	std::vector<std::pair<unsigned long long, size_t>> order;
+	for (size_t i = 0; i < merged.size(); ++i) {
+		unsigned long long ms = 0;
+		sscanf(merged[i].getID().c_str(), "%llu", &ms);
+		order.push_back(std::make_pair(ms, i));
+	}
+	std::sort(order.begin(), order.end(), entryNewer);
+
+	for (size_t i = 0; (i < order.size()) && (i < n); ++i) {
+		ret.push_back(merged[order[i].second]);
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the latest entry from each of the streams passed
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadLatestMulti(
+	const std::vector<std::pair<std::string, std::string>> &streams,
+	const std::vector<std::vector<std::string>> &keys,
+	std::vector<Entry> &ret)
+{
+	size_t n_streams = streams.size();
+
+	if (keys.size() != n_streams) {
+		log(LOG_ERR, "Need a set of keys for each stream");
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	// Make a slot for each stream up front s.t. the handlers can fill
+	//	them in directly
+	ret.assign(n_streams, Entry(""));
+
+	// The KV items for all of the streams go in one buffer, on the stack
+	//	if they fit, pointing right at the caller's strings
+	size_t n_total_keys = 0;
+	for (auto const &stream_keys : keys) {
+		n_total_keys += stream_keys.size();
+	}
+	struct redis_xread_kv_item stack_items[ELEMENT_READ_N_STACK_KEYS];
+	std::vector<struct redis_xread_kv_item> heap_items;
+	struct redis_xread_kv_item *kv_items = stack_items;
+	if (n_total_keys > ELEMENT_READ_N_STACK_KEYS) {
+		heap_items.resize(n_total_keys);
+		kv_items = heap_items.data();
+	}
+
+	std::vector<struct element_entry_read_info> read_infos(n_streams);
+	std::vector<EntryReadInfo> handlers;
+	handlers.reserve(n_streams);
+	for (size_t i = 0; i < n_streams; ++i) {
+
+		// Fill in the read info
+		read_infos[i].element = (streams[i].first.size() > 0) ?
+			streams[i].first.c_str() : NULL;
+		read_infos[i].stream = streams[i].second.c_str();
+
+		// Point it at its KV items
+		read_infos[i].kv_items = kv_items;
+		read_infos[i].n_kv_items = keys[i].size();
+		for (auto const &key : keys[i]) {
+			kv_items->key = key.c_str();
+			kv_items->key_len = key.size();
+			++kv_items;
+		}
+
+		// Fill in the handler and response callback
+		handlers.emplace_back(entryAssignCB, (void*)&ret[i]);
+		read_infos[i].user_data = (void*)&handlers.back();
+		read_infos[i].response_cb = entryReadResponseCB;
+		read_infos[i].freshness = NULL;
+		read_infos[i].weight = REDIS_STREAM_DEFAULT_WEIGHT;
+		read_infos[i].max_count = REDIS_XREAD_NOMAXCOUNT;
+	}
+
+	// And do the read. This is a snapshot of now so it always goes
+	//	to the primary
+	redisContext *ctx = getContext();
+	enum atom_error_t err = element_entry_read_latest_multi(
+		ctx,
+		elem,
+		read_infos.data(),
+		n_streams);
+	releaseContext(ctx);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries from the stream since the passed ID.
+//			Default nonblocking
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadSince(
+	const std::string &element,
+	const std::string &stream,
+	const std::vector<std::string> &keys,
+	size_t n,
+	std::vector<Entry> &ret,
+	const std::string &last_id,
+	int timeout)
+{
+	struct element_entry_read_info read_info;
+	struct redis_xread_kv_item stack_items[ELEMENT_READ_N_STACK_KEYS];
+	std::vector<struct redis_xread_kv_item> heap_items;
+
+	// Fill in the read info, pointing right at the caller's strings
+	read_info.element = (element.size() > 0) ? element.c_str() : NULL;
+	read_info.stream = stream.c_str();
+	read_info.kv_items = keysToKVItems(
+		keys, stack_items, ELEMENT_READ_N_STACK_KEYS, heap_items);
+	read_info.n_kv_items = keys.size();
+	read_info.weight = REDIS_STREAM_DEFAULT_WEIGHT;
+	read_info.max_count = REDIS_XREAD_NOMAXCOUNT;
+
+	return readSince(
+		read_info, element, stream, n, ret, last_id, timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries since the passed ID with a reusable
+//			request
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadSince(
+	EntryReadRequest &req,
+	size_t n,
+	std::vector<Entry> &ret,
+	const std::string &last_id,
+	int timeout)
+{
+	return readSince(
+		req.read_info, req.element, req.stream, n, ret, last_id, timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries since the passed ID with read info that
+//			has the stream and keys filled in
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::readSince(
+	struct element_entry_read_info &read_info,
+	const std::string &element,
+	const std::string &stream,
+	size_t n,
+	std::vector<Entry> &ret,
+	const std::string &last_id,
+	int timeout)
+{
+	EntryReadInfo user_data(entryCopyCB, (void*)&ret);
+
+	// Fill in the handler and response callback
+	read_info.user_data = (void*)&user_data;
+	read_info.response_cb = entryReadResponseCB;
+	read_info.freshness = getFreshness(element, stream);
+
+	// And now call element_entry_read_since. Big reads go over the bulk
+	//	contexts.
+	ContextClass cls = (n >= ELEMENT_BULK_READ_MIN_N) ?
+		CONTEXT_BULK : CONTEXT_CONTROL;
+	redisContext *ctx = getContext(cls);
+	enum atom_error_t err = element_entry_read_since(
+		ctx,
+		elem,
+		&read_info,
+		(last_id.size() > 0) ? last_id.c_str() : NULL,
+		timeout,
+		n);
+
+	// Put the context back
+	releaseContext(ctx, cls);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the key a stream's freshness is tracked under. As with
+//			reads, an empty element means stream is a raw stream name.
+//
+////////////////////////////////////////////////////////////////////////////////
+std::string Element::freshnessKey(
+	const std::string &element,
+	const std::string &stream)
+{
+	return (element.size() > 0) ? (element + ":" + stream) : stream;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the freshness tracker for a stream, if any
+//
+////////////////////////////////////////////////////////////////////////////////
+struct element_entry_freshness *Element::getFreshness(
+	const std::string &element,
+	const std::string &stream)
+{
+	std::lock_guard<std::mutex> lock(freshness_mutex);
+
+	auto exists = freshness.find(freshnessKey(element, stream));
+	if (exists == freshness.end()) {
+		return NULL;
+	}
+
+	return &exists->second;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Starts tracking the freshness of a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::entryFreshnessTrack(
+	std::string element,
+	std::string stream,
+	uint64_t budget_us,
+	void (*violation_cb)(const char *, uint64_t, void *),
+	void *user_data)
+{
+	std::lock_guard<std::mutex> lock(freshness_mutex);
+
+	// If we're already tracking the stream a read loop might be recording
+	//	into it, so reset it in place
+	std::string key = freshnessKey(element, stream);
+	auto exists = freshness.find(key);
+	if (exists != freshness.end()) {
+		element_entry_freshness_reset(
+			&exists->second, budget_us, violation_cb, user_data);
+		return;
+	}
+
+	element_entry_freshness_init(
+		&freshness[key], budget_us, violation_cb, user_data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets a snapshot of the freshness of a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+bool Element::entryFreshnessGet(
+	std::string element,
+	std::string stream,
+	struct element_entry_freshness &ret)
+{
+	std::lock_guard<std::mutex> lock(freshness_mutex);
+
+	auto exists = freshness.find(freshnessKey(element, stream));
+	if (exists == freshness.end()) {
+		return false;
+	}
+
+	element_entry_freshness_snapshot(&exists->second, &ret);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the writer for a stream, making it if asked to
+//
+////////////////////////////////////////////////////////////////////////////////
+Element::StreamWriter *Element::getWriter(
+	const std::string &stream,
+	bool create)
+{
+	WriterShard &shard = writer_shards[
+		std::hash<std::string>()(stream) % ELEMENT_N_WRITER_SHARDS];
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto exists = shard.writers.find(stream);
+	if (exists != shard.writers.end()) {
+		return exists->second.get();
+	}
+
+	if (!create) {
+		return NULL;
+	}
+
+	StreamWriter *writer = new StreamWriter();
+	shard.writers.emplace(stream, std::unique_ptr<StreamWriter>(writer));
+	return writer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up the write info for a stream with the keys in data
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::initWriter(
+	redisContext *ctx,
+	StreamWriter *writer,
+	const std::string &stream,
+	entry_data_t &data)
+{
+	struct element_entry_write_info *info = writer->info;
+
+	// If the stream info exists we want to clean it up
+	if (info != NULL) {
+		for (size_t i = 0; i < info->n_items; ++i) {
+			free((char*)info->items[i].key);
+		}
+		element_entry_write_cleanup(ctx, info);
+	}
+
+	// Make the info
+	info = element_entry_write_init(
+		ctx,
+		elem,
+		stream.c_str(),
+		data.size());
+	assert(info != NULL);
+
+	{
+		std::lock_guard<std::mutex> lock(writer_config_mutex);
+
+		// Fall back to the spool if we have one
+		element_entry_write_set_spool(info, spool);
+
+		// And trim based on our consumers if we've been asked to
+		auto trim = trims.find(stream);
+		if (trim != trims.end()) {
+			element_entry_write_set_trim(info, &trim->second);
 		}
 
-		// Fill in the handler and response callback
-		read_infos[i].user_data = (void*)new EntryReadInfo(
-			std::get<3>(handler),
-			std::get<4>(handler));
-		read_infos[i].response_cb = entryReadResponseCB;
+		// And publish rather than persist if it's ephemeral
+		element_entry_write_set_ephemeral(
+			info, ephemeral_streams.count(stream) > 0);
 	}
 
-	return read_infos;
+	// Fill in the keys in the info
+	int idx = 0;
+	for (auto const &x: data) {
+
+		// Fill in the write info
+		info->items[idx].key = strdup(x.first.c_str());
+		info->items[idx].key_len = x.first.size();
+
+		// Increment the index
+		idx += 1;
+	}
+
+	writer->info = info;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads in a loop from the handlers in the ElementReadMap
+//  @brief Returns the partition that an entry goes to. Entries with the
+//			partition key go to the partition for its value, the rest
+//			are spread round-robin.
 //
 ////////////////////////////////////////////////////////////////////////////////
-void Element::freeEntryInfo(
-	struct element_entry_read_info *info,
-	size_t n_infos)
+const std::string &Element::partitionFor(
+	StreamWriter *writer,
+	const entry_data_t &data)
 {
-	// And go ahead and free all of the info
-	if (info != NULL) {
-		for (size_t i = 0; i < n_infos; ++i) {
-			if (info[i].element != NULL) {
-				free((void*)info[i].element);
-			}
-			if (info[i].stream != NULL) {
-				free((void*)info[i].stream);
-			}
-			if (info[i].kv_items != NULL) {
-				for (size_t j = 0; j < info[i].n_kv_items; ++j) {
-					free((void*)info[i].kv_items[j].key);
-				}
-				free(info[i].kv_items);
-			}
-			if (info[i].user_data != NULL) {
-				delete (EntryReadInfo *)info[i].user_data;
-			}
+	int n_partitions = writer->partitions.size();
+
+	if (writer->partition_key.size() > 0) {
+		auto value = data.find(writer->partition_key);
+		if (value != data.end()) {
+			return writer->partitions[atom_partition_for_key(
+				(const uint8_t *)value->second.data(),
+				value->second.size(),
+				n_partitions)];
 		}
-		free(info);
 	}
+
+	return writer->partitions[writer->next_partition++ % n_partitions];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads in a loop from the handlers in the ElementReadMap
+//  @brief Writes an entry to a stream. Writes to different streams can be
+//			made from different threads at once.
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryReadLoop(
-	ElementReadMap &m,
-	int n_loops)
+enum atom_error_t Element::entryWrite(
+	const std::string &stream,
+	entry_data_t &data,
+	int timestamp,
+	int maxlen)
 {
-	struct element_entry_read_info *read_infos = readMapToEntryInfo(m);
-	size_t n_infos = m.getNumHandlers();
+	// Find the writer for the stream and hold it for the write
+	StreamWriter *writer = getWriter(stream, true);
+	std::unique_lock<std::mutex> lock(writer->mutex);
+
+	// Partitioned streams hand the write off to one of their partitions
+	if (writer->partitions.size() > 0) {
+		std::string partition = partitionFor(writer, data);
+		lock.unlock();
+		return entryWrite(partition, data, timestamp, maxlen);
+	}
 
-	// And now call element_entry_read_loop
-	redisContext *ctx = getContext();
+	// Big entries go over the bulk contexts s.t. they don't hold up
+	//	commands and small writes
+	size_t n_bytes = 0;
+	for (auto const &x : data) {
+		n_bytes += x.second.size();
+	}
+	ContextClass cls = (n_bytes >= ELEMENT_BULK_MIN_BYTES) ?
+		CONTEXT_BULK : CONTEXT_CONTROL;
+	redisContext *ctx = getContext(cls);
 
-	// And if we're looping infinitely
-	enum atom_error_t err;
-	if (n_loops == ELEMENT_INFINITE_READ_LOOPS) {
-		err = element_entry_read_loop(
-			ctx,
-			elem,
-			read_infos,
-			n_infos,
-			true,
-			ELEMENT_ENTRY_READ_LOOP_FOREVER);
-	} else {
-		for (size_t i = 0; i < n_infos; ++i) {
-			read_infos[i].items_to_read = n_loops;
+	// We don't have the write info yet or the number of keys was off
+	if ((writer->info == NULL) ||
+		(writer->info->n_items != data.size()))
+	{
+		initWriter(ctx, writer, stream, data);
+	}
+	struct element_entry_write_info *info = writer->info;
+
+	// Loop over the keys in the info
+	for (size_t idx = 0; idx < info->n_items; ++idx) {
+
+		// Find the item in the input dict
+		auto item = data.find(info->items[idx].key);
+		if (item == data.end()) {
+			std::runtime_error("Invalid key for stream");
 		}
 
-		err = element_entry_read_loop(
-			ctx,
-			elem,
-			read_infos,
-			n_infos,
-			false,
-			ELEMENT_ENTRY_READ_LOOP_FOREVER);
+		// Fill in the data size and length
+		info->items[idx].data = (const uint8_t*)item->second.c_str();
+		info->items[idx].data_len = item->second.size();
 	}
 
-	// Put the context back
-	releaseContext(ctx);
+	// Do the write
+	enum atom_error_t err = element_entry_write(
+		ctx,
+		info,
+		timestamp,
+		maxlen);
 
-	// And free the entry info we made
-	freeEntryInfo(read_infos, n_infos);
+	// Return the context
+	releaseContext(ctx, cls);
 
+	// And return the error
 	return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Copies the data into the vector passed in user_data
+//  @brief Partitions a stream we write. The number of partitions is
+//			published for readers before any writes go to them.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool entryCopyCB(
-	Entry &e,
-	void *user_data)
+enum atom_error_t Element::entryPartitionEnable(
+	const std::string &stream,
+	int n_partitions,
+	const std::string &partition_key)
 {
-	std::vector<Entry> *user_vector =
-		(std::vector<Entry>*)user_data;
+	char partition[ATOM_NAME_MAXLEN];
+	std::vector<std::string> partitions;
 
-	user_vector->emplace_back(std::move(e));
+	if ((n_partitions < 1) || (n_partitions > ATOM_MAX_PARTITIONS)) {
+		log(LOG_ERR, "Invalid number of partitions %d", n_partitions);
+		return ATOM_INTERNAL_ERROR;
+	}
 
-	return true;
+	for (int p = 0; p < n_partitions; ++p) {
+		if (atom_get_partition_stream_name(
+			stream.c_str(), p, partition) == NULL)
+		{
+			return ATOM_INTERNAL_ERROR;
+		}
+		partitions.push_back(partition);
+	}
+
+	redisContext *ctx = getContext();
+	enum atom_error_t err = atom_set_partition_count(
+		ctx, name.c_str(), stream.c_str(), n_partitions);
+	releaseContext(ctx);
+	if (err != ATOM_NO_ERROR) {
+		return err;
+	}
+
+	StreamWriter *writer = getWriter(stream, true);
+	std::lock_guard<std::mutex> lock(writer->mutex);
+	writer->partitions = std::move(partitions);
+	writer->partition_key = partition_key;
+	writer->next_partition = 0;
+
+	return ATOM_NO_ERROR;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads N pieces of data from each stream passed
+//  @brief Gets the number of partitions of a stream
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryReadN(
-	std::string element,
-	std::string stream,
-	std::vector<std::string> &keys,
-	size_t n,
-	std::vector<Entry> &ret)
+enum atom_error_t Element::entryPartitionCount(
+	const std::string &element,
+	const std::string &stream,
+	int &n_partitions)
 {
-	struct element_entry_read_info read_info;
-
-	// Fill in the read info
-	read_info.element = (element.size() > 0) ? element.c_str() : NULL;
-	read_info.stream = stream.c_str();
-
-	// Get the keys
-	size_t n_keys = keys.size();
-
-	// Make the KV items
-	read_info.kv_items = (struct redis_xread_kv_item *)
-		malloc(n_keys * sizeof(struct redis_xread_kv_item));
-	assert(read_info.kv_items != NULL);
-	read_info.n_kv_items = n_keys;
-
-	// Fill in the kv items
-	for (size_t j = 0; j < n_keys; ++j) {
-		read_info.kv_items[j].key = keys[j].c_str();
-		read_info.kv_items[j].key_len = keys[j].size();
-	}
-
-	// Fill in the handler and response callback
-	read_info.user_data = (void*)new EntryReadInfo(entryCopyCB, (void*)&ret);
-	read_info.response_cb = entryReadResponseCB;
-
-	// And now call element_entry_read_n
 	redisContext *ctx = getContext();
-	enum atom_error_t err = element_entry_read_n(
+	enum atom_error_t err = atom_get_partition_count(
 		ctx,
-		elem,
-		&read_info,
-		n);
-
-	// Put the context back
+		(element.size() > 0) ? element.c_str() : NULL,
+		stream.c_str(),
+		&n_partitions);
 	releaseContext(ctx);
 
-	// And clean up the memory we allocated
-	delete (EntryReadInfo *)read_info.user_data;
-	free(read_info.kv_items);
-
 	return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads at most N entries from the stream since the passed ID.
-//			Default nonblocking
+//  @brief Enables the write-ahead spool for all of our entry writes
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryReadSince(
-	std::string element,
-	std::string stream,
-	std::vector<std::string> &keys,
-	size_t n,
-	std::vector<Entry> &ret,
-	std::string last_id,
-	int timeout)
+enum atom_error_t Element::entrySpoolEnable(
+	std::string path,
+	size_t size,
+	unsigned int drain_rate)
 {
-	struct element_entry_read_info read_info;
-
-	// Fill in the read info
-	read_info.element = (element.size() > 0) ? element.c_str() : NULL;
-	read_info.stream = stream.c_str();
-
-	// Get the keys
-	size_t n_keys = keys.size();
+	{
+		std::lock_guard<std::mutex> lock(writer_config_mutex);
 
-	// Make the KV items
-	read_info.kv_items = (struct redis_xread_kv_item *)
-		malloc(n_keys * sizeof(struct redis_xread_kv_item));
-	assert(read_info.kv_items != NULL);
-	read_info.n_kv_items = n_keys;
+		if (spool != NULL) {
+			log(LOG_ERR, "Spool already enabled");
+			return ATOM_INTERNAL_ERROR;
+		}
 
-	// Fill in the kv items
-	for (size_t j = 0; j < n_keys; ++j) {
-		read_info.kv_items[j].key = keys[j].c_str();
-		read_info.kv_items[j].key_len = keys[j].size();
+		spool = element_entry_spool_init(path.c_str(), size, drain_rate);
+		if (spool == NULL) {
+			log(LOG_ERR, "Failed to open spool at %s", path.c_str());
+			return ATOM_INTERNAL_ERROR;
+		}
 	}
 
-	// Fill in the handler and response callback
-	read_info.user_data = (void*)new EntryReadInfo(entryCopyCB, (void*)&ret);
-	read_info.response_cb = entryReadResponseCB;
+	// Point any streams we've already been writing on at the spool
+	for (auto &shard : writer_shards) {
+		std::lock_guard<std::mutex> shard_lock(shard.mutex);
+		for (auto const &x : shard.writers) {
+			std::lock_guard<std::mutex> lock(x.second->mutex);
+			if (x.second->info != NULL) {
+				element_entry_write_set_spool(x.second->info, spool);
+			}
+		}
+	}
 
-	// And now call element_entry_read_since
-	redisContext *ctx = getContext();
-	enum atom_error_t err = element_entry_read_since(
-		ctx,
-		elem,
-		&read_info,
-		(last_id.size() > 0) ? last_id.c_str() : NULL,
-		timeout,
-		n);
+	return ATOM_NO_ERROR;
+}
 
-	// Put the context back
-	releaseContext(ctx);
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Drains the write-ahead spool into redis
+//
+////////////////////////////////////////////////////////////////////////////////
+int Element::entrySpoolDrain()
+{
+	if (spool == NULL) {
+		return 0;
+	}
 
-	// And clean up the memory we allocated
-	delete (EntryReadInfo *)read_info.user_data;
-	free(read_info.kv_items);
+	redisContext *ctx = getContext(CONTEXT_BACKGROUND);
+	int ret = element_entry_spool_drain(ctx, spool);
+	releaseContext(ctx, CONTEXT_BACKGROUND);
 
-	return err;
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Writes an entry to a stream
+//  @brief Returns the number of entries waiting in the spool
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryWrite(
-	std::string stream,
-	entry_data_t &data,
-	int timestamp,
-	int maxlen)
+size_t Element::entrySpoolSize()
 {
-	redisContext *ctx = getContext();
+	if (spool == NULL) {
+		return 0;
+	}
 
-	// Try to find the write info for the stream
-	auto exists = streams.find(stream);
-	struct element_entry_write_info *info = NULL;
+	return element_entry_spool_size(spool);
+}
 
-	// We did not find the write info or the number of keys was off
-	if ((exists == streams.end()) ||
-		(exists->second->n_items != data.size()))
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Enables consumer-aware trimming on a stream we write
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryTrimEnable(
+	std::string stream,
+	uint64_t max_age_ms,
+	size_t max_bytes,
+	uint64_t refresh_ms)
+{
+	struct element_entry_trim *trim_info;
 	{
-		// If the stream info exists we want to clean it up
-		if (exists != streams.end()) {
-			info = exists->second;
-			for (size_t i = 0; i < info->n_items; ++i) {
-				free((char*)info->items[i].key);
-			}
-			element_entry_write_cleanup(ctx, exists->second);
+		std::lock_guard<std::mutex> lock(writer_config_mutex);
+
+		auto trim = trims.find(stream);
+		if (trim == trims.end()) {
+			trim = trims.emplace(stream, element_entry_trim()).first;
 		}
+		trim_info = &trim->second;
+	}
 
-		// Make the info
-		info = element_entry_write_init(
-			ctx,
-			elem,
-			stream.c_str(),
-			data.size());
-		assert(info != NULL);
+	// Set up the trim under the writer's lock s.t. a write isn't using
+	//	it at the same time, and point the stream at it if we've already
+	//	been writing on it
+	StreamWriter *writer = getWriter(stream, true);
+	std::lock_guard<std::mutex> lock(writer->mutex);
+	element_entry_trim_init(trim_info, max_age_ms, max_bytes, refresh_ms);
+	if (writer->info != NULL) {
+		element_entry_write_set_trim(writer->info, trim_info);
+	}
 
-		// Fill in the keys in the info
-		int idx = 0;
-		for (auto const &x: data) {
+	return ATOM_NO_ERROR;
+}
 
-			// Fill in the write info
-			info->items[idx].key = strdup(x.first.c_str());
-			info->items[idx].key_len = x.first.size();
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes a stream we write ephemeral
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryEphemeralEnable(
+	std::string stream)
+{
+	{
+		std::lock_guard<std::mutex> lock(writer_config_mutex);
+		ephemeral_streams.insert(stream);
+	}
 
-			// Increment the index
-			idx += 1;
+	// Switch the stream over if we've already been writing on it
+	StreamWriter *writer = getWriter(stream, false);
+	if (writer != NULL) {
+		std::lock_guard<std::mutex> lock(writer->mutex);
+		if (writer->info != NULL) {
+			element_entry_write_set_ephemeral(writer->info, true);
 		}
+	}
 
-		streams.emplace(stream, info);
+	return ATOM_NO_ERROR;
+}
 
-	// We found the write info
-	} else {
-		info = exists->second;
-	}
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reports our position on a stream as a durable consumer. We're
+//			registered under our element name.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryConsumerReport(
+	std::string element,
+	std::string stream,
+	std::string last_id)
+{
+	redisContext *ctx = getContext(CONTEXT_BACKGROUND);
 
+	enum atom_error_t err = element_entry_trim_report(
+		ctx,
+		(element.size() > 0) ? element.c_str() : NULL,
+		stream.c_str(),
+		name.c_str(),
+		last_id.c_str());
 
-	// Loop over the keys in the info
-	for (size_t idx = 0; idx < info->n_items; ++idx) {
+	releaseContext(ctx, CONTEXT_BACKGROUND);
 
-		// Find the item in the input dict
-		auto item = data.find(info->items[idx].key);
-		if (item == data.end()) {
-			std::runtime_error("Invalid key for stream");
-		}
+	return err;
+}
 
-		// Fill in the data size and length
-		info->items[idx].data = (const uint8_t*)item->second.c_str();
-		info->items[idx].data_len = item->second.size();
-	}
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unregisters us as a durable consumer of a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryConsumerRemove(
+	std::string element,
+	std::string stream)
+{
+	redisContext *ctx = getContext(CONTEXT_BACKGROUND);
 
-	// Do the write
-	enum atom_error_t err = element_entry_write(
+	enum atom_error_t err = element_entry_trim_unregister(
 		ctx,
-		info,
-		timestamp,
-		maxlen);
+		(element.size() > 0) ? element.c_str() : NULL,
+		stream.c_str(),
+		name.c_str());
 
-	// Return the context
-	releaseContext(ctx);
+	releaseContext(ctx, CONTEXT_BACKGROUND);
 
-	// And return the error
 	return err;
 }
 
@@ -1049,11 +2900,27 @@ enum atom_error_t Element::entryWrite(
 ////////////////////////////////////////////////////////////////////////////////
 void Element::log(
 	int level,
-	std::string msg)
+	const std::string &msg)
 {
-	redisContext *ctx = getContext();
-	enum atom_error_t err = atom_log(ctx, elem, level, msg.c_str(), msg.size());
-	releaseContext(ctx);
+	log(NULL, level, msg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a log message, rate limited on the site passed
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::log(
+	const char *site,
+	int level,
+	const std::string &msg)
+{
+	// Rate limit on the site the caller passed, the message is already
+	//	formatted so there's no format string to go by
+	redisContext *ctx = getContext(CONTEXT_BACKGROUND);
+	enum atom_error_t err = atom_log_limited(ctx, elem, level,
+		site, msg.c_str(), msg.size());
+	releaseContext(ctx, CONTEXT_BACKGROUND);
 	if (err != ATOM_NO_ERROR) {
 		error("Failed to log", false);
 	}
@@ -1072,9 +2939,9 @@ void Element::log(
 	va_list args;
 	va_start(args, fmt);
 
-	redisContext *ctx = getContext();
+	redisContext *ctx = getContext(CONTEXT_BACKGROUND);
 	enum atom_error_t err = atom_vlogf(ctx, elem, level, fmt, args);
-	releaseContext(ctx);
+	releaseContext(ctx, CONTEXT_BACKGROUND);
 	if (err != ATOM_NO_ERROR) {
 		error("Failed to log", false);
 	}
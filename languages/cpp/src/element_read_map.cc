@@ -19,7 +19,7 @@ namespace atom {
 //  @brief Constructor. Nothing allocated, just a placeholder
 //
 ////////////////////////////////////////////////////////////////////////////////
-ElementReadMap::ElementReadMap()
+ElementReadMap::ElementReadMap() : batching_enabled(false), ephemeral(false)
 {
 }
 
@@ -32,6 +32,23 @@ ElementReadMap::~ElementReadMap()
 {
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds a handler to an ElementReadMap
+//
+////////////////////////////////////////////////////////////////////////////////
+void ElementReadMap::addHandler(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> keys,
+	readHandlerFn fn,
+	void *user_data,
+	unsigned int weight,
+	size_t max_count)
+{
+	handlers.emplace_back(std::move(element), std::move(stream), std::move(keys), fn, user_data, weight, max_count);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Adds a handler to an ElementReadMap
@@ -44,7 +61,7 @@ void ElementReadMap::addHandler(
 	readHandlerFn fn,
 	void *user_data)
 {
-	handlers.emplace_back(std::move(element), std::move(stream), std::move(keys), fn, user_data);
+	addHandler(element, stream, keys, fn, user_data, REDIS_STREAM_DEFAULT_WEIGHT);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -61,6 +78,38 @@ void ElementReadMap::addHandler(
 	addHandler(element, stream, keys, fn, NULL);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds a handler for each of the partitions of a stream that
+//			we own
+//
+////////////////////////////////////////////////////////////////////////////////
+void ElementReadMap::addPartitionedHandler(
+	std::string element,
+	std::string stream,
+	int n_partitions,
+	std::vector<std::string> keys,
+	readHandlerFn fn,
+	void *user_data,
+	int member,
+	int n_members)
+{
+	char partition[ATOM_NAME_MAXLEN];
+
+	if ((n_members < 1) || (member < 0) || (member >= n_members)) {
+		return;
+	}
+
+	for (int p = member; p < n_partitions; p += n_members) {
+		if (atom_get_partition_stream_name(
+			stream.c_str(), p, partition) == NULL)
+		{
+			break;
+		}
+		addHandler(element, partition, keys, fn, user_data);
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Gets the number of handlers
@@ -82,4 +131,49 @@ handler_t &ElementReadMap::getHandler(
 	return handlers.at(n);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Enables adaptive batching for the read loop
+//
+////////////////////////////////////////////////////////////////////////////////
+void ElementReadMap::setBatching(
+	size_t min_count,
+	size_t max_count,
+	int spin_us)
+{
+	element_entry_read_batching_init(&batching, min_count, max_count, spin_us);
+	batching_enabled = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the batching settings and stats, if enabled
+//
+////////////////////////////////////////////////////////////////////////////////
+struct element_entry_read_batching *ElementReadMap::getBatching()
+{
+	return batching_enabled ? &batching : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Marks the streams as ephemeral
+//
+////////////////////////////////////////////////////////////////////////////////
+void ElementReadMap::setEphemeral(
+	bool e)
+{
+	ephemeral = e;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets whether the streams are ephemeral
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ElementReadMap::isEphemeral()
+{
+	return ephemeral;
+}
+
 } // namespace atom
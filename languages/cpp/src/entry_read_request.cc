@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file entry_read_request.cc
+//
+//  @brief Reusable request for reading entries from a single stream
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "entry_read_request.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Sets up the read info once, pointing at our own
+//			copies of the names and keys.
+//
+////////////////////////////////////////////////////////////////////////////////
+EntryReadRequest::EntryReadRequest(
+	const std::string &e,
+	const std::string &s,
+	const std::vector<std::string> &k) : element(e), stream(s), keys(k),
+	kv_items(k.size())
+{
+	for (size_t i = 0; i < keys.size(); ++i) {
+		kv_items[i].key = keys[i].c_str();
+		kv_items[i].key_len = keys[i].size();
+	}
+
+	read_info.element = (element.size() > 0) ? element.c_str() : NULL;
+	read_info.stream = stream.c_str();
+	read_info.kv_items = kv_items.data();
+	read_info.n_kv_items = kv_items.size();
+	read_info.user_data = NULL;
+	read_info.response_cb = NULL;
+	read_info.freshness = NULL;
+	read_info.weight = REDIS_STREAM_DEFAULT_WEIGHT;
+	read_info.max_count = REDIS_XREAD_NOMAXCOUNT;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Getters
+//
+////////////////////////////////////////////////////////////////////////////////
+const std::string &EntryReadRequest::getElement() const
+{
+	return element;
+}
+
+const std::string &EntryReadRequest::getStream() const
+{
+	return stream;
+}
+
+const std::vector<std::string> &EntryReadRequest::getKeys() const
+{
+	return keys;
+}
+
+} // namespace atom
@@ -0,0 +1,364 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file subscription_mux.cc
+//
+//  @brief Per-process multiplexer for stream subscriptions
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "element.h"
+#include "subscription_mux.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief XREAD callback. User data is the stream the entry came in on, or
+//			NULL for the wakeup stream which has nothing to dispatch.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool subscriptionMuxCB(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	if (user_data == NULL) {
+		return true;
+	}
+
+	SubscriptionMux::instance().dispatch(
+		(SubscriptionMux::Stream *)user_data, id, reply);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. The thread and context are made on the first
+//			subscription.
+//
+////////////////////////////////////////////////////////////////////////////////
+SubscriptionMux::SubscriptionMux() : next_id(0), generation(0), ctx(NULL),
+	stop(false), cmd_ctx(NULL)
+{
+	char host[64];
+
+	if (gethostname(host, sizeof(host)) != 0) {
+		host[0] = '\0';
+	}
+	host[sizeof(host) - 1] = '\0';
+
+	wakeup_stream = std::string(SUBSCRIPTION_MUX_WAKEUP_PREFIX) + host + ":" +
+		std::to_string(getpid());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Stops the mux thread and cleans up the context
+//
+////////////////////////////////////////////////////////////////////////////////
+SubscriptionMux::~SubscriptionMux()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	cond.notify_all();
+
+	if (thread.joinable()) {
+		thread.join();
+	}
+
+	if (ctx != NULL) {
+		redis_context_cleanup(ctx);
+	}
+
+	if (cmd_ctx != NULL) {
+		redisReply *reply = (redisReply *)redisCommand(
+			cmd_ctx, "DEL %s", wakeup_stream.c_str());
+		if (reply != NULL) {
+			freeReplyObject(reply);
+		}
+		redis_context_cleanup(cmd_ctx);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Wakes up the mux thread by writing to the wakeup stream, which
+//			is in every XREAD it does. Called with the lock held.
+//
+////////////////////////////////////////////////////////////////////////////////
+void SubscriptionMux::wakeup()
+{
+	redisReply *reply = (redisReply *)redisCommand(cmd_ctx,
+		"XADD %s MAXLEN 1 * wakeup 1", wakeup_stream.c_str());
+	if ((reply == NULL) || (reply->type != REDIS_REPLY_STRING)) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to wake up subscription mux");
+	}
+	if (reply != NULL) {
+		freeReplyObject(reply);
+	} else {
+		redis_context_reconnect(cmd_ctx);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the mux for the process
+//
+////////////////////////////////////////////////////////////////////////////////
+SubscriptionMux &SubscriptionMux::instance()
+{
+	static SubscriptionMux mux;
+	return mux;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Subscribes to a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+int SubscriptionMux::subscribe(
+	const std::string &element,
+	const std::string &stream,
+	sharedReadHandlerFn fn,
+	void *user_data)
+{
+	char stream_name[ATOM_NAME_MAXLEN];
+	if (element.size() > 0) {
+		atom_get_data_stream_str(element.c_str(), stream.c_str(), stream_name);
+	} else {
+		snprintf(stream_name, sizeof(stream_name), "%s", stream.c_str());
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// All of the streams are read with one XREAD, so there's a limit
+	auto exists = streams.find(stream_name);
+	if ((exists == streams.end()) &&
+		(streams.size() >= SUBSCRIPTION_MUX_MAX_STREAMS))
+	{
+		atom_logf(NULL, NULL, LOG_ERR,
+			"Subscription mux can't take more than %d streams",
+			SUBSCRIPTION_MUX_MAX_STREAMS);
+		return -1;
+	}
+
+	if (cmd_ctx == NULL) {
+		cmd_ctx = redis_context_init();
+	}
+
+	// Make the new version of the stream with the subscriber added. A new
+	//	stream starts at the current time, taken now rather than when the
+	//	mux thread gets around to it.
+	auto new_stream = std::make_shared<Stream>();
+	new_stream->name = stream_name;
+	if (exists != streams.end()) {
+		new_stream->subscribers = exists->second->subscribers;
+		new_stream->start_id = exists->second->start_id;
+	} else {
+		struct redis_stream_info info;
+		if ((cmd_ctx == NULL) || !redis_init_stream_info(cmd_ctx, &info,
+			stream_name, subscriptionMuxCB, NULL, NULL))
+		{
+			atom_logf(NULL, NULL, LOG_ERR,
+				"Subscription mux failed to get start ID for %s", stream_name);
+			return -1;
+		}
+		new_stream->start_id = info.last_id;
+	}
+
+	int id = next_id++;
+	new_stream->subscribers.push_back(
+		std::make_shared<Subscriber>(id, fn, user_data));
+
+	streams[new_stream->name] = new_stream;
+	subscriber_streams[id] = new_stream->name;
+	generation += 1;
+
+	// Start the mux if this is the first subscription, otherwise get it
+	//	out of its XREAD to pick up the new one
+	if (!thread.joinable()) {
+		ctx = redis_context_init();
+		thread = std::thread(&SubscriptionMux::run, this);
+	} else {
+		wakeup();
+	}
+
+	cond.notify_all();
+
+	return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unsubscribes
+//
+////////////////////////////////////////////////////////////////////////////////
+void SubscriptionMux::unsubscribe(
+	int id)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto name = subscriber_streams.find(id);
+		if (name == subscriber_streams.end()) {
+			return;
+		}
+
+		auto stream = streams.find(name->second);
+		subscriber_streams.erase(name);
+
+		// Make the new version of the stream without the subscriber. The
+		//	mux thread might still be using the old one, so turn the
+		//	subscriber off there as well.
+		auto new_stream = std::make_shared<Stream>();
+		new_stream->name = stream->second->name;
+		new_stream->start_id = stream->second->start_id;
+		for (auto &sub : stream->second->subscribers) {
+			if (sub->id == id) {
+				sub->active = false;
+			} else {
+				new_stream->subscribers.push_back(sub);
+			}
+		}
+
+		if (new_stream->subscribers.empty()) {
+			streams.erase(stream);
+		} else {
+			stream->second = new_stream;
+		}
+		generation += 1;
+	}
+
+	// Wait out any handler call that's already underway, unless that's us
+	if (std::this_thread::get_id() != thread.get_id()) {
+		std::lock_guard<std::mutex> lock(dispatch_mutex);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Decodes an entry once and passes it to each subscriber
+//
+////////////////////////////////////////////////////////////////////////////////
+void SubscriptionMux::dispatch(
+	Stream *stream,
+	const char *id,
+	const struct redisReply *reply)
+{
+	auto entry = std::make_shared<Entry>(id);
+	for (size_t i = 0; (i + 1) < reply->elements; i += 2) {
+		entry->addData(
+			reply->element[i]->str,
+			reply->element[i + 1]->str,
+			reply->element[i + 1]->len);
+	}
+	std::shared_ptr<const Entry> shared_entry(std::move(entry));
+
+	std::lock_guard<std::mutex> lock(dispatch_mutex);
+	for (auto const &sub : stream->subscribers) {
+		if (!sub->active) {
+			continue;
+		}
+
+		if (!sub->fn(shared_entry, sub->user_data)) {
+			atom_logf(NULL, NULL, LOG_ERR, "User callback failed");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Mux thread. Does a single XREAD on all of the subscribed streams
+//			and the wakeup stream, rebuilding it whenever the set of
+//			subscriptions changes.
+//
+////////////////////////////////////////////////////////////////////////////////
+void SubscriptionMux::run()
+{
+	std::vector<struct redis_stream_info> infos(1);
+	std::vector<std::shared_ptr<Stream>> active;
+	// Generation is always at least 1 by the time we're running
+	unsigned int built = 0;
+
+	// The wakeup stream is always first
+	redis_init_stream_info(ctx, &infos[0], wakeup_stream.c_str(),
+		subscriptionMuxCB, NULL, NULL);
+
+	while (true) {
+		bool ok = true;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this]() { return stop || !streams.empty(); });
+			if (stop) {
+				break;
+			}
+
+			// Rebuild the XREAD, picking up where we left off on any
+			//	streams we were already reading and at their start IDs
+			//	on new ones
+			if (built != generation) {
+				std::map<std::string, std::string> last_ids;
+				for (size_t i = 1; i < infos.size(); ++i) {
+					last_ids[infos[i].name] = infos[i].last_id;
+				}
+
+				std::vector<struct redis_stream_info> new_infos(
+					streams.size() + 1);
+				std::vector<std::shared_ptr<Stream>> new_active;
+				new_infos[0] = infos[0];
+				for (auto const &x : streams) {
+					auto last_id = last_ids.find(x.first);
+					new_active.push_back(x.second);
+					if (!redis_init_stream_info(
+						ctx,
+						&new_infos[new_active.size()],
+						x.second->name.c_str(),
+						subscriptionMuxCB,
+						(last_id != last_ids.end()) ?
+							last_id->second.c_str() : x.second->start_id.c_str(),
+						x.second.get()))
+					{
+						ok = false;
+						break;
+					}
+				}
+
+				if (ok) {
+					infos.swap(new_infos);
+					active.swap(new_active);
+					built = generation;
+				}
+			}
+		}
+
+		if (ok && !redis_xread(
+			ctx,
+			infos.data(),
+			infos.size(),
+			SUBSCRIPTION_MUX_BLOCK_MS,
+			REDIS_XREAD_NOMAXCOUNT))
+		{
+			ok = false;
+		}
+
+		// If redis is having issues then back off and reconnect
+		if (!ok) {
+			atom_logf(NULL, NULL, LOG_ERR, "Subscription mux redis issue");
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(SUBSCRIPTION_MUX_RETRY_MS));
+			redis_context_reconnect(ctx);
+		}
+	}
+}
+
+} // namespace atom
@@ -12,6 +12,7 @@
 #include <list>
 #include <hiredis/hiredis.h>
 #include <thread>
+#include <atomic>
 #include <unistd.h>
 #include <limits.h>
 #include "atom/atom.h"
@@ -19,6 +20,7 @@
 #include "element.h"
 #include "element_response.h"
 #include "element_read_map.h"
+#include "batching_client.h"
 
 // Need to use the atom namespace
 using namespace atom;
@@ -114,6 +116,126 @@ TEST_F(ElementTest, single_entry_single_key) {
 	}
 }
 
+// Tests writing to different streams from different threads at once
+TEST_F(ElementTest, concurrent_writers) {
+	const int n_threads = 4;
+	const int n_writes = 100;
+	std::vector<std::thread> threads;
+
+	for (int t = 0; t < n_threads; ++t) {
+		threads.emplace_back([&, t]() {
+			std::string stream = "concurrent" + std::to_string(t);
+			for (int i = 0; i < n_writes; ++i) {
+				entry_data_t data;
+				data["thread"] = std::to_string(t);
+				data["i"] = std::to_string(i);
+				ASSERT_EQ(element->entryWrite(stream, data), ATOM_NO_ERROR);
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	// Each stream should have all of its thread's writes, in order
+	std::vector<std::string> keys = {"thread", "i"};
+	for (int t = 0; t < n_threads; ++t) {
+		std::vector<Entry> ret;
+		ASSERT_EQ(element->entryReadN(
+			"testing",
+			"concurrent" + std::to_string(t),
+			keys,
+			n_writes,
+			ret), ATOM_NO_ERROR);
+		ASSERT_EQ(ret.size(), n_writes);
+		for (int i = 0; i < n_writes; ++i) {
+			ASSERT_EQ(ret[i].getKey("thread"), std::to_string(t));
+			ASSERT_EQ(ret[i].getKey("i"), std::to_string(n_writes - 1 - i));
+		}
+	}
+}
+
+// Tests big writes, small writes and logs at once, with a context pool for
+//	each traffic class and with the classes sharing the control contexts.
+//	There are more writers than contexts s.t. they have to wait on them.
+TEST_F(ElementTest, traffic_classes) {
+	const int n_threads = 4;
+	const int n_writes = 5;
+	std::vector<std::thread> threads;
+	Element classes("traffic_classes", 2, 1, 1);
+	Element shared("traffic_shared", 2, 0, 0);
+
+	std::string big(ELEMENT_BULK_MIN_BYTES, 'x');
+	for (int t = 0; t < n_threads; ++t) {
+		threads.emplace_back([&, t]() {
+			Element &elem = (t % 2 == 0) ? classes : shared;
+			for (int i = 0; i < n_writes; ++i) {
+				entry_data_t data;
+				data["image"] = big;
+				data["i"] = std::to_string(i);
+				ASSERT_EQ(elem.entryWrite(
+					"images" + std::to_string(t), data), ATOM_NO_ERROR);
+			}
+		});
+	}
+
+	// Small writes and logs carry on alongside
+	for (int i = 0; i < n_writes; ++i) {
+		entry_data_t data;
+		data["hello"] = "world";
+		ASSERT_EQ(classes.entryWrite("small", data), ATOM_NO_ERROR);
+		classes.log(LOG_INFO, "write %d", i);
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	std::vector<std::string> keys = {"image", "i"};
+	for (int t = 0; t < n_threads; ++t) {
+		std::vector<Entry> ret;
+		ASSERT_EQ(element->entryReadN(
+			(t % 2 == 0) ? "traffic_classes" : "traffic_shared",
+			"images" + std::to_string(t),
+			keys,
+			n_writes,
+			ret), ATOM_NO_ERROR);
+		ASSERT_EQ(ret.size(), n_writes);
+		ASSERT_EQ(ret[0].getKey("image"), big);
+	}
+}
+
+// Tests reading with the same request over and over
+TEST_F(ElementTest, reusable_read_request) {
+	entry_data_t data;
+	std::vector<std::string> keys = {"hello", "foo"};
+	EntryReadRequest req("testing", "foobar", keys);
+	std::vector<Entry> ret;
+
+	for (int i = 0; i < 3; ++i) {
+		data["hello"] = "world" + std::to_string(i);
+		data["foo"] = "bar" + std::to_string(i);
+		ASSERT_EQ(element->entryWrite("foobar", data), ATOM_NO_ERROR);
+
+		// The latest entry with N
+		ret.clear();
+		ASSERT_EQ(element->entryReadN(req, 1, ret), ATOM_NO_ERROR);
+		ASSERT_EQ(ret.size(), 1);
+		ASSERT_EQ(ret[0].getKey("hello"), data["hello"]);
+		ASSERT_EQ(ret[0].getKey("foo"), data["foo"]);
+
+		// And everything so far with since
+		ret.clear();
+		ASSERT_EQ(element->entryReadSince(
+			req,
+			10,
+			ret,
+			ENTRY_READ_SINCE_BEGIN_WITH_OLDEST_ID), ATOM_NO_ERROR);
+		ASSERT_EQ(ret.size(), i + 1);
+		ASSERT_EQ(ret[i].getKey("hello"), data["hello"]);
+	}
+}
+
 // Tests writing data to a stream and then reading it back
 TEST_F(ElementTest, single_entry_multiple_keys) {
 
@@ -241,6 +363,136 @@ TEST_F(ElementTest, multiple_streams) {
 	ASSERT_EQ(ret2[0].getKey("foo"), "bar");
 }
 
+// Tests reading the latest entry of multiple streams at once
+TEST_F(ElementTest, read_latest_multi) {
+
+	entry_data_t data1;
+	entry_data_t data2;
+
+	data1["hello"] = "world";
+	data2["foo"] = "bar";
+
+	// Write twice to the first stream s.t. we know we get the latest
+	ASSERT_EQ(element->entryWrite("elementary", data1), ATOM_NO_ERROR);
+	data1["hello"] = "again";
+	ASSERT_EQ(element->entryWrite("elementary", data1), ATOM_NO_ERROR);
+	ASSERT_EQ(element->entryWrite("robotics", data2), ATOM_NO_ERROR);
+
+	std::vector<std::pair<std::string, std::string>> streams = {
+		{"testing", "elementary"},
+		{"testing", "nothing_here"},
+		{"testing", "robotics"},
+	};
+	std::vector<std::vector<std::string>> keys = {
+		{"hello"},
+		{"hello"},
+		{"foo"},
+	};
+	std::vector<Entry> ret;
+	ASSERT_EQ(element->entryReadLatestMulti(streams, keys, ret), ATOM_NO_ERROR);
+
+	ASSERT_EQ(ret.size(), 3);
+	ASSERT_EQ(ret[0].getKey("hello"), "again");
+	ASSERT_EQ(ret[1].getID(), "");
+	ASSERT_EQ(ret[1].size(), 0);
+	ASSERT_EQ(ret[2].getKey("foo"), "bar");
+	ASSERT_NE(ret[0].getID(), "");
+}
+
+// Tests writing to and reading from a partitioned stream
+TEST_F(ElementTest, partitioned_stream) {
+	const int n_partitions = 4;
+	const int n_objects = 8;
+	const int n_writes = 5;
+
+	ASSERT_EQ(element->entryPartitionEnable(
+		"detections", n_partitions, "object"), ATOM_NO_ERROR);
+
+	int n_found = 0;
+	ASSERT_EQ(element->entryPartitionCount(
+		"testing", "detections", n_found), ATOM_NO_ERROR);
+	ASSERT_EQ(n_found, n_partitions);
+
+	for (int i = 0; i < n_writes; ++i) {
+		for (int obj = 0; obj < n_objects; ++obj) {
+			entry_data_t data;
+			data["object"] = std::to_string(obj);
+			data["i"] = std::to_string(i);
+			ASSERT_EQ(element->entryWrite("detections", data), ATOM_NO_ERROR);
+		}
+	}
+
+	// Each object's entries are all in its partition, in order
+	std::vector<std::string> keys = {"object", "i"};
+	for (int obj = 0; obj < n_objects; ++obj) {
+		std::string value = std::to_string(obj);
+		int p = atom_partition_for_key(
+			(const uint8_t *)value.data(), value.size(), n_partitions);
+
+		std::vector<Entry> ret;
+		ASSERT_EQ(element->entryReadN(
+			"testing",
+			"detections:p" + std::to_string(p),
+			keys,
+			n_writes * n_objects,
+			ret), ATOM_NO_ERROR);
+
+		int expected = n_writes - 1;
+		for (auto &entry : ret) {
+			if (entry.getKey("object") == value) {
+				ASSERT_EQ(entry.getKey("i"), std::to_string(expected));
+				expected--;
+			}
+		}
+		ASSERT_EQ(expected, -1);
+	}
+
+	// The count can be looked up by raw stream name as well
+	char raw_stream[ATOM_NAME_MAXLEN];
+	atom_get_data_stream_str("testing", "detections", raw_stream);
+	n_found = 0;
+	ASSERT_EQ(element->entryPartitionCount(
+		"", raw_stream, n_found), ATOM_NO_ERROR);
+	ASSERT_EQ(n_found, n_partitions);
+
+	// Reading across the partitions merges them newest first. IDs on
+	//	different partitions are only ordered to the millisecond, so all
+	//	we can count on is that the milliseconds never go up and that each
+	//	object's entries, being on one partition, stay in order.
+	std::vector<Entry> ret;
+	ASSERT_EQ(element->entryReadPartitionedN(
+		"testing", "detections", keys, n_writes * n_objects, ret),
+		ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), n_writes * n_objects);
+	std::map<std::string, int> next_i;
+	unsigned long long last_ms = ULLONG_MAX;
+	for (auto &entry : ret) {
+		unsigned long long ms = std::stoull(entry.getID());
+		ASSERT_LE(ms, last_ms);
+		last_ms = ms;
+
+		std::string object = entry.getKey("object");
+		if (next_i.find(object) == next_i.end()) {
+			next_i[object] = n_writes - 1;
+		}
+		ASSERT_EQ(entry.getKey("i"), std::to_string(next_i[object]));
+		next_i[object]--;
+	}
+	ASSERT_EQ(next_i.size(), n_objects);
+
+	// Two readers splitting the stream own every partition once
+	ElementReadMap first;
+	ElementReadMap second;
+	first.addPartitionedHandler("testing", "detections", n_partitions,
+		keys, NULL, NULL, 0, 2);
+	second.addPartitionedHandler("testing", "detections", n_partitions,
+		keys, NULL, NULL, 1, 2);
+	ASSERT_EQ(first.getNumHandlers(), 2);
+	ASSERT_EQ(second.getNumHandlers(), 2);
+	ASSERT_EQ(std::get<1>(first.getHandler(0)), "detections:p0");
+	ASSERT_EQ(std::get<1>(second.getHandler(1)), "detections:p3");
+}
+
 // Tests getAllStreams
 TEST_F(ElementTest, get_all_streams_single_element_all_streams) {
 
@@ -471,6 +723,34 @@ public:
 };
 
 
+// Tests that commands are published in the command registry
+TEST_F(ElementTest, command_registry) {
+	Element cmd_elem("registry");
+	cmd_elem.addCommand("hello", "hello, world", hello_callback_fn, NULL, 1000);
+	cmd_elem.addCommand("test_err", "tests an error", test_err_callback_fn, NULL, 2000);
+
+	// Just the one element
+	std::vector<CommandInfo> commands;
+	ASSERT_EQ(element->getAllCommands(commands, "registry"), ATOM_NO_ERROR);
+	ASSERT_EQ(commands.size(), 2);
+
+	std::map<std::string, CommandInfo> found;
+	for (auto const &x : commands) {
+		ASSERT_EQ(x.element, "registry");
+		found[x.command] = x;
+	}
+	ASSERT_EQ(found["hello"].description, "hello, world");
+	ASSERT_EQ(found["hello"].timeout, 1000);
+	ASSERT_EQ(found["test_err"].description, "tests an error");
+	ASSERT_EQ(found["test_err"].timeout, 2000);
+
+	// And across all of the elements
+	commands.clear();
+	element->addCommand("hello", "hi", hello_callback_fn, NULL, 500);
+	ASSERT_EQ(element->getAllCommands(commands), ATOM_NO_ERROR);
+	ASSERT_EQ(commands.size(), 3);
+}
+
 // Thread that creates a command element
 void* command_element(void *data)
 {
@@ -525,6 +805,336 @@ TEST_F(ElementTest, basic_commands) {
 	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
 }
 
+// Thread that creates a command element with a cacheable command. Only
+//	handles 3 commands, anything past that has to come from the cache.
+void* cacheable_command_element(void *data)
+{
+	Element elem("test_cache");
+	elem.addCommand("hello", "hello, world", hello_callback_fn, NULL, 1000);
+	elem.commandSetCacheable("hello", 60000);
+
+	elem.commandLoop(3);
+	return NULL;
+}
+
+// Tests that responses to cacheable commands are served from the cache
+//	until the element bumps its cache version
+TEST_F(ElementTest, cacheable_command) {
+	ElementResponse resp;
+
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, cacheable_command_element, NULL), 0);
+
+	while (true) {
+		std::vector<std::string> elements;
+		ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+		if (std::find(elements.begin(), elements.end(), "test_cache") != elements.end()) {
+			break;
+		}
+		usleep(100000);
+	}
+
+	// First call finds out the command is cacheable, second caches it
+	for (int i = 0; i < 2; ++i) {
+		ElementResponse resp;
+		ASSERT_EQ(element->sendCommand(resp, "test_cache", "hello", NULL, 0), ATOM_NO_ERROR);
+		ASSERT_EQ(resp.getData(), "world");
+	}
+
+	// The rest come from the cache
+	for (int i = 0; i < 10; ++i) {
+		ElementResponse resp;
+		ASSERT_EQ(element->sendCommand(resp, "test_cache", "hello", NULL, 0), ATOM_NO_ERROR);
+		ASSERT_EQ(resp.getData(), "world");
+	}
+
+	// Until the version is bumped, then it goes back to the element
+	redisContext *ctx = redis_context_init();
+	ASSERT_TRUE(redis_incr(ctx, "cache_version:test_cache", NULL));
+	redis_context_cleanup(ctx);
+
+	// Which we notice once the version we have is stale
+	usleep(2 * ELEMENT_CACHE_VERSION_REFRESH_MS * 1000);
+
+	ASSERT_EQ(element->sendCommand(resp, "test_cache", "hello", NULL, 0), ATOM_NO_ERROR);
+	ASSERT_EQ(resp.getData(), "world");
+
+	// Which will have handled its 3 commands and exited
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Thread that creates an element taking list RPC for its command
+void* rpc_command_element(void *data)
+{
+	Element elem("test_rpc");
+	elem.addCommand("hello", "hello, world", hello_callback_fn, NULL, 1000);
+	elem.commandSetRpc("hello");
+
+	// First call comes in over the streams, the rest over list RPC
+	std::thread rpc_thread([&elem]() { elem.commandRpcLoop(2); });
+	elem.commandLoop(1);
+	rpc_thread.join();
+	return NULL;
+}
+
+// Tests that callers switch over to list RPC once the element
+//	tells them they can
+TEST_F(ElementTest, rpc_command) {
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, rpc_command_element, NULL), 0);
+
+	while (true) {
+		std::vector<std::string> elements;
+		ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+		if (std::find(elements.begin(), elements.end(), "test_rpc") != elements.end()) {
+			break;
+		}
+		usleep(100000);
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		ElementResponse resp;
+		ASSERT_EQ(element->sendCommand(resp, "test_rpc", "hello", NULL, 0), ATOM_NO_ERROR);
+		ASSERT_EQ(resp.getData(), "world");
+	}
+
+	// Which will have handled the one command and the two RPCs and exited
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Streaming command that sums up the bytes it's sent and counts the chunks
+class ChunkCount : public StreamingCommand {
+public:
+	size_t n_chunks;
+	size_t n_bytes;
+
+	ChunkCount() : StreamingCommand("chunk_count", "counts chunks") {}
+
+	virtual void init() {
+		n_chunks = 0;
+		n_bytes = 0;
+	}
+
+	virtual bool onChunk(const uint8_t *chunk, size_t chunk_len) {
+		for (size_t i = 0; i < chunk_len; ++i) {
+			n_bytes += chunk[i];
+		}
+		n_chunks++;
+		return true;
+	}
+
+	virtual bool run() {
+		response->setData(std::to_string(n_chunks) + ":" +
+			std::to_string(n_bytes));
+		return true;
+	}
+};
+
+// Thread that creates an element with a streaming command
+void* streaming_command_element(void *data)
+{
+	Element elem("test_stream");
+	ChunkCount chunk_count;
+	elem.addCommand(&chunk_count);
+
+	// Handles a chunked request, an aborted one and one sent all at once
+	elem.commandLoop(3);
+	return NULL;
+}
+
+// Tests that a streaming command gets its request a chunk at a time
+TEST_F(ElementTest, streaming_command) {
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, streaming_command_element, NULL), 0);
+
+	while (true) {
+		std::vector<std::string> elements;
+		ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+		if (std::find(elements.begin(), elements.end(), "test_stream") != elements.end()) {
+			break;
+		}
+		usleep(100000);
+	}
+
+	uint8_t data[10];
+	for (int i = 0; i < 10; ++i) {
+		data[i] = i;
+	}
+
+	ElementResponse resp;
+	ASSERT_EQ(element->sendCommandChunked(resp, "test_stream", "chunk_count",
+		data, sizeof(data), 4), ATOM_NO_ERROR);
+	ASSERT_EQ(resp.getData(), "3:45");
+
+	// Giving up partway fails the command
+	int n_sent = 0;
+	ElementResponse aborted;
+	ASSERT_EQ(element->sendCommandChunked(aborted, "test_stream", "chunk_count",
+		[&n_sent](std::string &chunk, bool &last) {
+			chunk = "a";
+			last = false;
+			return (n_sent++ == 0);
+		}), ATOM_CALLBACK_FAILED);
+
+	// And the partial request doesn't carry over to the next one
+	ElementResponse whole;
+	ASSERT_EQ(element->sendCommand(whole, "test_stream", "chunk_count",
+		data, sizeof(data)), ATOM_NO_ERROR);
+	ASSERT_EQ(whole.getData(), "1:45");
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Thread that creates an element keeping command stats
+void* command_stats_element(void *data)
+{
+	Element elem("test_stats");
+	elem.addCommand("hello", "hello, world", hello_callback_fn, NULL, 1000);
+	elem.addCommand("test_err", "tests an error", test_err_callback_fn, NULL, 1000);
+	elem.commandStatsEnable();
+
+	// Two hellos, an error and then the stats
+	elem.commandLoop(4);
+	return NULL;
+}
+
+// Tests that the command stats count calls, errors and data
+TEST_F(ElementTest, command_stats) {
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_stats_element, NULL), 0);
+
+	while (true) {
+		std::vector<std::string> elements;
+		ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+		if (std::find(elements.begin(), elements.end(), "test_stats") != elements.end()) {
+			break;
+		}
+		usleep(100000);
+	}
+
+	ElementResponse hello1;
+	ASSERT_EQ(element->sendCommand(hello1, "test_stats", "hello",
+		(const uint8_t *)"abc", 3), ATOM_NO_ERROR);
+	ElementResponse hello2;
+	ASSERT_EQ(element->sendCommand(hello2, "test_stats", "hello", NULL, 0),
+		ATOM_NO_ERROR);
+	ElementResponse err;
+	ASSERT_EQ(element->sendCommand(err, "test_stats", "test_err", NULL, 0),
+		ATOM_USER_ERRORS_BEGIN + 1);
+
+	ElementResponse stats;
+	ASSERT_EQ(element->sendCommand(stats, "test_stats",
+		COMMAND_STATS_COMMAND_STR, NULL, 0), ATOM_NO_ERROR);
+	ASSERT_NE(stats.getData().find("hello calls=2 errors=0 "), std::string::npos);
+	ASSERT_NE(stats.getData().find("req_bytes=3 res_bytes=10 "), std::string::npos);
+	ASSERT_NE(stats.getData().find("test_err calls=1 errors=1 "), std::string::npos);
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Tests that the circuit breaker opens on an element that isn't there,
+//	fails fast while open and lets a probe through once it's been open
+//	for long enough
+TEST_F(ElementTest, circuit_breaker) {
+	element->commandCircuitBreakerEnable(4, 2, 0.5, 500);
+
+	for (int i = 0; i < 2; ++i) {
+		ElementResponse resp;
+		ASSERT_EQ(element->sendCommand(resp, "not_there", "hello", NULL, 0),
+			ATOM_COMMAND_NO_ACK);
+	}
+	ASSERT_EQ(element->commandCircuitBreakerState("not_there"),
+		CircuitBreaker::OPEN);
+
+	auto start = std::chrono::steady_clock::now();
+	ElementResponse open;
+	ASSERT_EQ(element->sendCommand(open, "not_there", "hello", NULL, 0),
+		ATOM_COMMAND_CIRCUIT_OPEN);
+	ASSERT_TRUE(open.isError());
+	ASSERT_LT(std::chrono::steady_clock::now() - start,
+		std::chrono::milliseconds(100));
+
+	// Probe still fails, so back to open
+	usleep(600000);
+	ElementResponse probe;
+	ASSERT_EQ(element->sendCommand(probe, "not_there", "hello", NULL, 0),
+		ATOM_COMMAND_NO_ACK);
+	ASSERT_EQ(element->commandCircuitBreakerState("not_there"),
+		CircuitBreaker::OPEN);
+
+	// Errors from an element that's there don't count and a good probe
+	//	closes the breaker
+	CircuitBreaker breaker(4, 2, 0.5, 0);
+	uint64_t token;
+	breaker.record(ATOM_COMMAND_UNSUPPORTED, CIRCUIT_BREAKER_NO_PROBE);
+	breaker.record(ATOM_USER_ERRORS_BEGIN, CIRCUIT_BREAKER_NO_PROBE);
+	ASSERT_EQ(breaker.getState(), CircuitBreaker::CLOSED);
+	breaker.record(ATOM_COMMAND_NO_ACK, CIRCUIT_BREAKER_NO_PROBE);
+	breaker.record(ATOM_COMMAND_NO_RESPONSE, CIRCUIT_BREAKER_NO_PROBE);
+	ASSERT_EQ(breaker.getState(), CircuitBreaker::OPEN);
+	ASSERT_TRUE(breaker.allow(token));
+	ASSERT_NE(token, (uint64_t)CIRCUIT_BREAKER_NO_PROBE);
+	ASSERT_EQ(breaker.getState(), CircuitBreaker::HALF_OPEN);
+	uint64_t other;
+	ASSERT_FALSE(breaker.allow(other));
+
+	// A command that went out before the breaker opened coming back
+	//	doesn't decide the probe
+	breaker.record(ATOM_NO_ERROR, CIRCUIT_BREAKER_NO_PROBE);
+	ASSERT_EQ(breaker.getState(), CircuitBreaker::HALF_OPEN);
+	breaker.record(ATOM_NO_ERROR, token);
+	ASSERT_EQ(breaker.getState(), CircuitBreaker::CLOSED);
+}
+
+// Tests that a batching client gets all of its commands to the element in
+//	a single batch and the responses back to the right callers
+TEST_F(ElementTest, batching_client) {
+
+	// Command element only handles a single command, which will be
+	//	the batch
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element, NULL), 0);
+
+	while (true) {
+		std::vector<std::string> elements;
+		ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+		if (std::find(elements.begin(), elements.end(), "test_cmd") != elements.end()) {
+			break;
+		}
+		usleep(100000);
+	}
+
+	// Window is long enough that the batch fills up before it expires
+	BatchingClient client(*element, "test_cmd", 4, 1000000);
+	auto hello1 = client.sendCommand("hello", NULL, 0);
+	auto err = client.sendCommand("test_err", NULL, 0);
+	auto missing = client.sendCommand("not_a_command", NULL, 0);
+	auto hello2 = client.sendCommand("hello", NULL, 0);
+
+	ElementResponse resp = hello1.get();
+	ASSERT_FALSE(resp.isError());
+	ASSERT_EQ(resp.getData(), "world");
+
+	resp = err.get();
+	ASSERT_TRUE(resp.isError());
+	ASSERT_EQ(resp.getError(), ATOM_USER_ERRORS_BEGIN + 1);
+
+	resp = missing.get();
+	ASSERT_TRUE(resp.isError());
+	ASSERT_EQ(resp.getError(), ATOM_COMMAND_UNSUPPORTED);
+
+	resp = hello2.get();
+	ASSERT_FALSE(resp.isError());
+	ASSERT_EQ(resp.getData(), "world");
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
 // Tests messagepack command
 TEST_F(ElementTest, msgpack_command) {
 	ElementResponse resp;
@@ -811,6 +1421,59 @@ TEST_F(ElementTest, readSinceLog) {
 	}
 }
 
+// Tests that logs are rate limited per call site and that repeats are
+//	summed up. The third "repeated" is over the site's burst and dropped.
+TEST_F(ElementTest, limited_log) {
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"level", "element", "msg", "host"};
+
+	// A burst of 2 at 1 per second, with repeats summed up once a minute
+	atom_log_limit_set(1, 2, 60000);
+
+	for (int i = 0; i < 5; ++i) {
+		element->log(LOG_INFO, "limited %d", i);
+	}
+	for (int i = 0; i < 3; ++i) {
+		element->log(ELEMENT_LOG_SITE, LOG_INFO, "repeated");
+	}
+	element->log(ELEMENT_LOG_SITE, LOG_INFO, "done");
+
+	// Repeats that are still held back when logging stops come out on
+	//	a flush
+	for (int i = 0; i < 2; ++i) {
+		element->log(LOG_INFO, std::string("tail"));
+	}
+	ASSERT_EQ(atom_log_flush(NULL), ATOM_NO_ERROR);
+
+	atom_log_limit_set(
+		ATOM_LOG_NO_LIMIT,
+		ATOM_LOG_DEFAULT_SITE_BURST,
+		ATOM_LOG_NO_LIMIT);
+
+	ASSERT_EQ(element->entryReadSince(
+		"",
+		"log",
+		keys,
+		10,
+		ret,
+		ENTRY_READ_SINCE_BEGIN_WITH_OLDEST_ID), ATOM_NO_ERROR);
+
+	std::vector<std::string> expected = {
+		"limited 0",
+		"limited 1",
+		"repeated",
+		"Last message repeated 1 times",
+		"done",
+		"tail",
+		"Last message repeated 1 times",
+	};
+	ASSERT_EQ(ret.size(), expected.size());
+	for (size_t i = 0; i < expected.size(); ++i) {
+		ASSERT_EQ(ret.at(i).getKey("msg"), expected[i]);
+		ASSERT_EQ(ret.at(i).getKey("level"), std::to_string(LOG_INFO));
+	}
+}
+
 // Tests readSince API with element
 TEST_F(ElementTest, readSinceElement) {
 
@@ -951,3 +1614,165 @@ void reader_element(int &i)
 
 // 	ASSERT_EQ(count, 3);
 // }
+
+// Tests that history reads still work when the configured replica
+//	can't be used. Pointing the replica at the primary means it'll never
+//	look like a caught-up replica, so the reads have to fall back.
+TEST_F(ElementTest, replica_fallback) {
+
+	ASSERT_EQ(element->replicaEnable("/tmp/atom_no_such_replica.sock"),
+		ATOM_REDIS_ERROR);
+	ASSERT_EQ(element->replicaEnable(REDIS_DEFAULT_LOCAL_SOCKET, 1, 1),
+		ATOM_NO_ERROR);
+
+	entry_data_t data;
+	data["hello"] = "world";
+	ASSERT_EQ(element->entryWrite("foobar", data), ATOM_NO_ERROR);
+
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"hello"};
+	ASSERT_EQ(element->entryReadN(
+		"testing",
+		"foobar",
+		keys,
+		1,
+		ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 1);
+	ASSERT_EQ(ret[0].getKey("hello"), "world");
+
+	std::vector<std::string> elements;
+	ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+	ASSERT_EQ(elements.size(), 1);
+	ASSERT_EQ(elements[0], "testing");
+}
+
+bool sharedReaderHandler(
+	std::shared_ptr<const Entry> e,
+	void *user_data)
+{
+	std::vector<std::shared_ptr<const Entry>> *entries =
+		(std::vector<std::shared_ptr<const Entry>> *)user_data;
+	entries->push_back(e);
+	return true;
+}
+
+// Tests that two subscribers to the same stream through the subscription
+//	mux both get every entry, and that they share the decoded entry
+TEST_F(ElementTest, subscription_mux) {
+	std::vector<std::shared_ptr<const Entry>> first;
+	std::vector<std::shared_ptr<const Entry>> second;
+
+	// An empty element means the raw stream name, same as for reads
+	char stream_name[ATOM_NAME_MAXLEN];
+	atom_get_data_stream_str("testing", "shared", stream_name);
+
+	int first_id = element->entrySubscribe("testing", "shared", sharedReaderHandler, &first);
+	int second_id = element->entrySubscribe("", stream_name, sharedReaderHandler, &second);
+	ASSERT_GE(first_id, 0);
+	ASSERT_GE(second_id, 0);
+
+	// No need to wait for the mux, anything written after subscribing
+	//	gets delivered
+	entry_data_t data;
+	data["foo"] = "bar";
+	for (int i = 0; i < 3; ++i) {
+		ASSERT_EQ(element->entryWrite("shared", data), ATOM_NO_ERROR);
+	}
+
+	// Wait for the entries to make it through
+	usleep(2 * SUBSCRIPTION_MUX_BLOCK_MS * 1000);
+
+	// Unsubscribe before checking s.t. the handlers aren't running
+	element->entryUnsubscribe(first_id);
+	element->entryUnsubscribe(second_id);
+
+	ASSERT_EQ(first.size(), 3);
+	ASSERT_EQ(second.size(), 3);
+	for (size_t i = 0; i < first.size(); ++i) {
+		ASSERT_EQ(first[i].get(), second[i].get());
+		ASSERT_EQ(first[i]->getKey("foo"), "bar");
+	}
+}
+
+// Tests that the mux takes up to SUBSCRIPTION_MUX_MAX_STREAMS streams and
+//	turns down any more
+TEST_F(ElementTest, subscription_mux_max_streams) {
+	std::vector<std::shared_ptr<const Entry>> entries;
+	std::vector<int> ids;
+
+	for (int i = 0; i < SUBSCRIPTION_MUX_MAX_STREAMS; ++i) {
+		std::string stream = "stream:test_mux:" + std::to_string(i);
+		int id = element->entrySubscribe("", stream, sharedReaderHandler, &entries);
+		ASSERT_GE(id, 0);
+		ids.push_back(id);
+	}
+
+	// More subscribers on a stream we already have are fine
+	int extra_id = element->entrySubscribe("", "stream:test_mux:0", sharedReaderHandler, &entries);
+	ASSERT_GE(extra_id, 0);
+	ids.push_back(extra_id);
+
+	// But not another stream
+	ASSERT_EQ(element->entrySubscribe("", "stream:test_mux:overflow", sharedReaderHandler, &entries), -1);
+
+	for (auto id : ids) {
+		element->entryUnsubscribe(id);
+	}
+
+	// And once there's room again it works
+	int id = element->entrySubscribe("", "stream:test_mux:overflow", sharedReaderHandler, &entries);
+	ASSERT_GE(id, 0);
+	element->entryUnsubscribe(id);
+}
+
+bool ephemeralReaderHandler(
+	Entry &e,
+	void *user_data)
+{
+	std::atomic<int> *n_read = (std::atomic<int> *)user_data;
+
+	if ((e.size() == 1) && (e.getKey("foo") == "bar")) {
+		*n_read += 1;
+	}
+	return true;
+}
+
+// Tests that entries written to an ephemeral stream make it through to
+//	an ephemeral read loop. Nothing is kept for readers that aren't
+//	listening yet, so keep writing until the reader has what it wants.
+TEST_F(ElementTest, ephemeral_read_loop) {
+	std::atomic<int> n_read(0);
+	std::atomic<bool> done(false);
+
+	ASSERT_EQ(element->entryEphemeralEnable("ephemeral"), ATOM_NO_ERROR);
+
+	std::thread reader([&n_read, &done]() {
+		Element elem("ephemeral_reader");
+		ElementReadMap m;
+		m.setEphemeral();
+		m.addHandler("testing", "ephemeral", { "foo" },
+			ephemeralReaderHandler, &n_read);
+		EXPECT_EQ(elem.entryReadLoop(m, 3), ATOM_NO_ERROR);
+		done = true;
+	});
+
+	entry_data_t data;
+	data["foo"] = "bar";
+	for (int i = 0; (i < 500) && !done; ++i) {
+		ASSERT_EQ(element->entryWrite("ephemeral", data), ATOM_NO_ERROR);
+		usleep(10000);
+	}
+
+	reader.join();
+	ASSERT_TRUE(done);
+	ASSERT_EQ(n_read, 3);
+
+	// And nothing landed in a redis stream
+	redisContext *ctx = redis_context_init();
+	redisReply *reply = (redisReply *)redisCommand(
+		ctx, "EXISTS stream:testing:ephemeral");
+	ASSERT_NE(reply, (redisReply *)NULL);
+	EXPECT_EQ(reply->integer, 0);
+	freeReplyObject(reply);
+	redis_context_cleanup(ctx);
+}
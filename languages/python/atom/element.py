@@ -526,6 +526,7 @@ class Element:
         try:
             self._rclient.unlink(self._make_response_id(self.name))
             self._rclient.unlink(self._make_command_id(self.name))
+            self._rclient.unlink(self._make_command_registry_id(self.name))
             self._rclient.unlink(self._make_consumer_group_counter(self.name))
         except redis.exceptions.RedisError:
             raise Exception("Could not connect to nucleus!")
@@ -581,6 +582,16 @@ class Element:
         """
         return f"command:{element_name}"
 
+    def _make_command_registry_id(self, element_name: str) -> str:
+        """
+        Creates the string representation for an element's command registry
+        hash id.
+
+        Args:
+            element_name (str): Name of the element to generate the id for.
+        """
+        return f"command_registry:{element_name}"
+
     def _make_consumer_group_counter(self, element_name: str) -> str:
         """
         Creates the string representation for an element's command group
@@ -916,10 +927,18 @@ class Element:
         if ignore_caller and self.name in elements:
             elements.remove(self.name)
 
+        # Read every element's command registry at once, and only fall
+        #   back to asking elements that don't keep one
+        registries = self._get_command_registries(elements)
+
         command_list = []
         for element in elements:
+            if element in registries:
+                command_list.extend(
+                    [f"{element}:{command}" for command in registries[element]]
+                )
             # Check support for command_list command
-            if self._check_element_version(element, {"Python"}, 0.3):
+            elif self._check_element_version(element, {"Python"}, 0.3):
                 # Retrieve commands for each element
                 elem_commands = self.command_send(
                     element, COMMAND_LIST_COMMAND, serialization="msgpack"
@@ -930,6 +949,61 @@ class Element:
                 )
         return command_list
 
+    def get_command_info(
+        self, element_name: Optional[str] = None
+    ) -> dict[str, dict[str, dict]]:
+        """
+        Gets the commands that elements have published in the command
+            registry, for all elements by default. All of the registries
+            are read in a single round trip.
+
+        Args:
+            element_name (str, optional): Name of the element to get the
+                commands of.
+
+        Returns:
+            Dict of element name to a dict of command name to a dict with
+            the command's "timeout" and "description". Elements that don't
+            keep a registry are left out.
+        """
+        if element_name is None:
+            elements = self.get_all_elements()
+        else:
+            elements = [element_name]
+        return self._get_command_registries(elements)
+
+    def _get_command_registries(self, elements: list[str]) -> dict[str, dict]:
+        """
+        Reads the command registries of the elements in one pipeline.
+
+        Args:
+            elements (list): Names of the elements to read the registries of.
+
+        Returns:
+            Dict of element name to its commands, see get_command_info.
+        """
+        if not elements:
+            return {}
+
+        with RedisPipeline(self) as redis_pipeline:
+            for element in elements:
+                redis_pipeline.hgetall(self._make_command_registry_id(element))
+            replies = redis_pipeline.execute()
+
+        registries = {}
+        for element, reply in zip(elements, replies):
+            if not reply:
+                continue
+            commands = {}
+            for command, value in reply.items():
+                timeout, _, description = value.decode().partition(" ")
+                commands[command.decode()] = {
+                    "timeout": int(timeout),
+                    "description": description,
+                }
+            registries[element] = commands
+        return registries
+
     def _command_add_init_metrics(self, name: str) -> None:
         """
         Create the metrics for a new command. Puts the command's metric
@@ -972,9 +1046,12 @@ class Element:
         timeout: int = RESPONSE_TIMEOUT,
         serialization: Optional[ser.SerializationMethod] = None,
         deserialize: Optional[bool] = None,
+        description: str = "",
     ) -> None:
         """
-        Adds a command to the element for another element to call.
+        Adds a command to the element for another element to call. The
+            command is published in the element's command registry s.t.
+            it can be discovered without sending the element a command.
 
         Args:
             name (str): Name of the command.
@@ -983,6 +1060,8 @@ class Element:
                 to finish.
             serialization (str, optional): The method of serialization to use;
                 defaults to None.
+            description (str, optional): Description of the command for the
+                command registry.
 
             Deprecated:
             deserialize (bool, optional): Whether or not to deserialize the data
@@ -1009,6 +1088,14 @@ class Element:
 
         self.timeouts[name] = timeout
 
+        # Publish the command in the registry
+        if name not in RESERVED_COMMANDS:
+            self._rclient.hset(
+                self._make_command_registry_id(self.name),
+                name,
+                f"{timeout} {description}",
+            )
+
         # Make the metric for the command
         self._command_add_init_metrics(name)
 
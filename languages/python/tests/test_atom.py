@@ -913,6 +913,10 @@ class TestAtom:
         self._element_start(responder, caller)
         self._element_start(responder2, caller)
 
+        # Drop responder's command registry s.t. it's asked for its commands
+        #   like an element that doesn't keep one
+        caller._rclient.unlink(caller._make_command_registry_id(responder_name))
+
         # Retrieve commands
         commands = caller.get_all_commands(
             element_name=[responder_name, responder2_name]
@@ -993,6 +997,29 @@ class TestAtom:
         del responder1
         del responder2
 
+    def test_get_command_info(self, caller, responder):
+        """
+        Verify that commands are published in the command registry
+        """
+        caller, caller_name = caller
+        responder, responder_name = responder
+
+        responder.command_add("foo_func0", lambda x: x, timeout=50)
+        responder.command_add(
+            "foo_func1", lambda x: x, timeout=70, description="Does foo"
+        )
+
+        info = caller.get_command_info(responder_name)
+        assert info == {
+            responder_name: {
+                "foo_func0": {"timeout": 50, "description": ""},
+                "foo_func1": {"timeout": 70, "description": "Does foo"},
+            }
+        }
+
+        # Reserved commands aren't published
+        assert caller.get_command_info(caller_name) == {}
+
     def test_no_ack(self, caller, responder):
         """
         Element sends command and responder does not acknowledge.
@@ -0,0 +1,173 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_exporter.h
+//
+//  @brief Exports redis streams to columnar Arrow IPC or Parquet files
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_EXPORT_STREAM_EXPORTER_H
+#define __ATOM_EXPORT_STREAM_EXPORTER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include <hiredis/hiredis.h>
+#include <arrow/api.h>
+#include <arrow/util/compression.h>
+#include <arrow/util/config.h>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+
+// The IPC options and Result APIs used here are Arrow 1.0's, which is the
+//	version pinned in the base image
+#if (ARROW_VERSION_MAJOR != 1) || (ARROW_VERSION_MINOR != 0)
+	#error "atom-export is built against Arrow 1.0"
+#endif
+
+// Default number of entries read with each XRANGE, and so in each
+//	record batch written
+#define STREAM_EXPORTER_DEFAULT_BATCH_SIZE 10000
+
+// Default number of threads decoding batches
+#define STREAM_EXPORTER_DEFAULT_N_THREADS 4
+
+// Columns for the entry ID, ahead of the columns for the keys
+#define EXPORT_ID_MS_COLUMN "id_ms"
+#define EXPORT_ID_SEQ_COLUMN "id_seq"
+#define EXPORT_N_ID_COLUMNS 2
+
+// Suffix of the time index written next to an Arrow IPC export. It has a
+//	line for each record batch, in order, with the id_ms of its first and
+//	last entries and its number of entries, e.g. "1589324400000
+//	1589324459999 10000".
+#define EXPORT_INDEX_SUFFIX ".idx"
+
+namespace atom {
+
+// Formats that streams can be exported to. Parquet is only there when
+//	built with ATOM_EXPORT_PARQUET.
+enum ExportFormat {
+	EXPORT_ARROW_IPC,
+	EXPORT_PARQUET,
+};
+
+// How entry values are turned into columns. Raw values go into binary
+//	columns as they are. Msgpack'd scalars go into typed columns, int64,
+//	double, bool or string, and anything else goes into a binary column
+//	still packed. A key with both ints and floats gets a double column, and
+//	a key with any other mix of types gets a binary column.
+enum ExportDecode {
+	EXPORT_DECODE_RAW,
+	EXPORT_DECODE_MSGPACK,
+};
+
+// Totals for an export
+struct StreamExportStats {
+	uint64_t entries;
+	uint64_t batches;
+
+	// Values written as null since they didn't fit their column's type or
+	//	their key only showed up after the schema was set. Each batch with
+	//	any is logged, and they fail the export in strict mode.
+	uint64_t mismatched;
+
+	StreamExportStats() : entries(0), batches(0), mismatched(0) {}
+};
+
+// Exports a stream to a file a batch at a time. Entries are read with
+//	XRANGE batch_size at a time and each batch is decoded into a record
+//	batch on its own thread, up to n_threads at once, while the batches
+//	before it are written out in order. At most n_threads batches, plus
+//	the one being read, are held in memory no matter how long the stream
+//	is.
+//	Each entry becomes a row with its ID split into the id_ms and id_seq
+//	columns and a column for each key. The columns and their types are
+//	set by all of the entries in the first batch. Arrow IPC exports also
+//	get a time index s.t. queries can skip batches without reading them.
+class StreamExporter {
+public:
+
+	StreamExporter(
+		redisContext *ctx,
+		ExportFormat format = EXPORT_ARROW_IPC,
+		ExportDecode decode = EXPORT_DECODE_MSGPACK,
+		size_t batch_size = STREAM_EXPORTER_DEFAULT_BATCH_SIZE,
+		size_t n_threads = STREAM_EXPORTER_DEFAULT_N_THREADS);
+
+	// Sets how the file is compressed. For Arrow IPC this compresses the
+	//	record batch buffers, using the threads as well.
+	void setCompression(
+		arrow::Compression::type compression);
+
+	// Sets whether a value that doesn't fit the schema fails the export
+	//	rather than being written as null
+	void setStrict(
+		bool strict);
+
+	// Exports the entries of the redis stream with IDs in [start, end] to
+	//	the file at path
+	enum atom_error_t exportStream(
+		const std::string &stream,
+		const std::string &path,
+		const std::string &start = "-",
+		const std::string &end = "+");
+
+	// Stats and error for the last export
+	const StreamExportStats &getStats() const;
+	const std::string &getError() const;
+
+private:
+	redisContext *ctx;
+	ExportFormat format;
+	ExportDecode decode;
+	size_t batch_size;
+	size_t n_threads;
+	arrow::Compression::type compression;
+	bool strict;
+
+	// Schema for the export in progress and the column of each key
+	std::shared_ptr<arrow::Schema> schema;
+	std::unordered_map<std::string, int> columns;
+
+	StreamExportStats stats;
+	std::string error;
+
+	// Reads the next batch of entries, starting right after last_id if
+	//	it's set
+	std::shared_ptr<redisReply> readBatch(
+		const std::string &stream,
+		const std::string &start,
+		const std::string &end,
+		const std::string &last_id);
+
+	// Sets the schema from all of the entries in the first batch
+	void makeSchema(
+		const redisReply *reply);
+
+	// Decodes a batch of entries into a record batch. Run on the decode
+	//	threads, only reads the schema.
+	std::shared_ptr<arrow::RecordBatch> decodeBatch(
+		std::shared_ptr<redisReply> reply,
+		uint64_t &mismatched) const;
+
+	// Writes the time index for an Arrow IPC export
+	enum atom_error_t writeIndex(
+		const std::string &path,
+		const std::vector<std::string> &lines);
+
+	// Notes an error
+	enum atom_error_t fail(
+		enum atom_error_t err,
+		const std::string &msg);
+};
+
+} // namespace atom
+
+#endif // __ATOM_EXPORT_STREAM_EXPORTER_H
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_query.h
+//
+//  @brief Queries over streams exported to Arrow IPC files
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_EXPORT_STREAM_QUERY_H
+#define __ATOM_EXPORT_STREAM_QUERY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <future>
+
+#include <arrow/api.h>
+
+#include "atom/atom.h"
+#include "stream_exporter.h"
+
+// Default number of threads scanning batches
+#define STREAM_QUERY_DEFAULT_N_THREADS 4
+
+// Schema metadata key on result batches with the export they came from,
+//	i.e. "<element>.<stream>"
+#define STREAM_QUERY_SOURCE_METADATA "source"
+
+namespace atom {
+
+// Comparisons for predicates
+enum QueryOp {
+	QUERY_EQ,
+	QUERY_NE,
+	QUERY_LT,
+	QUERY_LE,
+	QUERY_GT,
+	QUERY_GE,
+};
+
+// Value a column is compared against. Ints compare against int and float
+//	columns, floats against float columns, bools against bool columns and
+//	strings against string and binary columns.
+struct QueryValue {
+	enum Type {
+		INT,
+		FLOAT,
+		BOOL,
+		STRING,
+	};
+
+	Type type;
+	int64_t i;
+	double d;
+	bool b;
+	std::string s;
+
+	QueryValue(int v) : type(INT), i(v), d(0), b(false) {}
+	QueryValue(int64_t v) : type(INT), i(v), d(0), b(false) {}
+	QueryValue(double v) : type(FLOAT), i(0), d(v), b(false) {}
+	QueryValue(bool v) : type(BOOL), i(0), d(0), b(v) {}
+	QueryValue(const char *v) : type(STRING), i(0), d(0), b(false), s(v) {}
+	QueryValue(const std::string &v) : type(STRING), i(0), d(0), b(false),
+		s(v) {}
+};
+
+// Predicate on a key. Nulls, and values that can't be compared against
+//	the predicate's value, never match.
+struct QueryPredicate {
+	std::string key;
+	QueryOp op;
+	QueryValue value;
+};
+
+// Totals for a query
+struct StreamQueryStats {
+	uint64_t files;
+	uint64_t batches;
+
+	// Batches skipped without being read, from the time index or from not
+	//	having a key that a predicate is on
+	uint64_t pruned;
+
+	uint64_t rows_scanned;
+	uint64_t rows_matched;
+
+	StreamQueryStats() : files(0), batches(0), pruned(0), rows_scanned(0),
+		rows_matched(0) {}
+};
+
+// Defined in stream_query.cc
+struct QueryPlan;
+
+// Result of scanning a batch
+struct QueryScan {
+	std::shared_ptr<arrow::RecordBatch> batch;
+	uint64_t rows_scanned;
+	std::string error;
+};
+
+// Iterates over the results of a query a batch at a time. Batches are
+//	scanned on up to n_threads threads ahead of the one being returned, and
+//	come back in file and then time order.
+class QueryCursor {
+public:
+	QueryCursor();
+
+	// Gets the next batch of matches. Returns false once there are no more
+	//	or on an error, check getError() to tell which.
+	bool next(
+		std::shared_ptr<arrow::RecordBatch> &batch);
+
+	// Stats and error so far
+	const StreamQueryStats &getStats() const;
+	const std::string &getError() const;
+
+private:
+	friend class StreamQuery;
+
+	QueryCursor(const QueryCursor &) = delete;
+	QueryCursor &operator=(const QueryCursor &) = delete;
+
+	std::shared_ptr<const QueryPlan> plan;
+	size_t n_threads;
+	size_t next_batch;
+	std::deque<std::future<QueryScan>> pending;
+
+	StreamQueryStats stats;
+	std::string error;
+};
+
+// Query over the exports in a directory, e.g. all of the detections with
+//	label "person" in a time range:
+//
+//	StreamQuery query("/data");
+//	query.stream("camera", "detections")
+//		.between(t1, t2)
+//		.select({"label", "box"})
+//		.where("label", QUERY_EQ, "person");
+//
+// Batches outside of the time range are skipped using the index written
+//	with each export, and the files are memory mapped s.t. only the columns
+//	selected or in predicates are ever read off of disk.
+class StreamQuery {
+public:
+
+	StreamQuery(
+		const std::string &dir,
+		size_t n_threads = STREAM_QUERY_DEFAULT_N_THREADS);
+
+	// Adds a stream to the query. Queries all of the exports in the
+	//	directory if none are added.
+	StreamQuery &stream(
+		const std::string &element,
+		const std::string &stream);
+
+	// Limits the query to entries with id_ms in [start_ms, end_ms]
+	StreamQuery &between(
+		uint64_t start_ms,
+		uint64_t end_ms);
+
+	// Sets the keys returned, along with id_ms and id_seq. Returns all of
+	//	them if not set.
+	StreamQuery &select(
+		const std::vector<std::string> &keys);
+
+	// Adds a predicate. Entries have to match all of them.
+	StreamQuery &where(
+		const std::string &key,
+		QueryOp op,
+		const QueryValue &value);
+
+	// Starts the query
+	enum atom_error_t open(
+		QueryCursor &cursor);
+
+	// Runs the query and collects all of the results
+	enum atom_error_t run(
+		std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+		StreamQueryStats *stats = NULL);
+
+	const std::string &getError() const;
+
+private:
+	std::string dir;
+	size_t n_threads;
+	std::vector<std::string> sources;
+	uint64_t start_ms;
+	uint64_t end_ms;
+	std::vector<std::string> keys;
+	std::vector<QueryPredicate> predicates;
+	std::string error;
+
+	// Adds an export to the plan, skipping the batches it can
+	enum atom_error_t planFile(
+		const std::string &source,
+		QueryPlan &plan,
+		StreamQueryStats &stats);
+
+	// Notes an error
+	enum atom_error_t fail(
+		enum atom_error_t err,
+		const std::string &msg);
+};
+
+} // namespace atom
+
+#endif // __ATOM_EXPORT_STREAM_QUERY_H
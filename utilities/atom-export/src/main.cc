@@ -0,0 +1,230 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file main.cc
+//
+//  @brief Command line tool for exporting element streams to Arrow IPC or
+//			Parquet files
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <string>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "stream_exporter.h"
+
+using namespace atom;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Prints how to use the tool
+//
+////////////////////////////////////////////////////////////////////////////////
+static void usage(
+	const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] element:stream [element:stream ...]\n"
+		"\n"
+		"Exports each stream to <output dir>/<element>.<stream>.<format>\n"
+		"\n"
+		"  -f, --format arrow|parquet   File format (default arrow)\n"
+		"  -d, --decode msgpack|raw     How values are decoded (default msgpack)\n"
+		"  -c, --compression none|lz4|zstd|snappy|gzip\n"
+		"                               Compression (default none)\n"
+		"  -b, --batch N                Entries per batch (default %d)\n"
+		"  -j, --threads N              Decode threads (default %d)\n"
+		"  -s, --start ID               First entry ID (default -)\n"
+		"  -e, --end ID                 Last entry ID (default +)\n"
+		"  -S, --strict                 Fail on values that don't fit the\n"
+		"                               schema instead of writing null\n"
+		"  -o, --output DIR             Output dir (default .)\n"
+		"  -r, --redis SOCKET           Redis socket (default nucleus)\n",
+		name,
+		STREAM_EXPORTER_DEFAULT_BATCH_SIZE,
+		STREAM_EXPORTER_DEFAULT_N_THREADS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Parses a compression name
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool parseCompression(
+	const char *name,
+	arrow::Compression::type &compression)
+{
+	if (!strcmp(name, "none")) {
+		compression = arrow::Compression::UNCOMPRESSED;
+	} else if (!strcmp(name, "lz4")) {
+		compression = arrow::Compression::LZ4_FRAME;
+	} else if (!strcmp(name, "zstd")) {
+		compression = arrow::Compression::ZSTD;
+	} else if (!strcmp(name, "snappy")) {
+		compression = arrow::Compression::SNAPPY;
+	} else if (!strcmp(name, "gzip")) {
+		compression = arrow::Compression::GZIP;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+int main(
+	int argc,
+	char **argv)
+{
+	static struct option long_options[] = {
+		{"format", required_argument, NULL, 'f'},
+		{"decode", required_argument, NULL, 'd'},
+		{"compression", required_argument, NULL, 'c'},
+		{"batch", required_argument, NULL, 'b'},
+		{"threads", required_argument, NULL, 'j'},
+		{"start", required_argument, NULL, 's'},
+		{"end", required_argument, NULL, 'e'},
+		{"strict", no_argument, NULL, 'S'},
+		{"output", required_argument, NULL, 'o'},
+		{"redis", required_argument, NULL, 'r'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0},
+	};
+
+	ExportFormat format = EXPORT_ARROW_IPC;
+	ExportDecode decode = EXPORT_DECODE_MSGPACK;
+	arrow::Compression::type compression = arrow::Compression::UNCOMPRESSED;
+	size_t batch_size = STREAM_EXPORTER_DEFAULT_BATCH_SIZE;
+	size_t n_threads = STREAM_EXPORTER_DEFAULT_N_THREADS;
+	std::string start = "-";
+	std::string end = "+";
+	std::string output = ".";
+	bool strict = false;
+	const char *socket = NULL;
+	int opt;
+
+	while ((opt = getopt_long(
+		argc, argv, "f:d:c:b:j:s:e:So:r:h", long_options, NULL)) != -1)
+	{
+		switch (opt) {
+			case 'f':
+				if (!strcmp(optarg, "arrow")) {
+					format = EXPORT_ARROW_IPC;
+				} else if (!strcmp(optarg, "parquet")) {
+					format = EXPORT_PARQUET;
+				} else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'd':
+				if (!strcmp(optarg, "msgpack")) {
+					decode = EXPORT_DECODE_MSGPACK;
+				} else if (!strcmp(optarg, "raw")) {
+					decode = EXPORT_DECODE_RAW;
+				} else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'c':
+				if (!parseCompression(optarg, compression)) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'b':
+				batch_size = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				n_threads = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				start = optarg;
+				break;
+			case 'e':
+				end = optarg;
+				break;
+			case 'S':
+				strict = true;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'r':
+				socket = optarg;
+				break;
+			case 'h':
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	redisContext *ctx = (socket != NULL) ?
+		redis_context_init_local(socket) : redis_context_init();
+	if (ctx == NULL) {
+		fprintf(stderr, "Failed to connect to redis\n");
+		return 1;
+	}
+
+	StreamExporter exporter(ctx, format, decode, batch_size, n_threads);
+	exporter.setCompression(compression);
+	exporter.setStrict(strict);
+
+	int ret = 0;
+	for (int i = optind; i < argc; ++i) {
+		char stream[ATOM_NAME_MAXLEN];
+		std::string arg = argv[i];
+
+		// Streams are given as element:stream
+		size_t delim = arg.find(':');
+		if (delim == std::string::npos) {
+			fprintf(stderr, "Invalid stream %s, need element:stream\n", argv[i]);
+			ret = 1;
+			continue;
+		}
+		std::string element = arg.substr(0, delim);
+		std::string name = arg.substr(delim + 1);
+		if (atom_get_data_stream_str(
+			element.c_str(), name.c_str(), stream) == NULL)
+		{
+			fprintf(stderr, "Invalid stream %s\n", argv[i]);
+			ret = 1;
+			continue;
+		}
+
+		std::string path = output + "/" + element + "." + name +
+			((format == EXPORT_PARQUET) ? ".parquet" : ".arrow");
+
+		if (exporter.exportStream(stream, path, start, end) != ATOM_NO_ERROR) {
+			fprintf(stderr, "Failed to export %s: %s\n",
+				argv[i], exporter.getError().c_str());
+			ret = 1;
+			continue;
+		}
+
+		const StreamExportStats &stats = exporter.getStats();
+		printf("%s: %llu entries in %llu batches to %s",
+			argv[i],
+			(unsigned long long)stats.entries,
+			(unsigned long long)stats.batches,
+			path.c_str());
+		if (stats.mismatched > 0) {
+			printf(", %llu values didn't fit their column",
+				(unsigned long long)stats.mismatched);
+		}
+		printf("\n");
+	}
+
+	redis_context_cleanup(ctx);
+	return ret;
+}
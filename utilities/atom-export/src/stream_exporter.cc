@@ -0,0 +1,647 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_exporter.cc
+//
+//  @brief Exports redis streams to columnar Arrow IPC or Parquet files
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <limits>
+#include <algorithm>
+#include <deque>
+#include <future>
+
+#include <msgpack.hpp>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#ifdef ATOM_EXPORT_PARQUET
+	#include <parquet/arrow/writer.h>
+#endif
+
+#include "stream_exporter.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Splits a stream ID into its time and sequence number
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool parseID(
+	const char *id,
+	uint64_t &ms,
+	uint64_t &seq)
+{
+	return sscanf(id, "%" SCNu64 "-%" SCNu64, &ms, &seq) == 2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the type of column a value goes in
+//
+////////////////////////////////////////////////////////////////////////////////
+static std::shared_ptr<arrow::DataType> valueType(
+	ExportDecode decode,
+	const char *data,
+	size_t data_len)
+{
+	if (decode == EXPORT_DECODE_RAW) {
+		return arrow::binary();
+	}
+
+	try {
+		msgpack::object_handle handle = msgpack::unpack(data, data_len);
+		switch (handle.get().type) {
+			case msgpack::type::POSITIVE_INTEGER:
+			case msgpack::type::NEGATIVE_INTEGER:
+				return arrow::int64();
+			case msgpack::type::FLOAT32:
+			case msgpack::type::FLOAT64:
+				return arrow::float64();
+			case msgpack::type::BOOLEAN:
+				return arrow::boolean();
+			case msgpack::type::STR:
+				return arrow::utf8();
+			default:
+				return arrow::binary();
+		}
+	} catch (...) {
+		return arrow::binary();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the type of column that fits values of both types. Ints
+//			widen to floats, and any other mix goes in a binary column.
+//
+////////////////////////////////////////////////////////////////////////////////
+static std::shared_ptr<arrow::DataType> widenType(
+	const std::shared_ptr<arrow::DataType> &type,
+	const std::shared_ptr<arrow::DataType> &other)
+{
+	if (type->Equals(other)) {
+		return type;
+	}
+
+	if (((type->id() == arrow::Type::INT64) &&
+		(other->id() == arrow::Type::DOUBLE)) ||
+		((type->id() == arrow::Type::DOUBLE) &&
+		(other->id() == arrow::Type::INT64)))
+	{
+		return arrow::float64();
+	}
+
+	return arrow::binary();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends a value to its column. Returns false if it doesn't fit
+//			the column's type, in which case nothing is appended.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool appendValue(
+	ExportDecode decode,
+	arrow::ArrayBuilder *builder,
+	const char *data,
+	size_t data_len)
+{
+	arrow::Type::type type = builder->type()->id();
+
+	// Binary columns take the value as is, packed or not
+	if (type == arrow::Type::BINARY) {
+		return static_cast<arrow::BinaryBuilder *>(builder)->Append(
+			(const uint8_t *)data, data_len).ok();
+	}
+
+	if (decode == EXPORT_DECODE_RAW) {
+		return false;
+	}
+
+	msgpack::object_handle handle;
+	try {
+		handle = msgpack::unpack(data, data_len);
+	} catch (...) {
+		return false;
+	}
+	const msgpack::object &obj = handle.get();
+
+	switch (type) {
+		case arrow::Type::INT64:
+			if (obj.type == msgpack::type::NEGATIVE_INTEGER) {
+				return static_cast<arrow::Int64Builder *>(builder)->Append(
+					obj.via.i64).ok();
+			}
+			if ((obj.type == msgpack::type::POSITIVE_INTEGER) &&
+				(obj.via.u64 <= (uint64_t)std::numeric_limits<int64_t>::max()))
+			{
+				return static_cast<arrow::Int64Builder *>(builder)->Append(
+					(int64_t)obj.via.u64).ok();
+			}
+			return false;
+
+		// Ints are fine in a float column
+		case arrow::Type::DOUBLE:
+			if ((obj.type == msgpack::type::FLOAT32) ||
+				(obj.type == msgpack::type::FLOAT64))
+			{
+				return static_cast<arrow::DoubleBuilder *>(builder)->Append(
+					obj.via.f64).ok();
+			}
+			if (obj.type == msgpack::type::NEGATIVE_INTEGER) {
+				return static_cast<arrow::DoubleBuilder *>(builder)->Append(
+					(double)obj.via.i64).ok();
+			}
+			if (obj.type == msgpack::type::POSITIVE_INTEGER) {
+				return static_cast<arrow::DoubleBuilder *>(builder)->Append(
+					(double)obj.via.u64).ok();
+			}
+			return false;
+
+		case arrow::Type::BOOL:
+			if (obj.type != msgpack::type::BOOLEAN) {
+				return false;
+			}
+			return static_cast<arrow::BooleanBuilder *>(builder)->Append(
+				obj.via.boolean).ok();
+
+		case arrow::Type::STRING:
+			if (obj.type != msgpack::type::STR) {
+				return false;
+			}
+			return static_cast<arrow::StringBuilder *>(builder)->Append(
+				obj.via.str.ptr, obj.via.str.size).ok();
+
+		default:
+			return false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamExporter::StreamExporter(
+	redisContext *c,
+	ExportFormat f,
+	ExportDecode d,
+	size_t b,
+	size_t n) : ctx(c), format(f), decode(d), batch_size((b > 0) ? b : 1),
+	n_threads((n > 0) ? n : 1), compression(arrow::Compression::UNCOMPRESSED),
+	strict(false)
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets how the file is compressed
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamExporter::setCompression(
+	arrow::Compression::type c)
+{
+	compression = c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets whether values that don't fit the schema fail the export
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamExporter::setStrict(
+	bool s)
+{
+	strict = s;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Getters
+//
+////////////////////////////////////////////////////////////////////////////////
+const StreamExportStats &StreamExporter::getStats() const
+{
+	return stats;
+}
+
+const std::string &StreamExporter::getError() const
+{
+	return error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Notes an error and returns it
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamExporter::fail(
+	enum atom_error_t err,
+	const std::string &msg)
+{
+	error = msg;
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes the time index for an Arrow IPC export
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamExporter::writeIndex(
+	const std::string &path,
+	const std::vector<std::string> &lines)
+{
+	std::string index_path = path + EXPORT_INDEX_SUFFIX;
+
+	FILE *f = fopen(index_path.c_str(), "w");
+	if (f == NULL) {
+		return fail(ATOM_INTERNAL_ERROR, "Failed to open " + index_path);
+	}
+	for (const std::string &line : lines) {
+		fputs(line.c_str(), f);
+	}
+	if (fclose(f) != 0) {
+		return fail(ATOM_INTERNAL_ERROR, "Failed to write " + index_path);
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the next batch of entries. XRANGE takes inclusive IDs so
+//			we start at the ID right after the last one we read.
+//
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<redisReply> StreamExporter::readBatch(
+	const std::string &stream,
+	const std::string &start,
+	const std::string &end,
+	const std::string &last_id)
+{
+	char next_id[STREAM_ID_BUFFLEN];
+	const char *from = start.c_str();
+	uint64_t ms;
+	uint64_t seq;
+
+	if (last_id.size() > 0) {
+		if (!parseID(last_id.c_str(), ms, seq)) {
+			return NULL;
+		}
+		if (seq == std::numeric_limits<uint64_t>::max()) {
+			ms++;
+			seq = 0;
+		} else {
+			seq++;
+		}
+		snprintf(next_id, sizeof(next_id), "%" PRIu64 "-%" PRIu64, ms, seq);
+		from = next_id;
+	}
+
+	redisReply *reply = (redisReply *)redisCommand(ctx,
+		"XRANGE %s %s %s COUNT %zu",
+		stream.c_str(),
+		from,
+		end.c_str(),
+		batch_size);
+	if (reply == NULL) {
+		return NULL;
+	}
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		freeReplyObject(reply);
+		return NULL;
+	}
+
+	return std::shared_ptr<redisReply>(reply, freeReplyObject);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the schema from the first batch. Keys get columns in the
+//			order we first see them, typed to fit all of their values in
+//			the batch.
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamExporter::makeSchema(
+	const redisReply *reply)
+{
+	std::vector<std::string> keys;
+	std::vector<std::shared_ptr<arrow::DataType>> types;
+
+	columns.clear();
+	for (size_t i = 0; i < reply->elements; ++i) {
+		const redisReply *kvs = reply->element[i]->element[1];
+		for (size_t j = 0; (j + 1) < kvs->elements; j += 2) {
+			std::string key(kvs->element[j]->str, kvs->element[j]->len);
+			std::shared_ptr<arrow::DataType> type = valueType(
+				decode,
+				kvs->element[j + 1]->str,
+				kvs->element[j + 1]->len);
+
+			auto column = columns.find(key);
+			if (column == columns.end()) {
+				columns[key] = EXPORT_N_ID_COLUMNS + keys.size();
+				keys.push_back(key);
+				types.push_back(type);
+			} else {
+				int k = column->second - EXPORT_N_ID_COLUMNS;
+				types[k] = widenType(types[k], type);
+			}
+		}
+	}
+
+	std::vector<std::shared_ptr<arrow::Field>> fields = {
+		arrow::field(EXPORT_ID_MS_COLUMN, arrow::uint64(), false),
+		arrow::field(EXPORT_ID_SEQ_COLUMN, arrow::uint64(), false),
+	};
+	for (size_t k = 0; k < keys.size(); ++k) {
+		fields.push_back(arrow::field(keys[k], types[k]));
+	}
+
+	schema = arrow::schema(fields);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Decodes a batch of entries into a record batch
+//
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<arrow::RecordBatch> StreamExporter::decodeBatch(
+	std::shared_ptr<redisReply> reply,
+	uint64_t &mismatched) const
+{
+	int n_columns = schema->num_fields();
+	std::vector<std::unique_ptr<arrow::ArrayBuilder>> builders(n_columns);
+	std::vector<std::shared_ptr<arrow::Array>> arrays(n_columns);
+	std::vector<bool> filled(n_columns);
+	uint64_t ms;
+	uint64_t seq;
+
+	mismatched = 0;
+
+	for (int i = 0; i < n_columns; ++i) {
+		if (!arrow::MakeBuilder(arrow::default_memory_pool(),
+			schema->field(i)->type(), &builders[i]).ok() ||
+			!builders[i]->Reserve(reply->elements).ok())
+		{
+			return NULL;
+		}
+	}
+
+	auto *id_ms = static_cast<arrow::UInt64Builder *>(builders[0].get());
+	auto *id_seq = static_cast<arrow::UInt64Builder *>(builders[1].get());
+
+	for (size_t i = 0; i < reply->elements; ++i) {
+		const redisReply *entry = reply->element[i];
+		const redisReply *kvs = entry->element[1];
+
+		if (!parseID(entry->element[0]->str, ms, seq)) {
+			return NULL;
+		}
+		id_ms->UnsafeAppend(ms);
+		id_seq->UnsafeAppend(seq);
+
+		// Every column gets exactly one value or null for each entry
+		std::fill(filled.begin(), filled.end(), false);
+		for (size_t j = 0; (j + 1) < kvs->elements; j += 2) {
+			auto column = columns.find(
+				std::string(kvs->element[j]->str, kvs->element[j]->len));
+			if (column == columns.end()) {
+				mismatched++;
+				continue;
+			}
+			if (filled[column->second]) {
+				continue;
+			}
+
+			if (appendValue(
+				decode,
+				builders[column->second].get(),
+				kvs->element[j + 1]->str,
+				kvs->element[j + 1]->len))
+			{
+				filled[column->second] = true;
+			} else {
+				mismatched++;
+			}
+		}
+
+		for (int c = EXPORT_N_ID_COLUMNS; c < n_columns; ++c) {
+			if (!filled[c] && !builders[c]->AppendNull().ok()) {
+				return NULL;
+			}
+		}
+	}
+
+	for (int i = 0; i < n_columns; ++i) {
+		if (!builders[i]->Finish(&arrays[i]).ok()) {
+			return NULL;
+		}
+	}
+
+	return arrow::RecordBatch::Make(schema, reply->elements, arrays);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Exports the entries of a stream with IDs in [start, end] to the
+//			file at path. Batches are read on this thread and decoded on
+//			their own threads, and the oldest batch is written out once
+//			there are n_threads in flight.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamExporter::exportStream(
+	const std::string &stream,
+	const std::string &path,
+	const std::string &start,
+	const std::string &end)
+{
+	struct Pending {
+		std::future<std::shared_ptr<arrow::RecordBatch>> batch;
+		std::shared_ptr<uint64_t> mismatched;
+	};
+	std::deque<Pending> pending;
+	std::shared_ptr<arrow::io::FileOutputStream> file;
+	std::shared_ptr<arrow::ipc::RecordBatchWriter> ipc_writer;
+#ifdef ATOM_EXPORT_PARQUET
+	std::unique_ptr<parquet::arrow::FileWriter> parquet_writer;
+#endif
+	std::vector<std::string> index;
+	std::string last_id;
+	enum atom_error_t err = ATOM_NO_ERROR;
+
+	stats = StreamExportStats();
+	error.clear();
+
+#ifndef ATOM_EXPORT_PARQUET
+	if (format == EXPORT_PARQUET) {
+		return fail(ATOM_INTERNAL_ERROR, "Not built with Parquet support");
+	}
+#endif
+
+	// The first batch sets the schema
+	std::shared_ptr<redisReply> reply = readBatch(stream, start, end, last_id);
+	if (reply == NULL) {
+		return fail(ATOM_REDIS_ERROR, "Failed to read " + stream);
+	}
+	makeSchema(reply.get());
+
+	auto opened = arrow::io::FileOutputStream::Open(path);
+	if (!opened.ok()) {
+		return fail(ATOM_INTERNAL_ERROR, opened.status().ToString());
+	}
+	file = *opened;
+
+	if (format == EXPORT_ARROW_IPC) {
+		arrow::ipc::IpcWriteOptions options =
+			arrow::ipc::IpcWriteOptions::Defaults();
+		options.compression = compression;
+		options.use_threads = (n_threads > 1);
+
+		auto writer = arrow::ipc::RecordBatchFileWriter::Open(
+			file.get(), schema, options);
+		if (!writer.ok()) {
+			return fail(ATOM_INTERNAL_ERROR, writer.status().ToString());
+		}
+		ipc_writer = *writer;
+	}
+#ifdef ATOM_EXPORT_PARQUET
+	else {
+		std::shared_ptr<parquet::WriterProperties> props =
+			parquet::WriterProperties::Builder().compression(compression)->build();
+		arrow::Status status = parquet::arrow::FileWriter::Open(
+			*schema, arrow::default_memory_pool(), file, props, &parquet_writer);
+		if (!status.ok()) {
+			return fail(ATOM_INTERNAL_ERROR, status.ToString());
+		}
+	}
+#endif
+
+	// Writes out the oldest batch in flight
+	auto write_oldest = [&]() -> enum atom_error_t {
+		std::shared_ptr<arrow::RecordBatch> batch = pending.front().batch.get();
+		uint64_t mismatched = *pending.front().mismatched;
+		pending.pop_front();
+
+		if (batch == NULL) {
+			return fail(ATOM_INTERNAL_ERROR, "Failed to decode batch");
+		}
+
+		// Values that didn't fit the schema are lost, so don't let them go
+		//	by quietly
+		if (mismatched > 0) {
+			char msg[128];
+			snprintf(msg, sizeof(msg),
+				"%" PRIu64 " values in batch %" PRIu64 " didn't fit the schema",
+				mismatched, stats.batches);
+			if (strict) {
+				return fail(ATOM_INTERNAL_ERROR, msg);
+			}
+			atom_logf(NULL, NULL, LOG_WARNING,
+				"Exporting %s: %s, wrote them as null", stream.c_str(), msg);
+			stats.mismatched += mismatched;
+		}
+
+		arrow::Status status;
+		if (ipc_writer != NULL) {
+			status = ipc_writer->WriteRecordBatch(*batch);
+
+			// Note the time range of the batch for the index
+			auto id_ms = std::static_pointer_cast<arrow::UInt64Array>(
+				batch->column(0));
+			char line[64];
+			snprintf(line, sizeof(line), "%" PRIu64 " %" PRIu64 " %" PRId64 "\n",
+				id_ms->Value(0),
+				id_ms->Value(batch->num_rows() - 1),
+				batch->num_rows());
+			index.push_back(line);
+		}
+#ifdef ATOM_EXPORT_PARQUET
+		else {
+			auto table = arrow::Table::FromRecordBatches({batch});
+			status = table.ok() ?
+				parquet_writer->WriteTable(**table, batch->num_rows()) :
+				table.status();
+		}
+#endif
+		if (!status.ok()) {
+			return fail(ATOM_INTERNAL_ERROR, status.ToString());
+		}
+
+		stats.entries += batch->num_rows();
+		stats.batches++;
+		return ATOM_NO_ERROR;
+	};
+
+	while ((reply != NULL) && (reply->elements > 0)) {
+
+		// Hand the batch off to be decoded
+		last_id = reply->element[reply->elements - 1]->element[0]->str;
+		Pending p;
+		p.mismatched = std::make_shared<uint64_t>(0);
+		std::shared_ptr<uint64_t> mismatched = p.mismatched;
+		p.batch = std::async(std::launch::async, [this, reply, mismatched]() {
+			return decodeBatch(reply, *mismatched);
+		});
+		pending.push_back(std::move(p));
+
+		// Keep the number of batches in memory bounded
+		if (pending.size() >= n_threads) {
+			err = write_oldest();
+			if (err != ATOM_NO_ERROR) {
+				break;
+			}
+		}
+
+		// A short batch means we're at the end of the range
+		if (reply->elements < batch_size) {
+			break;
+		}
+
+		reply = readBatch(stream, start, end, last_id);
+		if (reply == NULL) {
+			err = fail(ATOM_REDIS_ERROR, "Failed to read " + stream);
+			break;
+		}
+	}
+
+	// Write out whatever's left, waiting on the decodes either way
+	while (pending.size() > 0) {
+		if (err == ATOM_NO_ERROR) {
+			err = write_oldest();
+		} else {
+			pending.front().batch.wait();
+			pending.pop_front();
+		}
+	}
+
+	arrow::Status status;
+	if (ipc_writer != NULL) {
+		status = ipc_writer->Close();
+	}
+#ifdef ATOM_EXPORT_PARQUET
+	else {
+		status = parquet_writer->Close();
+	}
+#endif
+	if (status.ok()) {
+		status = file->Close();
+	}
+	if ((err == ATOM_NO_ERROR) && !status.ok()) {
+		err = fail(ATOM_INTERNAL_ERROR, status.ToString());
+	}
+	if ((err == ATOM_NO_ERROR) && (ipc_writer != NULL)) {
+		err = writeIndex(path, index);
+	}
+
+	return err;
+}
+
+} // namespace atom
@@ -0,0 +1,700 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_query.cc
+//
+//  @brief Queries over streams exported to Arrow IPC files
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <limits>
+#include <algorithm>
+
+#include <arrow/io/file.h>
+#include <arrow/ipc/reader.h>
+#include <arrow/util/key_value_metadata.h>
+#include <arrow/util/string_view.h>
+
+#include "stream_query.h"
+
+namespace atom {
+
+// Suffix of the export files
+#define QUERY_FILE_SUFFIX ".arrow"
+
+// An export being queried
+struct QueryFile {
+	std::string source;
+	std::shared_ptr<arrow::io::MemoryMappedFile> file;
+
+	// Columns read off of disk, in file order
+	std::vector<int> included;
+
+	// Columns returned, and the column each predicate is on, indexed into
+	//	the batches as read, i.e. into included
+	std::vector<int> output;
+	std::vector<int> predicate_columns;
+
+	// Schema of the results
+	std::shared_ptr<arrow::Schema> schema;
+};
+
+// A record batch in an export that needs to be scanned
+struct QuerySegment {
+	std::shared_ptr<QueryFile> file;
+	int batch;
+};
+
+// Everything the scans need, shared with them s.t. they can outlive the
+//	query
+struct QueryPlan {
+	std::vector<QuerySegment> segments;
+	std::vector<QueryPredicate> predicates;
+	uint64_t start_ms;
+	uint64_t end_ms;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Compares a value against a predicate's value
+//
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+static bool compare(
+	QueryOp op,
+	const T &a,
+	const T &b)
+{
+	switch (op) {
+		case QUERY_EQ:
+			return a == b;
+		case QUERY_NE:
+			return !(a == b);
+		case QUERY_LT:
+			return a < b;
+		case QUERY_LE:
+			return !(b < a);
+		case QUERY_GT:
+			return b < a;
+		case QUERY_GE:
+			return !(a < b);
+		default:
+			return false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Keeps the rows whose value in the column matches
+//
+////////////////////////////////////////////////////////////////////////////////
+template <typename ArrayType, typename T>
+static void filterRows(
+	const arrow::Array &array,
+	QueryOp op,
+	const T &value,
+	std::vector<int64_t> &rows)
+{
+	const ArrayType &typed = static_cast<const ArrayType &>(array);
+	size_t n = 0;
+
+	for (int64_t row : rows) {
+		if (!typed.IsNull(row) && compare(op, (T)typed.GetView(row), value)) {
+			rows[n++] = row;
+		}
+	}
+	rows.resize(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Keeps the rows that match a predicate. Rows with values that
+//			can't be compared against the predicate's value don't.
+//
+////////////////////////////////////////////////////////////////////////////////
+static void applyPredicate(
+	const arrow::Array &array,
+	const QueryPredicate &pred,
+	std::vector<int64_t> &rows)
+{
+	const QueryValue &v = pred.value;
+	arrow::util::string_view s(v.s);
+
+	switch (array.type_id()) {
+		case arrow::Type::INT64:
+			if (v.type == QueryValue::INT) {
+				filterRows<arrow::Int64Array>(array, pred.op, v.i, rows);
+			} else if (v.type == QueryValue::FLOAT) {
+				filterRows<arrow::Int64Array>(array, pred.op, v.d, rows);
+			} else {
+				rows.clear();
+			}
+			break;
+		case arrow::Type::UINT64:
+			if ((v.type == QueryValue::INT) && (v.i >= 0)) {
+				filterRows<arrow::UInt64Array>(
+					array, pred.op, (uint64_t)v.i, rows);
+			} else {
+				rows.clear();
+			}
+			break;
+		case arrow::Type::DOUBLE:
+			if (v.type == QueryValue::INT) {
+				filterRows<arrow::DoubleArray>(
+					array, pred.op, (double)v.i, rows);
+			} else if (v.type == QueryValue::FLOAT) {
+				filterRows<arrow::DoubleArray>(array, pred.op, v.d, rows);
+			} else {
+				rows.clear();
+			}
+			break;
+		case arrow::Type::BOOL:
+			if (v.type == QueryValue::BOOL) {
+				filterRows<arrow::BooleanArray>(array, pred.op, v.b, rows);
+			} else {
+				rows.clear();
+			}
+			break;
+		case arrow::Type::STRING:
+			if (v.type == QueryValue::STRING) {
+				filterRows<arrow::StringArray>(array, pred.op, s, rows);
+			} else {
+				rows.clear();
+			}
+			break;
+		case arrow::Type::BINARY:
+			if (v.type == QueryValue::STRING) {
+				filterRows<arrow::BinaryArray>(array, pred.op, s, rows);
+			} else {
+				rows.clear();
+			}
+			break;
+		default:
+			rows.clear();
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Copies the given rows of a column into a new one
+//
+////////////////////////////////////////////////////////////////////////////////
+template <typename ArrayType, typename BuilderType>
+static std::shared_ptr<arrow::Array> takeRows(
+	const arrow::Array &array,
+	const std::vector<int64_t> &rows)
+{
+	const ArrayType &typed = static_cast<const ArrayType &>(array);
+	BuilderType builder(array.type(), arrow::default_memory_pool());
+	std::shared_ptr<arrow::Array> out;
+
+	if (!builder.Reserve(rows.size()).ok()) {
+		return NULL;
+	}
+	for (int64_t row : rows) {
+		arrow::Status status = typed.IsNull(row) ?
+			builder.AppendNull() : builder.Append(typed.GetView(row));
+		if (!status.ok()) {
+			return NULL;
+		}
+	}
+	if (!builder.Finish(&out).ok()) {
+		return NULL;
+	}
+
+	return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Copies the given rows of a column of any of the types that the
+//			exporter writes
+//
+////////////////////////////////////////////////////////////////////////////////
+static std::shared_ptr<arrow::Array> takeColumn(
+	const arrow::Array &array,
+	const std::vector<int64_t> &rows)
+{
+	switch (array.type_id()) {
+		case arrow::Type::UINT64:
+			return takeRows<arrow::UInt64Array, arrow::UInt64Builder>(
+				array, rows);
+		case arrow::Type::INT64:
+			return takeRows<arrow::Int64Array, arrow::Int64Builder>(
+				array, rows);
+		case arrow::Type::DOUBLE:
+			return takeRows<arrow::DoubleArray, arrow::DoubleBuilder>(
+				array, rows);
+		case arrow::Type::BOOL:
+			return takeRows<arrow::BooleanArray, arrow::BooleanBuilder>(
+				array, rows);
+		case arrow::Type::STRING:
+			return takeRows<arrow::StringArray, arrow::StringBuilder>(
+				array, rows);
+		case arrow::Type::BINARY:
+			return takeRows<arrow::BinaryArray, arrow::BinaryBuilder>(
+				array, rows);
+		default:
+			return NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Scans a batch. Runs on its own thread. The batch is read with
+//			only the columns the query needs, so with the file memory
+//			mapped the rest are never paged in. The time range is found
+//			with a binary search since entries are in ID order, then the
+//			predicates are applied to whatever's left and only the rows
+//			that match are copied out.
+//
+////////////////////////////////////////////////////////////////////////////////
+static QueryScan scanSegment(
+	std::shared_ptr<const QueryPlan> plan,
+	size_t index)
+{
+	const QuerySegment &segment = plan->segments[index];
+	const QueryFile &qf = *segment.file;
+	QueryScan scan;
+
+	scan.rows_scanned = 0;
+
+	// The reader keeps state, so each scan gets its own on the shared map
+	arrow::ipc::IpcReadOptions options = arrow::ipc::IpcReadOptions::Defaults();
+	options.included_fields = qf.included;
+	options.use_threads = false;
+
+	auto reader = arrow::ipc::RecordBatchFileReader::Open(
+		qf.file.get(), options);
+	if (!reader.ok()) {
+		scan.error = reader.status().ToString();
+		return scan;
+	}
+	auto read = (*reader)->ReadRecordBatch(segment.batch);
+	if (!read.ok()) {
+		scan.error = read.status().ToString();
+		return scan;
+	}
+	std::shared_ptr<arrow::RecordBatch> batch = *read;
+	scan.rows_scanned = batch->num_rows();
+
+	// id_ms is always the first column read
+	auto id_ms = std::static_pointer_cast<arrow::UInt64Array>(batch->column(0));
+	const uint64_t *ms = id_ms->raw_values();
+	int64_t first = std::lower_bound(
+		ms, ms + batch->num_rows(), plan->start_ms) - ms;
+	int64_t last = std::upper_bound(
+		ms + first, ms + batch->num_rows(), plan->end_ms) - ms;
+
+	std::vector<int64_t> rows;
+	rows.reserve(last - first);
+	for (int64_t row = first; row < last; ++row) {
+		rows.push_back(row);
+	}
+
+	for (size_t i = 0; (i < plan->predicates.size()) && (rows.size() > 0); ++i) {
+		applyPredicate(
+			*batch->column(qf.predicate_columns[i]),
+			plan->predicates[i],
+			rows);
+	}
+
+	// Contiguous matches, the whole batch included, are just a slice
+	std::vector<std::shared_ptr<arrow::Array>> columns;
+	bool contiguous = (rows.size() > 0) &&
+		((rows.back() - rows.front() + 1) == (int64_t)rows.size());
+
+	for (int column : qf.output) {
+		if (contiguous) {
+			columns.push_back(batch->column(column)->Slice(
+				rows.front(), rows.size()));
+		} else {
+			std::shared_ptr<arrow::Array> taken = takeColumn(
+				*batch->column(column), rows);
+			if (taken == NULL) {
+				scan.error = "Failed to copy column " +
+					batch->schema()->field(column)->name();
+				return scan;
+			}
+			columns.push_back(taken);
+		}
+	}
+
+	scan.batch = arrow::RecordBatch::Make(qf.schema, rows.size(), columns);
+	return scan;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the time index for an export. Returns false if it's
+//			missing or doesn't match the file, in which case nothing can be
+//			skipped on time.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool readIndex(
+	const std::string &path,
+	int n_batches,
+	std::vector<std::pair<uint64_t, uint64_t>> &ranges)
+{
+	std::string index_path = path + EXPORT_INDEX_SUFFIX;
+	uint64_t first;
+	uint64_t last;
+	int64_t n_rows;
+
+	FILE *f = fopen(index_path.c_str(), "r");
+	if (f == NULL) {
+		return false;
+	}
+
+	ranges.clear();
+	while (fscanf(f, "%" SCNu64 " %" SCNu64 " %" SCNd64,
+		&first, &last, &n_rows) == 3)
+	{
+		ranges.push_back(std::make_pair(first, last));
+	}
+	fclose(f);
+
+	return ranges.size() == (size_t)n_batches;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+QueryCursor::QueryCursor() : n_threads(1), next_batch(0)
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the next batch of matches. Keeps up to n_threads scans
+//			going and hands back their results in order, skipping the
+//			batches with nothing in them.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool QueryCursor::next(
+	std::shared_ptr<arrow::RecordBatch> &batch)
+{
+	while (true) {
+
+		// Top up the scans in flight
+		while ((plan != NULL) && (next_batch < plan->segments.size()) &&
+			(pending.size() < n_threads))
+		{
+			pending.push_back(std::async(
+				std::launch::async, scanSegment, plan, next_batch));
+			next_batch++;
+		}
+
+		if (pending.size() == 0) {
+			return false;
+		}
+
+		QueryScan scan = pending.front().get();
+		pending.pop_front();
+		stats.rows_scanned += scan.rows_scanned;
+
+		if (scan.batch == NULL) {
+			error = scan.error;
+
+			// Don't start anything else
+			next_batch = plan->segments.size();
+			pending.clear();
+			return false;
+		}
+
+		if (scan.batch->num_rows() > 0) {
+			stats.rows_matched += scan.batch->num_rows();
+			batch = scan.batch;
+			return true;
+		}
+	}
+}
+
+const StreamQueryStats &QueryCursor::getStats() const
+{
+	return stats;
+}
+
+const std::string &QueryCursor::getError() const
+{
+	return error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamQuery::StreamQuery(
+	const std::string &d,
+	size_t n) : dir(d), n_threads((n > 0) ? n : 1), start_ms(0),
+	end_ms(std::numeric_limits<uint64_t>::max())
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Builders for the query
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamQuery &StreamQuery::stream(
+	const std::string &element,
+	const std::string &stream)
+{
+	sources.push_back(element + "." + stream);
+	return *this;
+}
+
+StreamQuery &StreamQuery::between(
+	uint64_t start,
+	uint64_t end)
+{
+	start_ms = start;
+	end_ms = end;
+	return *this;
+}
+
+StreamQuery &StreamQuery::select(
+	const std::vector<std::string> &k)
+{
+	keys = k;
+	return *this;
+}
+
+StreamQuery &StreamQuery::where(
+	const std::string &key,
+	QueryOp op,
+	const QueryValue &value)
+{
+	predicates.push_back({key, op, value});
+	return *this;
+}
+
+const std::string &StreamQuery::getError() const
+{
+	return error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Notes an error and returns it
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamQuery::fail(
+	enum atom_error_t err,
+	const std::string &msg)
+{
+	error = msg;
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds an export to the plan. The file is memory mapped and its
+//			footer read to get the schema and number of batches. Exports
+//			without a key that a predicate is on can't match anything and
+//			batches outside of the time range can't either, so neither
+//			are scanned.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamQuery::planFile(
+	const std::string &source,
+	QueryPlan &plan,
+	StreamQueryStats &stats)
+{
+	std::string path = dir + "/" + source + QUERY_FILE_SUFFIX;
+	std::shared_ptr<QueryFile> qf = std::make_shared<QueryFile>();
+
+	qf->source = source;
+
+	auto mapped = arrow::io::MemoryMappedFile::Open(
+		path, arrow::io::FileMode::READ);
+	if (!mapped.ok()) {
+		return fail(ATOM_INTERNAL_ERROR, mapped.status().ToString());
+	}
+	qf->file = *mapped;
+
+	auto reader = arrow::ipc::RecordBatchFileReader::Open(qf->file.get());
+	if (!reader.ok()) {
+		return fail(ATOM_INTERNAL_ERROR, reader.status().ToString());
+	}
+	std::shared_ptr<arrow::Schema> schema = (*reader)->schema();
+	int n_batches = (*reader)->num_record_batches();
+
+	stats.files++;
+	stats.batches += n_batches;
+
+	if ((schema->num_fields() < EXPORT_N_ID_COLUMNS) ||
+		(schema->field(0)->name() != EXPORT_ID_MS_COLUMN) ||
+		(schema->field(0)->type()->id() != arrow::Type::UINT64))
+	{
+		return fail(ATOM_INTERNAL_ERROR, path + " isn't an export");
+	}
+
+	// Figure out the columns to read in file order
+	std::vector<int> wanted;
+	std::vector<int> predicate_fields;
+	for (int i = 0; i < EXPORT_N_ID_COLUMNS; ++i) {
+		wanted.push_back(i);
+	}
+	if (keys.size() > 0) {
+		for (const std::string &key : keys) {
+			int field = schema->GetFieldIndex(key);
+			if (field >= EXPORT_N_ID_COLUMNS) {
+				wanted.push_back(field);
+			}
+		}
+	} else {
+		for (int i = EXPORT_N_ID_COLUMNS; i < schema->num_fields(); ++i) {
+			wanted.push_back(i);
+		}
+	}
+	for (const QueryPredicate &pred : predicates) {
+		int field = schema->GetFieldIndex(pred.key);
+		if (field < 0) {
+			stats.pruned += n_batches;
+			return ATOM_NO_ERROR;
+		}
+		predicate_fields.push_back(field);
+	}
+
+	qf->included = wanted;
+	qf->included.insert(qf->included.end(),
+		predicate_fields.begin(), predicate_fields.end());
+	std::sort(qf->included.begin(), qf->included.end());
+	qf->included.erase(std::unique(qf->included.begin(), qf->included.end()),
+		qf->included.end());
+
+	// Batches come back with just the included columns
+	auto read_index = [&qf](int field) -> int {
+		return std::lower_bound(qf->included.begin(), qf->included.end(),
+			field) - qf->included.begin();
+	};
+
+	std::vector<std::shared_ptr<arrow::Field>> fields;
+	for (int field : wanted) {
+		qf->output.push_back(read_index(field));
+		fields.push_back(schema->field(field));
+	}
+	for (int field : predicate_fields) {
+		qf->predicate_columns.push_back(read_index(field));
+	}
+	qf->schema = arrow::schema(fields, arrow::key_value_metadata(
+		{STREAM_QUERY_SOURCE_METADATA}, {source}));
+
+	std::vector<std::pair<uint64_t, uint64_t>> ranges;
+	bool indexed = readIndex(path, n_batches, ranges);
+
+	for (int i = 0; i < n_batches; ++i) {
+		if (indexed &&
+			((ranges[i].second < start_ms) || (ranges[i].first > end_ms)))
+		{
+			stats.pruned++;
+			continue;
+		}
+		plan.segments.push_back({qf, i});
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Plans the query and starts it
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamQuery::open(
+	QueryCursor &cursor)
+{
+	std::shared_ptr<QueryPlan> plan = std::make_shared<QueryPlan>();
+	std::vector<std::string> to_query = sources;
+	StreamQueryStats stats;
+	enum atom_error_t err;
+
+	error.clear();
+
+	// With no streams added query everything in the directory
+	if (to_query.size() == 0) {
+		DIR *d = opendir(dir.c_str());
+		if (d == NULL) {
+			return fail(ATOM_INTERNAL_ERROR, "Failed to open " + dir);
+		}
+
+		size_t suffix_len = strlen(QUERY_FILE_SUFFIX);
+		struct dirent *ent;
+		while ((ent = readdir(d)) != NULL) {
+			std::string name = ent->d_name;
+			if ((name.size() > suffix_len) &&
+				(name.compare(name.size() - suffix_len, suffix_len,
+					QUERY_FILE_SUFFIX) == 0))
+			{
+				to_query.push_back(name.substr(0, name.size() - suffix_len));
+			}
+		}
+		closedir(d);
+		std::sort(to_query.begin(), to_query.end());
+	}
+
+	plan->predicates = predicates;
+	plan->start_ms = start_ms;
+	plan->end_ms = end_ms;
+
+	for (const std::string &source : to_query) {
+		err = planFile(source, *plan, stats);
+		if (err != ATOM_NO_ERROR) {
+			return err;
+		}
+	}
+
+	cursor.pending.clear();
+	cursor.plan = plan;
+	cursor.n_threads = n_threads;
+	cursor.next_batch = 0;
+	cursor.stats = stats;
+	cursor.error.clear();
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs the query and collects all of the results
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamQuery::run(
+	std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+	StreamQueryStats *stats)
+{
+	QueryCursor cursor;
+	std::shared_ptr<arrow::RecordBatch> batch;
+
+	enum atom_error_t err = open(cursor);
+	if (err != ATOM_NO_ERROR) {
+		return err;
+	}
+
+	while (cursor.next(batch)) {
+		batches.push_back(batch);
+	}
+
+	if (stats != NULL) {
+		*stats = cursor.getStats();
+	}
+	if (cursor.getError().size() > 0) {
+		return fail(ATOM_INTERNAL_ERROR, cursor.getError());
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+} // namespace atom
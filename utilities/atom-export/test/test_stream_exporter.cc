@@ -0,0 +1,290 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file test_stream_exporter.cc
+//
+//  @brief Round trip tests for the stream exporter
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <utility>
+#include <hiredis/hiredis.h>
+#include <msgpack.hpp>
+#include <arrow/io/file.h>
+#include <arrow/ipc/reader.h>
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "stream_exporter.h"
+
+// Need to use the atom namespace
+using namespace atom;
+
+#define TEST_EXPORT_STREAM "stream:test_export:data"
+#define TEST_EXPORT_N_ENTRIES 10
+#define TEST_EXPORT_BATCH_SIZE 4
+
+// Packs a value with msgpack
+template <typename T>
+static std::string pack(
+	const T &value)
+{
+	msgpack::sbuffer buffer;
+	msgpack::pack(buffer, value);
+	return std::string(buffer.data(), buffer.size());
+}
+
+//
+// Tests for exporting a stream and reading it back
+//
+class StreamExporterTest : public testing::Test
+{
+
+protected:
+	redisContext *ctx;
+	char dir[32];
+	std::string path;
+	std::vector<std::string> ids;
+
+	virtual void SetUp() {
+		// Get a context and send a flushAll to remove all existing keys
+		ctx = redis_context_init();
+		ASSERT_NE(ctx, (redisContext*)NULL);
+		redisReply *reply = (redisReply *)redisCommand(ctx, "FLUSHALL");
+		ASSERT_NE(reply, (redisReply*)NULL);
+		freeReplyObject(reply);
+
+		snprintf(dir, sizeof(dir), "/tmp/atom_export_XXXXXX");
+		ASSERT_NE(mkdtemp(dir), (char*)NULL);
+		path = std::string(dir) + "/test_export.data.arrow";
+	};
+
+	virtual void TearDown() {
+		unlink(path.c_str());
+		unlink((path + EXPORT_INDEX_SUFFIX).c_str());
+		rmdir(dir);
+		redis_context_cleanup(ctx);
+	};
+
+	// Adds an entry to the stream and notes its ID
+	void addEntry(
+		const std::vector<std::pair<std::string, std::string>> &kvs)
+	{
+		std::vector<const char *> argv = {"XADD", TEST_EXPORT_STREAM, "*"};
+		std::vector<size_t> argvlen = {4, strlen(TEST_EXPORT_STREAM), 1};
+		for (auto const &kv : kvs) {
+			argv.push_back(kv.first.data());
+			argvlen.push_back(kv.first.size());
+			argv.push_back(kv.second.data());
+			argvlen.push_back(kv.second.size());
+		}
+
+		redisReply *reply = (redisReply *)redisCommandArgv(
+			ctx, argv.size(), argv.data(), argvlen.data());
+		ASSERT_NE(reply, (redisReply*)NULL);
+		ASSERT_EQ(reply->type, REDIS_REPLY_STRING);
+		ids.push_back(std::string(reply->str, reply->len));
+		freeReplyObject(reply);
+	}
+
+	// Adds the test entries. Each entry n has
+	//	i: n, except for a string at 6 which won't fit the int column
+	//	f: an int at 0 and 5, n + 0.5 otherwise, s.t. the column is double
+	//	b: only on even entries
+	//	s: "s<n>"
+	//	m: an int at 0 and a string at 1, s.t. the column is binary
+	//	late: only at 9, after the schema is set
+	void addEntries() {
+		for (int n = 0; n < TEST_EXPORT_N_ENTRIES; ++n) {
+			std::vector<std::pair<std::string, std::string>> kvs;
+
+			kvs.push_back({"i", (n == 6) ? pack("six") : pack(n)});
+			kvs.push_back({"f", ((n == 0) || (n == 5)) ?
+				pack(n) : pack(n + 0.5)});
+			if ((n % 2) == 0) {
+				kvs.push_back({"b", pack((n % 4) == 0)});
+			}
+			kvs.push_back({"s", pack("s" + std::to_string(n))});
+			if (n == 0) {
+				kvs.push_back({"m", pack(7)});
+			} else if (n == 1) {
+				kvs.push_back({"m", pack("seven")});
+			}
+			if (n == 9) {
+				kvs.push_back({"late", pack(n)});
+			}
+
+			addEntry(kvs);
+		}
+	}
+
+	// Reads back all of the record batches in the export
+	void readExport(
+		std::shared_ptr<arrow::Schema> &schema,
+		std::vector<std::shared_ptr<arrow::RecordBatch>> &batches)
+	{
+		auto file = arrow::io::ReadableFile::Open(path);
+		ASSERT_TRUE(file.ok()) << file.status().ToString();
+		auto reader = arrow::ipc::RecordBatchFileReader::Open(file->get());
+		ASSERT_TRUE(reader.ok()) << reader.status().ToString();
+
+		schema = (*reader)->schema();
+		for (int i = 0; i < (*reader)->num_record_batches(); ++i) {
+			auto batch = (*reader)->ReadRecordBatch(i);
+			ASSERT_TRUE(batch.ok()) << batch.status().ToString();
+			batches.push_back(*batch);
+		}
+	}
+};
+
+// Exports the entries and checks that the IDs, types, values and nulls all
+//	come back out, along with the index
+TEST_F(StreamExporterTest, round_trip) {
+	addEntries();
+
+	StreamExporter exporter(
+		ctx, EXPORT_ARROW_IPC, EXPORT_DECODE_MSGPACK, TEST_EXPORT_BATCH_SIZE, 2);
+	ASSERT_EQ(exporter.exportStream(TEST_EXPORT_STREAM, path), ATOM_NO_ERROR)
+		<< exporter.getError();
+
+	const StreamExportStats &stats = exporter.getStats();
+	ASSERT_EQ(stats.entries, (uint64_t)TEST_EXPORT_N_ENTRIES);
+	ASSERT_EQ(stats.batches, (uint64_t)3);
+	ASSERT_EQ(stats.mismatched, (uint64_t)2);
+
+	std::shared_ptr<arrow::Schema> schema;
+	std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+	readExport(schema, batches);
+	ASSERT_EQ(batches.size(), (size_t)3);
+
+	// Columns come in the order the keys were first seen, and late didn't
+	//	make it into the schema
+	std::vector<std::pair<std::string, arrow::Type::type>> fields = {
+		{EXPORT_ID_MS_COLUMN, arrow::Type::UINT64},
+		{EXPORT_ID_SEQ_COLUMN, arrow::Type::UINT64},
+		{"i", arrow::Type::INT64},
+		{"f", arrow::Type::DOUBLE},
+		{"b", arrow::Type::BOOL},
+		{"s", arrow::Type::STRING},
+		{"m", arrow::Type::BINARY},
+	};
+	ASSERT_EQ(schema->num_fields(), (int)fields.size());
+	for (size_t c = 0; c < fields.size(); ++c) {
+		EXPECT_EQ(schema->field(c)->name(), fields[c].first);
+		EXPECT_EQ(schema->field(c)->type()->id(), fields[c].second)
+			<< fields[c].first;
+	}
+
+	int n = 0;
+	for (auto const &batch : batches) {
+		ASSERT_TRUE(batch->schema()->Equals(*schema));
+		auto id_ms = std::static_pointer_cast<arrow::UInt64Array>(
+			batch->column(0));
+		auto id_seq = std::static_pointer_cast<arrow::UInt64Array>(
+			batch->column(1));
+		auto i = std::static_pointer_cast<arrow::Int64Array>(batch->column(2));
+		auto f = std::static_pointer_cast<arrow::DoubleArray>(batch->column(3));
+		auto b = std::static_pointer_cast<arrow::BooleanArray>(
+			batch->column(4));
+		auto s = std::static_pointer_cast<arrow::StringArray>(batch->column(5));
+		auto m = std::static_pointer_cast<arrow::BinaryArray>(batch->column(6));
+
+		for (int64_t row = 0; row < batch->num_rows(); ++row, ++n) {
+			ASSERT_LT(n, TEST_EXPORT_N_ENTRIES);
+
+			char id[STREAM_ID_BUFFLEN];
+			snprintf(id, sizeof(id), "%llu-%llu",
+				(unsigned long long)id_ms->Value(row),
+				(unsigned long long)id_seq->Value(row));
+			EXPECT_EQ(std::string(id), ids[n]);
+
+			if (n == 6) {
+				EXPECT_TRUE(i->IsNull(row));
+			} else {
+				ASSERT_FALSE(i->IsNull(row));
+				EXPECT_EQ(i->Value(row), n);
+			}
+
+			ASSERT_FALSE(f->IsNull(row));
+			EXPECT_EQ(f->Value(row), ((n == 0) || (n == 5)) ? n : n + 0.5);
+
+			if ((n % 2) == 0) {
+				ASSERT_FALSE(b->IsNull(row));
+				EXPECT_EQ(b->Value(row), (n % 4) == 0);
+			} else {
+				EXPECT_TRUE(b->IsNull(row));
+			}
+
+			ASSERT_FALSE(s->IsNull(row));
+			EXPECT_EQ(s->GetString(row), "s" + std::to_string(n));
+
+			if (n == 0) {
+				EXPECT_EQ(m->GetString(row), pack(7));
+			} else if (n == 1) {
+				EXPECT_EQ(m->GetString(row), pack("seven"));
+			} else {
+				EXPECT_TRUE(m->IsNull(row));
+			}
+		}
+	}
+	ASSERT_EQ(n, TEST_EXPORT_N_ENTRIES);
+
+	// The index has the time range and size of each batch
+	std::ifstream index(path + EXPORT_INDEX_SUFFIX);
+	ASSERT_TRUE(index.is_open());
+	for (auto const &batch : batches) {
+		auto id_ms = std::static_pointer_cast<arrow::UInt64Array>(
+			batch->column(0));
+		uint64_t first, last;
+		int64_t n_rows;
+		ASSERT_TRUE((bool)(index >> first >> last >> n_rows));
+		EXPECT_EQ(first, id_ms->Value(0));
+		EXPECT_EQ(last, id_ms->Value(batch->num_rows() - 1));
+		EXPECT_EQ(n_rows, batch->num_rows());
+	}
+}
+
+// Checks that a value that doesn't fit the schema fails a strict export
+TEST_F(StreamExporterTest, strict) {
+	addEntries();
+
+	StreamExporter exporter(
+		ctx, EXPORT_ARROW_IPC, EXPORT_DECODE_MSGPACK, TEST_EXPORT_BATCH_SIZE, 2);
+	exporter.setStrict(true);
+	ASSERT_EQ(exporter.exportStream(TEST_EXPORT_STREAM, path),
+		ATOM_INTERNAL_ERROR);
+	EXPECT_NE(exporter.getError().find("didn't fit the schema"),
+		std::string::npos);
+}
+
+// Checks that raw exports keep every value as is in binary columns
+TEST_F(StreamExporterTest, raw) {
+	addEntries();
+
+	StreamExporter exporter(
+		ctx, EXPORT_ARROW_IPC, EXPORT_DECODE_RAW, TEST_EXPORT_BATCH_SIZE, 2);
+	ASSERT_EQ(exporter.exportStream(TEST_EXPORT_STREAM, path), ATOM_NO_ERROR)
+		<< exporter.getError();
+	ASSERT_EQ(exporter.getStats().mismatched, (uint64_t)1);
+
+	std::shared_ptr<arrow::Schema> schema;
+	std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+	readExport(schema, batches);
+	ASSERT_EQ(batches.size(), (size_t)3);
+
+	for (int c = EXPORT_N_ID_COLUMNS; c < schema->num_fields(); ++c) {
+		EXPECT_EQ(schema->field(c)->type()->id(), arrow::Type::BINARY);
+	}
+
+	auto i = std::static_pointer_cast<arrow::BinaryArray>(
+		batches[1]->GetColumnByName("i"));
+	ASSERT_TRUE(i != NULL);
+	EXPECT_EQ(i->GetString(2), pack("six"));
+}
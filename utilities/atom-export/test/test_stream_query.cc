@@ -0,0 +1,471 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file test_stream_query.cc
+//
+//  @brief Tests for queries over stream exports
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/util/key_value_metadata.h>
+#include "atom/atom.h"
+#include "stream_exporter.h"
+#include "stream_query.h"
+
+// Need to use the atom namespace
+using namespace atom;
+
+// The test export has TEST_QUERY_N_BATCHES batches of TEST_QUERY_BATCH_SIZE
+//	entries. Entry n is row n % TEST_QUERY_BATCH_SIZE of batch
+//	n / TEST_QUERY_BATCH_SIZE and has
+//	id_ms: 100 * (batch + 1) + row
+//	label: "person" for every third entry, "car" otherwise
+//	score: n * 0.5, null at 4
+//	count: n, null at 7
+//	ok: whether n is even
+//	blob: "b<n>"
+#define TEST_QUERY_ELEMENT "camera"
+#define TEST_QUERY_STREAM "detections"
+#define TEST_QUERY_SOURCE TEST_QUERY_ELEMENT "." TEST_QUERY_STREAM
+#define TEST_QUERY_N_BATCHES 3
+#define TEST_QUERY_BATCH_SIZE 4
+#define TEST_QUERY_N_ENTRIES (TEST_QUERY_N_BATCHES * TEST_QUERY_BATCH_SIZE)
+
+// Returns the id_ms of entry n
+static uint64_t entryMs(
+	int n)
+{
+	return 100 * (n / TEST_QUERY_BATCH_SIZE + 1) + n % TEST_QUERY_BATCH_SIZE;
+}
+
+//
+// Tests for querying exports
+//
+class StreamQueryTest : public testing::Test
+{
+
+protected:
+	char dir[32];
+	std::vector<std::string> files;
+
+	virtual void SetUp() {
+		snprintf(dir, sizeof(dir), "/tmp/atom_query_XXXXXX");
+		ASSERT_NE(mkdtemp(dir), (char*)NULL);
+		writeExport(TEST_QUERY_SOURCE);
+		writeIndex(TEST_QUERY_SOURCE, TEST_QUERY_N_BATCHES);
+	};
+
+	virtual void TearDown() {
+		for (const std::string &file : files) {
+			unlink(file.c_str());
+		}
+		rmdir(dir);
+	};
+
+	std::string exportPath(
+		const std::string &source)
+	{
+		return std::string(dir) + "/" + source + ".arrow";
+	}
+
+	// Makes a batch of the test export
+	std::shared_ptr<arrow::RecordBatch> makeBatch(
+		const std::shared_ptr<arrow::Schema> &schema,
+		int b)
+	{
+		arrow::UInt64Builder id_ms;
+		arrow::UInt64Builder id_seq;
+		arrow::StringBuilder label;
+		arrow::DoubleBuilder score;
+		arrow::Int64Builder count;
+		arrow::BooleanBuilder ok;
+		arrow::BinaryBuilder blob;
+
+		for (int row = 0; row < TEST_QUERY_BATCH_SIZE; ++row) {
+			int n = b * TEST_QUERY_BATCH_SIZE + row;
+			std::string b_n = "b" + std::to_string(n);
+
+			EXPECT_TRUE(id_ms.Append(entryMs(n)).ok());
+			EXPECT_TRUE(id_seq.Append(0).ok());
+			EXPECT_TRUE(label.Append(
+				std::string(((n % 3) == 0) ? "person" : "car")).ok());
+			EXPECT_TRUE(((n == 4) ?
+				score.AppendNull() : score.Append(n * 0.5)).ok());
+			EXPECT_TRUE(((n == 7) ? count.AppendNull() : count.Append(n)).ok());
+			EXPECT_TRUE(ok.Append((n % 2) == 0).ok());
+			EXPECT_TRUE(blob.Append(b_n).ok());
+		}
+
+		std::vector<std::shared_ptr<arrow::Array>> arrays(7);
+		EXPECT_TRUE(id_ms.Finish(&arrays[0]).ok());
+		EXPECT_TRUE(id_seq.Finish(&arrays[1]).ok());
+		EXPECT_TRUE(label.Finish(&arrays[2]).ok());
+		EXPECT_TRUE(score.Finish(&arrays[3]).ok());
+		EXPECT_TRUE(count.Finish(&arrays[4]).ok());
+		EXPECT_TRUE(ok.Finish(&arrays[5]).ok());
+		EXPECT_TRUE(blob.Finish(&arrays[6]).ok());
+
+		return arrow::RecordBatch::Make(
+			schema, TEST_QUERY_BATCH_SIZE, arrays);
+	}
+
+	// Writes the test export, laid out the same as the exporter would
+	void writeExport(
+		const std::string &source)
+	{
+		std::shared_ptr<arrow::Schema> schema = arrow::schema({
+			arrow::field(EXPORT_ID_MS_COLUMN, arrow::uint64(), false),
+			arrow::field(EXPORT_ID_SEQ_COLUMN, arrow::uint64(), false),
+			arrow::field("label", arrow::utf8()),
+			arrow::field("score", arrow::float64()),
+			arrow::field("count", arrow::int64()),
+			arrow::field("ok", arrow::boolean()),
+			arrow::field("blob", arrow::binary()),
+		});
+		std::string path = exportPath(source);
+		files.push_back(path);
+
+		auto file = arrow::io::FileOutputStream::Open(path);
+		ASSERT_TRUE(file.ok()) << file.status().ToString();
+		auto writer = arrow::ipc::RecordBatchFileWriter::Open(
+			file->get(), schema);
+		ASSERT_TRUE(writer.ok()) << writer.status().ToString();
+
+		for (int b = 0; b < TEST_QUERY_N_BATCHES; ++b) {
+			ASSERT_TRUE((*writer)->WriteRecordBatch(
+				*makeBatch(schema, b)).ok());
+		}
+		ASSERT_TRUE((*writer)->Close().ok());
+		ASSERT_TRUE((*file)->Close().ok());
+	}
+
+	// Writes the index for the first n_batches batches of the export
+	void writeIndex(
+		const std::string &source,
+		int n_batches)
+	{
+		std::string path = exportPath(source) + EXPORT_INDEX_SUFFIX;
+		files.push_back(path);
+
+		FILE *f = fopen(path.c_str(), "w");
+		ASSERT_NE(f, (FILE*)NULL);
+		for (int b = 0; b < n_batches; ++b) {
+			fprintf(f, "%llu %llu %d\n",
+				(unsigned long long)entryMs(b * TEST_QUERY_BATCH_SIZE),
+				(unsigned long long)entryMs(
+					(b + 1) * TEST_QUERY_BATCH_SIZE - 1),
+				TEST_QUERY_BATCH_SIZE);
+		}
+		fclose(f);
+	}
+
+	// Runs a query and returns the id_ms of each match
+	std::vector<uint64_t> matches(
+		StreamQuery &query,
+		StreamQueryStats *stats = NULL,
+		std::vector<std::shared_ptr<arrow::RecordBatch>> *results = NULL)
+	{
+		std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+		std::vector<uint64_t> ms;
+
+		EXPECT_EQ(query.run(batches, stats), ATOM_NO_ERROR)
+			<< query.getError();
+		for (auto const &batch : batches) {
+			auto id_ms = std::static_pointer_cast<arrow::UInt64Array>(
+				batch->column(0));
+			for (int64_t row = 0; row < batch->num_rows(); ++row) {
+				ms.push_back(id_ms->Value(row));
+			}
+		}
+		if (results != NULL) {
+			*results = batches;
+		}
+		return ms;
+	}
+
+	// Returns the id_ms of the entries that pass a test
+	template <typename F>
+	std::vector<uint64_t> expected(
+		F pass)
+	{
+		std::vector<uint64_t> ms;
+		for (int n = 0; n < TEST_QUERY_N_ENTRIES; ++n) {
+			if (pass(n)) {
+				ms.push_back(entryMs(n));
+			}
+		}
+		return ms;
+	}
+};
+
+// Checks that a query with nothing set returns all of the export
+TEST_F(StreamQueryTest, everything) {
+	StreamQuery query(dir, 2);
+	StreamQueryStats stats;
+	std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+
+	std::vector<uint64_t> ms = matches(query, &stats, &batches);
+	EXPECT_EQ(ms, expected([](int n) { return true; }));
+
+	EXPECT_EQ(stats.files, (uint64_t)1);
+	EXPECT_EQ(stats.batches, (uint64_t)TEST_QUERY_N_BATCHES);
+	EXPECT_EQ(stats.pruned, (uint64_t)0);
+	EXPECT_EQ(stats.rows_scanned, (uint64_t)TEST_QUERY_N_ENTRIES);
+	EXPECT_EQ(stats.rows_matched, (uint64_t)TEST_QUERY_N_ENTRIES);
+
+	ASSERT_EQ(batches.size(), (size_t)TEST_QUERY_N_BATCHES);
+	ASSERT_EQ(batches[0]->num_columns(), 7);
+	auto metadata = batches[0]->schema()->metadata();
+	ASSERT_TRUE(metadata != NULL);
+	EXPECT_EQ(metadata->value(metadata->FindKey(STREAM_QUERY_SOURCE_METADATA)),
+		TEST_QUERY_SOURCE);
+}
+
+// Checks that batches outside of the time range are skipped using the
+//	index and that the range is exact within the batches that are scanned
+TEST_F(StreamQueryTest, time_pruning) {
+	StreamQuery query(dir);
+	StreamQueryStats stats;
+
+	query.stream(TEST_QUERY_ELEMENT, TEST_QUERY_STREAM).between(200, 202);
+	EXPECT_EQ(matches(query, &stats), std::vector<uint64_t>({200, 201, 202}));
+	EXPECT_EQ(stats.batches, (uint64_t)TEST_QUERY_N_BATCHES);
+	EXPECT_EQ(stats.pruned, (uint64_t)2);
+	EXPECT_EQ(stats.rows_scanned, (uint64_t)TEST_QUERY_BATCH_SIZE);
+	EXPECT_EQ(stats.rows_matched, (uint64_t)3);
+
+	// Spanning the end of one batch and the start of the next
+	query.between(103, 200);
+	EXPECT_EQ(matches(query, &stats), std::vector<uint64_t>({103, 200}));
+	EXPECT_EQ(stats.pruned, (uint64_t)1);
+	EXPECT_EQ(stats.rows_scanned, (uint64_t)(2 * TEST_QUERY_BATCH_SIZE));
+
+	// Between batches
+	query.between(150, 160);
+	EXPECT_EQ(matches(query, &stats), std::vector<uint64_t>());
+	EXPECT_EQ(stats.pruned, (uint64_t)TEST_QUERY_N_BATCHES);
+	EXPECT_EQ(stats.rows_scanned, (uint64_t)0);
+}
+
+// Checks that the index is ignored when it doesn't match the file, in
+//	which case nothing is pruned on time but the results are the same
+TEST_F(StreamQueryTest, index_fallback) {
+	StreamQuery query(dir);
+	StreamQueryStats stats;
+
+	query.between(200, 202);
+
+	// An index with a batch missing
+	writeIndex(TEST_QUERY_SOURCE, TEST_QUERY_N_BATCHES - 1);
+	EXPECT_EQ(matches(query, &stats), std::vector<uint64_t>({200, 201, 202}));
+	EXPECT_EQ(stats.pruned, (uint64_t)0);
+	EXPECT_EQ(stats.rows_scanned, (uint64_t)TEST_QUERY_N_ENTRIES);
+
+	// And no index at all
+	unlink((exportPath(TEST_QUERY_SOURCE) + EXPORT_INDEX_SUFFIX).c_str());
+	EXPECT_EQ(matches(query, &stats), std::vector<uint64_t>({200, 201, 202}));
+	EXPECT_EQ(stats.pruned, (uint64_t)0);
+	EXPECT_EQ(stats.rows_scanned, (uint64_t)TEST_QUERY_N_ENTRIES);
+}
+
+// Checks that only the ID columns and the selected keys come back, in the
+//	order selected, and that predicate columns aren't returned unless
+//	they're selected
+TEST_F(StreamQueryTest, select) {
+	StreamQuery query(dir);
+	std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+
+	query.select({"score", "label", "missing"})
+		.where("count", QUERY_LT, 2);
+	EXPECT_EQ(matches(query, NULL, &batches), expected([](int n) {
+		return n < 2;
+	}));
+
+	ASSERT_EQ(batches.size(), (size_t)1);
+	std::shared_ptr<arrow::Schema> schema = batches[0]->schema();
+	ASSERT_EQ(schema->num_fields(), 4);
+	EXPECT_EQ(schema->field(0)->name(), EXPORT_ID_MS_COLUMN);
+	EXPECT_EQ(schema->field(1)->name(), EXPORT_ID_SEQ_COLUMN);
+	EXPECT_EQ(schema->field(2)->name(), "score");
+	EXPECT_EQ(schema->field(3)->name(), "label");
+
+	auto score = std::static_pointer_cast<arrow::DoubleArray>(
+		batches[0]->column(2));
+	auto label = std::static_pointer_cast<arrow::StringArray>(
+		batches[0]->column(3));
+	EXPECT_EQ(score->Value(1), 0.5);
+	EXPECT_EQ(label->GetString(0), "person");
+	EXPECT_EQ(label->GetString(1), "car");
+}
+
+// Checks each of the ops against an int column with a null in it. The
+//	null never matches, not even QUERY_NE.
+TEST_F(StreamQueryTest, ops) {
+	struct {
+		QueryOp op;
+		bool (*pass)(int n);
+	} cases[] = {
+		{QUERY_EQ, [](int n) { return n == 5; }},
+		{QUERY_NE, [](int n) { return (n != 5) && (n != 7); }},
+		{QUERY_LT, [](int n) { return n < 5; }},
+		{QUERY_LE, [](int n) { return n <= 5; }},
+		{QUERY_GT, [](int n) { return (n > 5) && (n != 7); }},
+		{QUERY_GE, [](int n) { return (n >= 5) && (n != 7); }},
+	};
+
+	for (auto const &c : cases) {
+		StreamQuery query(dir);
+		query.where("count", c.op, 5);
+		EXPECT_EQ(matches(query), expected(c.pass)) << "op " << c.op;
+	}
+}
+
+// Checks predicates on each of the column types
+TEST_F(StreamQueryTest, types) {
+	struct {
+		std::string key;
+		QueryOp op;
+		QueryValue value;
+		bool (*pass)(int n);
+	} cases[] = {
+		// Floats against an int column and ints against a float column
+		{"count", QUERY_GT, 9.5, [](int n) { return n > 9; }},
+		{"score", QUERY_GE, 5, [](int n) { return n >= 10; }},
+
+		// The null score doesn't match
+		{"score", QUERY_NE, 100.0, [](int n) { return n != 4; }},
+		{"score", QUERY_LT, 1.0, [](int n) { return n < 2; }},
+
+		{"ok", QUERY_EQ, true, [](int n) { return (n % 2) == 0; }},
+		{"ok", QUERY_NE, true, [](int n) { return (n % 2) == 1; }},
+		{"label", QUERY_EQ, "person", [](int n) { return (n % 3) == 0; }},
+		{"label", QUERY_GT, "cat", [](int n) { return (n % 3) == 0; }},
+		{"blob", QUERY_EQ, "b3", [](int n) { return n == 3; }},
+
+		// IDs can be queried on too
+		{EXPORT_ID_MS_COLUMN, QUERY_GE, 300, [](int n) { return n >= 8; }},
+	};
+
+	for (auto const &c : cases) {
+		StreamQuery query(dir);
+		query.where(c.key, c.op, c.value);
+		EXPECT_EQ(matches(query), expected(c.pass)) << c.key << " op " << c.op;
+	}
+}
+
+// Checks that values that can't be compared never match, and that a
+//	predicate on a key the export doesn't have prunes all of it
+TEST_F(StreamQueryTest, mismatches) {
+	struct {
+		std::string key;
+		QueryValue value;
+	} cases[] = {
+		{"count", "5"},
+		{"count", true},
+		{"score", "0.5"},
+		{"ok", 1},
+		{"label", 1},
+		{"blob", 1.0},
+		{EXPORT_ID_MS_COLUMN, -1},
+		{EXPORT_ID_MS_COLUMN, 100.0},
+	};
+
+	for (auto const &c : cases) {
+		StreamQuery query(dir);
+		StreamQueryStats stats;
+		query.where(c.key, QUERY_NE, c.value);
+		EXPECT_EQ(matches(query, &stats), std::vector<uint64_t>()) << c.key;
+		EXPECT_EQ(stats.rows_scanned, (uint64_t)TEST_QUERY_N_ENTRIES);
+	}
+
+	StreamQuery query(dir);
+	StreamQueryStats stats;
+	query.where("missing", QUERY_NE, 1);
+	EXPECT_EQ(matches(query, &stats), std::vector<uint64_t>());
+	EXPECT_EQ(stats.pruned, (uint64_t)TEST_QUERY_N_BATCHES);
+	EXPECT_EQ(stats.rows_scanned, (uint64_t)0);
+}
+
+// Checks that contiguous matches come back as a slice of the batch as read
+//	and the rest get copied out, with nulls kept either way
+TEST_F(StreamQueryTest, slice_and_take) {
+	std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+
+	// Contiguous, the last row of which has the null count
+	StreamQuery sliced(dir);
+	sliced.between(201, 203).select({"count"});
+	EXPECT_EQ(matches(sliced, NULL, &batches),
+		std::vector<uint64_t>({201, 202, 203}));
+	ASSERT_EQ(batches.size(), (size_t)1);
+
+	auto count = std::static_pointer_cast<arrow::Int64Array>(
+		batches[0]->column(2));
+	EXPECT_EQ(count->offset(), 1);
+	EXPECT_EQ(count->Value(0), 5);
+	EXPECT_EQ(count->Value(1), 6);
+	EXPECT_TRUE(count->IsNull(2));
+
+	// Every other row, one of which has the null score
+	StreamQuery taken(dir);
+	taken.between(200, 203).select({"score", "label", "ok", "blob"})
+		.where("ok", QUERY_EQ, true);
+	EXPECT_EQ(matches(taken, NULL, &batches),
+		std::vector<uint64_t>({200, 202}));
+	ASSERT_EQ(batches.size(), (size_t)1);
+
+	auto score = std::static_pointer_cast<arrow::DoubleArray>(
+		batches[0]->column(2));
+	auto label = std::static_pointer_cast<arrow::StringArray>(
+		batches[0]->column(3));
+	auto ok = std::static_pointer_cast<arrow::BooleanArray>(
+		batches[0]->column(4));
+	auto blob = std::static_pointer_cast<arrow::BinaryArray>(
+		batches[0]->column(5));
+	EXPECT_EQ(score->offset(), 0);
+	EXPECT_TRUE(score->IsNull(0));
+	EXPECT_EQ(score->Value(1), 3.0);
+	EXPECT_EQ(label->GetString(0), "car");
+	EXPECT_EQ(label->GetString(1), "person");
+	EXPECT_TRUE(ok->Value(0));
+	EXPECT_TRUE(ok->Value(1));
+	EXPECT_EQ(blob->GetString(0), "b4");
+	EXPECT_EQ(blob->GetString(1), "b6");
+}
+
+// Checks that the cursor hands back the batches of every export in the
+//	directory in order, each marked with its source
+TEST_F(StreamQueryTest, cursor) {
+	writeExport("arm.joints");
+
+	StreamQuery query(dir, 1);
+	QueryCursor cursor;
+	std::shared_ptr<arrow::RecordBatch> batch;
+	std::vector<std::string> sources;
+
+	query.between(100, 103);
+	ASSERT_EQ(query.open(cursor), ATOM_NO_ERROR) << query.getError();
+	while (cursor.next(batch)) {
+		auto metadata = batch->schema()->metadata();
+		ASSERT_TRUE(metadata != NULL);
+		sources.push_back(metadata->value(
+			metadata->FindKey(STREAM_QUERY_SOURCE_METADATA)));
+		EXPECT_EQ(batch->num_rows(), TEST_QUERY_BATCH_SIZE);
+	}
+	EXPECT_EQ(cursor.getError(), "");
+	EXPECT_EQ(sources, std::vector<std::string>({
+		"arm.joints", TEST_QUERY_SOURCE}));
+
+	// arm.joints has no index, so none of its batches are pruned
+	const StreamQueryStats &stats = cursor.getStats();
+	EXPECT_EQ(stats.files, (uint64_t)2);
+	EXPECT_EQ(stats.pruned, (uint64_t)(TEST_QUERY_N_BATCHES - 1));
+	EXPECT_EQ(stats.rows_matched, (uint64_t)(2 * TEST_QUERY_BATCH_SIZE));
+}